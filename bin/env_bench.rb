@@ -0,0 +1,95 @@
+#!/usr/bin/env ruby
+
+# Compares the Ruby objects allocated per request when iodine copies every
+# request header to the Rack `env` (the default) and when headers are copied
+# only when read (the `lazy_env: true` listening option / `-lazy-env` CLI).
+#
+# The requests include a typical set of browser headers, while the application
+# reads only a few of them (as many applications do).
+#
+#   ruby bin/env_bench.rb [requests]
+
+$LOAD_PATH.unshift File.expand_path(File.join('..', '..', 'lib'), __FILE__)
+require 'iodine'
+require 'socket'
+
+REQUESTS = (ARGV[0] || 2000).to_i
+PORT = 3000 + (Process.pid % 2000)
+
+REQUEST = ["GET /products/7?page=2 HTTP/1.1",
+           "Host: localhost:#{PORT}",
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0",
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+           "Accept-Language: en-US,en;q=0.5",
+           "Accept-Encoding: gzip, deflate, br",
+           "Referer: http://localhost/products",
+           "Connection: keep-alive",
+           "Cookie: _session_id=b6a6fa3f0c5e4b7e; theme=dark",
+           "Upgrade-Insecure-Requests: 1",
+           "Sec-Fetch-Dest: document",
+           "Sec-Fetch-Mode: navigate",
+           "Sec-Fetch-Site: same-origin",
+           "Sec-Fetch-User: ?1",
+           "DNT: 1",
+           "Cache-Control: max-age=0",
+           "If-None-Match: W/\"5e4b7e\"",
+           "X-Request-Id: 6f1c2a9d-8a43-4f1b-9b0e-3d2c1e5a7b90",
+           "X-Forwarded-For: 203.0.113.7",
+           "X-Forwarded-Proto: http",
+           "X-Custom-Tracking: abc123",
+           "", ""].join("\r\n").freeze
+
+# reads the headers an application would typically read
+APP = proc do |env|
+  env['HTTP_ACCEPT']
+  env['HTTP_COOKIE']
+  env['HTTP_USER_AGENT']
+  env['HTTP_X_REQUEST_ID']
+  env['HTTP_IF_NONE_MATCH']
+  [200, { 'Content-Length' => '2' }, ['OK']]
+end
+
+def measure(lazy)
+  rd, wr = IO.pipe
+  pid = fork do
+    rd.close
+    counts = []
+    last = nil
+    app = proc do |env|
+      now = GC.stat(:total_allocated_objects)
+      counts << (now - last) if last
+      last = now
+      APP.call(env)
+    end
+    Iodine.listen service: :http, port: PORT.to_s, handler: app,
+                  lazy_env: lazy, log: false
+    Iodine.on_state(:on_finish) do
+      counts.shift(counts.length / 10) # warmup
+      wr.puts(counts.sum.to_f / counts.length) unless counts.empty?
+      wr.close
+    end
+    Iodine.verbosity = 0
+    Iodine.threads = 1
+    Iodine.workers = 1
+    Iodine.start
+  end
+  wr.close
+  sleep 0.5
+  socket = TCPSocket.new('localhost', PORT)
+  REQUESTS.times do
+    socket.write REQUEST
+    socket.readpartial(4096)
+  end
+  socket.close
+  Process.kill(:INT, pid)
+  Process.wait(pid)
+  rd.read.to_f
+ensure
+  rd.close unless rd.closed?
+end
+
+eager = measure(false)
+lazy = measure(true)
+puts "Objects allocated per request (#{REQUESTS} requests, the app reads 5 of 20 headers):"
+puts format("  eager env: %.1f", eager)
+puts format("  lazy env:  %.1f", lazy)
@@ -22,6 +22,20 @@ EOS
 int main(void) {
   int fd = epoll_create1(EPOLL_CLOEXEC);
 }
+EOS
+
+  iodine_poll_test_uring = <<EOS
+\#define _GNU_SOURCE
+\#include <stdlib.h>
+\#include <unistd.h>
+\#include <sys/syscall.h>
+\#include <linux/io_uring.h>
+int main(void) {
+  struct io_uring_params params = {.features = IORING_FEAT_EXT_ARG};
+  struct io_uring_getevents_arg arg = {.ts = 0};
+  int fd = syscall(__NR_io_uring_setup, 1, &params);
+  syscall(__NR_io_uring_enter, fd, 0, 0, IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
 EOS
 
   iodine_poll_test_poll = <<EOS
@@ -45,6 +59,14 @@ EOS
   elsif ENV['FIO_FORCE_EPOLL']
     puts "skipping polling tests, enforcing manual selection of: epoll"
     $defs << "-DFIO_ENGINE_EPOLL"
+  elsif ENV['FIO_FORCE_URING'] || ENV['FIO_URING']
+    if try_compile(iodine_poll_test_uring)
+      puts "* Skipping polling tests, enforcing manual selection of: io_uring (epoll fallback)"
+      $defs << "-DFIO_ENGINE_URING"
+    else
+      puts "* WARNING: io_uring headers missing, using `epoll`."
+      $defs << "-DFIO_ENGINE_EPOLL"
+    end
   elsif ENV['FIO_FORCE_KQUEUE']
     puts "* Skipping polling tests, enforcing manual selection of: kqueue"
     $defs << "-DFIO_ENGINE_KQUEUE"
@@ -101,4 +123,22 @@ EOS
   end
 end
 
+# Test for zlib (and optionally brotli) for on-the-fly response compression.
+unless ENV['NO_COMPRESSION']
+  dir_config("zlib")
+  if have_header('zlib.h') && have_library('z', 'deflateInit2_')
+    $defs << "-DHAVE_ZLIB"
+    puts "detected zlib, compiling with HAVE_ZLIB (response compression)."
+    if have_header('brotli/encode.h') && have_library('brotlienc', 'BrotliEncoderCreateInstance')
+      $defs << "-DHAVE_BROTLI"
+      puts "detected brotli, compiling with HAVE_BROTLI."
+    end
+  else
+    puts "* WARNING: zlib is missing, response compression will be unavailable."
+  end
+end
+
+# Ruby 3.0+ can deduplicate (intern) the Rack env keys iodine creates.
+have_func('rb_interned_str', 'ruby.h')
+
 create_makefile 'iodine/iodine'
@@ -216,6 +216,7 @@ Version and helper macros
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #if !defined(__GNUC__) && !defined(__clang__) && !defined(FIO_GNUC_BYPASS)
@@ -640,12 +641,52 @@ int fio_set_non_block(int fd);
  */
 size_t fio_capa(void);
 
+/** Connection table statistics, see `fio_capa_stats`. */
+typedef struct {
+  /** The connection capacity (see `fio_capa`). */
+  size_t capa;
+  /** One above the highest fd used so far (the touched part of the tables). */
+  size_t used;
+  /** The (approximate) resident memory used by the connection tables. */
+  size_t resident;
+  /** The connection table memory used by each connection (in bytes). */
+  size_t per_connection;
+} fio_capa_stats_s;
+
+/**
+ * Returns the connection table statistics.
+ *
+ * The connection tables are reserved for the full capacity, but memory is only
+ * committed for the fds actually used, so the resident memory tracks the
+ * number of connections rather than the open file limit.
+ */
+fio_capa_stats_s fio_capa_stats(void);
+
 /** Sets a timeout for a specific connection (only when running and valid). */
 void fio_timeout_set(intptr_t uuid, uint8_t timeout);
 
 /** Gets a timeout for a specific connection. Returns 0 if none. */
 uint8_t fio_timeout_get(intptr_t uuid);
 
+/** Timeout review statistics, see `fio_timeout_stats`. */
+typedef struct {
+  /** The number of connections visited by the review. */
+  size_t reviewed;
+  /** The number of `ping` callbacks scheduled. */
+  size_t pings;
+  /** The number of connections closed (or scheduled for closure). */
+  size_t timeouts;
+} fio_timeout_stats_s;
+
+/**
+ * Returns the statistics for the last timeout review tick.
+ *
+ * Connections are tracked using deadline buckets, so the review only visits
+ * connections that might have timed out (or were touched since their last
+ * review).
+ */
+fio_timeout_stats_s fio_timeout_stats(void);
+
 /**
  * "Touches" a socket connection, resetting it's timeout counter.
  */
@@ -706,6 +747,17 @@ struct fio_listen_args {
    *
    * This will be called separately for every process. */
   void (*on_finish)(intptr_t uuid, void *udata);
+  /**
+   * Set to 1 for each worker process to listen on its own `SO_REUSEPORT`
+   * socket, so the kernel balances new connections between the workers
+   * (rather than all workers competing over a single `accept` backlog).
+   *
+   * Set to 2 to (also) steer new connections by the CPU that received them
+   * (Linux only, using SO_ATTACH_REUSEPORT_CBPF).
+   *
+   * Ignored for Unix sockets.
+   */
+  uint8_t reuse_port;
 };
 
 /**
@@ -1023,7 +1075,7 @@ struct timespec fio_last_tick(void);
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void);
 
@@ -1259,6 +1311,22 @@ inline FIO_FUNC ssize_t fio_sendfile(intptr_t uuid, intptr_t source_fd,
  */
 size_t fio_pending(intptr_t uuid);
 
+/**
+ * Holds back data written to the connection (using `fio_write2`) until
+ * `fio_uncork` is called, so a number of writes (i.e., responses to pipelined
+ * requests) are coalesced and sent using a single system call.
+ *
+ * This is a user-space equivalent of `TCP_CORK` that works for any socket (and
+ * read/write hook). It's only a hint - data might be sent earlier if the
+ * connection had unsent data or when the connection is closed.
+ *
+ * Always call `fio_uncork` once the writes were performed.
+ */
+void fio_cork(intptr_t uuid);
+
+/** Releases data held by `fio_cork`, scheduling it to be sent. */
+void fio_uncork(intptr_t uuid);
+
 /**
  * `fio_flush` attempts to write any remaining data in the internal buffer to
  * the underlying file descriptor and closes the underlying file descriptor once
@@ -1281,10 +1349,28 @@ ssize_t fio_flush(intptr_t uuid);
 /**
  * `fio_flush_all` attempts flush all the open connections.
  *
+ * Only connections with pending output (since the last call) are tested.
+ *
  * Returns the number of sockets still in need to be flushed.
  */
 size_t fio_flush_all(void);
 
+/**
+ * Blocks until a connection has data waiting to be flushed (see
+ * `fio_flush_all`), or until the timeout (in milliseconds) expires.
+ *
+ * Returns 1 if there's data waiting to be flushed, 0 if not (on timeout) and -1
+ * on error.
+ *
+ * Meant for a (single) dedicated IO thread, such as:
+ *
+ *     while (running) {
+ *       if (!fio_flush_all())
+ *         fio_flush_wait(150);
+ *     }
+ */
+int fio_flush_wait(size_t milliseconds);
+
 /**
  * Convert between a facil.io connection's identifier (uuid) and system's fd.
  */
@@ -1413,6 +1499,19 @@ typedef struct fio_rw_hook_s {
    * This callback is always called, even if `fio_rw_hook_set` fails.
    * */
   void (*cleanup)(void *udata);
+  /**
+   * OPTIONAL: Implement gathered writing to a file descriptor. Should behave
+   * like the file system `writev` call.
+   *
+   * When a number of buffers are waiting in the outgoing queue, `fio_flush`
+   * will attempt to send them using a single `writev` call. If this callback
+   * is NULL, the buffers will be sent one at a time using the `write` callback.
+   *
+   * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
+   * deadlock might occur.
+   */
+  ssize_t (*writev)(intptr_t uuid, void *udata, const struct iovec *iov,
+                    int iovcnt);
 } fio_rw_hook_s;
 
 /** Sets a socket hook state (a pointer to the struct). */
@@ -1563,6 +1662,35 @@ int fio_defer(void (*task)(void *, void *), void *udata1, void *udata2);
 int fio_run_every(size_t milliseconds, size_t repetitions, void (*task)(void *),
                   void *arg, void (*on_finish)(void *));
 
+/** An opaque timer handle, used for timer cancellation. */
+typedef struct fio_timer_s fio_timer_s;
+
+/**
+ * Same as `fio_run_every`, but returns a handle that can be used to cancel the
+ * timer (or NULL on error).
+ *
+ * Timers are stored in a hierarchical timing wheel, so adding or cancelling a
+ * timer doesn't depend on the number of existing timers.
+ *
+ * The handle MUST be released using either `fio_timer_cancel` or
+ * `fio_timer_free`.
+ */
+fio_timer_s *fio_run_every_handle(size_t milliseconds, size_t repetitions,
+                                  void (*task)(void *), void *arg,
+                                  void (*on_finish)(void *));
+
+/**
+ * Cancels a timer and releases the handle.
+ *
+ * The `on_finish` handler will be called (unless the timer already finished).
+ *
+ * Returns -1 if the timer was already done (or cancelled), 0 on success.
+ */
+int fio_timer_cancel(fio_timer_s *timer);
+
+/** Releases a timer handle without cancelling the timer. */
+void fio_timer_free(fio_timer_s *timer);
+
 /**
  * Performs all deferred tasks.
  */
@@ -33,6 +33,11 @@ The SSL/TLS helper data types (can be left as is)
 #define FIO_TLS_TIMEOUT 4
 #endif
 
+/* the buffer used for coalescing small writes into a single TLS record */
+#ifndef FIO_TLS_WRITEV_BUFFER
+#define FIO_TLS_WRITEV_BUFFER (1 << 14)
+#endif
+
 typedef struct {
   fio_str_s private_key;
   fio_str_s public_key;
@@ -307,7 +312,11 @@ typedef struct {
   fio_tls_s *tls;
   void *alpn_arg;
   intptr_t uuid;
+  char *wbuf;
+  size_t wpos;
+  size_t wlen;
   uint8_t is_server;
+  uint8_t closing;
   volatile uint8_t alpn_ok;
 } fio_tls_connection_s;
 
@@ -392,7 +401,8 @@ static void fio_tls_build_context(fio_tls_s *tls) {
 
   /* create new context */
   tls->ctx = SSL_CTX_new(TLS_method());
-  SSL_CTX_set_mode(tls->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+  SSL_CTX_set_mode(tls->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
   /* see: https://caniuse.com/#search=tls */
   SSL_CTX_set_min_proto_version(tls->ctx, TLS1_2_VERSION);
   SSL_CTX_set_options(tls->ctx, SSL_OP_NO_COMPRESSION);
@@ -564,22 +574,6 @@ static ssize_t fio_tls_read(intptr_t uuid, void *udata, void *buf,
   (void)uuid;
 }
 
-/**
- * When implemented, this function will be called to flush any data remaining
- * in the internal buffer.
- *
- * The function should return the number of bytes remaining in the internal
- * buffer (0 is a valid response) or -1 (on error).
- *
- * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
- * deadlock might occur.
- */
-static ssize_t fio_tls_flush(intptr_t uuid, void *udata) {
-  (void)uuid;
-  (void)udata;
-  return 0;
-}
-
 /**
  * Implement writing to a file descriptor. Should behave like the file system
  * `write` call.
@@ -590,9 +584,8 @@ static ssize_t fio_tls_flush(intptr_t uuid, void *udata) {
  * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
  * deadlock might occur.
  */
-static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
-                             size_t count) {
-  fio_tls_connection_s *c = udata;
+static ssize_t fio_tls_write_ssl(fio_tls_connection_s *c, const void *buf,
+                                 size_t count) {
   ssize_t ret = SSL_write(c->ssl, buf, count);
   if (ret > 0)
     return ret;
@@ -617,6 +610,113 @@ static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
     break;
   }
   return -1;
+}
+
+/**
+ * Sends any data left in the coalescing buffer (see `fio_tls_writev`).
+ *
+ * Returns 1 once the buffer is empty, otherwise behaves like `SSL_write`.
+ */
+static ssize_t fio_tls_write_pending(fio_tls_connection_s *c) {
+  while (c->wlen) {
+    ssize_t ret = fio_tls_write_ssl(c, c->wbuf + c->wpos, c->wlen);
+    if (ret <= 0)
+      return ret;
+    c->wpos += ret;
+    c->wlen -= ret;
+  }
+  c->wpos = 0;
+  return 1;
+}
+
+/**
+ * When implemented, this function will be called to flush any data remaining
+ * in the internal buffer.
+ *
+ * The function should return the number of bytes remaining in the internal
+ * buffer (0 is a valid response) or -1 (on error).
+ *
+ * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
+ * deadlock might occur.
+ */
+static ssize_t fio_tls_flush(intptr_t uuid, void *udata) {
+  fio_tls_connection_s *c = udata;
+  if (c->wlen) {
+    ssize_t ret = fio_tls_write_pending(c);
+    if (!ret)
+      errno = ECONNRESET;
+    if (ret <= 0 && errno != EWOULDBLOCK)
+      return -1;
+    if (c->wlen)
+      return c->wlen;
+  }
+  if (c->closing) {
+    /* the shutdown was delayed until the buffered data was sent */
+    c->closing = 0;
+    SSL_shutdown(c->ssl);
+  }
+  return 0;
+  (void)uuid;
+}
+
+/**
+ * Implement writing to a file descriptor. Should behave like the file system
+ * `write` call.
+ *
+ * If an internal buffer is implemented and it is full, errno should be set to
+ * EWOULDBLOCK and the function should return -1.
+ *
+ * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
+ * deadlock might occur.
+ */
+static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
+                             size_t count) {
+  fio_tls_connection_s *c = udata;
+  if (c->wlen) {
+    ssize_t ret = fio_tls_write_pending(c);
+    if (ret <= 0)
+      return ret;
+  }
+  return fio_tls_write_ssl(c, buf, count);
+  (void)uuid;
+}
+
+/**
+ * Implement gathered writing to a file descriptor.
+ *
+ * Small buffers are copied into a single TLS record (instead of a record per
+ * buffer). Once copied, the data is owned by the connection and the copied
+ * length is reported as written, even if the record is still pending.
+ *
+ * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
+ * deadlock might occur.
+ */
+static ssize_t fio_tls_writev(intptr_t uuid, void *udata,
+                              const struct iovec *iov, int iovcnt) {
+  fio_tls_connection_s *c = udata;
+  if (c->wlen) {
+    ssize_t ret = fio_tls_write_pending(c);
+    if (ret <= 0)
+      return ret;
+  }
+  if (iovcnt == 1 || iov[0].iov_len >= FIO_TLS_WRITEV_BUFFER)
+    return fio_tls_write_ssl(c, iov[0].iov_base, iov[0].iov_len);
+  if (!c->wbuf) {
+    c->wbuf = malloc(FIO_TLS_WRITEV_BUFFER);
+    FIO_ASSERT_ALLOC(c->wbuf);
+  }
+  size_t len = 0;
+  for (int i = 0; i < iovcnt && len < FIO_TLS_WRITEV_BUFFER; ++i) {
+    size_t part = iov[i].iov_len;
+    if (part > FIO_TLS_WRITEV_BUFFER - len)
+      part = FIO_TLS_WRITEV_BUFFER - len;
+    memcpy(c->wbuf + len, iov[i].iov_base, part);
+    len += part;
+  }
+  c->wlen = len;
+  /* errors will be reported by the next write / flush */
+  fio_tls_write_pending(c);
+  return len;
   (void)uuid;
 }
 
@@ -631,6 +731,10 @@ static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
  * */
 static ssize_t fio_tls_before_close(intptr_t uuid, void *udata) {
   fio_tls_connection_s *c = udata;
+  if (c->wlen && fio_tls_write_pending(c) <= 0) {
+    c->closing = 1; /* shutdown once `flush` sends the buffered data */
+    return 1;
+  }
   SSL_shutdown(c->ssl);
   return 1;
   (void)uuid;
@@ -644,6 +748,7 @@ static void fio_tls_cleanup(void *udata) {
     alpn_select(alpn_default(c->tls), -1, c->alpn_arg);
   }
   SSL_free(c->ssl);
+  free(c->wbuf);
   FIO_LOG_DEBUG("TLS cleanup for %p", (void *)c->uuid);
   fio_tls_destroy(c->tls); /* manage reference count */
   free(udata);
@@ -655,6 +760,7 @@ static fio_rw_hook_s FIO_TLS_HOOKS = {
     .flush = fio_tls_flush,
     .before_close = fio_tls_before_close,
     .cleanup = fio_tls_cleanup,
+    .writev = fio_tls_writev,
 };
 
 #define FIO_TLS_HANDSHAKE_ERROR 0
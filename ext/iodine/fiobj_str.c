@@ -194,6 +194,37 @@ FIOBJ fiobj_str_tmp(void) {
   return ((uintptr_t)&tmp | FIOBJECT_STRING_FLAG);
 }
 
+/**
+ * Creates a frozen String object (copying the data) using memory provided by a
+ * custom allocator.
+ */
+FIOBJ fiobj_str_new_in(void *(*alloc)(void *udata, size_t size), void *udata,
+                       const char *str, size_t len) {
+  /* small Strings are stored within the object */
+  const size_t extra = (len < FIO_STR_SMALL_CAPA) ? 0 : (len + 1);
+  fiobj_str_s *s = alloc(udata, sizeof(*s) + extra);
+  if (!s)
+    return FIOBJ_INVALID;
+  *s = (fiobj_str_s){
+      .head =
+          {
+              .ref = FIOBJ_STR_NEW_IN_REF,
+              .type = FIOBJ_T_STRING,
+          },
+      .str = FIO_STR_INIT,
+  };
+  if (extra) {
+    char *data = (char *)(s + 1);
+    memcpy(data, str, len);
+    data[len] = 0;
+    s->str = FIO_STR_INIT_STATIC2(data, len);
+  } else if (str && len) {
+    fio_str_write(&s->str, str, len);
+  }
+  fio_str_freeze(&s->str);
+  return ((uintptr_t)s | FIOBJECT_STRING_FLAG);
+}
+
 /** Prevents the String object from being changed. */
 void fiobj_str_freeze(FIOBJ str) {
   if (FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
@@ -339,6 +370,13 @@ Tests
 ***************************************************************************** */
 
 #if DEBUG
+static void *fiobj_test_string_alloc(void *udata, size_t size) {
+  uintptr_t *pos = udata;
+  void *ret = (void *)pos[0];
+  pos[0] += (size + 15) & (~(size_t)15);
+  return ret;
+}
+
 void fiobj_test_string(void) {
   fprintf(stderr, "=== Testing Strings\n");
   fprintf(stderr, "* Internal String Capacity %u \n",
@@ -415,6 +453,40 @@ void fiobj_test_string(void) {
               fiobj_obj2cstr(o).data);
   fiobj_free(o);
 
+  {
+    /* Strings allocated using a custom allocator (i.e., an arena) */
+    static char buf[512] __attribute__((aligned(16)));
+    uintptr_t pos = (uintptr_t)buf;
+    const char *long_str = "This String is too long to be stored within the "
+                           "String object itself.";
+    o = fiobj_str_new_in(fiobj_test_string_alloc, &pos, "Hi", 2);
+    FIOBJ o2 = fiobj_str_new_in(fiobj_test_string_alloc, &pos, long_str,
+                                strlen(long_str));
+    TEST_ASSERT((uintptr_t)FIOBJ2PTR(o) == (uintptr_t)buf &&
+                    (uintptr_t)FIOBJ2PTR(o2) == (uintptr_t)buf +
+                                                    sizeof(fiobj_str_s),
+                "`fiobj_str_new_in` didn't use the allocator!\n");
+    TEST_ASSERT(pos - (uintptr_t)buf ==
+                    ((sizeof(fiobj_str_s) * 2 + strlen(long_str) + 1 + 15) &
+                     (~(size_t)15)),
+                "`fiobj_str_new_in` allocated data outside the allocator!\n");
+    TEST_ASSERT(fiobj_obj2cstr(o).len == 2 &&
+                    !memcmp(fiobj_obj2cstr(o).data, "Hi", 3),
+                "`fiobj_str_new_in` small String error\n");
+    TEST_ASSERT(fiobj_obj2cstr(o2).data == buf + sizeof(fiobj_str_s) * 2 &&
+                    !strcmp(fiobj_obj2cstr(o2).data, long_str),
+                "`fiobj_str_new_in` String data error\n");
+    fiobj_str_write(o2, "!", 1);
+    TEST_ASSERT(fiobj_obj2cstr(o2).len == strlen(long_str),
+                "`fiobj_str_new_in` String isn't frozen!\n");
+    fiobj_dup(o2);
+    fiobj_free(o2);
+    fiobj_free(o2);
+    fiobj_free(o);
+    TEST_ASSERT(!strcmp(fiobj_obj2cstr(o2).data, long_str),
+                "`fiobj_free` shouldn't free `fiobj_str_new_in` Strings\n");
+  }
+
   fprintf(stderr, "* passed.\n");
 }
 #endif
@@ -56,6 +56,23 @@ FIOBJ fiobj_str_move(char *str, size_t len, size_t capacity);
  */
 FIOBJ fiobj_str_tmp(void);
 
+/**
+ * Creates a frozen String object (copying the data) using memory provided by a
+ * custom allocator, such as an arena that's released in one step.
+ *
+ * `alloc` is called once, for both the object and it's data, and must return
+ * 16 byte aligned memory (or NULL, in which case FIOBJ_INVALID is returned).
+ *
+ * The object's memory is never freed by the String - `fiobj_free` only
+ * decreases the reference count. The String MUST NOT be used (or `fiobj_dup`-ed
+ * for later use) once the allocator's memory was released.
+ */
+FIOBJ fiobj_str_new_in(void *(*alloc)(void *udata, size_t size), void *udata,
+                       const char *str, size_t len);
+
+/** The reference count of a new `fiobj_str_new_in` String. */
+#define FIOBJ_STR_NEW_IN_REF ((~(uint32_t)0) >> 4)
+
 /* *****************************************************************************
 API: Editing a String
 ***************************************************************************** */
@@ -350,76 +350,36 @@ static MAYBE_UNUSED int hpack_huffman_pack(void *dest_, const int limit,
   uint8_t *dest = (uint8_t *)dest_;
   uint8_t *data = (uint8_t *)data_;
   int comp_len = 0;
-  uint8_t *pos = data;
-  const uint8_t *end = pos + len;
-  uint8_t offset = 0;
   if (!len)
     return 0;
-  if (!limit)
-    goto calc_final_length;
-
-  dest[comp_len] = 0;
-  do {
-    uint32_t code = huffman_encode_table[*pos].code;
-    uint8_t bits = huffman_encode_table[*pos].bits;
-    ++pos;
-
-    if (offset) {
-      /* does the code fit in the existing byte */
-      if (bits + offset <= 8) {
-        dest[comp_len] |= code >> (24 + offset);
-        offset = offset + bits;
-        continue;
-      }
-      /* fill in current byte */
-      dest[comp_len] |= (code >> (24 + offset)) & 0xFF;
-      code <<= 8 - offset;
-      bits -= 8 - offset;
-      offset = 0;
-      ++comp_len;
-      dest[comp_len] = 0;
-    }
-
-    /* make sure we have enough space */
-    if (((bits + (comp_len << 3) + 7) >> 3) >= limit)
-      goto calc_final_length;
-
-    /* copy full bytes */
-    switch (bits >> 3) {
-    case 3:
-      dest[comp_len + 2] = (uint8_t)(code >> 8) & 0xFF;
-    /* fallthrough */
-    case 2:
-      dest[comp_len + 1] = (uint8_t)(code >> 16) & 0xFF;
-    /* fallthrough */
-    case 1:
-      dest[comp_len + 0] = (uint8_t)(code >> 24) & 0xFF;
-      comp_len += (bits >> 3);
-      code <<= (bits & (~7));
-      dest[comp_len] = 0;
-    }
-
-    /* copy partial bits */
-    dest[comp_len] |= (uint8_t)(code >> 24) & ((uint8_t)0xFF);
-    offset = bits & 7;
-  } while (pos < end);
-
-  if (offset & 7) {
-    /* pad last bits as 1 */
-    dest[comp_len] |= (uint8_t)(0xFFUL >> (offset & 7));
-    ++comp_len;
-  }
-  return comp_len;
-
-calc_final_length:
-
-  comp_len = 0;
   for (size_t i = 0; i < len; i++) {
     comp_len += huffman_encode_table[data[i]].bits;
   }
   comp_len += 7;
   comp_len >>= 3;
-  return comp_len;
+  if (!dest || comp_len > limit)
+    return comp_len;
+
+  /* codes are MSB aligned, collect bits and write whole bytes */
+  uint64_t bits = 0;
+  uint8_t bit_count = 0;
+  int pos = 0;
+  for (size_t i = 0; i < len; i++) {
+    const uint8_t code_bits = huffman_encode_table[data[i]].bits;
+    bits = (bits << code_bits) |
+           (huffman_encode_table[data[i]].code >> (32 - code_bits));
+    bit_count += code_bits;
+    while (bit_count >= 8) {
+      bit_count -= 8;
+      dest[pos++] = (uint8_t)(bits >> bit_count);
+    }
+  }
+  if (bit_count) {
+    /* pad last bits as 1 (the EOS prefix) */
+    dest[pos++] =
+        (uint8_t)((bits << (8 - bit_count)) | (0xFFU >> bit_count));
+  }
+  return pos;
 }
 
 /* *****************************************************************************
@@ -438,15 +398,15 @@ static const struct {
     {.data = {{.val = ":method", .len = 7}, {.val = "POST", .len = 4}}},
     {.data = {{.val = ":path", .len = 5}, {.val = "/", .len = 1}}},
     {.data = {{.val = ":path", .len = 5}, {.val = "/index.html", .len = 11}}},
-    {.data = {{.val = ":scheme", .len = 7}, {.val = "http", .len = 0}}},
-    {.data = {{.val = ":scheme", .len = 7}, {.val = "https", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "200", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "204", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "206", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "304", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "400", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "404", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "500", .len = 0}}},
+    {.data = {{.val = ":scheme", .len = 7}, {.val = "http", .len = 4}}},
+    {.data = {{.val = ":scheme", .len = 7}, {.val = "https", .len = 5}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "200", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "204", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "206", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "304", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "400", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "404", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "500", .len = 3}}},
     {.data = {{.val = "accept-charset", .len = 14}, {.len = 0}}},
     {.data = {{.val = "accept-encoding", .len = 15},
               {.val = "gzip, deflate", .len = 13}}},
@@ -458,7 +418,7 @@ static const struct {
     {.data = {{.val = "allow", .len = 5}, {.len = 0}}},
     {.data = {{.val = "authorization", .len = 13}, {.len = 0}}},
     {.data = {{.val = "cache-control", .len = 13}, {.len = 0}}},
-    {.data = {{.val = "content-disposition", .len = 0}, {.len = 0}}},
+    {.data = {{.val = "content-disposition", .len = 19}, {.len = 0}}},
     {.data = {{.val = "content-encoding", .len = 16}, {.len = 0}}},
     {.data = {{.val = "content-language", .len = 16}, {.len = 0}}},
     {.data = {{.val = "content-length", .len = 14}, {.len = 0}}},
@@ -8,14 +8,19 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fio.h>
 
 #include <http1.h>
+#include <http2.h>
 #include <http_internal.h>
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #ifndef HAVE_TM_TM_ZONE
@@ -318,6 +323,130 @@ int http_set_cookie(http_s *h, http_cookie_args_s cookie) {
 #define http_set_cookie(http__req__, ...)                                      \
   http_set_cookie((http__req__), (http_cookie_args_s){__VA_ARGS__})
 
+/**
+ * Returns the value of a request header (or a response header, in client
+ * mode), using the (lower case) header name's hash (see `fiobj_hash_string`).
+ *
+ * If the header was received more than once, the last value is returned.
+ *
+ * Returns an empty `fio_str_info_s` (`data == NULL`) if the header is missing.
+ */
+fio_str_info_s http_header_get(http_s *h, uint64_t name_hash) {
+  if (!h)
+    goto missing;
+  if (h->headers) {
+    FIOBJ tmp = fiobj_hash_get2(h->headers, name_hash);
+    if (tmp && FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+      tmp = fiobj_ary_index(tmp, -1);
+    if (!tmp)
+      goto missing;
+    return fiobj_obj2cstr(tmp);
+  }
+  if (h->private_data.hslices) {
+    http_hslices_s *s = h->private_data.hslices;
+    http_hslice_s *slice = http_hslices_find(s, name_hash);
+    if (slice)
+      return http_hslice_value(s, slice);
+  }
+missing:
+  return (fio_str_info_s){.data = NULL};
+}
+
+/** Removes a request header (all of it's values, if it was repeated). */
+void http_header_remove(http_s *h, uint64_t name_hash) {
+  if (!h)
+    return;
+  if (h->headers)
+    fiobj_hash_delete2(h->headers, name_hash);
+  else if (h->private_data.hslices)
+    http_hslices_remove(h->private_data.hslices, name_hash, 0);
+}
+
+struct http_header_each_s {
+  int (*task)(fio_str_info_s, fio_str_info_s, size_t, void *);
+  void *udata;
+  size_t count;
+};
+
+static int http_header_each_task(FIOBJ o, void *a_) {
+  struct http_header_each_s *a = a_;
+  fio_str_info_s name = fiobj_obj2cstr(fiobj_hash_key_in_loop());
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    size_t count = fiobj_ary_count(o);
+    for (size_t i = 0; i < count; ++i) {
+      ++a->count;
+      if (a->task(name, fiobj_obj2cstr(fiobj_ary_index(o, (int64_t)i)), i,
+                  a->udata) == -1)
+        return -1;
+    }
+    return 0;
+  }
+  ++a->count;
+  return a->task(name, fiobj_obj2cstr(o), 0, a->udata);
+}
+
+/**
+ * Calls `task` for each request header value, where `index` is the value's
+ * position when a header was received more than once (0 for the first value).
+ *
+ * The loop stops if `task` returns -1. Returns the number of values visited.
+ */
+size_t http_header_each(http_s *h,
+                        int (*task)(fio_str_info_s name, fio_str_info_s value,
+                                    size_t index, void *udata),
+                        void *udata) {
+  if (!h || !task)
+    return 0;
+  if (h->headers) {
+    struct http_header_each_s a = {.task = task, .udata = udata};
+    fiobj_each1(h->headers, 0, http_header_each_task, &a);
+    return a.count;
+  }
+  http_hslices_s *s = h->private_data.hslices;
+  if (!s)
+    return 0;
+  size_t count = 0;
+  for (size_t i = 0; i < s->count; ++i) {
+    http_hslice_s *slice = s->slices + i;
+    if (slice->removed)
+      continue;
+    ++count;
+    if (task(http_hslice_name(s, slice), http_hslice_value(s, slice),
+             slice->dup, udata) == -1)
+      break;
+  }
+  return count;
+}
+
+/**
+ * Returns the request headers as a Hash (see the `headers` field).
+ *
+ * Headers stored as slices of the connection's buffer are only converted to
+ * FIOBJ objects when this function is called.
+ */
+FIOBJ http_headers(http_s *h) {
+  if (!h)
+    return FIOBJ_INVALID;
+  if (!h->headers && h->private_data.hslices)
+    h->headers = http_hslices2hash(h->private_data.hslices);
+  return h->headers;
+}
+
+/* stores a response in the micro-cache and sends it (see below) */
+static int http_micro_cache_send_body(http_s *h, void *data, uintptr_t length);
+
+/*
+ * Releases the request's pending micro-cache entry (if any) as a "pass", for
+ * responses that aren't sent using `http_send_body` (streamed, files, upgrades),
+ * so waiting requests don't wait for the whole response.
+ */
+static inline void http_micro_cache_pass(http_s *h) {
+  if (!h->private_data.micro_cache)
+    return;
+  http_micro_cache_release(h->private_data.micro_cache);
+  h->private_data.micro_cache = NULL;
+}
+
 /**
  * Sends the response headers and body.
  *
@@ -335,9 +464,90 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
   add_content_length(r, length);
   // add_content_type(r);
   add_date(r);
+  if (r->private_data.micro_cache &&
+      !http_micro_cache_send_body(r, data, length))
+    return 0;
   return ((http_vtable_s *)r->private_data.vtbl)
       ->http_send_body(r, data, length);
 }
+/**
+ * Streams a chunk of the response body, sending the response headers with the
+ * first chunk. The response is completed by calling `http_finish`.
+ *
+ * Returns -1 on error (i.e., the connection was lost) and 0 on success.
+ */
+int http_stream(http_s *r, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(r) || !r->private_data.flag ||
+      !fio_is_valid(((http_fio_protocol_s *)r->private_data.flag)->uuid))
+    return -1;
+  if (!length || !data)
+    return 0;
+  http_micro_cache_pass(r);
+  add_date(r);
+  return ((http_vtable_s *)r->private_data.vtbl)->http_stream(r, data, length);
+}
+
+/**
+ * Returns the number of packets waiting in the connection's outgoing queue, or
+ * held back by the protocol (i.e., by HTTP/2 flow control).
+ */
+size_t http_pending(http_s *r) {
+  if (!r || !r->private_data.flag)
+    return 0;
+  size_t held = 0;
+  if (((http_vtable_s *)r->private_data.vtbl)->http_pending)
+    held = ((http_vtable_s *)r->private_data.vtbl)->http_pending(r);
+  return held +
+         fio_pending(((http_fio_protocol_s *)r->private_data.flag)->uuid);
+}
+
+/**
+ * Blocks until no more than `max_pending` packets are waiting in the
+ * connection's outgoing queue (or held back by the protocol), writing to the
+ * socket while waiting.
+ *
+ * Returns -1 if the connection was lost and 0 on success.
+ */
+int http_stream_wait(http_s *r, size_t max_pending) {
+  if (!r || !r->private_data.flag)
+    return -1;
+  const intptr_t uuid = ((http_fio_protocol_s *)r->private_data.flag)->uuid;
+  while (http_pending(r) > max_pending) {
+    if (fio_pending(uuid) <= max_pending) {
+      /* the protocol holds the data back (i.e., HTTP/2 flow control) */
+      if (!((http_vtable_s *)r->private_data.vtbl)->http_wait ||
+          ((http_vtable_s *)r->private_data.vtbl)->http_wait(r))
+        return -1;
+      continue;
+    }
+    ssize_t flushed = fio_flush(uuid);
+    if (flushed < 0) {
+      if (errno != EWOULDBLOCK)
+        return -1;
+      /* another thread is writing to the socket */
+      fio_throttle_thread(500000);
+    } else if (flushed > 0 && fio_pending(uuid) > max_pending) {
+      /* wait for the socket to drain */
+      struct pollfd list = {.fd = fio_uuid2fd(uuid), .events = POLLOUT};
+      if (poll(&list, 1, 100) < 0 && errno != EINTR)
+        return -1;
+    }
+  }
+  return fio_is_valid(uuid) ? 0 : -1;
+}
+
+/**
+ * Aborts a streaming response, so the client can't mistake the partial response
+ * for a complete one.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+void http_stream_abort(http_s *r) {
+  if (!r || !r->private_data.vtbl)
+    return;
+  ((http_vtable_s *)r->private_data.vtbl)->http_stream_abort(r);
+}
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -347,9 +557,10 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
  */
 int http_sendfile(http_s *r, int fd, uintptr_t length, uintptr_t offset) {
   if (HTTP_INVALID_HANDLE(r)) {
-    close(fd);
+    http_sendfile_close(fd);
     return -1;
   };
+  http_micro_cache_pass(r);
   add_content_length(r, length);
   add_content_type(r);
   add_date(r);
@@ -371,6 +582,632 @@ static inline int http_test_encoded_path(const char *mem, size_t len) {
   return 0;
 }
 
+/* finds the mime-type for the file's extension (remember to `fiobj_free`) */
+static FIOBJ http_sendfile_mimetype_find(const char *name, size_t len) {
+  size_t pos = len - 1;
+  while (pos && name[pos] != '.')
+    pos--;
+  pos++; /* assuming, but that's fine. */
+  return http_mimetype_find((char *)name + pos, len - pos);
+}
+
+/* sets the `content-type` header (unless set) using the file's extension */
+static void http_sendfile_mimetype(http_s *h, const char *name, size_t len) {
+  static uint64_t ct_hash = 0;
+  if (!ct_hash)
+    ct_hash = fiobj_hash_string("content-type", 12);
+  if (fiobj_hash_get2(h->private_data.out_headers, ct_hash))
+    return;
+  FIOBJ tmp = http_sendfile_mimetype_find(name, len);
+  if (tmp)
+    http_set_header(h, HTTP_HEADER_CONTENT_TYPE, tmp);
+}
+
+/* returns a new `last-modified` header value */
+static FIOBJ http_sendfile_last_modified(time_t mtime) {
+  FIOBJ last_modified = fiobj_str_buf(32);
+  fiobj_str_resize(last_modified,
+                   http_time2str(fiobj_obj2cstr(last_modified).data, mtime));
+  return last_modified;
+}
+
+/* returns a new `etag` header value */
+static FIOBJ http_sendfile_etag(int64_t size, time_t mtime) {
+  uint64_t etag = (uint64_t)size;
+  etag ^= (uint64_t)mtime;
+  etag = fiobj_hash_string(&etag, sizeof(uint64_t));
+  FIOBJ etag_str = fiobj_str_buf(32);
+  fiobj_str_resize(etag_str,
+                   fio_base64_encode(fiobj_obj2cstr(etag_str).data,
+                                     (void *)&etag, sizeof(uint64_t)));
+  return etag_str;
+}
+
+/**
+ * Sets the `last-modified` and `etag` headers (unless set) and reviews the
+ * conditional (`if-none-match`, `if-range`) and `range` request headers.
+ *
+ * The `etag` and `last_modified` values are optional (they're computed when
+ * missing) and aren't consumed.
+ *
+ * Returns -1 if the response was sent (304 Not Modified). Otherwise, `offset`
+ * and `length` are updated to the range that should be sent.
+ *
+ * Only 200 (OK) responses are reviewed.
+ */
+static int http_sendfile_review(http_s *h, int64_t size, time_t mtime,
+                                FIOBJ etag, FIOBJ last_modified,
+                                int64_t *offset, int64_t *length) {
+  static uint64_t lm_hash = 0, etag_hash = 0, none_match_hash = 0,
+                  ifrange_hash = 0, range_hash = 0;
+  if (!lm_hash) {
+    etag_hash = fiobj_hash_string("etag", 4);
+    none_match_hash = fiobj_hash_string("if-none-match", 13);
+    ifrange_hash = fiobj_hash_string("if-range", 8);
+    range_hash = fiobj_hash_string("range", 5);
+    lm_hash = fiobj_hash_string("last-modified", 13); /* set last */
+  }
+  *offset = 0;
+  *length = size;
+  if (h->status != 200)
+    return 0;
+  /* set last-modified */
+  FIOBJ tmp_obj = fiobj_hash_get2(h->private_data.out_headers, lm_hash);
+  if (tmp_obj) {
+    last_modified = tmp_obj;
+  } else {
+    last_modified = last_modified ? fiobj_dup(last_modified)
+                                  : http_sendfile_last_modified(mtime);
+    http_set_header(h, HTTP_HEADER_LAST_MODIFIED, last_modified);
+  }
+  /* set etag */
+  FIOBJ etag_str = fiobj_hash_get2(h->private_data.out_headers, etag_hash);
+  if (!etag_str) {
+    etag_str = etag ? fiobj_dup(etag) : http_sendfile_etag(size, mtime);
+    http_set_header(h, HTTP_HEADER_ETAG, etag_str);
+  }
+  fio_str_info_s etag_cstr = fiobj_obj2cstr(etag_str);
+  /* test etag */
+  fio_str_info_s tmp = http_header_get(h, none_match_hash);
+  if (tmp.len == etag_cstr.len &&
+      !memcmp(tmp.data, etag_cstr.data, etag_cstr.len)) {
+    h->status = 304;
+    http_finish(h);
+    return -1;
+  }
+  /* handle range requests */
+  fio_str_info_s range = http_header_get(h, range_hash);
+  if (!range.data || range.len < 7 || memcmp("bytes=", range.data, 6))
+    return 0;
+  tmp = http_header_get(h, ifrange_hash);
+  if (tmp.data) {
+    /* the range is only valid if the file wasn't changed */
+    fio_str_info_s lm = fiobj_obj2cstr(last_modified);
+    if (!(tmp.len == etag_cstr.len &&
+          !memcmp(tmp.data, etag_cstr.data, etag_cstr.len)) &&
+        !(tmp.len == lm.len && !memcmp(tmp.data, lm.data, lm.len)))
+      return 0;
+  }
+  /* we ignore multimple ranges, only responding with the first range. */
+  int64_t start_at, end_at = size - 1;
+  char *pos = range.data + 6;
+  if (*pos == '-') {
+    /* suffix range (the last N bytes) */
+    ++pos;
+    start_at = fio_atol(&pos);
+    if (start_at <= 0 || !size)
+      return 0;
+    start_at = (start_at < size) ? (size - start_at) : 0;
+  } else {
+    start_at = fio_atol(&pos);
+    if (start_at < 0 || start_at >= size || *pos != '-')
+      return 0;
+    ++pos;
+    if (*pos >= '0' && *pos <= '9') {
+      end_at = fio_atol(&pos);
+      if (end_at < start_at)
+        return 0;
+      if (end_at >= size)
+        end_at = size - 1;
+    }
+  }
+  *offset = start_at;
+  *length = end_at - start_at + 1;
+  h->status = 206;
+  {
+    FIOBJ cranges = fiobj_str_buf(1);
+    fiobj_str_printf(cranges, "bytes %lu-%lu/%lu", (unsigned long)start_at,
+                     (unsigned long)end_at, (unsigned long)size);
+    http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
+  }
+  http_set_header(h, HTTP_HEADER_ACCEPT_RANGES, fiobj_dup(HTTP_HVALUE_BYTES));
+  return 0;
+}
+
+/* *****************************************************************************
+Static file cache
+***************************************************************************** */
+
+/*
+ * The static file cache keeps files served by `http_sendfile2` open, together
+ * with their `etag`, `last-modified` and `content-type` header values and their
+ * precompressed variants (`.gz`, `.zst` and `.br` files), if any.
+ *
+ * Cached file descriptors are shared by all the requests serving the file
+ * (files are sent using offsets, never moving the file's position). Each file
+ * descriptor is reference counted: the cache holds one reference and every
+ * response in flight holds another, so `http_sendfile_close` closes the file
+ * only when the last reference is released.
+ *
+ * Small files are also kept in memory as pre-serialized responses (headers and
+ * body), which are sent as is (only the `date` header is updated, once a
+ * second).
+ *
+ * Cached files are revalidated (using `stat`) once `HTTP_FILE_CACHE_TTL`
+ * seconds have passed since they were last validated. Files that changed are
+ * reopened.
+ */
+
+/* a single file (either the file or one of its precompressed variants) */
+typedef struct {
+  int fd;
+  int64_t size;
+  time_t mtime;
+  ino_t ino;
+  FIOBJ etag;
+  FIOBJ last_modified;
+  /* a pre-serialized response (if any), it's `date` value and position */
+  FIOBJ response;
+  time_t date;
+  size_t date_pos;
+} http_file_cache_file_s;
+
+/* the number of variants for each file (the file and it's encodings) */
+#define HTTP_FILE_CACHE_VARIANTS 4
+
+/*
+ * The file variants, by order of preference when their size is the same (the
+ * last is preferred). `file[0]` is the (identity encoded) file.
+ */
+static const struct {
+  const char *ext;
+  size_t ext_len;
+  FIOBJ *encoding;
+} http_file_cache_variants[HTTP_FILE_CACHE_VARIANTS] = {
+    {.ext = NULL},
+    {.ext = ".gz", .ext_len = 3, .encoding = &HTTP_HVALUE_GZIP},
+    {.ext = ".zst", .ext_len = 4, .encoding = &HTTP_HVALUE_ZSTD},
+    {.ext = ".br", .ext_len = 3, .encoding = &HTTP_HVALUE_BR},
+};
+
+/* the content encoding names of the variants (see `http_accept_encoding`) */
+static const char *const http_file_cache_encodings[HTTP_FILE_CACHE_VARIANTS] =
+    {"identity", "gzip", "zstd", "br"};
+
+typedef struct {
+  /* the file followed by it's variants (fd == -1 if missing) */
+  http_file_cache_file_s file[HTTP_FILE_CACHE_VARIANTS];
+  FIOBJ content_type;
+  time_t validated;
+} http_file_cache_s;
+
+static void http_file_cache_free(http_file_cache_s *c);
+
+#define FIO_FORCE_MALLOC_TMP 1 /* use malloc for long lived objects */
+#define FIO_SET_NAME http_file_cache_set
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) fiobj_iseq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, key) ((dest) = fiobj_dup((key)))
+#define FIO_SET_KEY_DESTROY(key) fiobj_free((key))
+#define FIO_SET_OBJ_TYPE http_file_cache_s *
+#define FIO_SET_OBJ_DESTROY(obj) http_file_cache_free((obj))
+#include <fio.h>
+
+static http_file_cache_set_s http_file_cache = FIO_SET_INIT;
+static fio_lock_i http_file_cache_lock = FIO_LOCK_INIT;
+static size_t http_file_cache_hits = 0;
+static size_t http_file_cache_misses = 0;
+static size_t http_file_cache_memory_hits = 0;
+/* the memory used by pre-serialized responses */
+static size_t http_file_cache_memory = 0;
+/* file descriptor reference counts (0 for files that aren't cached) */
+static volatile uint32_t *http_file_cache_refs = NULL;
+static size_t http_file_cache_refs_len = 0;
+
+/**
+ * Releases a file descriptor sent using `http_sendfile`, closing the file unless
+ * it's still used by the static file cache or by other responses.
+ */
+void http_sendfile_close(intptr_t fd) {
+  if (fd < 0)
+    return;
+  if ((size_t)fd < http_file_cache_refs_len && http_file_cache_refs[fd] &&
+      fio_atomic_sub(http_file_cache_refs + fd, 1))
+    return;
+  close(fd);
+}
+
+/*
+ * Returns the file name of a variant (`i > 0`), or FIOBJ_INVALID if the file is
+ * itself a precompressed variant (i.e., a `.gz` file).
+ */
+static FIOBJ http_file_cache_variant_name(fio_str_info_s s, size_t i) {
+  for (size_t j = 1; j < HTTP_FILE_CACHE_VARIANTS; ++j) {
+    const size_t len = http_file_cache_variants[j].ext_len;
+    if (s.len > len &&
+        !memcmp(s.data + s.len - len, http_file_cache_variants[j].ext, len))
+      return FIOBJ_INVALID;
+  }
+  FIOBJ name = fiobj_str_buf(s.len + http_file_cache_variants[i].ext_len);
+  fiobj_str_write(name, s.data, s.len);
+  fiobj_str_write(name, http_file_cache_variants[i].ext,
+                  http_file_cache_variants[i].ext_len);
+  return name;
+}
+
+/* opens a file for the cache, taking the cache's reference. */
+static int http_file_cache_open(http_file_cache_file_s *f, const char *name) {
+  struct stat file_data;
+  *f = (http_file_cache_file_s){.fd = open(name, O_RDONLY)};
+  if (f->fd == -1)
+    return -1;
+  if (fstat(f->fd, &file_data) || !S_ISREG(file_data.st_mode) ||
+      (size_t)f->fd >= http_file_cache_refs_len) {
+    close(f->fd);
+    f->fd = -1;
+    return -1;
+  }
+  f->size = file_data.st_size;
+  f->mtime = file_data.st_mtime;
+  f->ino = file_data.st_ino;
+  f->etag = http_sendfile_etag(f->size, f->mtime);
+  f->last_modified = http_sendfile_last_modified(f->mtime);
+  fio_atomic_add(http_file_cache_refs + f->fd, 1);
+  return 0;
+}
+
+/* releases the cache's references */
+static void http_file_cache_free(http_file_cache_s *c) {
+  for (size_t i = 0; i < HTTP_FILE_CACHE_VARIANTS; ++i) {
+    if (c->file[i].fd == -1)
+      continue;
+    if (c->file[i].response) {
+      http_file_cache_memory -= fiobj_obj2cstr(c->file[i].response).len;
+      fiobj_free(c->file[i].response);
+    }
+    fiobj_free(c->file[i].etag);
+    fiobj_free(c->file[i].last_modified);
+    http_sendfile_close(c->file[i].fd);
+  }
+  fiobj_free(c->content_type);
+  free(c);
+}
+
+/* opens a file and it's variants, returns NULL if all are missing. */
+static http_file_cache_s *http_file_cache_new(FIOBJ filename) {
+  fio_str_info_s s = fiobj_obj2cstr(filename);
+  http_file_cache_s *c = malloc(sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  *c = (http_file_cache_s){.validated = fio_last_tick().tv_sec};
+  uint8_t found = (http_file_cache_open(c->file, s.data) == 0);
+  for (size_t i = 1; i < HTTP_FILE_CACHE_VARIANTS; ++i) {
+    FIOBJ name = http_file_cache_variant_name(s, i);
+    c->file[i].fd = -1;
+    if (!name)
+      continue;
+    if (!http_file_cache_open(c->file + i, fiobj_obj2cstr(name).data))
+      found = 1;
+    fiobj_free(name);
+  }
+  if (!found) {
+    free(c);
+    return NULL;
+  }
+  c->content_type = http_sendfile_mimetype_find(s.data, s.len);
+  return c;
+}
+
+/* tests if the files in the cache are the same as the files on disk. */
+static int http_file_cache_is_valid(http_file_cache_s *c,
+                                    struct stat st[HTTP_FILE_CACHE_VARIANTS]) {
+  for (size_t i = 0; i < HTTP_FILE_CACHE_VARIANTS; ++i) {
+    if (c->file[i].fd == -1) {
+      if (S_ISREG(st[i].st_mode))
+        return 0;
+      continue;
+    }
+    if (!S_ISREG(st[i].st_mode) || st[i].st_ino != c->file[i].ino ||
+        st[i].st_size != c->file[i].size || st[i].st_mtime != c->file[i].mtime)
+      return 0;
+  }
+  return 1;
+}
+
+/* collects the file system data for a file and it's variants. */
+static void http_file_cache_stat(FIOBJ filename,
+                                 struct stat st[HTTP_FILE_CACHE_VARIANTS]) {
+  fio_str_info_s s = fiobj_obj2cstr(filename);
+  if (stat(s.data, st))
+    st[0].st_mode = 0;
+  for (size_t i = 1; i < HTTP_FILE_CACHE_VARIANTS; ++i) {
+    FIOBJ name = http_file_cache_variant_name(s, i);
+    st[i].st_mode = 0;
+    if (!name)
+      continue;
+    if (stat(fiobj_obj2cstr(name).data, st + i))
+      st[i].st_mode = 0;
+    fiobj_free(name);
+  }
+}
+
+/**
+ * Selects the variant with the highest quality value (`q`), preferring the
+ * smallest variant when quality values are equal. The identity encoded file is
+ * selected if no other variant is acceptable.
+ *
+ * Copies the selected file's data to `dest`, taking a reference to the file.
+ */
+static int http_file_cache_pick(http_file_cache_s *c, const uint16_t *q,
+                                uint8_t *variant, uint8_t *vary,
+                                http_file_cache_file_s *dest,
+                                FIOBJ *content_type) {
+  size_t selected = 0;
+  *vary = 0;
+  for (size_t i = 1; i < HTTP_FILE_CACHE_VARIANTS; ++i) {
+    if (c->file[i].fd == -1)
+      continue;
+    *vary = 1;
+    if (!q[i])
+      continue;
+    if (c->file[selected].fd == -1 || q[i] > q[selected] ||
+        (q[i] == q[selected] && c->file[i].size <= c->file[selected].size) ||
+        (!selected && !q[0]))
+      selected = i;
+  }
+  *variant = selected;
+  http_file_cache_file_s *f = c->file + selected;
+  if (f->fd == -1)
+    return -1;
+  fio_atomic_add(http_file_cache_refs + f->fd, 1);
+  *dest = *f;
+  fiobj_dup(f->etag);
+  fiobj_dup(f->last_modified);
+  fiobj_dup(f->response);
+  *content_type = fiobj_dup(c->content_type);
+  return 0;
+}
+
+/**
+ * Finds (or opens) `filename` and it's variants, selecting a variant according
+ * to the `q` quality values (see `http_accept_encoding`) and copying the
+ * selected file's data to `dest`.
+ *
+ * `*variant` is set to the selected variant and `*vary` is set if the file has
+ * precompressed variants.
+ *
+ * The file descriptor should be released using `http_sendfile_close` (or
+ * `http_sendfile`) and the FIOBJ values should be freed.
+ *
+ * Returns -1 if the file is missing.
+ */
+static int http_file_cache_get(FIOBJ filename, const uint16_t *q,
+                               uint8_t *variant, uint8_t *vary,
+                               http_file_cache_file_s *dest,
+                               FIOBJ *content_type) {
+  int ret;
+  uint64_t hash = fiobj_obj2hash(filename);
+  time_t now = fio_last_tick().tv_sec;
+  fio_lock(&http_file_cache_lock);
+  if (!http_file_cache_refs) {
+    http_file_cache_refs_len = fio_capa();
+    http_file_cache_refs =
+        calloc(sizeof(*http_file_cache_refs), http_file_cache_refs_len);
+    FIO_ASSERT_ALLOC(http_file_cache_refs);
+  }
+  http_file_cache_s *c =
+      http_file_cache_set_find(&http_file_cache, hash, filename);
+  if (c && now - c->validated >= HTTP_FILE_CACHE_TTL) {
+    /* revalidate the cached files (without holding the lock) */
+    struct stat st[HTTP_FILE_CACHE_VARIANTS];
+    fio_unlock(&http_file_cache_lock);
+    http_file_cache_stat(filename, st);
+    fio_lock(&http_file_cache_lock);
+    c = http_file_cache_set_find(&http_file_cache, hash, filename);
+    if (c && http_file_cache_is_valid(c, st))
+      c->validated = now;
+  }
+  if (c && now - c->validated < HTTP_FILE_CACHE_TTL) {
+    ret = http_file_cache_pick(c, q, variant, vary, dest, content_type);
+    ++http_file_cache_hits;
+    fio_unlock(&http_file_cache_lock);
+    return ret;
+  }
+  ++http_file_cache_misses;
+  fio_unlock(&http_file_cache_lock);
+
+  c = http_file_cache_new(filename);
+  if (!c) {
+    if (HTTP_FILE_CACHE_LIMIT) {
+      fio_lock(&http_file_cache_lock);
+      http_file_cache_set_remove(&http_file_cache, hash, filename, NULL);
+      fio_unlock(&http_file_cache_lock);
+    }
+    return -1;
+  }
+  ret = http_file_cache_pick(c, q, variant, vary, dest, content_type);
+  if (!HTTP_FILE_CACHE_LIMIT) {
+    http_file_cache_free(c);
+    return ret;
+  }
+  fio_lock(&http_file_cache_lock);
+  while (http_file_cache_set_count(&http_file_cache) >= HTTP_FILE_CACHE_LIMIT &&
+         !http_file_cache_set_find(&http_file_cache, hash, filename)) {
+    /* evict the oldest entry */
+    FIOBJ oldest = FIOBJ_INVALID;
+    FIO_SET_FOR_LOOP(&http_file_cache, pos) {
+      if (pos->hash) {
+        oldest = pos->obj.key;
+        break;
+      }
+    }
+    http_file_cache_set_remove(&http_file_cache, fiobj_obj2hash(oldest),
+                               oldest, NULL);
+  }
+  http_file_cache_set_insert(&http_file_cache, hash, filename, c, NULL);
+  fio_unlock(&http_file_cache_lock);
+  return ret;
+}
+
+/**
+ * Stores (or replaces) the pre-serialized response for a cached file (`f`, as
+ * returned by `http_file_cache_get`), unless the memory limit was reached.
+ *
+ * `f->response` is updated (and freed) if the new response was stored.
+ */
+static void http_file_cache_store(FIOBJ filename, uint8_t variant,
+                                  http_file_cache_file_s *f, FIOBJ response,
+                                  intptr_t limit) {
+  const size_t len = fiobj_obj2cstr(response).len;
+  uint64_t hash = fiobj_obj2hash(filename);
+  fio_lock(&http_file_cache_lock);
+  http_file_cache_s *c =
+      http_file_cache_set_find(&http_file_cache, hash, filename);
+  if (!c || c->file[variant].fd != f->fd ||
+      c->file[variant].response != f->response)
+    goto finish;
+  if (!f->response &&
+      (limit <= 0 || http_file_cache_memory + len > (size_t)limit))
+    goto finish;
+  if (f->response) {
+    http_file_cache_memory -= fiobj_obj2cstr(f->response).len;
+    fiobj_free(c->file[variant].response);
+    fiobj_free(f->response);
+  }
+  http_file_cache_memory += len;
+  c->file[variant].response = fiobj_dup(response);
+  c->file[variant].date = f->date;
+  c->file[variant].date_pos = f->date_pos;
+  f->response = fiobj_dup(response);
+finish:
+  fio_unlock(&http_file_cache_lock);
+}
+
+/**
+ * Sends the cached file's pre-serialized response (updating the `date` header
+ * if required). Returns -1 if the response can't be used for the request.
+ */
+static int http_file_cache_send(http_s *h, FIOBJ filename, uint8_t variant,
+                                http_file_cache_file_s *f) {
+  static uint64_t range_hash = 0, none_match_hash = 0, ifrange_hash = 0;
+  if (!range_hash) {
+    none_match_hash = fiobj_hash_string("if-none-match", 13);
+    ifrange_hash = fiobj_hash_string("if-range", 8);
+    range_hash = fiobj_hash_string("range", 5);
+  }
+  /* conditional and range requests are reviewed by `http_sendfile_review` */
+  if (!((http_vtable_s *)h->private_data.vtbl)->http_send_prepared ||
+      h->status != 200 || http_header_get(h, range_hash).data ||
+      http_header_get(h, none_match_hash).data ||
+      http_header_get(h, ifrange_hash).data)
+    return -1;
+  fio_str_info_s s = fiobj_obj2cstr(h->method);
+  if (s.len != 3 || strncasecmp("get", s.data, 3))
+    return -1;
+  const time_t now = fio_last_tick().tv_sec;
+  FIOBJ response;
+  if (f->date == now) {
+    response = fiobj_dup(f->response);
+  } else {
+    /* the date changed, replace the response (it might be in use) */
+    char date[48];
+    fio_str_info_s old = fiobj_obj2cstr(f->response);
+    if (http_time2str(date, now) != 29)
+      return -1;
+    response = fiobj_str_buf(old.len);
+    fiobj_str_write(response, old.data, old.len);
+    memcpy(fiobj_obj2cstr(response).data + f->date_pos, date, 29);
+    f->date = now;
+    http_file_cache_store(filename, variant, f, response,
+                          http_settings(h)->static_cache_size);
+  }
+  if (http_settings(h)->log) {
+    /* for the log */
+    http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(f->size));
+  }
+  if (((http_vtable_s *)h->private_data.vtbl)
+          ->http_send_prepared(h, response)) {
+    fiobj_free(response);
+    return -1;
+  }
+  fio_atomic_add(&http_file_cache_memory_hits, 1);
+  return 0;
+}
+
+/**
+ * Serializes the response and sends it, keeping the pre-serialized response in
+ * the cache. Returns -1 if the response can't be pre-serialized.
+ */
+static int http_file_cache_prepare(http_s *h, FIOBJ filename, uint8_t variant,
+                                   http_file_cache_file_s *f) {
+  http_vtable_s *vtbl = h->private_data.vtbl;
+  if (!vtbl->http_prepare || !vtbl->http_send_prepared ||
+      http_settings(h)->static_cache_size <= 0 ||
+      f->size > HTTP_FILE_CACHE_SMALL_FILE)
+    return -1;
+  add_content_length(h, f->size);
+  add_content_type(h);
+  add_date(h);
+  FIOBJ response = vtbl->http_prepare(h, f->size);
+  if (!response)
+    return -1;
+  fio_str_info_s s = fiobj_obj2cstr(response);
+  fiobj_str_capa_assert(response, s.len + f->size);
+  s = fiobj_obj2cstr(response);
+  /* find the `date` header's value */
+  char *pos = s.data;
+  char *end = s.data + s.len;
+  while ((pos = memchr(pos, '\n', end - pos)) && end - pos > 36 &&
+         memcmp(pos + 1, "date:", 5))
+    ++pos;
+  if (!pos || end - pos <= 36 || pos[35] != '\r')
+    goto error;
+  f->date_pos = (pos + 6) - s.data;
+  f->date = last_date_added;
+  if (pread(f->fd, s.data + s.len, f->size, 0) != f->size)
+    goto error;
+  fiobj_str_resize(response, s.len + f->size);
+  http_file_cache_store(filename, variant, f, response,
+                        http_settings(h)->static_cache_size);
+  if (vtbl->http_send_prepared(h, response))
+    goto error;
+  return 0;
+error:
+  fiobj_free(response);
+  return -1;
+}
+
+/** Returns the static file cache's hit / miss counters. */
+http_file_cache_stats_s http_file_cache_stats(void) {
+  http_file_cache_stats_s ret;
+  fio_lock(&http_file_cache_lock);
+  ret = (http_file_cache_stats_s){
+      .hits = http_file_cache_hits,
+      .misses = http_file_cache_misses,
+      .count = http_file_cache_set_count(&http_file_cache),
+      .memory_hits = http_file_cache_memory_hits,
+      .memory = http_file_cache_memory,
+  };
+  fio_unlock(&http_file_cache_lock);
+  return ret;
+}
+
+/** Closes all the files in the static file cache. */
+void http_file_cache_clear(void) {
+  fio_lock(&http_file_cache_lock);
+  http_file_cache_set_free(&http_file_cache);
+  fio_unlock(&http_file_cache_lock);
+}
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -382,13 +1219,9 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
                    const char *encoded, size_t encoded_len) {
   if (HTTP_INVALID_HANDLE(h))
     return -1;
-  struct stat file_data = {.st_size = 0};
-  static uint64_t accept_enc_hash = 0;
-  if (!accept_enc_hash)
-    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
-  static uint64_t range_hash = 0;
-  if (!range_hash)
-    range_hash = fiobj_hash_string("range", 5);
+  static uint64_t ct_hash = 0;
+  if (!ct_hash)
+    ct_hash = fiobj_hash_string("content-type", 12);
 
   /* create filename string */
   FIOBJ filename = fiobj_str_tmp();
@@ -424,129 +1257,34 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
     if (tmp.data[tmp.len - 1] == '/')
       fiobj_str_write(filename, "index.html", 10);
   }
-  /* test for file existance  */
-
-  int file = -1;
-  uint8_t is_gz = 0;
-
-  fio_str_info_s s = fiobj_obj2cstr(filename);
-  {
-    FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
-    if (!tmp)
-      goto no_gzip_support;
-    fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
-    if (!ac_str.data || !strstr(ac_str.data, "gzip"))
-      goto no_gzip_support;
-    if (s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
-        s.data[s.len - 1] != 'z') {
-      fiobj_str_write(filename, ".gz", 3);
-      s = fiobj_obj2cstr(filename);
-      if (!stat(s.data, &file_data) &&
-          (S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode))) {
-        is_gz = 1;
-        goto found_file;
-      }
-      fiobj_str_resize(filename, s.len - 3);
-    }
-  }
-no_gzip_support:
-  if (stat(s.data, &file_data) ||
-      !(S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode)))
+  /* test for file existance (selecting a precompressed variant) */
+  uint16_t q[HTTP_FILE_CACHE_VARIANTS];
+  uint8_t variant, vary;
+  http_accept_encoding(h, http_file_cache_encodings, HTTP_FILE_CACHE_VARIANTS,
+                       q);
+  http_file_cache_file_s file;
+  FIOBJ content_type = FIOBJ_INVALID;
+  /* pre-serialized responses require that no headers were set */
+  const uint8_t prepare = !fiobj_hash_count(h->private_data.out_headers);
+  if (http_file_cache_get(filename, q, &variant, &vary, &file, &content_type))
     return -1;
-found_file:
-  /* set last-modified */
-  {
-    FIOBJ tmp = fiobj_str_buf(32);
-    fiobj_str_resize(
-        tmp, http_time2str(fiobj_obj2cstr(tmp).data, file_data.st_mtime));
-    http_set_header(h, HTTP_HEADER_LAST_MODIFIED, tmp);
-  }
+  http_micro_cache_pass(h);
+  if (prepare && file.response &&
+      !http_file_cache_send(h, filename, variant, &file))
+    goto finish;
   /* set cache-control */
   http_set_header(h, HTTP_HEADER_CACHE_CONTROL, fiobj_dup(HTTP_HVALUE_MAX_AGE));
-  /* set & test etag */
-  uint64_t etag = (uint64_t)file_data.st_size;
-  etag ^= (uint64_t)file_data.st_mtime;
-  etag = fiobj_hash_string(&etag, sizeof(uint64_t));
-  FIOBJ etag_str = fiobj_str_buf(32);
-  fiobj_str_resize(etag_str,
-                   fio_base64_encode(fiobj_obj2cstr(etag_str).data,
-                                     (void *)&etag, sizeof(uint64_t)));
-  /* set */
-  http_set_header(h, HTTP_HEADER_ETAG, etag_str);
-  /* test */
-  {
-    static uint64_t none_match_hash = 0;
-    if (!none_match_hash)
-      none_match_hash = fiobj_hash_string("if-none-match", 13);
-    FIOBJ tmp2 = fiobj_hash_get2(h->headers, none_match_hash);
-    if (tmp2 && fiobj_iseq(tmp2, etag_str)) {
-      h->status = 304;
-      http_finish(h);
-      return 0;
-    }
-  }
-  /* handle range requests */
+  if (vary)
+    http_set_header(h, HTTP_HEADER_VARY,
+                    fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+  /* set & test etag, handle range requests */
   int64_t offset = 0;
-  int64_t length = file_data.st_size;
-  {
-    static uint64_t ifrange_hash = 0;
-    if (!ifrange_hash)
-      ifrange_hash = fiobj_hash_string("if-range", 8);
-    FIOBJ tmp = fiobj_hash_get2(h->headers, ifrange_hash);
-    if (tmp && fiobj_iseq(tmp, etag_str)) {
-      fiobj_hash_delete2(h->headers, range_hash);
-    } else {
-      tmp = fiobj_hash_get2(h->headers, range_hash);
-      if (tmp) {
-        /* range ahead... */
-        if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
-          tmp = fiobj_ary_index(tmp, 0);
-        fio_str_info_s range = fiobj_obj2cstr(tmp);
-        if (!range.data || memcmp("bytes=", range.data, 6))
-          goto open_file;
-        char *pos = range.data + 6;
-        int64_t start_at = 0, end_at = 0;
-        start_at = fio_atol(&pos);
-        if (start_at >= file_data.st_size)
-          goto open_file;
-        if (start_at >= 0) {
-          pos++;
-          end_at = fio_atol(&pos);
-          if (end_at <= 0)
-            goto open_file;
-        }
-        /* we ignore multimple ranges, only responding with the first range. */
-        if (start_at < 0) {
-          if (0 - start_at < file_data.st_size) {
-            offset = file_data.st_size - start_at;
-            length = 0 - start_at;
-          }
-        } else if (end_at) {
-          offset = start_at;
-          length = end_at - start_at + 1;
-          if (length + start_at > file_data.st_size || length <= 0)
-            length = length - start_at;
-        } else {
-          offset = start_at;
-          length = length - start_at;
-        }
-        h->status = 206;
-
-        {
-          FIOBJ cranges = fiobj_str_buf(1);
-          fiobj_str_printf(cranges, "bytes %lu-%lu/%lu",
-                           (unsigned long)start_at,
-                           (unsigned long)(start_at + length - 1),
-                           (unsigned long)file_data.st_size);
-          http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
-        }
-        http_set_header(h, HTTP_HEADER_ACCEPT_RANGES,
-                        fiobj_dup(HTTP_HVALUE_BYTES));
-      }
-    }
-  }
+  int64_t length = file.size;
+  if (http_sendfile_review(h, file.size, file.mtime, file.etag,
+                           file.last_modified, &offset, &length))
+    goto finish;
   /* test for an OPTIONS request or invalid methods */
-  s = fiobj_obj2cstr(h->method);
+  fio_str_info_s s = fiobj_obj2cstr(h->method);
   switch (s.len) {
   case 7:
     if (!strncasecmp("options", s.data, 7)) {
@@ -554,56 +1292,88 @@ found_file:
                        (fio_str_info_s){.data = (char *)"GET, HEAD", .len = 9});
       h->status = 200;
       http_finish(h);
-      return 0;
+      goto finish;
     }
     break;
   case 3:
     if (!strncasecmp("get", s.data, 3))
-      goto open_file;
+      goto send_file;
     break;
   case 4:
     if (!strncasecmp("head", s.data, 4)) {
+      if (variant)
+        http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                        fiobj_dup(*http_file_cache_variants[variant].encoding));
       http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
       http_finish(h);
-      return 0;
+      goto finish;
     }
     break;
   }
   http_send_error(h, 403);
+  goto finish;
+send_file:
+  if (variant)
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                    fiobj_dup(*http_file_cache_variants[variant].encoding));
+  if (content_type &&
+      !fiobj_hash_get2(h->private_data.out_headers, ct_hash))
+    http_set_header(h, HTTP_HEADER_CONTENT_TYPE, fiobj_dup(content_type));
+  if (prepare && !file.response && h->status == 200 && length == file.size &&
+      !http_file_cache_prepare(h, filename, variant, &file))
+    goto finish;
+  http_sendfile(h, file.fd, length, offset);
+  file.fd = -1;
+finish:
+  if (file.fd != -1)
+    http_sendfile_close(file.fd);
+  fiobj_free(file.etag);
+  fiobj_free(file.last_modified);
+  fiobj_free(file.response);
+  fiobj_free(content_type);
   return 0;
-open_file:
-  s = fiobj_obj2cstr(filename);
-  file = open(s.data, O_RDONLY);
-  if (file == -1) {
-    FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n", s.data);
-    perror("     ");
-    http_send_error(h, 500);
+}
+
+/**
+ * Sends the response headers and an open file (the response's body), handling
+ * conditional and `Range` requests as `http_sendfile2` does.
+ *
+ * Returns -1 on error (the file is closed, the `http_s` handle should still be
+ * used) and 0 on success.
+ *
+ * AFTER A SUCCESSFUL CALL, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_sendfile_fd(http_s *h, int fd, const char *filename,
+                     size_t filename_len) {
+  struct stat file_data;
+  if (HTTP_INVALID_HANDLE(h) || fstat(fd, &file_data) ||
+      !S_ISREG(file_data.st_mode)) {
+    close(fd);
+    return -1;
+  }
+  http_micro_cache_pass(h);
+  int64_t offset = 0;
+  int64_t length = file_data.st_size;
+  if (http_sendfile_review(h, file_data.st_size, file_data.st_mtime,
+                           FIOBJ_INVALID, FIOBJ_INVALID, &offset, &length)) {
+    close(fd);
     return 0;
   }
-  {
-    FIOBJ tmp = 0;
-    uintptr_t pos = 0;
-    if (is_gz) {
-      http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
-                      fiobj_dup(HTTP_HVALUE_GZIP));
-
-      pos = s.len - 4;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos - 3);
-
-    } else {
-      pos = s.len - 1;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos);
-    }
-    if (tmp)
-      http_set_header(h, HTTP_HEADER_CONTENT_TYPE, tmp);
+  /* the length is set according to the range being sent */
+  static uint64_t cl_hash = 0;
+  if (!cl_hash)
+    cl_hash = fiobj_hash_string("content-length", 14);
+  fiobj_hash_delete2(h->private_data.out_headers, cl_hash);
+  if (filename && filename_len)
+    http_sendfile_mimetype(h, filename, filename_len);
+  fio_str_info_s m = fiobj_obj2cstr(h->method);
+  if (m.len == 4 && !strncasecmp("head", m.data, 4)) {
+    close(fd);
+    http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
+    http_finish(h);
+    return 0;
   }
-  http_sendfile(h, file, length, offset);
+  http_sendfile(h, fd, length, offset);
   return 0;
 }
 
@@ -694,6 +1464,7 @@ int http_upgrade2ws(http_s *h, websocket_settings_s args) {
   }
   if (HTTP_INVALID_HANDLE(h))
     goto error;
+  http_micro_cache_pass(h);
   return ((http_vtable_s *)h->private_data.vtbl)->http2websocket(h, &args);
 error:
   if (args.on_close)
@@ -755,45 +1526,572 @@ static void http_resume_fallback_wrapper(intptr_t uuid, void *arg) {
 }
 
 /**
- * Defers the request / response handling for later.
+ * Defers the request / response handling for later.
+ */
+void http_pause(http_s *h, void (*task)(http_pause_handle_s *http)) {
+  if (HTTP_INVALID_HANDLE(h)) {
+    return;
+  }
+  http_fio_protocol_s *p = (http_fio_protocol_s *)h->private_data.flag;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  http_pause_handle_s *http = fio_malloc(sizeof(*http));
+  *http = (http_pause_handle_s){
+      .uuid = p->uuid,
+      .h = h,
+      .udata = h->udata,
+  };
+  vtbl->http_on_pause(h, p);
+  fio_defer(http_pause_wrapper, http, (void *)((uintptr_t)task));
+}
+
+/**
+ * Defers the request / response handling for later.
+ */
+void http_resume(http_pause_handle_s *http, void (*task)(http_s *h),
+                 void (*fallback)(void *udata)) {
+  if (!http)
+    return;
+  http->task = task;
+  http->fallback = fallback;
+  fio_defer_io_task(http->uuid, .udata = http, .type = FIO_PR_LOCK_TASK,
+                    .task = http_resume_wrapper,
+                    .fallback = http_resume_fallback_wrapper);
+}
+
+/**
+ * Hijacks the socket away from the HTTP protocol and away from facil.io.
+ */
+intptr_t http_hijack(http_s *h, fio_str_info_s *leftover) {
+  if (!h)
+    return -1;
+  http_micro_cache_pass(h);
+  return ((http_vtable_s *)h->private_data.vtbl)->http_hijack(h, leftover);
+}
+
+/* *****************************************************************************
+Micro-Cache (dynamic responses)
+***************************************************************************** */
+
+/*
+ * The micro-cache keeps dynamic responses to `GET` requests as pre-serialized
+ * HTTP/1.1 responses for the number of seconds set by the response's
+ * `Cache-Control: s-maxage` directive (see the `micro_cache_size` setting).
+ *
+ * Entries are keyed by the service (settings), method, host, path, query and
+ * the request headers the response might vary by (`accept-encoding` and the
+ * `micro_cache_vary` list).
+ *
+ * The first request for a missing (or expired) entry marks the entry as
+ * pending and is handled by the application. Identical requests are paused and
+ * added to the entry's waiting list until the response is known (request
+ * collapsing). Once the response was sent, the waiting requests are resumed and
+ * either answered from the cache or handled by the application (if the
+ * response wasn't cacheable). Responses that aren't cacheable leave a "pass"
+ * entry for `HTTP_MICRO_CACHE_PASS_TTL` milliseconds, so requests for the
+ * resource aren't collapsed.
+ *
+ * The memory limit covers the entries and their keys as well as the responses.
+ * Expired entries are swept (at most once a second) when entries are added.
+ *
+ * Like the static file cache, the `date` header of a cached response is
+ * updated once a second.
+ */
+
+typedef struct {
+  /* the entry's key (the Set's copy) */
+  FIOBJ key;
+  /* the pre-serialized response (FIOBJ_INVALID while pending or a "pass") */
+  FIOBJ response;
+  /* the response's status and body length (for the log) */
+  uintptr_t status;
+  size_t body_len;
+  /* the response's `date` value and position (0 if missing) */
+  time_t date;
+  size_t date_pos;
+  /* the time (in milliseconds) when the entry expires */
+  uint64_t expires;
+  /* the memory used by the entry and its key (the response isn't included) */
+  size_t size;
+  /* paused requests waiting for the response (`http_pause_handle_s *`) */
+  fio_ls_s waiters;
+  /* set while the response is produced */
+  uint8_t pending;
+} http_micro_cache_s;
+
+static void http_micro_cache_free(http_micro_cache_s *c);
+
+#define FIO_FORCE_MALLOC_TMP 1 /* use malloc for long lived objects */
+#define FIO_SET_NAME http_micro_cache_set
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) fiobj_iseq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, key) ((dest) = fiobj_dup((key)))
+#define FIO_SET_KEY_DESTROY(key) fiobj_free((key))
+#define FIO_SET_OBJ_TYPE http_micro_cache_s *
+#define FIO_SET_OBJ_DESTROY(obj) http_micro_cache_free((obj))
+#include <fio.h>
+
+static http_micro_cache_set_s http_micro_cache = FIO_SET_INIT;
+static fio_lock_i http_micro_cache_lock = FIO_LOCK_INIT;
+static size_t http_micro_cache_hits = 0;
+static size_t http_micro_cache_misses = 0;
+static size_t http_micro_cache_collapsed = 0;
+/* the memory used by the entries, their keys and the cached responses */
+static size_t http_micro_cache_memory = 0;
+/* the last time (in milliseconds) expired entries were swept */
+static uint64_t http_micro_cache_swept = 0;
+
+/* a paused request's `udata`, until it's added to the waiting list */
+typedef struct {
+  FIOBJ key;
+  void *udata;
+} http_micro_cache_wait_s;
+
+static void http_micro_cache_on_resume(http_s *h);
+
+/* frees an entry (called by the Set, with the lock held) */
+static void http_micro_cache_free(http_micro_cache_s *c) {
+  http_micro_cache_memory -= c->size;
+  if (c->response)
+    http_micro_cache_memory -= fiobj_obj2cstr(c->response).len;
+  fiobj_free(c->response);
+  while (fio_ls_any(&c->waiters))
+    http_resume((http_pause_handle_s *)fio_ls_pop(&c->waiters),
+                http_micro_cache_on_resume, NULL);
+  free(c);
+}
+
+/* the current time in milliseconds */
+static inline uint64_t http_micro_cache_now(void) {
+  struct timespec t = fio_last_tick();
+  return ((uint64_t)t.tv_sec * 1000) + (t.tv_nsec / 1000000);
+}
+
+/*
+ * Reads the next comma separated token (trimming white space), returning 0
+ * once there are no more tokens.
+ */
+static int http_micro_cache_token(const char **pos, const char *end,
+                                  fio_str_info_s *token) {
+  const char *p = *pos;
+  while (p < end && (*p == ',' || *p == ' ' || *p == '\t'))
+    ++p;
+  if (p >= end)
+    return 0;
+  const char *stop = p;
+  while (stop < end && *stop != ',')
+    ++stop;
+  *pos = stop;
+  while (stop > p && (stop[-1] == ' ' || stop[-1] == '\t'))
+    --stop;
+  *token = (fio_str_info_s){.data = (char *)p, .len = (size_t)(stop - p)};
+  return 1;
+}
+
+/* builds the request's key */
+static FIOBJ http_micro_cache_key(http_s *h, http_settings_s *settings) {
+  static uint64_t host_hash = 0, accept_encoding_hash = 0;
+  if (!host_hash) {
+    accept_encoding_hash = fiobj_hash_string("accept-encoding", 15);
+    host_hash = fiobj_hash_string("host", 4);
+  }
+  /* the host can't contain a '/' or a '\n', so the parts can't be confused */
+  FIOBJ key = fiobj_str_buf(256);
+  fiobj_str_write(key, (char *)&settings, sizeof(settings));
+  fiobj_str_join(key, h->method);
+  fiobj_str_write(key, "\n", 1);
+  fio_str_info_s tmp = http_header_get(h, host_hash);
+  if (tmp.data)
+    fiobj_str_write(key, tmp.data, tmp.len);
+  fiobj_str_write(key, "\n", 1);
+  fiobj_str_join(key, h->path);
+  if (h->query) {
+    fiobj_str_write(key, "?", 1);
+    fiobj_str_join(key, h->query);
+  }
+  tmp = http_header_get(h, accept_encoding_hash);
+  fiobj_str_write(key, "\n", 1);
+  if (tmp.data)
+    fiobj_str_write(key, tmp.data, tmp.len);
+  if (!settings->micro_cache_vary)
+    return key;
+  const char *pos = settings->micro_cache_vary;
+  const char *end = pos + strlen(pos);
+  fio_str_info_s name;
+  while (http_micro_cache_token(&pos, end, &name)) {
+    tmp = http_header_get(h, fiobj_hash_string(name.data, name.len));
+    fiobj_str_write(key, "\n", 1);
+    if (tmp.data)
+      fiobj_str_write(key, tmp.data, tmp.len);
+  }
+  return key;
+}
+
+/* tests if a request can use the micro-cache */
+static int http_micro_cache_is_cacheable_request(http_s *h) {
+  static uint64_t range_hash = 0, none_match_hash = 0, modified_since_hash = 0,
+                  host_hash = 0;
+  if (!range_hash) {
+    none_match_hash = fiobj_hash_string("if-none-match", 13);
+    modified_since_hash = fiobj_hash_string("if-modified-since", 17);
+    host_hash = fiobj_hash_string("host", 4);
+    range_hash = fiobj_hash_string("range", 5);
+  }
+  http_vtable_s *vtbl = h->private_data.vtbl;
+  if (!vtbl->http_prepare || !vtbl->http_send_prepared)
+    return 0;
+  fio_str_info_s s = fiobj_obj2cstr(h->method);
+  if (s.len != 3 || strncasecmp("get", s.data, 3))
+    return 0;
+  /* a host with a path (or a line break) might collide with another key */
+  s = http_header_get(h, host_hash);
+  if (s.data && (memchr(s.data, '/', s.len) || memchr(s.data, '\n', s.len)))
+    return 0;
+  /* conditional and range requests are left to the application */
+  return !http_header_get(h, range_hash).data &&
+         !http_header_get(h, none_match_hash).data &&
+         !http_header_get(h, modified_since_hash).data;
+}
+
+/*
+ * Returns the number of milliseconds a response may be cached, or 0 if the
+ * response can't be cached.
+ */
+static uint64_t http_micro_cache_ttl(http_s *h, http_settings_s *settings) {
+  switch (h->status) {
+  case 200: /* fallthrough */
+  case 203: /* fallthrough */
+  case 300: /* fallthrough */
+  case 301: /* fallthrough */
+  case 404: /* fallthrough */
+  case 410:
+    break;
+  default:
+    return 0;
+  }
+  FIOBJ out = h->private_data.out_headers;
+  if (fiobj_hash_get(out, HTTP_HEADER_SET_COOKIE))
+    return 0;
+  FIOBJ tmp = fiobj_hash_get(out, HTTP_HEADER_CACHE_CONTROL);
+  if (!tmp || FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+    return 0;
+  uint64_t ttl = 0;
+  fio_str_info_s s = fiobj_obj2cstr(tmp);
+  const char *pos = s.data;
+  fio_str_info_s token;
+  while (http_micro_cache_token(&pos, s.data + s.len, &token)) {
+    if (token.len > 9 && !strncasecmp("s-maxage=", token.data, 9)) {
+      ttl = (uint64_t)fio_atol(&(char *){token.data + 9}) * 1000;
+    } else if ((token.len >= 7 && !strncasecmp("private", token.data, 7) &&
+                (token.len == 7 || token.data[7] == '=')) ||
+               (token.len >= 8 && !strncasecmp("no-store", token.data, 8)) ||
+               (token.len >= 8 && !strncasecmp("no-cache", token.data, 8))) {
+      return 0;
+    }
+  }
+  tmp = fiobj_hash_get(out, HTTP_HEADER_VARY);
+  if (!tmp || !ttl)
+    return ttl;
+  if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+    return 0;
+  /* the response may only vary by headers in the key */
+  s = fiobj_obj2cstr(tmp);
+  pos = s.data;
+  while (http_micro_cache_token(&pos, s.data + s.len, &token)) {
+    if (token.len == 15 && !strncasecmp("accept-encoding", token.data, 15))
+      continue;
+    if (!settings->micro_cache_vary)
+      return 0;
+    const char *lpos = settings->micro_cache_vary;
+    const char *lend = lpos + strlen(lpos);
+    fio_str_info_s name;
+    uint8_t found = 0;
+    while (!found && http_micro_cache_token(&lpos, lend, &name))
+      found = (name.len == token.len &&
+               !strncasecmp(name.data, token.data, token.len));
+    if (!found)
+      return 0;
+  }
+  return ttl;
+}
+
+/*
+ * Sends a cached response (updating the `date` header if required). Returns -1
+ * if the response can't be used for the request.
+ */
+static int http_micro_cache_send(http_s *h, FIOBJ key, uint64_t hash) {
+  const time_t now = fio_last_tick().tv_sec;
+  FIOBJ response = FIOBJ_INVALID;
+  FIOBJ old = FIOBJ_INVALID;
+  uintptr_t status = 200;
+  size_t body_len = 0, date_pos = 0;
+  fio_lock(&http_micro_cache_lock);
+  http_micro_cache_s *c = http_micro_cache_set_find(&http_micro_cache, hash, key);
+  if (c && c->response && c->expires > http_micro_cache_now()) {
+    ++http_micro_cache_hits;
+    response = fiobj_dup(c->response);
+    status = c->status;
+    body_len = c->body_len;
+    date_pos = c->date_pos;
+    if (date_pos && c->date != now) {
+      c->date = now;
+      old = response;
+    }
+  }
+  fio_unlock(&http_micro_cache_lock);
+  if (!response)
+    return -1;
+  if (old) {
+    /* the date changed, replace the response (it might be in use) */
+    char date[48];
+    fio_str_info_s s = fiobj_obj2cstr(old);
+    if (http_time2str(date, now) == 29) {
+      response = fiobj_str_buf(s.len);
+      fiobj_str_write(response, s.data, s.len);
+      memcpy(fiobj_obj2cstr(response).data + date_pos, date, 29);
+      fio_lock(&http_micro_cache_lock);
+      c = http_micro_cache_set_find(&http_micro_cache, hash, key);
+      if (c && c->response == old) {
+        c->response = fiobj_dup(response);
+        fiobj_free(old);
+      }
+      fio_unlock(&http_micro_cache_lock);
+      fiobj_free(old);
+    }
+  }
+  h->status = status;
+  if (http_settings(h)->log) {
+    /* for the log */
+    http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(body_len));
+  }
+  if (((http_vtable_s *)h->private_data.vtbl)
+          ->http_send_prepared(h, response)) {
+    fiobj_free(response);
+    fiobj_hash_delete(h->private_data.out_headers, HTTP_HEADER_CONTENT_LENGTH);
+    h->status = 200;
+    return -1;
+  }
+  return 0;
+}
+
+/* a paused request, adds itself to the entry's waiting list */
+static void http_micro_cache_on_pause(http_pause_handle_s *http) {
+  http_micro_cache_wait_s *w = http_paused_udata_get(http);
+  http_paused_udata_set(http, w->udata);
+  fio_lock(&http_micro_cache_lock);
+  http_micro_cache_s *c = http_micro_cache_set_find(
+      &http_micro_cache, fiobj_obj2hash(w->key), w->key);
+  if (c && c->pending) {
+    fio_ls_push(&c->waiters, http);
+    http = NULL;
+  }
+  fio_unlock(&http_micro_cache_lock);
+  fiobj_free(w->key);
+  fio_free(w);
+  if (http)
+    http_resume(http, http_micro_cache_on_resume, NULL);
+}
+
+/* a resumed request, answered from the cache or by the application */
+static void http_micro_cache_on_resume(http_s *h) {
+  http_settings_s *settings = http_settings(h);
+  FIOBJ key = http_micro_cache_key(h, settings);
+  int failed = http_micro_cache_send(h, key, fiobj_obj2hash(key));
+  fiobj_free(key);
+  if (failed)
+    settings->on_request(h);
+}
+
+static void http_micro_cache_evict(http_micro_cache_s *keep, size_t len,
+                                   size_t limit);
+
+/* removes the expired entries, at most once a second (lock must be held) */
+static void http_micro_cache_sweep(uint64_t now) {
+  if (now < http_micro_cache_swept + 1000)
+    return;
+  http_micro_cache_swept = now;
+  FIO_SET_FOR_LOOP(&http_micro_cache, pos) {
+    if (pos->hash && !pos->obj.obj->pending && pos->obj.obj->expires <= now)
+      http_micro_cache_set_remove(&http_micro_cache, pos->hash, pos->obj.key,
+                                  NULL);
+  }
+}
+
+/**
+ * Answers a request from the micro-cache, or pauses it while an identical
+ * request is handled. Returns 0 if the request should be handled by the
+ * application.
  */
-void http_pause(http_s *h, void (*task)(http_pause_handle_s *http)) {
-  if (HTTP_INVALID_HANDLE(h)) {
+int http_micro_cache_request(http_s *h, http_settings_s *settings) {
+  if (!http_micro_cache_is_cacheable_request(h))
+    return 0;
+  FIOBJ key = http_micro_cache_key(h, settings);
+  const uint64_t hash = fiobj_obj2hash(key);
+  const uint64_t now = http_micro_cache_now();
+  http_micro_cache_s *c;
+  fio_lock(&http_micro_cache_lock);
+  c = http_micro_cache_set_find(&http_micro_cache, hash, key);
+  if (!c) {
+    const size_t size = sizeof(*c) + fiobj_obj2cstr(key).len;
+    http_micro_cache_sweep(now);
+    http_micro_cache_evict(NULL, size, settings->micro_cache_size);
+    c = malloc(sizeof(*c));
+    FIO_ASSERT_ALLOC(c);
+    *c = (http_micro_cache_s){
+        .key = key, .size = size, .waiters = FIO_LS_INIT(c->waiters)};
+    http_micro_cache_set_insert(&http_micro_cache, hash, key, c, NULL);
+    http_micro_cache_memory += size;
+  } else if (c->pending) {
+    /* collapse the request, waiting for the response */
+    ++http_micro_cache_collapsed;
+    fio_unlock(&http_micro_cache_lock);
+    http_micro_cache_wait_s *w = fio_malloc(sizeof(*w));
+    FIO_ASSERT_ALLOC(w);
+    *w = (http_micro_cache_wait_s){.key = key, .udata = h->udata};
+    h->udata = w;
+    http_pause(h, http_micro_cache_on_pause);
+    return 1;
+  } else if (c->expires > now) {
+    fio_unlock(&http_micro_cache_lock);
+    /* a "pass" entry isn't sent */
+    const int failed = http_micro_cache_send(h, key, hash);
+    fiobj_free(key);
+    return !failed;
+  } else if (c->response) {
+    http_micro_cache_memory -= fiobj_obj2cstr(c->response).len;
+    fiobj_free(c->response);
+    c->response = FIOBJ_INVALID;
+  }
+  /* the application produces the response */
+  ++http_micro_cache_misses;
+  c->pending = 1;
+  fio_unlock(&http_micro_cache_lock);
+  fiobj_free(key);
+  h->private_data.micro_cache = c;
+  return 0;
+}
+
+/* completes a pending entry (lock must be held) */
+static void http_micro_cache_complete(http_micro_cache_s *c, uint8_t pass) {
+  c->pending = 0;
+  while (fio_ls_any(&c->waiters))
+    http_resume((http_pause_handle_s *)fio_ls_pop(&c->waiters),
+                http_micro_cache_on_resume, NULL);
+  if (c->response)
+    return;
+  if (pass) {
+    c->expires = http_micro_cache_now() + HTTP_MICRO_CACHE_PASS_TTL;
     return;
   }
-  http_fio_protocol_s *p = (http_fio_protocol_s *)h->private_data.flag;
-  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
-  http_pause_handle_s *http = fio_malloc(sizeof(*http));
-  *http = (http_pause_handle_s){
-      .uuid = p->uuid,
-      .h = h,
-      .udata = h->udata,
-  };
-  vtbl->http_on_pause(h, p);
-  fio_defer(http_pause_wrapper, http, (void *)((uintptr_t)task));
+  http_micro_cache_set_remove(&http_micro_cache, fiobj_obj2hash(c->key), c->key,
+                              NULL);
+}
+
+/* removes expired entries, then the oldest entries, until `len` bytes fit */
+static void http_micro_cache_evict(http_micro_cache_s *keep, size_t len,
+                                   size_t limit) {
+  const uint64_t now = http_micro_cache_now();
+  for (int expired = 1; expired >= 0; --expired) {
+    FIO_SET_FOR_LOOP(&http_micro_cache, pos) {
+      if (http_micro_cache_memory + len <= limit)
+        return;
+      http_micro_cache_s *c = pos->obj.obj;
+      if (!pos->hash || c == keep || c->pending ||
+          (expired && c->expires > now))
+        continue;
+      http_micro_cache_set_remove(&http_micro_cache, pos->hash, pos->obj.key,
+                                  NULL);
+    }
+  }
 }
 
 /**
- * Defers the request / response handling for later.
+ * Completes a micro-cache entry that wasn't filled by the response (i.e.,
+ * streamed responses), handling the waiting requests.
  */
-void http_resume(http_pause_handle_s *http, void (*task)(http_s *h),
-                 void (*fallback)(void *udata)) {
-  if (!http)
-    return;
-  http->task = task;
-  http->fallback = fallback;
-  fio_defer_io_task(http->uuid, .udata = http, .type = FIO_PR_LOCK_TASK,
-                    .task = http_resume_wrapper,
-                    .fallback = http_resume_fallback_wrapper);
+void http_micro_cache_release(void *entry) {
+  fio_lock(&http_micro_cache_lock);
+  http_micro_cache_complete(entry, 1);
+  fio_unlock(&http_micro_cache_lock);
 }
 
 /**
- * Hijacks the socket away from the HTTP protocol and away from facil.io.
+ * Stores the response in the pending entry (if the response is cacheable) and
+ * sends it. Returns -1 if the response wasn't sent.
  */
-intptr_t http_hijack(http_s *h, fio_str_info_s *leftover) {
-  if (!h)
+static int http_micro_cache_send_body(http_s *h, void *data, uintptr_t length) {
+  http_micro_cache_s *c = h->private_data.micro_cache;
+  http_settings_s *settings = http_settings(h);
+  http_vtable_s *vtbl = h->private_data.vtbl;
+  const uint64_t ttl = http_micro_cache_ttl(h, settings);
+  h->private_data.micro_cache = NULL;
+  if (!ttl || length > (size_t)settings->micro_cache_size / 4) {
+    http_micro_cache_release(c);
     return -1;
-  return ((http_vtable_s *)h->private_data.vtbl)->http_hijack(h, leftover);
+  }
+  FIOBJ response = vtbl->http_prepare(h, length);
+  if (!response) {
+    /* the connection isn't persistent, the next request might be */
+    fio_lock(&http_micro_cache_lock);
+    http_micro_cache_complete(c, 0);
+    fio_unlock(&http_micro_cache_lock);
+    return -1;
+  }
+  fio_str_info_s s = fiobj_obj2cstr(response);
+  /* find the `date` header's value */
+  char *pos = s.data;
+  char *end = s.data + s.len;
+  size_t date_pos = 0;
+  while ((pos = memchr(pos, '\n', end - pos)) && end - pos > 36 &&
+         memcmp(pos + 1, "date:", 5))
+    ++pos;
+  if (pos && end - pos > 36 && pos[35] == '\r')
+    date_pos = (pos + 6) - s.data;
+  fiobj_str_write(response, data, length);
+  s = fiobj_obj2cstr(response);
+  fio_lock(&http_micro_cache_lock);
+  http_micro_cache_evict(c, s.len, settings->micro_cache_size);
+  if (http_micro_cache_memory + s.len <= (size_t)settings->micro_cache_size) {
+    http_micro_cache_memory += s.len;
+    c->response = fiobj_dup(response);
+    c->status = h->status;
+    c->body_len = length;
+    c->date = last_date_added;
+    c->date_pos = date_pos;
+    c->expires = http_micro_cache_now() + ttl;
+  }
+  http_micro_cache_complete(c, 1);
+  fio_unlock(&http_micro_cache_lock);
+  if (vtbl->http_send_prepared(h, response)) {
+    fiobj_free(response);
+    return -1;
+  }
+  return 0;
+}
+
+/** Returns the micro-cache's hit / miss counters. */
+http_micro_cache_stats_s http_micro_cache_stats(void) {
+  http_micro_cache_stats_s ret;
+  fio_lock(&http_micro_cache_lock);
+  ret = (http_micro_cache_stats_s){
+      .hits = http_micro_cache_hits,
+      .misses = http_micro_cache_misses,
+      .collapsed = http_micro_cache_collapsed,
+      .count = http_micro_cache_set_count(&http_micro_cache),
+      .memory = http_micro_cache_memory,
+  };
+  fio_unlock(&http_micro_cache_lock);
+  return ret;
+}
+
+/** Removes all the cached responses (pending entries are kept). */
+void http_micro_cache_clear(void) {
+  fio_lock(&http_micro_cache_lock);
+  FIO_SET_FOR_LOOP(&http_micro_cache, pos) {
+    if (pos->hash && !pos->obj.obj->pending)
+      http_micro_cache_set_remove(&http_micro_cache, pos->hash, pos->obj.key,
+                                  NULL);
+  }
+  fio_unlock(&http_micro_cache_lock);
 }
 
 /* *****************************************************************************
@@ -819,6 +2117,10 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
 
   if (!arg_settings.max_body_size)
     arg_settings.max_body_size = HTTP_DEFAULT_BODY_LIMIT;
+  if (!arg_settings.pipeline_limit)
+    arg_settings.pipeline_limit = HTTP_DEFAULT_PIPELINE_LIMIT;
+  if (!arg_settings.static_cache_size)
+    arg_settings.static_cache_size = HTTP_DEFAULT_STATIC_CACHE;
   if (!arg_settings.timeout)
     arg_settings.timeout = 40;
   if (!arg_settings.ws_max_msg_size)
@@ -859,11 +2161,21 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
       ((uint8_t *)settings->public_folder)[settings->public_folder_length] = 0;
     }
   }
+  if (settings->micro_cache_vary) {
+    /* header names are stored (and hashed) in lower case */
+    size_t len = strlen(settings->micro_cache_vary);
+    char *tmp = malloc(len + 1);
+    FIO_ASSERT_ALLOC(tmp);
+    for (size_t i = 0; i <= len; ++i)
+      tmp[i] = tolower(settings->micro_cache_vary[i]);
+    settings->micro_cache_vary = tmp;
+  }
   return settings;
 }
 
 static void http_settings_free(http_settings_s *s) {
   free((void *)s->public_folder);
+  free((void *)s->micro_cache_vary);
   free(s);
 }
 /* *****************************************************************************
@@ -872,8 +2184,8 @@ Listening to HTTP connections
 
 static uint8_t fio_http_at_capa = 0;
 
-static void http_on_server_protocol_http1(intptr_t uuid, void *set,
-                                          void *ignr_) {
+/** tests (and reports) if the server reached its connection limit. */
+static int http_on_server_protocol_at_capa(intptr_t uuid, void *set) {
   if ((unsigned int)fio_uuid2fd(uuid) >=
       ((http_settings_s *)set)->max_clients) {
     if (fio_uuid2fd(uuid) != -1) {
@@ -883,9 +2195,16 @@ static void http_on_server_protocol_http1(intptr_t uuid, void *set,
       http_send_error2(uuid, 503, set);
       fio_close(uuid);
     }
-    return;
+    return 1;
   }
   fio_http_at_capa = 0;
+  return 0;
+}
+
+static void http_on_server_protocol_http1(intptr_t uuid, void *set,
+                                          void *ignr_) {
+  if (http_on_server_protocol_at_capa(uuid, set))
+    return;
   fio_protocol_s *pr = http1_new(uuid, set, NULL, 0);
   if (!pr)
     fio_close(uuid);
@@ -894,6 +2213,18 @@ static void http_on_server_protocol_http1(intptr_t uuid, void *set,
   (void)ignr_;
 }
 
+static void http_on_server_protocol_http2(intptr_t uuid, void *set,
+                                          void *ignr_) {
+  if (http_on_server_protocol_at_capa(uuid, set))
+    return;
+  fio_protocol_s *pr = http2_new(uuid, set, NULL, 0);
+  if (!pr)
+    fio_close(uuid);
+  else
+    fio_timeout_set(uuid, ((http_settings_s *)set)->timeout);
+  (void)ignr_;
+}
+
 static void http_on_open(intptr_t uuid, void *set) {
   http_on_server_protocol_http1(uuid, set, NULL);
 }
@@ -930,11 +2261,13 @@ intptr_t http_listen(const char *port, const char *binding,
   if (settings->tls) {
     fio_tls_alpn_add(settings->tls, "http/1.1", http_on_server_protocol_http1,
                      NULL, NULL);
+    fio_tls_alpn_add(settings->tls, "h2", http_on_server_protocol_http2, NULL,
+                     NULL);
   }
 
   return fio_listen(.port = port, .address = binding, .tls = arg_settings.tls,
                     .on_finish = http_on_finish, .on_open = http_on_open,
-                    .udata = settings);
+                    .udata = settings, .reuse_port = arg_settings.reuse_port);
 }
 /** Listens to HTTP connections at the specified `port` and `binding`. */
 #define http_listen(port, binding, ...)                                        \
@@ -1330,6 +2663,7 @@ int http_upgrade2sse(http_s *h, http_sse_s sse) {
       sse.on_close(&sse);
     return -1;
   }
+  http_micro_cache_pass(h);
   return ((http_vtable_s *)h->private_data.vtbl)->http_upgrade2sse(h, &sse);
 }
 
@@ -1487,11 +2821,8 @@ void http_parse_query(http_s *h) {
   } while (q.len);
 }
 
-static inline void http_parse_cookies_cookie_str(FIOBJ dest, FIOBJ str,
+static inline void http_parse_cookies_cookie_str(FIOBJ dest, fio_str_info_s s,
                                                  uint8_t is_url_encoded) {
-  if (!FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
-    return;
-  fio_str_info_s s = fiobj_obj2cstr(str);
   while (s.len) {
     if (s.data[0] == ' ') {
       ++s.data;
@@ -1513,11 +2844,9 @@ static inline void http_parse_cookies_cookie_str(FIOBJ dest, FIOBJ str,
     s.data = cut2 + 1;
   }
 }
-static inline void http_parse_cookies_setcookie_str(FIOBJ dest, FIOBJ str,
-                                                    uint8_t is_url_encoded) {
-  if (!FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
-    return;
-  fio_str_info_s s = fiobj_obj2cstr(str);
+static inline void
+http_parse_cookies_setcookie_str(FIOBJ dest, fio_str_info_s s,
+                                 uint8_t is_url_encoded) {
   char *cut = memchr(s.data, '=', s.len);
   if (!cut)
     cut = s.data;
@@ -1529,49 +2858,37 @@ static inline void http_parse_cookies_setcookie_str(FIOBJ dest, FIOBJ str,
                   is_url_encoded);
 }
 
+struct http_parse_cookies_s {
+  http_s *h;
+  uint8_t is_url_encoded;
+};
+
+static int http_parse_cookies_task(fio_str_info_s name, fio_str_info_s value,
+                                   size_t index, void *a_) {
+  struct http_parse_cookies_s *a = a_;
+  if (name.len == 6 && !memcmp(name.data, "cookie", 6)) {
+    if (!a->h->cookies)
+      a->h->cookies = fiobj_hash_new();
+    http_parse_cookies_cookie_str(a->h->cookies, value, a->is_url_encoded);
+  } else if (name.len == 10 && !memcmp(name.data, "set-cookie", 10)) {
+    if (!a->h->cookies)
+      a->h->cookies = fiobj_hash_new();
+    http_parse_cookies_setcookie_str(a->h->cookies, value, a->is_url_encoded);
+  }
+  return 0;
+  (void)index;
+}
+
 /** Parses any Cookie / Set-Cookie headers, using the `http_add2hash` scheme. */
 void http_parse_cookies(http_s *h, uint8_t is_url_encoded) {
-  if (!h->headers)
+  if (!h->headers && !h->private_data.hslices)
     return;
   if (h->cookies && fiobj_hash_count(h->cookies)) {
     FIO_LOG_WARNING("(http) attempting to parse cookies more than once.");
     return;
   }
-  static uint64_t setcookie_header_hash;
-  if (!setcookie_header_hash)
-    setcookie_header_hash = fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
-  FIOBJ c = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_COOKIE));
-  if (c) {
-    if (!h->cookies)
-      h->cookies = fiobj_hash_new();
-    if (FIOBJ_TYPE_IS(c, FIOBJ_T_ARRAY)) {
-      /* Array of Strings */
-      size_t count = fiobj_ary_count(c);
-      for (size_t i = 0; i < count; ++i) {
-        http_parse_cookies_cookie_str(
-            h->cookies, fiobj_ary_index(c, (int64_t)i), is_url_encoded);
-      }
-    } else {
-      /* single string */
-      http_parse_cookies_cookie_str(h->cookies, c, is_url_encoded);
-    }
-  }
-  c = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_SET_COOKIE));
-  if (c) {
-    if (!h->cookies)
-      h->cookies = fiobj_hash_new();
-    if (FIOBJ_TYPE_IS(c, FIOBJ_T_ARRAY)) {
-      /* Array of Strings */
-      size_t count = fiobj_ary_count(c);
-      for (size_t i = 0; i < count; ++i) {
-        http_parse_cookies_setcookie_str(
-            h->cookies, fiobj_ary_index(c, (int64_t)i), is_url_encoded);
-      }
-    } else {
-      /* single string */
-      http_parse_cookies_setcookie_str(h->cookies, c, is_url_encoded);
-    }
-  }
+  struct http_parse_cookies_s a = {.h = h, .is_url_encoded = is_url_encoded};
+  http_header_each(h, http_parse_cookies_task, &a);
 }
 
 /**
@@ -1926,8 +3243,7 @@ int http_parse_body(http_s *h) {
     return -1;
   if (!content_type_hash)
     content_type_hash = fiobj_hash_string("content-type", 12);
-  FIOBJ ct = fiobj_hash_get2(h->headers, content_type_hash);
-  fio_str_info_s content_type = fiobj_obj2cstr(ct);
+  fio_str_info_s content_type = http_header_get(h, content_type_hash);
   if (content_type.len < 16)
     return -1;
   if (content_type.len >= 33 &&
@@ -1974,17 +3290,576 @@ int http_parse_body(http_s *h) {
   return 0;
 }
 
+/* *****************************************************************************
+Access Log
+***************************************************************************** */
+
+/*
+ * Access log records are formatted by the thread that completed the request
+ * and added to the thread's own log buffer - a single producer / single
+ * consumer ring buffer, so logging a request requires no locks.
+ *
+ * A dedicated writer thread collects the pending data from all the buffers
+ * and writes it using `writev`. Records are dropped (and counted) when a
+ * buffer is full, rather than blocking the thread that handles the request.
+ *
+ * After the writer thread was stopped (during shutdown), records are written
+ * by the thread that logs them.
+ */
+
+typedef struct http_log_buffer_s http_log_buffer_s;
+struct http_log_buffer_s {
+  http_log_buffer_s *next;
+  /* written by the thread that owns the buffer */
+  size_t head;
+  size_t dropped;
+  /* written by the thread that writes the data */
+  size_t tail;
+  /* set when the owner thread exits, the buffer is freed once it's empty */
+  volatile uint8_t orphan;
+  char data[HTTP_LOG_BUFFER_SIZE];
+};
+
+static struct {
+  http_log_buffer_s *buffers;
+  /* the log file's name, or NULL when logging to a file descriptor */
+  char *filename;
+  /* records dropped by buffers that were freed */
+  size_t dropped;
+  size_t dropped_reported;
+  /* incremented after forking, invalidating the parent's buffers */
+  uintptr_t generation;
+  pthread_t writer;
+  int fd;
+  http_log_format_e format;
+  fio_lock_i lock;
+  volatile uint8_t running;
+  volatile uint8_t stopped;
+  volatile uint8_t reopen;
+  uint8_t signal;
+} http_log = {.fd = STDERR_FILENO, .generation = 1};
+
+static __thread http_log_buffer_s *http_log_local;
+static __thread uintptr_t http_log_local_generation;
+static pthread_key_t http_log_key;
+static struct sigaction http_log_old_sighup;
+
+/* the (internal) pub/sub filter used to forward a log reopen to the workers */
+#define HTTP_LOG_REOPEN_FILTER (-4)
+
+/* writes the whole vector, returns -1 on error (the data is discarded). */
+static int http_log_writev(struct iovec *iov, int count) {
+  while (count) {
+    ssize_t w = writev(http_log.fd, iov, count);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pfd = {.fd = http_log.fd, .events = POLLOUT};
+        if (poll(&pfd, 1, 1000) == 1)
+          continue;
+      }
+      return -1;
+    }
+    while (count && (size_t)w >= iov->iov_len) {
+      w -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+/* writes the pending data, returns the number of bytes written. */
+static size_t http_log_flush(void) {
+  struct iovec iov[64];
+  http_log_buffer_s *owner[64];
+  size_t lengths[64];
+  int count = 0;
+  size_t total = 0;
+  fio_lock(&http_log.lock);
+  for (http_log_buffer_s *b = http_log.buffers; b && count < 63; b = b->next) {
+    size_t head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    size_t pos = b->tail & (HTTP_LOG_BUFFER_SIZE - 1);
+    size_t len = head - b->tail;
+    if (!len)
+      continue;
+    if (pos + len > HTTP_LOG_BUFFER_SIZE) {
+      /* the pending data wraps around the end of the buffer */
+      iov[count] = (struct iovec){.iov_base = b->data + pos,
+                                  .iov_len = HTTP_LOG_BUFFER_SIZE - pos};
+      lengths[count] = iov[count].iov_len;
+      owner[count++] = b;
+      len -= HTTP_LOG_BUFFER_SIZE - pos;
+      pos = 0;
+    }
+    iov[count] = (struct iovec){.iov_base = b->data + pos, .iov_len = len};
+    lengths[count] = len;
+    owner[count++] = b;
+  }
+  if (count) {
+    if (http_log_writev(iov, count))
+      FIO_LOG_DEBUG("(http) access log write failed: %s", strerror(errno));
+    for (int i = 0; i < count; ++i) {
+      __atomic_store_n(&owner[i]->tail, owner[i]->tail + lengths[i],
+                       __ATOMIC_RELEASE);
+      total += lengths[i];
+    }
+  }
+  /* free the (empty) buffers of threads that exited */
+  for (http_log_buffer_s **pos = &http_log.buffers; *pos;) {
+    http_log_buffer_s *b = *pos;
+    if (b->orphan && __atomic_load_n(&b->head, __ATOMIC_ACQUIRE) == b->tail) {
+      *pos = b->next;
+      http_log.dropped += b->dropped;
+      fio_free(b);
+      continue;
+    }
+    pos = &b->next;
+  }
+  fio_unlock(&http_log.lock);
+  return total;
+}
+
+/* opens the log file, replacing the log's file descriptor (if it's a file). */
+static int http_log_open(const char *filename) {
+  int fd = open(filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+    return -1;
+  if (!http_log.filename) {
+    http_log.fd = fd;
+    return 0;
+  }
+  /* `dup2` replaces the file descriptor atomically */
+  if (dup2(fd, http_log.fd) == -1) {
+    int old_errno = errno;
+    close(fd);
+    errno = old_errno;
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+/** Reopens the access log file (if any), i.e., after the file was rotated. */
+int http_log_reopen(void) {
+  int ret = 0;
+  http_log.reopen = 0;
+  fio_lock(&http_log.lock);
+  if (http_log.filename && (ret = http_log_open(http_log.filename)))
+    FIO_LOG_ERROR("(http) couldn't reopen the access log %s: %s",
+                  http_log.filename, strerror(errno));
+  fio_unlock(&http_log.lock);
+  return ret;
+}
+
+/*
+ * SIGHUP handler - marks the log file for reopening.
+ *
+ * The signal isn't propagated (Ruby's default handler would stop the process).
+ */
+static void http_log_on_signal(int sig) {
+  http_log.reopen = 1;
+  (void)sig;
+}
+
+/* the root process forwarded a reopen request (see below) */
+static void http_log_on_reopen_message(fio_msg_s *msg) {
+  http_log.reopen = 1;
+  (void)msg;
+}
+
+/*
+ * Reviews the reopen flag. The signal is sent to the root process, which
+ * forwards the request to the workers (without restarting them).
+ */
+static void http_log_review_reopen(void *ignr_) {
+  if (!http_log.reopen)
+    return;
+  if (!fio_is_worker())
+    fio_publish(.engine = FIO_PUBSUB_SIBLINGS,
+                .filter = HTTP_LOG_REOPEN_FILTER);
+  http_log_reopen();
+  (void)ignr_;
+}
+
+/** Sets the access log's output. The default output is `stderr`. */
+int http_log_output(const char *filename, int fd) {
+  if (!filename && fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  fio_lock(&http_log.lock);
+  if (filename) {
+    if (http_log_open(filename)) {
+      fio_unlock(&http_log.lock);
+      return -1;
+    }
+    size_t len = strlen(filename);
+    fio_free(http_log.filename);
+    http_log.filename = fio_malloc(len + 1);
+    FIO_ASSERT_ALLOC(http_log.filename);
+    memcpy(http_log.filename, filename, len + 1);
+  } else {
+    if (http_log.filename) {
+      close(http_log.fd);
+      fio_free(http_log.filename);
+      http_log.filename = NULL;
+    }
+    http_log.fd = fd;
+  }
+  fio_unlock(&http_log.lock);
+  if (filename && !http_log.signal) {
+    /* SIGUSR1 is reserved for hot restarts (which restart the workers) */
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = http_log_on_signal;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    if (!sigaction(SIGHUP, &act, &http_log_old_sighup))
+      http_log.signal = 1;
+  }
+  return 0;
+}
+
+/** Sets the access log's format. */
+void http_log_format(http_log_format_e format) { http_log.format = format; }
+
+/** Returns the number of access log records dropped since the process began. */
+size_t http_log_dropped(void) {
+  fio_lock(&http_log.lock);
+  size_t dropped = http_log.dropped;
+  for (http_log_buffer_s *b = http_log.buffers; b; b = b->next)
+    dropped += __atomic_load_n(&b->dropped, __ATOMIC_RELAXED);
+  fio_unlock(&http_log.lock);
+  return dropped;
+}
+
+/* the access log writer thread */
+static void *http_log_writer(void *ignr_) {
+  time_t reviewed = 0;
+  while (http_log.running) {
+    if (http_log.reopen)
+      http_log_reopen();
+    if (!http_log_flush())
+      fio_throttle_thread(HTTP_LOG_FLUSH_INTERVAL * 1000000UL);
+    if (fio_last_tick().tv_sec != reviewed) {
+      /* report dropped records (at most once a second) */
+      size_t dropped = http_log_dropped();
+      reviewed = fio_last_tick().tv_sec;
+      if (dropped != http_log.dropped_reported) {
+        FIO_LOG_WARNING("(http) %zu access log records dropped (full buffer)",
+                        dropped - http_log.dropped_reported);
+        http_log.dropped_reported = dropped;
+      }
+    }
+  }
+  http_log_flush();
+  return NULL;
+  (void)ignr_;
+}
+
+/* returns the calling thread's log buffer. */
+static http_log_buffer_s *http_log_buffer(void) {
+  if (http_log_local && http_log_local_generation == http_log.generation)
+    return http_log_local;
+  http_log_buffer_s *b = fio_malloc(sizeof(*b));
+  FIO_ASSERT_ALLOC(b);
+  b->head = b->tail = b->dropped = 0;
+  b->orphan = 0;
+  pthread_setspecific(http_log_key, b);
+  fio_lock(&http_log.lock);
+  b->next = http_log.buffers;
+  http_log.buffers = b;
+  if (!http_log.running && !http_log.stopped) {
+    http_log.running = 1;
+    if (pthread_create(&http_log.writer, NULL, http_log_writer, NULL)) {
+      FIO_LOG_ERROR("(http) couldn't spawn the access log thread.");
+      http_log.running = 0;
+      http_log.stopped = 1;
+    }
+  }
+  fio_unlock(&http_log.lock);
+  http_log_local = b;
+  http_log_local_generation = http_log.generation;
+  return b;
+}
+
+/* adds a record to the calling thread's log buffer. */
+static void http_log_push(const char *data, size_t len) {
+  http_log_buffer_s *b = http_log_buffer();
+  size_t tail = __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE);
+  if (len > HTTP_LOG_BUFFER_SIZE - (b->head - tail)) {
+    __atomic_store_n(&b->dropped, b->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+  size_t pos = b->head & (HTTP_LOG_BUFFER_SIZE - 1);
+  if (pos + len > HTTP_LOG_BUFFER_SIZE) {
+    memcpy(b->data + pos, data, HTTP_LOG_BUFFER_SIZE - pos);
+    memcpy(b->data, data + (HTTP_LOG_BUFFER_SIZE - pos),
+           len - (HTTP_LOG_BUFFER_SIZE - pos));
+  } else {
+    memcpy(b->data + pos, data, len);
+  }
+  __atomic_store_n(&b->head, b->head + len, __ATOMIC_RELEASE);
+  if (http_log.stopped)
+    http_log_flush();
+}
+
+/* called when a thread exits. */
+static void http_log_on_thread_exit(void *b) {
+  ((http_log_buffer_s *)b)->orphan = 1;
+}
+
+/* restarts the writer thread (if stopped by a previous cycle). */
+static void http_log_on_start(void *ignr_) {
+  http_log.stopped = 0;
+  fio_subscribe(.filter = HTTP_LOG_REOPEN_FILTER,
+                .on_message = http_log_on_reopen_message);
+  (void)ignr_;
+}
+
+/* the root process reviews the reopen flag (workers might be busy forking) */
+static void http_log_pre_start(void *ignr_) {
+  if (http_log.filename)
+    fio_run_every(250, 0, http_log_review_reopen, NULL, NULL);
+  (void)ignr_;
+}
+
+/* stops the writer thread and writes any pending records. */
+static void http_log_on_finish(void *ignr_) {
+  fio_lock(&http_log.lock);
+  uint8_t running = http_log.running;
+  http_log.running = 0;
+  http_log.stopped = 1;
+  fio_unlock(&http_log.lock);
+  if (running)
+    pthread_join(http_log.writer, NULL);
+  http_log_flush();
+  (void)ignr_;
+}
+
+/* reopens the log file for new workers (hot restart) if it was rotated. */
+static void http_log_before_fork(void *ignr_) {
+  if (http_log.reopen)
+    http_log_reopen();
+  (void)ignr_;
+}
+
+/* the parent's threads (and their log buffers) don't exist in the child. */
+static void http_log_in_child(void *ignr_) {
+  http_log.lock = FIO_LOCK_INIT;
+  while (http_log.buffers) {
+    http_log_buffer_s *b = http_log.buffers;
+    http_log.buffers = b->next;
+    fio_free(b);
+  }
+  http_log.running = 0;
+  ++http_log.generation;
+  http_log_local = NULL;
+  pthread_setspecific(http_log_key, NULL);
+  (void)ignr_;
+}
+
+static void __attribute__((constructor)) http_log_constructor(void) {
+  pthread_key_create(&http_log_key, http_log_on_thread_exit);
+  fio_state_callback_add(FIO_CALL_PRE_START, http_log_pre_start, NULL);
+  fio_state_callback_add(FIO_CALL_ON_START, http_log_on_start, NULL);
+  fio_state_callback_add(FIO_CALL_ON_FINISH, http_log_on_finish, NULL);
+  fio_state_callback_add(FIO_CALL_BEFORE_FORK, http_log_before_fork, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_log_in_child, NULL);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, http_log_on_finish, NULL);
+}
+
+/* a log record being formatted (data is truncated when `pos` reaches `end`) */
+typedef struct {
+  char *pos;
+  char *end;
+} http_log_record_s;
+
+static inline void http_log_write(http_log_record_s *r, const char *data,
+                                  size_t len) {
+  if (len > (size_t)(r->end - r->pos))
+    len = r->end - r->pos;
+  memcpy(r->pos, data, len);
+  r->pos += len;
+}
+
+static inline void http_log_write_obj(http_log_record_s *r, FIOBJ o) {
+  fio_str_info_s s = fiobj_obj2cstr(o);
+  http_log_write(r, s.data, s.len);
+}
+
+static inline void http_log_write_num(http_log_record_s *r, int64_t num) {
+  if (r->end - r->pos >= 24)
+    r->pos += fio_ltoa(r->pos, num, 10);
+}
+
+/*
+ * Writes a JSON String (quoted and escaped).
+ *
+ * Long Strings are truncated within the quotes, leaving room for the following
+ * field names and (empty) Strings, so truncated records remain valid JSON.
+ */
+static void http_log_write_json(http_log_record_s *r, const char *data,
+                                size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  if (r->end - r->pos < 2)
+    return;
+  *(r->pos++) = '"';
+  for (size_t i = 0; i < len && r->end - r->pos > 7 + 48; ++i) {
+    uint8_t c = data[i];
+    if (c == '"' || c == '\\') {
+      r->pos[0] = '\\';
+      r->pos[1] = c;
+      r->pos += 2;
+    } else if (c < 0x20) {
+      memcpy(r->pos, "\\u00", 4);
+      r->pos[4] = hex[c >> 4];
+      r->pos[5] = hex[c & 15];
+      r->pos += 6;
+    } else {
+      *(r->pos++) = c;
+    }
+  }
+  *(r->pos++) = '"';
+}
+
+static inline void http_log_write_json_obj(http_log_record_s *r, FIOBJ o) {
+  fio_str_info_s s = fiobj_obj2cstr(o);
+  http_log_write_json(r, s.data, s.len);
+}
+
+/* writes the (per thread, cached) date of the record */
+static void http_log_write_date(http_log_record_s *r, time_t now) {
+  static __thread time_t sec = 0;
+  static __thread http_log_format_e format = HTTP_LOG_FORMAT_TEXT;
+  static __thread char date[48];
+  static __thread size_t date_len = 0;
+  if (sec != now || format != http_log.format) {
+    sec = now;
+    format = http_log.format;
+    if (format == HTTP_LOG_FORMAT_JSON) {
+      /* ISO 8601, i.e.: 2021-02-28T12:30:00Z */
+      struct tm tm;
+      http_gmtime(now, &tm);
+      char *p = date;
+      p += fio_ltoa(p, tm.tm_year + 1900, 10);
+      *(p++) = '-';
+      *(p++) = '0' + ((tm.tm_mon + 1) / 10);
+      *(p++) = '0' + ((tm.tm_mon + 1) % 10);
+      *(p++) = '-';
+      *(p++) = '0' + (tm.tm_mday / 10);
+      *(p++) = '0' + (tm.tm_mday % 10);
+      *(p++) = 'T';
+      *(p++) = '0' + (tm.tm_hour / 10);
+      *(p++) = '0' + (tm.tm_hour % 10);
+      *(p++) = ':';
+      *(p++) = '0' + (tm.tm_min / 10);
+      *(p++) = '0' + (tm.tm_min % 10);
+      *(p++) = ':';
+      *(p++) = '0' + (tm.tm_sec / 10);
+      *(p++) = '0' + (tm.tm_sec % 10);
+      *(p++) = 'Z';
+      date_len = p - date;
+    } else {
+      date_len = http_time2str(date, now);
+    }
+  }
+  http_log_write(r, date, date_len);
+}
+
 /* *****************************************************************************
 HTTP Helper functions that could be used globally
 ***************************************************************************** */
 
+/* parses a quality value (`q=0.5`), returning 0..1000 */
+static uint16_t http_accept_encoding_q(const char *pos, const char *end) {
+  uint16_t q = 0;
+  if (pos < end && *pos >= '0' && *pos <= '9')
+    q = (*(pos++) - '0') * 1000;
+  if (pos < end && *pos == '.') {
+    ++pos;
+    for (uint16_t m = 100; m && pos < end && *pos >= '0' && *pos <= '9';
+         m /= 10)
+      q += (*(pos++) - '0') * m;
+  }
+  return q > 1000 ? 1000 : q;
+}
+
+/**
+ * Sets the quality value (0..1000) the client assigned to each of the `count`
+ * content encodings in `names`, according to the request's `accept-encoding`
+ * header. `names[0]` must be the identity encoding (`"identity"`).
+ *
+ * Encodings that aren't listed use the `*` quality value (if listed). Otherwise
+ * only the identity encoding is acceptable (with the lowest preference).
+ *
+ * `x-gzip` is treated as `gzip`.
+ */
+void http_accept_encoding(http_s *h, const char *const *names, size_t count,
+                          uint16_t *q) {
+  static uint64_t accept_enc_hash = 0;
+  if (!accept_enc_hash)
+    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
+  fio_str_info_s s = http_header_get(h, accept_enc_hash);
+  int any = -1; /* the quality value for `*` */
+  uint32_t listed = 0;
+  const char *pos = s.data;
+  const char *end = s.data + s.len;
+  while (pos && pos < end) {
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+      ++pos;
+    const char *name = pos;
+    while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ' &&
+           *pos != '\t')
+      ++pos;
+    size_t name_len = pos - name;
+    uint16_t quality = 1000;
+    while (pos < end && *pos != ',') {
+      /* test the parameters for a quality value */
+      if (*(pos++) != ';')
+        continue;
+      while (pos < end && (*pos == ' ' || *pos == '\t'))
+        ++pos;
+      if (end - pos > 2 && (pos[0] | 32) == 'q' && pos[1] == '=')
+        quality = http_accept_encoding_q(pos + 2, end);
+    }
+    if (!name_len)
+      continue;
+    if (name_len == 1 && name[0] == '*') {
+      any = quality;
+      continue;
+    }
+    if (name_len == 6 && !strncasecmp(name, "x-gzip", 6)) {
+      name += 2;
+      name_len = 4;
+    }
+    for (size_t i = 0; i < count && i < 32; ++i) {
+      if (name_len == strlen(names[i]) &&
+          !strncasecmp(name, names[i], name_len)) {
+        q[i] = quality;
+        listed |= ((uint32_t)1 << i);
+      }
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (i >= 32 || !(listed & ((uint32_t)1 << i)))
+      q[i] = any >= 0 ? (uint16_t)any : (i ? 0 : 1);
+  }
+}
+
 /**
  * Returns a String object representing the unparsed HTTP request (HTTP
  * version is capped at HTTP/1.1). Mostly usable for proxy usage and
  * debugging.
  */
 FIOBJ http_req2str(http_s *h) {
-  if (HTTP_INVALID_HANDLE(h) || !fiobj_hash_count(h->headers))
+  if (HTTP_INVALID_HANDLE(h) || !fiobj_hash_count(http_headers(h)))
     return FIOBJ_INVALID;
 
   struct header_writer_s w;
@@ -2028,62 +3903,85 @@ FIOBJ http_req2str(http_s *h) {
 }
 
 void http_write_log(http_s *h) {
-  FIOBJ l = fiobj_str_buf(128);
+  char buf[2048];
+  /* the last 192 bytes are reserved for the status and timing data */
+  http_log_record_s r = {.pos = buf, .end = buf + sizeof(buf) - 192};
 
   intptr_t bytes_sent = fiobj_obj2num(fiobj_hash_get2(
       h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
 
-  struct timespec start, end;
+  struct timespec end;
   clock_gettime(CLOCK_REALTIME, &end);
-  start = h->received_at;
-
-  {
-    // TODO Guess IP address from headers (forwarded) where possible
-    fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
-    fiobj_str_write(l, peer.data, peer.len);
-  }
-  fio_str_info_s buff = fiobj_obj2cstr(l);
-
-  if (buff.len == 0) {
-    memcpy(buff.data, "[unknown]", 9);
-    buff.len = 9;
-  }
-  memcpy(buff.data + buff.len, " - - [", 6);
-  buff.len += 6;
-  fiobj_str_resize(l, buff.len);
-  {
-    FIOBJ date;
-    fio_lock(&date_lock);
-    date = fiobj_dup(current_date);
-    fio_unlock(&date_lock);
-    fiobj_str_join(l, current_date);
-    fiobj_free(date);
-  }
-  fiobj_str_write(l, "] \"", 3);
-  fiobj_str_join(l, h->method);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->path);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->version);
-  fiobj_str_write(l, "\" ", 2);
-  if (bytes_sent > 0) {
-    fiobj_str_write_i(l, h->status);
-    fiobj_str_write(l, " ", 1);
-    fiobj_str_write_i(l, bytes_sent);
-    fiobj_str_write(l, "b ", 2);
+  int64_t total = ((end.tv_sec - h->received_at.tv_sec) * 1000000) +
+                  ((end.tv_nsec - h->received_at.tv_nsec) / 1000);
+
+  // TODO Guess IP address from headers (forwarded) where possible
+  fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
+  if (!peer.len)
+    peer = (fio_str_info_s){.data = (char *)"[unknown]", .len = 9};
+
+  if (http_log.format == HTTP_LOG_FORMAT_JSON) {
+    /* time spent before the request was routed to the `on_request` callback */
+    int64_t wait = total;
+    if (h->private_data.handled_at.tv_sec) {
+      wait = ((h->private_data.handled_at.tv_sec - h->received_at.tv_sec) *
+              1000000) +
+             ((h->private_data.handled_at.tv_nsec - h->received_at.tv_nsec) /
+              1000);
+      if (wait < 0)
+        wait = 0;
+      else if (wait > total)
+        wait = total;
+    }
+    http_log_write(&r, "{\"time\":\"", 9);
+    http_log_write_date(&r, end.tv_sec);
+    http_log_write(&r, "\",\"peer\":", 9);
+    http_log_write_json(&r, peer.data, peer.len);
+    http_log_write(&r, ",\"method\":", 10);
+    http_log_write_json_obj(&r, h->method);
+    http_log_write(&r, ",\"path\":", 8);
+    http_log_write_json_obj(&r, h->path);
+    http_log_write(&r, ",\"version\":", 11);
+    http_log_write_json_obj(&r, h->version);
+    r.end += 192;
+    http_log_write(&r, ",\"status\":", 10);
+    http_log_write_num(&r, h->status);
+    http_log_write(&r, ",\"bytes\":", 9);
+    if (bytes_sent > 0)
+      http_log_write_num(&r, bytes_sent);
+    else
+      http_log_write(&r, "null", 4);
+    http_log_write(&r, ",\"wait_us\":", 11);
+    http_log_write_num(&r, wait);
+    http_log_write(&r, ",\"handler_us\":", 14);
+    http_log_write_num(&r, total - wait);
+    http_log_write(&r, ",\"total_us\":", 12);
+    http_log_write_num(&r, total);
+    http_log_write(&r, "}\n", 2);
   } else {
-    fiobj_str_join(l, fiobj_num_tmp(h->status));
-    fiobj_str_write(l, " -- ", 4);
+    http_log_write(&r, peer.data, peer.len);
+    http_log_write(&r, " - - [", 6);
+    http_log_write_date(&r, end.tv_sec);
+    http_log_write(&r, "] \"", 3);
+    http_log_write_obj(&r, h->method);
+    http_log_write(&r, " ", 1);
+    http_log_write_obj(&r, h->path);
+    http_log_write(&r, " ", 1);
+    http_log_write_obj(&r, h->version);
+    r.end += 192;
+    http_log_write(&r, "\" ", 2);
+    http_log_write_num(&r, h->status);
+    if (bytes_sent > 0) {
+      http_log_write(&r, " ", 1);
+      http_log_write_num(&r, bytes_sent);
+      http_log_write(&r, "b ", 2);
+    } else {
+      http_log_write(&r, " -- ", 4);
+    }
+    http_log_write_num(&r, total / 1000);
+    http_log_write(&r, "ms\r\n", 4);
   }
-
-  bytes_sent = ((end.tv_sec - start.tv_sec) * 1000) +
-               ((end.tv_nsec - start.tv_nsec) / 1000000);
-  fiobj_str_write_i(l, bytes_sent);
-  fiobj_str_write(l, "ms\r\n", 4);
-
-  buff = fiobj_obj2cstr(l);
-  fwrite(buff.data, 1, buff.len, stderr);
-  fiobj_free(l);
+  http_log_push(buf, r.pos - buf);
 }
 
 /**
@@ -2694,5 +4592,7 @@ void http_tests(void) {
   FIO_ASSERT(html_mime,
              "HTML mime-type not found! Mime-Type registry invalid!\n");
   fiobj_free(html_mime);
+  http1_parser_test();
+  http2_test();
 }
 #endif
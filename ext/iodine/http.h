@@ -33,6 +33,14 @@ Compile Time Settings
 #define HTTP_DEFAULT_BODY_LIMIT (1024 * 1024 * 50)
 #endif
 
+#ifndef HTTP_DEFAULT_PIPELINE_LIMIT
+/**
+ * The default maximum number of pipelined HTTP/1.x requests handled in a
+ * single pass (see the `pipeline_limit` setting).
+ */
+#define HTTP_DEFAULT_PIPELINE_LIMIT 8
+#endif
+
 #ifndef HTTP_MAX_HEADER_COUNT
 #define HTTP_MAX_HEADER_COUNT 128
 #endif
@@ -42,6 +50,46 @@ Compile Time Settings
 #define HTTP_MAX_HEADER_LENGTH 8192
 #endif
 
+#ifndef HTTP_FILE_CACHE_LIMIT
+/**
+ * The maximum number of files `http_sendfile2` keeps open (together with their
+ * `etag`, `last-modified` and `content-type` header values) between requests.
+ *
+ * Set to 0 to disable the static file cache.
+ */
+#define HTTP_FILE_CACHE_LIMIT 128
+#endif
+
+#ifndef HTTP_FILE_CACHE_TTL
+/**
+ * The number of seconds a cached file is served before it's revalidated
+ * (using `stat`), so changes to the file system are noticed.
+ */
+#define HTTP_FILE_CACHE_TTL 2
+#endif
+
+#ifndef HTTP_FILE_CACHE_SMALL_FILE
+/**
+ * Cached files up to this size are also kept in memory, as pre-serialized
+ * HTTP/1.1 responses (see the `static_cache_size` setting).
+ */
+#define HTTP_FILE_CACHE_SMALL_FILE (1024 * 64)
+#endif
+
+#ifndef HTTP_DEFAULT_STATIC_CACHE
+/** The default memory limit for small static files kept in memory. */
+#define HTTP_DEFAULT_STATIC_CACHE (1024 * 1024 * 8)
+#endif
+
+#ifndef HTTP_MICRO_CACHE_PASS_TTL
+/**
+ * The number of milliseconds the micro-cache remembers that a response can't be
+ * cached, so requests for the same resource aren't collapsed (each request is
+ * handled by the application).
+ */
+#define HTTP_MICRO_CACHE_PASS_TTL 1000
+#endif
+
 #ifndef FIO_HTTP_EXACT_LOGGING
 /**
  * By default, facil.io logs the HTTP request cycle using a fuzzy starting point
@@ -58,6 +106,22 @@ Compile Time Settings
 #define FIO_HTTP_EXACT_LOGGING 0
 #endif
 
+#ifndef HTTP_LOG_BUFFER_SIZE
+/**
+ * The size of each thread's access log buffer (a power of 2). Log records are
+ * dropped (and counted) when the buffer is full.
+ */
+#define HTTP_LOG_BUFFER_SIZE (1UL << 16)
+#endif
+
+#ifndef HTTP_LOG_FLUSH_INTERVAL
+/**
+ * The number of milliseconds the access log writer thread waits for new log
+ * records when all the buffers are empty.
+ */
+#define HTTP_LOG_FLUSH_INTERVAL 10
+#endif
+
 /** the `http_listen settings, see details in the struct definition. */
 typedef struct http_settings_s http_settings_s;
 
@@ -80,6 +144,14 @@ typedef struct {
     uintptr_t flag;
     /** The response headers, if they weren't sent. Don't access directly. */
     FIOBJ out_headers;
+    /** The request headers, if stored as slices. Don't access directly. */
+    void *hslices;
+    /** The request's (per-connection) arena, if any. Don't access directly. */
+    void *arena;
+    /** When the request was routed (logging only). Don't access directly. */
+    struct timespec handled_at;
+    /** The micro-cache entry the response fills, if any. Don't access. */
+    void *micro_cache;
   } private_data;
   /** a time merker indicating when the request was received. */
   struct timespec received_at;
@@ -99,7 +171,11 @@ typedef struct {
   /** The request query, if any. */
   FIOBJ query;
   /** a hash of general header data. When a header is set multiple times (such
-   * as cookie headers), an Array will be used instead of a String. */
+   * as cookie headers), an Array will be used instead of a String.
+   *
+   * HTTP/1.x requests keep their headers as slices of a connection buffer and
+   * leave this field empty until `http_headers` is called - use
+   * `http_header_get` to read single headers. */
   FIOBJ headers;
   /**
    * a placeholder for a hash of cookie data.
@@ -184,6 +260,38 @@ int http_set_cookie(http_s *h, http_cookie_args_s);
 #define http_set_cookie(http___handle, ...)                                    \
   http_set_cookie((http___handle), (http_cookie_args_s){__VA_ARGS__})
 
+/**
+ * Returns the value of a request header (or a response header, in client
+ * mode), using the (lower case) header name's hash (see `fiobj_hash_string`).
+ *
+ * If the header was received more than once, the last value is returned.
+ *
+ * Returns an empty `fio_str_info_s` (`data == NULL`) if the header is missing.
+ */
+fio_str_info_s http_header_get(http_s *h, uint64_t name_hash);
+
+/** Removes a request header (all of it's values, if it was repeated). */
+void http_header_remove(http_s *h, uint64_t name_hash);
+
+/**
+ * Calls `task` for each request header value, where `index` is the value's
+ * position when a header was received more than once (0 for the first value).
+ *
+ * The loop stops if `task` returns -1. Returns the number of values visited.
+ */
+size_t http_header_each(http_s *h,
+                        int (*task)(fio_str_info_s name, fio_str_info_s value,
+                                    size_t index, void *udata),
+                        void *udata);
+
+/**
+ * Returns the request headers as a Hash (see the `headers` field).
+ *
+ * Headers stored as slices of the connection's buffer are only converted to
+ * FIOBJ objects when this function is called.
+ */
+FIOBJ http_headers(http_s *h);
+
 /**
  * Sends the response headers and body.
  *
@@ -196,6 +304,47 @@ int http_set_cookie(http_s *h, http_cookie_args_s);
  */
 int http_send_body(http_s *h, void *data, uintptr_t length);
 
+/**
+ * Streams a chunk of the response body, sending the response headers with the
+ * first chunk.
+ *
+ * When the `content-length` header wasn't set, HTTP/1.1 responses use the
+ * chunked transfer encoding and HTTP/1.0 responses close the connection once
+ * the response is complete. HTTP/2 responses send the data as DATA frames.
+ *
+ * The data is copied. The response is completed by calling `http_finish`.
+ *
+ * Returns -1 on error (i.e., the connection was lost) and 0 on success.
+ */
+int http_stream(http_s *h, void *data, uintptr_t length);
+
+/**
+ * Returns the number of packets waiting in the connection's outgoing queue (see
+ * `fio_pending`), including DATA frames held back by HTTP/2 flow control.
+ */
+size_t http_pending(http_s *h);
+
+/**
+ * Blocks until no more than `max_pending` packets are waiting in the
+ * connection's outgoing queue (see `http_pending`), writing to the socket while
+ * waiting. HTTP/2 streams also wait for the client's WINDOW_UPDATE frames.
+ *
+ * Meant for threads streaming a large response from within the `on_request`
+ * callback, where the IO reactor can't drain the connection's queue.
+ *
+ * Returns -1 if the connection was lost and 0 on success.
+ */
+int http_stream_wait(http_s *h, size_t max_pending);
+
+/**
+ * Aborts a streaming response (see `http_stream`), so the client can't mistake
+ * the partial response for a complete one: HTTP/1.x connections are closed and
+ * HTTP/2 streams are reset.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+void http_stream_abort(http_s *h);
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -224,6 +373,26 @@ int http_sendfile(http_s *h, int fd, uintptr_t length, uintptr_t offset);
 int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
                    const char *encoded, size_t encoded_len);
 
+/**
+ * Sends the response headers and an open file (the response's body).
+ *
+ * Conditional (`If-None-Match`, `If-Range`) and `Range` requests are handled
+ * the same way `http_sendfile2` handles them (for 200 OK responses), except
+ * that `etag`, `last-modified` and `content-type` headers that were already set
+ * are preserved and no `cache-control` header is added. The `filename`
+ * (optional) is only used to guess the `content-type` when missing.
+ *
+ * The file is closed automatically.
+ *
+ * Returns 0 on success. A success value WILL CONSUME the `http_s` handle (it
+ * will become invalid).
+ *
+ * Returns -1 on error, i.e., if `fd` isn't a regular file (The `http_s` handle
+ * should still be used).
+ */
+int http_sendfile_fd(http_s *h, int fd, const char *filename,
+                     size_t filename_len);
+
 /**
  * Sends an HTTP error response.
  *
@@ -357,6 +526,57 @@ struct http_settings_s {
    * Defaults to ~ 50Mb.
    */
   size_t max_body_size;
+  /**
+   * The maximum number of pipelined HTTP/1.x requests handled in a single pass
+   * before other connections are served.
+   *
+   * The responses to the requests handled in a single pass are coalesced (see
+   * `fio_cork`) and sent together, using a single system call when possible.
+   *
+   * Defaults to `HTTP_DEFAULT_PIPELINE_LIMIT` (8).
+   */
+  size_t pipeline_limit;
+  /**
+   * The memory limit (in bytes) for small static files (up to
+   * `HTTP_FILE_CACHE_SMALL_FILE` bytes) kept in memory as pre-serialized
+   * responses, so they're sent without building the response headers or
+   * reading the file.
+   *
+   * The memory is shared by all the HTTP services in the process. Each service
+   * stops adding files once the memory used reaches its limit.
+   *
+   * Defaults to `HTTP_DEFAULT_STATIC_CACHE` (8Mb). Set to a negative value to
+   * disable.
+   */
+  intptr_t static_cache_size;
+  /**
+   * The memory limit (in bytes) for the micro-cache, which keeps dynamic
+   * responses to `GET` requests as pre-serialized HTTP/1.1 responses, for the
+   * number of seconds set by the response's `Cache-Control: s-maxage`
+   * directive.
+   *
+   * Responses are keyed by the method, host, path, query and the request
+   * headers listed in `micro_cache_vary`. Responses that set cookies, are
+   * `private` / `no-store` / `no-cache` or vary by other headers aren't cached
+   * and a single response is limited to a quarter of the memory limit.
+   *
+   * While a response is produced, identical requests wait for it (request
+   * collapsing), so the `on_request` callback is called once. Streamed
+   * responses, files and upgrades aren't cached and release the waiting
+   * requests once they start.
+   *
+   * The limit includes the entries (and their keys), not only the responses.
+   *
+   * Defaults to 0 (disabled).
+   */
+  intptr_t micro_cache_size;
+  /**
+   * A comma separated list of request header names (i.e.,
+   * `"accept-language, x-tenant"`) added to the micro-cache key.
+   *
+   * The `accept-encoding` header is always part of the key.
+   */
+  const char *micro_cache_vary;
   /**
    * The maximum number of clients that are allowed to connect concurrently.
    *
@@ -403,6 +623,12 @@ struct http_settings_s {
   uint8_t log;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
+  /**
+   * Per-worker `SO_REUSEPORT` listening sockets (see `fio_listen_args`).
+   *
+   * Ignored by `http_connect`.
+   */
+  uint8_t reuse_port;
 };
 
 /**
@@ -856,6 +1082,56 @@ FIOBJ http_mimetype_find2(FIOBJ url);
 /** Clears the Mime-Type registry (it will be empty after this call). */
 void http_mimetype_clear(void);
 
+/* *****************************************************************************
+Static File Cache
+***************************************************************************** */
+
+/** Static file cache statistics, see `http_file_cache_stats`. */
+typedef struct {
+  /** The number of times a cached file was used by `http_sendfile2`. */
+  size_t hits;
+  /** The number of times a file had to be opened (or wasn't found). */
+  size_t misses;
+  /** The number of files currently cached. */
+  size_t count;
+  /** The number of hits served using a pre-serialized response. */
+  size_t memory_hits;
+  /** The memory used by pre-serialized responses (in bytes). */
+  size_t memory;
+} http_file_cache_stats_s;
+
+/** Returns the static file cache statistics (for the current process). */
+http_file_cache_stats_s http_file_cache_stats(void);
+
+/**
+ * Clears the static file cache (closing any files that aren't being sent).
+ */
+void http_file_cache_clear(void);
+
+/* *****************************************************************************
+Micro-Cache (dynamic responses)
+***************************************************************************** */
+
+/** Micro-cache statistics, see `http_micro_cache_stats`. */
+typedef struct {
+  /** The number of requests answered with a cached response. */
+  size_t hits;
+  /** The number of requests handled by the application (and cached). */
+  size_t misses;
+  /** The number of requests that waited for an identical request. */
+  size_t collapsed;
+  /** The number of entries currently cached (including pending entries). */
+  size_t count;
+  /** The memory used by cached responses and entries (in bytes). */
+  size_t memory;
+} http_micro_cache_stats_s;
+
+/** Returns the micro-cache statistics (for the current process). */
+http_micro_cache_stats_s http_micro_cache_stats(void);
+
+/** Clears the micro-cache (pending entries are kept). */
+void http_micro_cache_clear(void);
+
 /* *****************************************************************************
 Commonly used headers (fiobj Symbol objects)
 ***************************************************************************** */
@@ -887,11 +1163,89 @@ HTTP General Helper functions that could be used globally
 FIOBJ http_req2str(http_s *h);
 
 /**
- * Writes a log line to `stderr` about the request / response object.
+ * Writes a log line about the request / response object to the access log (see
+ * `http_log_output`).
+ *
+ * The record is added to the calling thread's log buffer and written by the
+ * access log writer thread. If the buffer is full, the record is dropped.
  *
  * This function is called automatically if the `.log` setting is enabled.
  */
 void http_write_log(http_s *h);
+
+/** The access log formats (see `http_log_format`). */
+typedef enum {
+  /** A line of text per request (the default format). */
+  HTTP_LOG_FORMAT_TEXT = 0,
+  /**
+   * A JSON object per request, including the time spent before and after the
+   * request was routed to the `on_request` callback (in microseconds).
+   */
+  HTTP_LOG_FORMAT_JSON = 1,
+} http_log_format_e;
+
+/**
+ * Sets the access log's output. The default output is `stderr`.
+ *
+ * If `filename` isn't NULL, the file is opened for appending (and created if
+ * missing). The file is reopened when the (root) process receives a SIGHUP
+ * signal (or when `http_log_reopen` is called), allowing for log rotation. The
+ * root process forwards the request to the workers, which aren't restarted.
+ *
+ * Otherwise, the log is written to the file descriptor `fd`, which should
+ * remain open for as long as it's used.
+ *
+ * Returns -1 on error (errno is set), keeping the previous output.
+ */
+int http_log_output(const char *filename, int fd);
+
+/** Sets the access log's format. */
+void http_log_format(http_log_format_e format);
+
+/**
+ * Reopens the access log file (if any), i.e., after the file was rotated.
+ *
+ * Returns -1 on error (errno is set), keeping the previous file descriptor.
+ */
+int http_log_reopen(void);
+
+/** Returns the number of access log records dropped since the process began. */
+size_t http_log_dropped(void);
+
+/* *****************************************************************************
+Request Arena Statistics
+***************************************************************************** */
+
+/**
+ * Request scoped data (i.e., the request's method, path, query and version)
+ * is allocated from a per-connection arena that's emptied once the request is
+ * finished, instead of using an allocation per object.
+ */
+typedef struct {
+  /** The number of requests that used the arena. */
+  size_t requests;
+  /** The number of arena allocations (previously heap allocations). */
+  size_t allocations;
+  /** The number of bytes allocated from the arena. */
+  size_t bytes;
+  /** The number of heap allocations (overflow pages) made by the arenas. */
+  size_t pages;
+} http_arena_stats_s;
+
+/** Returns the process's request arena statistics. */
+http_arena_stats_s http_arena_stats(void);
+
+/**
+ * Sets the quality value (0..1000) the client assigned to each of the `count`
+ * content encodings in `names` (i.e., `"gzip"`), according to the request's
+ * `accept-encoding` header. `names[0]` must be the identity encoding
+ * (`"identity"`).
+ *
+ * Encodings that aren't listed use the `*` quality value (if listed). Otherwise
+ * only the identity encoding is acceptable (with the lowest preference).
+ */
+void http_accept_encoding(http_s *h, const char *const *names, size_t count,
+                          uint16_t *q);
 /* *****************************************************************************
 HTTP Time related helper functions that could be used globally
 ***************************************************************************** */
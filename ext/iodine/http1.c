@@ -6,6 +6,7 @@ License: MIT
 
 #include <http1.h>
 #include <http1_parser.h>
+#include <http2.h>
 #include <http_internal.h>
 #include <websockets.h>
 
@@ -22,12 +23,15 @@ typedef struct http1pr_s {
   http_fio_protocol_s p;
   http1_parser_s parser;
   http_s request;
+  http_hslices_s *hslices;
+  http_arena_s *arena;
   uintptr_t buf_len;
   uintptr_t max_header_size;
   uintptr_t header_size;
   uint8_t close;
   uint8_t is_client;
   uint8_t stop;
+  uint8_t stream; /* 1 == streaming raw data, 2 == chunked encoding */
   uint8_t buf[];
 } http1pr_s;
 
@@ -120,10 +124,9 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
       if (t.data[0] == 'c' || t.data[0] == 'C')
         p->close = 1;
     } else {
-      tmp = fiobj_hash_get2(h->headers, connection_hash);
-      if (tmp) {
-        t = fiobj_obj2cstr(tmp);
-        if (!t.data || !t.len || t.data[0] == 'k' || t.data[0] == 'K')
+      t = http_header_get(h, connection_hash);
+      if (t.data) {
+        if (!t.len || t.data[0] == 'k' || t.data[0] == 'K')
           fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
         else {
           fiobj_str_write(w.dest, "connection:close\r\n", 18);
@@ -157,11 +160,11 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
     static uint64_t host_hash;
     if (!host_hash)
       host_hash = fiobj_hash_string("host", 4);
-    FIOBJ tmp;
+    fio_str_info_s tmp;
     if (!fiobj_hash_get2(h->private_data.out_headers, host_hash) &&
-        (tmp = fiobj_hash_get2(h->headers, host_hash))) {
+        (tmp = http_header_get(h, host_hash)).data) {
       fiobj_str_write(w.dest, "host:", 5);
-      fiobj_str_join(w.dest, tmp);
+      fiobj_str_write(w.dest, tmp.data, tmp.len);
       fiobj_str_write(w.dest, "\r\n", 2);
     }
     if (!fiobj_hash_get2(h->private_data.out_headers, connection_hash))
@@ -191,7 +194,7 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
                           uintptr_t offset) {
   FIOBJ packet = headers2str(h, 0);
   if (!packet) {
-    close(fd);
+    http_sendfile_close(fd);
     http1_after_finish(h);
     return -1;
   }
@@ -202,25 +205,130 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
     s = fiobj_obj2cstr(packet);
     intptr_t i = pread(fd, s.data + s.len, length, offset);
     if (i < 0) {
-      close(fd);
+      http_sendfile_close(fd);
       fiobj_send_free((handle2pr(h)->p.uuid), packet);
       fio_close((handle2pr(h)->p.uuid));
       return -1;
     }
-    close(fd);
+    http_sendfile_close(fd);
     fiobj_str_resize(packet, s.len + i);
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
     http1_after_finish(h);
     return 0;
   }
   fiobj_send_free((handle2pr(h)->p.uuid), packet);
-  fio_sendfile((handle2pr(h)->p.uuid), fd, offset, length);
+  fio_write2((handle2pr(h)->p.uuid), .data.fd = fd, .length = length,
+             .offset = offset, .is_fd = 1, .after.close = http_sendfile_close);
   http1_after_finish(h);
   return 0;
 }
 
+/* tests if the connection is kept alive when the response doesn't set the
+ * `connection` header (as pre-serialized responses require). */
+static int http1_is_keep_alive(http_s *h) {
+  static uintptr_t connection_hash;
+  if (!connection_hash)
+    connection_hash = fiobj_hash_string("connection", 10);
+  http1pr_s *p = handle2pr(h);
+  if (p->is_client || p->close)
+    return 0;
+  fio_str_info_s t = http_header_get(h, connection_hash);
+  if (t.data)
+    return (!t.len || t.data[0] == 'k' || t.data[0] == 'K');
+  t = fiobj_obj2cstr(h->version);
+  return (t.len > 7 && t.data && t.data[5] == '1' && t.data[6] == '.' &&
+          t.data[7] == '1');
+}
+
+/** Should serialize the existing headers, leaving room for the body */
+static FIOBJ http1_prepare(http_s *h, uintptr_t length) {
+  if (!http1_is_keep_alive(h))
+    return FIOBJ_INVALID;
+  return headers2str(h, length);
+}
+
+/** Should send a pre-serialized response */
+static int http1_send_prepared(http_s *h, FIOBJ packet) {
+  if (!http1_is_keep_alive(h))
+    return -1;
+  fiobj_send_free((handle2pr(h)->p.uuid), packet);
+  http1_after_finish(h);
+  return 0;
+}
+
+/** Should send existing headers and data and prepare for streaming */
+static int http1_stream(http_s *h, void *data, uintptr_t length) {
+  http1pr_s *p = handle2pr(h);
+  FIOBJ packet;
+  if (!p->stream) {
+    static uint64_t content_length_hash;
+    if (!content_length_hash)
+      content_length_hash = fiobj_hash_string("content-length", 14);
+    p->stream = 1;
+    if (!fiobj_hash_get2(h->private_data.out_headers, content_length_hash)) {
+      /* unknown length - chunked encoding requires HTTP/1.1 */
+      fio_str_info_s v = fiobj_obj2cstr(h->version);
+      if (v.len > 7 && v.data && v.data[5] == '1' && v.data[6] == '.' &&
+          v.data[7] == '1') {
+        http_set_header2(
+            h,
+            (fio_str_info_s){.data = (char *)"transfer-encoding", .len = 17},
+            (fio_str_info_s){.data = (char *)"chunked", .len = 7});
+        p->stream = 2;
+      } else {
+        /* the body ends when the connection closes */
+        http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_str_new("close", 5));
+      }
+    }
+    packet = headers2str(h, length + 20);
+    if (!packet) {
+      p->stream = 0;
+      return -1;
+    }
+  } else {
+    packet = fiobj_str_buf(length + 20);
+  }
+  if (p->stream == 2) {
+    /* the chunk's length, in hex (`fio_ltoa` adds a "0x" prefix) */
+    char head[20];
+    size_t i = 18;
+    uintptr_t n = length;
+    head[18] = '\r';
+    head[19] = '\n';
+    do {
+      head[--i] = "0123456789ABCDEF"[n & 15];
+      n >>= 4;
+    } while (n);
+    fiobj_str_write(packet, head + i, 20 - i);
+    fiobj_str_write(packet, data, length);
+    fiobj_str_write(packet, "\r\n", 2);
+  } else {
+    fiobj_str_write(packet, data, length);
+  }
+  fiobj_send_free(p->p.uuid, packet);
+  /* streamed data isn't held back until the pipelined requests are handled */
+  fio_uncork(p->p.uuid);
+  return 0;
+}
+
+/** Should abort streaming (a complete response would end the chunked body) */
+static void http1_stream_abort(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  p->stream = 0;
+  p->close = 1;
+  http1_after_finish(h);
+}
+
 /** Should send existing headers or complete streaming */
 static void htt1p_finish(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (p->stream) {
+    if (p->stream == 2)
+      fio_write(p->p.uuid, "0\r\n\r\n", 5);
+    p->stream = 0;
+    http1_after_finish(h);
+    return;
+  }
   FIOBJ packet = headers2str(h, 0);
   if (packet)
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
@@ -280,6 +388,8 @@ static intptr_t http1_hijack(http_s *h, fio_str_info_s *leftover) {
 
   handle2pr(h)->stop = 3;
   intptr_t uuid = handle2pr(h)->p.uuid;
+  /* previous responses must be sent before the socket is written directly */
+  fio_uncork(uuid);
   fio_attach(uuid, NULL);
   return uuid;
 }
@@ -330,22 +440,18 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   if (!sec_key)
     sec_key = fiobj_hash_string("sec-websocket-key", 17);
 
-  FIOBJ tmp = fiobj_hash_get2(h->headers, sec_version);
-  if (!tmp)
-    goto bad_request;
-  fio_str_info_s stmp = fiobj_obj2cstr(tmp);
+  fio_str_info_s stmp = http_header_get(h, sec_version);
   if (stmp.len != 2 || stmp.data[0] != '1' || stmp.data[1] != '3')
     goto bad_request;
 
-  tmp = fiobj_hash_get2(h->headers, sec_key);
-  if (!tmp)
+  stmp = http_header_get(h, sec_key);
+  if (!stmp.data)
     goto bad_request;
-  stmp = fiobj_obj2cstr(tmp);
 
   fio_sha1_s sha1 = fio_sha1_init();
   fio_sha1_write(&sha1, stmp.data, stmp.len);
   fio_sha1_write(&sha1, ws_key_accpt_str, sizeof(ws_key_accpt_str) - 1);
-  tmp = fiobj_str_buf(32);
+  FIOBJ tmp = fiobj_str_buf(32);
   stmp = fiobj_obj2cstr(tmp);
   fiobj_str_resize(tmp,
                    fio_base64_encode(stmp.data, fio_sha1_result(&sha1), 20));
@@ -529,6 +635,8 @@ Virtual Table Decleration
 struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
     .http_sendfile = http1_sendfile,
+    .http_stream = http1_stream,
+    .http_stream_abort = http1_stream_abort,
     .http_finish = htt1p_finish,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
@@ -539,6 +647,8 @@ struct http_vtable_s HTTP1_VTABLE = {
     .http_upgrade2sse = http1_upgrade2sse,
     .http_sse_write = http1_sse_write,
     .http_sse_close = http1_sse_close,
+    .http_prepare = http1_prepare,
+    .http_send_prepared = http1_send_prepared,
 };
 
 void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
@@ -569,7 +679,7 @@ static int http1_on_response(http1_parser_s *parser) {
 static int http1_on_method(http1_parser_s *parser, char *method,
                            size_t method_len) {
   http1_pr2handle(parser2http(parser)).method =
-      fiobj_str_new(method, method_len);
+      http_arena_str(parser2http(parser)->arena, method, method_len);
   parser2http(parser)->header_size += method_len;
   return 0;
 }
@@ -587,20 +697,23 @@ static int http1_on_status(http1_parser_s *parser, size_t status,
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_path(http1_parser_s *parser, char *path, size_t len) {
-  http1_pr2handle(parser2http(parser)).path = fiobj_str_new(path, len);
+  http1_pr2handle(parser2http(parser)).path =
+      http_arena_str(parser2http(parser)->arena, path, len);
   parser2http(parser)->header_size += len;
   return 0;
 }
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_query(http1_parser_s *parser, char *query, size_t len) {
-  http1_pr2handle(parser2http(parser)).query = fiobj_str_new(query, len);
+  http1_pr2handle(parser2http(parser)).query =
+      http_arena_str(parser2http(parser)->arena, query, len);
   parser2http(parser)->header_size += len;
   return 0;
 }
 /** called when a the HTTP/1.x version is parsed. */
 static int http1_on_version(http1_parser_s *parser, char *version, size_t len) {
-  http1_pr2handle(parser2http(parser)).version = fiobj_str_new(version, len);
+  http1_pr2handle(parser2http(parser)).version =
+      http_arena_str(parser2http(parser)->arena, version, len);
   parser2http(parser)->header_size += len;
 /* start counting - occurs on the first line of both requests and responses */
 #if FIO_HTTP_EXACT_LOGGING
@@ -614,31 +727,33 @@ static int http1_on_version(http1_parser_s *parser, char *version, size_t len) {
 /** called when a header is parsed. */
 static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
                            char *data, size_t data_len) {
-  FIOBJ sym;
-  FIOBJ obj;
-  if (!http1_pr2handle(parser2http(parser)).headers) {
+  http1pr_s *p = parser2http(parser);
+  http_s *h = &http1_pr2handle(p);
+  if (!h->headers && !h->private_data.hslices) {
     FIO_LOG_ERROR("(http1 parse ordering error) missing HashMap for header "
                   "%s: %s",
                   name, data);
-    http_send_error2(500, parser2http(parser)->p.uuid,
-                     parser2http(parser)->p.settings);
+    http_send_error2(500, p->p.uuid, p->p.settings);
     return -1;
   }
-  parser2http(parser)->header_size += name_len + data_len;
-  if (parser2http(parser)->header_size >=
-          parser2http(parser)->max_header_size ||
-      fiobj_hash_count(http1_pr2handle(parser2http(parser)).headers) >
-          HTTP_MAX_HEADER_COUNT) {
-    if (parser2http(parser)->p.settings->log) {
+  p->header_size += name_len + data_len;
+  if (p->header_size >= p->max_header_size ||
+      (h->headers ? (fiobj_hash_count(h->headers) > HTTP_MAX_HEADER_COUNT)
+                  : http_hslices_add(p->hslices, name, name_len, data,
+                                     data_len))) {
+    if (p->p.settings->log) {
       FIO_LOG_WARNING("(HTTP) security alert - header flood detected.");
     }
-    http_send_error(&http1_pr2handle(parser2http(parser)), 413);
+    http_send_error(h, 413);
     return -1;
   }
-  sym = fiobj_str_new(name, name_len);
-  obj = fiobj_str_new(data, data_len);
-  set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
-  fiobj_free(sym);
+  if (h->headers) {
+    /* a handle that was created with a Hash (i.e., the client's request) */
+    FIOBJ sym = fiobj_str_new(name, name_len);
+    FIOBJ obj = fiobj_str_new(data, data_len);
+    set_header_add(h->headers, sym, obj);
+    fiobj_free(sym);
+  }
   return 0;
 }
 /** called when a body chunk is parsed. */
@@ -682,14 +797,17 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   }
   ssize_t i = 0;
   size_t org_len = p->buf_len;
-  int pipeline_limit = 8;
+  size_t pipeline_limit = p->p.settings->pipeline_limit;
   if (!p->buf_len)
     return;
+  /* coalesce the responses to pipelined requests (see `http1_stream`) */
+  fio_cork(uuid);
   do {
     i = http1_parse(&p->parser, p->buf + (org_len - p->buf_len), p->buf_len);
     p->buf_len -= i;
     --pipeline_limit;
   } while (i && p->buf_len && pipeline_limit && !p->stop);
+  fio_uncork(uuid);
 
   if (p->buf_len && org_len != p->buf_len) {
     memmove(p->buf, p->buf + (org_len - p->buf_len), p->buf_len);
@@ -766,8 +884,11 @@ static void http1_on_data_first_time(intptr_t uuid, fio_protocol_s *protocol) {
   /* ensure future reads skip this first time HTTP/2.0 test */
   p->p.protocol.on_data = http1_on_data;
   if (i >= 24 && !memcmp(p->buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24)) {
-    FIO_LOG_WARNING("client claimed unsupported HTTP/2 prior knowledge.");
-    fio_close(uuid);
+    /* h2c with prior knowledge, hand over the data read so far */
+    if (p->is_client || !http2_new(uuid, p->p.settings, p->buf, p->buf_len)) {
+      FIO_LOG_WARNING("client claimed unsupported HTTP/2 prior knowledge.");
+      fio_close(uuid);
+    }
     return;
   }
 
@@ -801,7 +922,9 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
       .max_header_size = settings->max_header_size,
       .is_client = settings->is_client,
   };
-  http_s_new(&p->request, &p->p, &HTTP1_VTABLE);
+  p->hslices = http_hslices_new();
+  p->arena = http_arena_new();
+  http_s_new2(&p->request, &p->p, &HTTP1_VTABLE, p->hslices, p->arena);
   if (unread_data && unread_length <= HTTP_MAX_HEADER_LENGTH) {
     memcpy(p->buf, unread_data, unread_length);
     p->buf_len = unread_length;
@@ -818,6 +941,8 @@ void http1_destroy(fio_protocol_s *pr) {
   http1pr_s *p = (http1pr_s *)pr;
   http1_pr2handle(p).status = 0;
   http_s_destroy(&http1_pr2handle(p), 0);
+  http_hslices_free(p->hslices);
+  http_arena_free(p->arena);
   // FIO_LOG_DEBUG("Deallocating HTTP/1.1 protocol %p(%d)=>%p", (void
   // *)p->p.uuid, (int)fio_uuid2fd(p->p.uuid), (void *)p);
   fio_free(p);
@@ -909,3 +1034,252 @@ static fio_str_info_s http1pr_status2str(uintptr_t status) {
   return ret;
 }
 #undef HTTP_SET_STATUS_STR
+
+/* *****************************************************************************
+Parser Tests
+***************************************************************************** */
+#if DEBUG
+
+/* a typical set of browser request headers (similar to bin/env_bench.rb) */
+static const char http1_test_headers_browser[] =
+    "Host: localhost:3000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 "
+    "Firefox/120.0\r\n"
+    "Accept: "
+    "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://localhost/products\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: _session_id=b6a6fa3f0c5e4b7e; theme=dark\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "DNT: 1\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "If-None-Match: W/\"5e4b7e\"\r\n"
+    "X-Request-Id: 6f1c2a9d-8a43-4f1b-9b0e-3d2c1e5a7b90\r\n"
+    "X-Forwarded-For: 203.0.113.7\r\n"
+    "X-Forwarded-Proto: http\r\n"
+    "X-Custom-Tracking: abc123\r\n";
+
+/* an API client behind a proxy (few, long, headers) */
+static const char http1_test_headers_api[] =
+    "host: api.example.com\r\n"
+    "authorization: Bearer "
+    "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJzdWIiOiIxMjM0NTY3ODkwIiwibmFtZSI6"
+    "IkpvaG4gRG9lIiwiaWF0IjoxNTE2MjM5MDIyfQ.SflKxwRJSMeKKF2QT4fwpMeJf36POk6yJV"
+    "_adQssw5c\r\n"
+    "content-type: application/json; charset=utf-8\r\n"
+    "accept: application/json\r\n"
+    "x-amzn-trace-id: "
+    "Root=1-5e1b4151-5ac6c58dc39a5a9a2d1f3f7b;Parent=53995c3f42cd8ad8;"
+    "Sampled=1\r\n"
+    "x-forwarded-for: 203.0.113.7, 198.51.100.17, 192.0.2.60\r\n"
+    "content-length: 2\r\n";
+
+typedef uint8_t (*http1_test_seek_header_fn)(uint8_t **, uint8_t *const,
+                                             uint8_t **);
+
+/* scans all the header lines in a buffer, returning the valid header count */
+static size_t http1_test_scan(http1_test_seek_header_fn seek, uint8_t *buf,
+                              size_t len) {
+  uint8_t *pos = buf;
+  uint8_t *const limit = buf + len;
+  uint8_t *end_name;
+  size_t count = 0;
+  while (pos < limit && seek(&pos, limit, &end_name)) {
+    count += (end_name != NULL);
+    ++pos;
+  }
+  return count;
+}
+
+/* compares a scanner to the scalar scanner, using the same input */
+static void http1_test_compare(http1_test_seek_header_fn seek,
+                               const char *name, const uint8_t *line,
+                               size_t len) {
+  uint8_t expected[192];
+  uint8_t result[192];
+  uint8_t *pos[2] = {expected + 1, result + 1};
+  uint8_t *end_name[2] = {NULL, NULL};
+  uint8_t ret[2];
+  FIO_ASSERT(len + 1 <= sizeof(expected), "test line too long");
+  /* a byte before the line is required by the EOL test (`\r\n`) */
+  expected[0] = result[0] = '\n';
+  memcpy(expected + 1, line, len);
+  memcpy(result + 1, line, len);
+  ret[0] = http1_seek_header_scalar(pos, expected + 1 + len, end_name);
+  ret[1] = seek(pos + 1, result + 1 + len, end_name + 1);
+  FIO_ASSERT(ret[0] == ret[1], "HTTP/1.x %s scanner EOL error (%d != %d): %.*s",
+             name, (int)ret[1], (int)ret[0], (int)len, line);
+  if (!ret[0])
+    return;
+  FIO_ASSERT(pos[0] - expected == pos[1] - result,
+             "HTTP/1.x %s scanner EOL position error: %.*s", name, (int)len,
+             line);
+  FIO_ASSERT((end_name[0] ? end_name[0] - expected : 0) ==
+                 (end_name[1] ? end_name[1] - result : 0),
+             "HTTP/1.x %s scanner header name error: %.*s", name, (int)len,
+             line);
+  /* invalid lines are rejected, the name's case doesn't matter */
+  FIO_ASSERT(!end_name[0] || !memcmp(expected, result, len + 1),
+             "HTTP/1.x %s scanner lowercase error: %.*s", name, (int)len,
+             line);
+}
+
+FIO_FUNC void http1_parser_speed_test(http1_test_seek_header_fn seek,
+                                      const char *name, const char *headers,
+                                      size_t len) {
+  uint8_t buffer[1024];
+  size_t count = 0;
+  FIO_ASSERT(len <= sizeof(buffer), "test headers too long");
+  memcpy(buffer, headers, len);
+  /* warmup */
+  for (size_t i = 0; i < 4; i++) {
+    count += http1_test_scan(seek, buffer, len);
+  }
+  /* loop until test runs for more than 2 seconds */
+  for (uint64_t cycles = 8192;;) {
+    clock_t start, end;
+    start = clock();
+    for (size_t i = cycles; i > 0; i--) {
+      count += http1_test_scan(seek, buffer, len);
+      __asm__ volatile("" ::: "memory");
+    }
+    end = clock();
+    if ((end - start) >= (2 * CLOCKS_PER_SEC) ||
+        cycles >= ((uint64_t)1 << 62)) {
+      fprintf(stderr, "%-28s %8.2f MB/s (%.2f ns per header block)\n", name,
+              (double)(len * cycles) /
+                  (((end - start) * 1000000.0 / CLOCKS_PER_SEC)),
+              ((end - start) * 1000000000.0 / CLOCKS_PER_SEC) / cycles);
+      break;
+    }
+    cycles <<= 2;
+  }
+  FIO_ASSERT(count, "HTTP/1.x speed test scanned no headers");
+}
+
+void http1_parser_test(void) {
+  struct {
+    http1_test_seek_header_fn seek;
+    const char *name;
+  } scanners[3] = {{http1_seek_header_scalar, "scalar"}};
+  size_t scanner_count = 1;
+#if HTTP1_PARSER_SIMD
+  switch (http1_simd_level()) {
+  case 2:
+    scanners[scanner_count++].seek = http1_seek_header_avx2;
+    scanners[scanner_count - 1].name = "AVX2";
+  /* fallthrough */
+  case 1:
+    scanners[scanner_count++].seek = http1_seek_header_sse42;
+    scanners[scanner_count - 1].name = "SSE4.2";
+  }
+#endif
+  fprintf(stderr, "=== Testing HTTP/1.x header scanners (%zu available)\n",
+          scanner_count);
+  {
+    /* known results */
+    uint8_t line[] = "X-Forwarded-FOR: 203.0.113.7\r\nnext";
+    uint8_t *pos = line;
+    uint8_t *end_name = NULL;
+    for (size_t i = 0; i < scanner_count; ++i) {
+      memcpy(line, "X-Forwarded-FOR", 15);
+      pos = line;
+      FIO_ASSERT(scanners[i].seek(&pos, line + sizeof(line) - 1, &end_name) ==
+                         2 &&
+                     pos == line + 29 && end_name == line + 15 &&
+                     !memcmp(line, "x-forwarded-for:", 16),
+                 "HTTP/1.x %s scanner failed a simple header line",
+                 scanners[i].name);
+    }
+  }
+  {
+    /* compare every scanner to the scalar scanner (block boundaries) */
+    const char *invalid = " \t\r\"(),/;<=>?@[\\]{}\x7F\x80\xFF";
+    const char *name_chars = "AbCdE-fGh_IjK.lMn0O1p!Q#r$S%t&U'v*W+x^Y`z|~";
+    uint8_t line[160];
+    for (size_t i = 1; i < scanner_count; ++i) {
+      for (size_t name_len = 0; name_len < 72; ++name_len) {
+        for (size_t n = 0; n < name_len; ++n)
+          line[n] = name_chars[n % 44];
+        for (size_t value_len = 0; value_len < 72; ++value_len) {
+          size_t len = name_len;
+          line[len++] = ':';
+          for (size_t v = 0; v < value_len; ++v)
+            line[len++] = "Value: With a COLON "[v % 20];
+          line[len++] = '\r';
+          line[len++] = '\n';
+          memcpy(line + len, "Next: header\r\n", 14);
+          /* complete lines, incomplete lines and lines without a CR */
+          http1_test_compare(scanners[i].seek, scanners[i].name, line,
+                             len + 14);
+          http1_test_compare(scanners[i].seek, scanners[i].name, line, len);
+          http1_test_compare(scanners[i].seek, scanners[i].name, line,
+                             len - 1);
+          line[len - 2] = '\n';
+          http1_test_compare(scanners[i].seek, scanners[i].name, line,
+                             len - 1);
+          line[len - 2] = '\r';
+          /* missing colon */
+          line[name_len] = '-';
+          http1_test_compare(scanners[i].seek, scanners[i].name, line,
+                             len + 14);
+          line[name_len] = ':';
+        }
+        /* invalid header name characters */
+        for (size_t pos = 0; pos < name_len; ++pos) {
+          for (const char *c = invalid; *c; ++c) {
+            line[pos] = *c;
+            memcpy(line + name_len, ": value\r\n", 9);
+            http1_test_compare(scanners[i].seek, scanners[i].name, line,
+                               name_len + 9);
+          }
+          line[pos] = name_chars[pos % 44];
+        }
+      }
+    }
+  }
+  {
+    /* realistic header sets */
+    uint8_t expected[1024];
+    uint8_t result[1024];
+    const char *sets[] = {http1_test_headers_browser, http1_test_headers_api};
+    const size_t lengths[] = {sizeof(http1_test_headers_browser) - 1,
+                              sizeof(http1_test_headers_api) - 1};
+    const size_t counts[] = {20, 7};
+    for (size_t set = 0; set < 2; ++set) {
+      memcpy(expected, sets[set], lengths[set]);
+      FIO_ASSERT(http1_test_scan(http1_seek_header_scalar, expected,
+                                 lengths[set]) == counts[set],
+                 "HTTP/1.x scalar scanner header count error");
+      for (size_t i = 1; i < scanner_count; ++i) {
+        memcpy(result, sets[set], lengths[set]);
+        FIO_ASSERT(http1_test_scan(scanners[i].seek, result, lengths[set]) ==
+                           counts[set] &&
+                       !memcmp(expected, result, lengths[set]),
+                   "HTTP/1.x %s scanner header set error", scanners[i].name);
+      }
+    }
+  }
+#if NODEBUG
+  for (size_t i = 0; i < scanner_count; ++i) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s (browser)", scanners[i].name);
+    http1_parser_speed_test(scanners[i].seek, name, http1_test_headers_browser,
+                            sizeof(http1_test_headers_browser) - 1);
+    snprintf(name, sizeof(name), "%s (API client)", scanners[i].name);
+    http1_parser_speed_test(scanners[i].seek, name, http1_test_headers_api,
+                            sizeof(http1_test_headers_api) - 1);
+  }
+#else
+  fprintf(stderr, "HTTP/1.x header scanners speed test skipped (debug mode "
+                  "is slow)\n");
+  (void)http1_parser_speed_test;
+#endif
+}
+#endif
@@ -26,4 +26,9 @@ void http1_destroy(fio_protocol_s *);
 /** returns the HTTP/1.1 protocol's VTable. */
 void *http1_vtable(void);
 
+#if DEBUG
+/** Tests the HTTP/1.x parser's scanners (and their speed, if NODEBUG). */
+void http1_parser_test(void);
+#endif
+
 #endif
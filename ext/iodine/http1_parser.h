@@ -51,6 +51,23 @@ Parser Settings
 #define HTTP1_PARSER_CONVERT_EOL2NUL 0
 #endif
 
+#ifndef HTTP1_PARSER_SIMD
+/**
+ * Scans header lines and request targets using SSE4.2 / AVX2 when the CPU
+ * supports them (tested at runtime), falling back to the scalar scanner.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define HTTP1_PARSER_SIMD 1
+#else
+#define HTTP1_PARSER_SIMD 0
+#endif
+#endif
+
+#if HTTP1_PARSER_SIMD
+#include <immintrin.h>
+#endif
+
 /* *****************************************************************************
 Parser API
 ***************************************************************************** */
@@ -258,23 +275,28 @@ inline static uint8_t seek2ch(uint8_t **pos, uint8_t *const limit, uint8_t ch) {
 
 #endif
 
-/* a helper that seeks the EOL, converts it to NUL and returns it's length */
-inline static uint8_t seek2eol(uint8_t **pos, uint8_t *const limit) {
-  /* single char lookup using memchr might be better when target is far... */
-  if (!seek2ch(pos, limit, '\n'))
-    return 0;
-  if ((*pos)[-1] == '\r') {
+/* a helper that tests an EOL, converts it to NUL and returns it's length */
+inline static uint8_t http1_eol_len(uint8_t *eol) {
+  if (eol[-1] == '\r') {
 #if HTTP1_PARSER_CONVERT_EOL2NUL
-    (*pos)[-1] = (*pos)[0] = 0;
+    eol[-1] = eol[0] = 0;
 #endif
     return 2;
   }
 #if HTTP1_PARSER_CONVERT_EOL2NUL
-  (*pos)[0] = 0;
+  eol[0] = 0;
 #endif
   return 1;
 }
 
+/* a helper that seeks the EOL, converts it to NUL and returns it's length */
+inline static uint8_t seek2eol(uint8_t **pos, uint8_t *const limit) {
+  /* single char lookup using memchr might be better when target is far... */
+  if (!seek2ch(pos, limit, '\n'))
+    return 0;
+  return http1_eol_len(*pos);
+}
+
 /* *****************************************************************************
 Change a letter to lower case (latin only)
 ***************************************************************************** */
@@ -285,6 +307,299 @@ static uint8_t http_tolower(uint8_t c) {
   return c;
 }
 
+/* *****************************************************************************
+Token characters (RFC 7230 `tchar`, allowed in methods and header names)
+***************************************************************************** */
+
+static const uint64_t http1_tchar_map[4] = {0x03FF6CFA00000000ULL,
+                                            0x57FFFFFFC7FFFFFEULL, 0, 0};
+
+inline static uint8_t http1_is_tchar(uint8_t c) {
+  return (uint8_t)((http1_tchar_map[c >> 6] >> (c & 63)) & 1);
+}
+
+/* *****************************************************************************
+Scanning header lines and request targets
+
+A header line is scanned once: the scanner finds the colon and the EOL,
+validates the header name and converts it to lowercase on the way.
+
+The SIMD scanners classify a whole block (16 / 32 bytes) at a time. The scalar
+scanners are used as a fallback and for the tail of the buffer.
+***************************************************************************** */
+
+/**
+ * Seeks the end of a header line, returning the EOL length (see `seek2eol`) or
+ * 0 if the line is incomplete.
+ *
+ * On success, `end_name` is set to the colon ending the header name, or NULL if
+ * the header name is missing or invalid. Header names are converted to
+ * lowercase when HTTP_HEADERS_LOWERCASE is set.
+ */
+static uint8_t http1_seek_header_scalar(uint8_t **pos, uint8_t *const limit,
+                                        uint8_t **end_name) {
+  uint8_t *const start = *pos;
+  uint8_t *tmp = start;
+  const uint8_t eol_len = seek2eol(pos, limit);
+  if (!eol_len)
+    return 0;
+  *end_name = NULL;
+  if (!seek2ch(&tmp, *pos, ':') || tmp == start)
+    return eol_len;
+  for (uint8_t *t = start; t < tmp; ++t) {
+    if (!http1_is_tchar(*t))
+      return eol_len;
+#if HTTP_HEADERS_LOWERCASE
+    *t = http_tolower(*t);
+#endif
+  }
+  *end_name = tmp;
+  return eol_len;
+}
+
+/**
+ * Seeks the end of a request path (the first '?' or ' '), returning 1 if found
+ * and 0 if the path isn't terminated before `limit`.
+ */
+static uint8_t http1_seek_path_scalar(uint8_t **pos, uint8_t *const limit) {
+  for (uint8_t *p = *pos; p < limit; ++p) {
+    if (*p == ' ' || *p == '?') {
+      *pos = p;
+      return 1;
+    }
+  }
+  *pos = limit;
+  return 0;
+}
+
+#if HTTP1_PARSER_SIMD
+
+/*
+ * `tchar` lookup tables, indexed using the low and the high nibbles. A byte is
+ * a token character if `ROWS[byte & 15] & COLS[byte >> 4]` isn't zero.
+ */
+#define HTTP1_SIMD_TCHAR_ROWS                                                  \
+  (char)0xE8, (char)0xFC, (char)0xF8, (char)0xFC, (char)0xFC, (char)0xFC,      \
+      (char)0xFC, (char)0xFC, (char)0xF8, (char)0xF8, (char)0xF4, (char)0x54,  \
+      (char)0xD0, (char)0x54, (char)0xF4, (char)0x70
+#define HTTP1_SIMD_TCHAR_COLS                                                  \
+  1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0
+
+__attribute__((target("sse4.2"))) static uint8_t
+http1_seek_header_sse42(uint8_t **pos, uint8_t *const limit,
+                        uint8_t **end_name) {
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i rows = _mm_setr_epi8(HTTP1_SIMD_TCHAR_ROWS);
+  const __m128i cols = _mm_setr_epi8(HTTP1_SIMD_TCHAR_COLS);
+#if HTTP_HEADERS_LOWERCASE
+  const __m128i before_a = _mm_set1_epi8('A' - 1);
+  const __m128i after_z = _mm_set1_epi8('Z' + 1);
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i index =
+      _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+#endif
+  uint32_t invalid = 0;
+  for (uint8_t *p = *pos; p + 16 <= limit; p += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    const uint32_t eol = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+    const uint32_t stop =
+        eol | (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, colon));
+    /* the bytes belonging to the header name (before the first stop) */
+    const uint32_t name = stop ? ((stop & (0U - stop)) - 1) : 0xFFFF;
+    const __m128i tchar = _mm_and_si128(
+        _mm_shuffle_epi8(rows, _mm_and_si128(v, nibble)),
+        _mm_shuffle_epi8(cols, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+    invalid |= name & (uint32_t)_mm_movemask_epi8(
+                          _mm_cmpeq_epi8(tchar, _mm_setzero_si128()));
+#if HTTP_HEADERS_LOWERCASE
+    const __m128i upper = _mm_and_si128(
+        _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmpgt_epi8(after_z, v)),
+        _mm_cmpgt_epi8(_mm_set1_epi8((char)(stop ? __builtin_ctz(stop) : 16)),
+                       index));
+    if (!_mm_testz_si128(upper, upper))
+      _mm_storeu_si128((__m128i *)p,
+                       _mm_or_si128(v, _mm_and_si128(upper, case_bit)));
+#endif
+    if (!stop)
+      continue;
+    const uint32_t found = (uint32_t)__builtin_ctz(stop);
+    if (p[found] == '\n') {
+      /* no colon */
+      *end_name = NULL;
+      *pos = p + found;
+      return http1_eol_len(*pos);
+    }
+    *end_name = (invalid || p + found == *pos) ? NULL : p + found;
+    if (eol) {
+      /* the EOL is in the same block (common for short values) */
+      *pos = p + __builtin_ctz(eol);
+      return http1_eol_len(*pos);
+    }
+    *pos = p + 16;
+    if (!seek2ch(pos, limit, '\n'))
+      return 0;
+    return http1_eol_len(*pos);
+  }
+  /* less than a block left in the buffer */
+  return http1_seek_header_scalar(pos, limit, end_name);
+}
+
+__attribute__((target("avx2"))) static uint8_t
+http1_seek_header_avx2(uint8_t **pos, uint8_t *const limit,
+                       uint8_t **end_name) {
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i rows =
+      _mm256_setr_epi8(HTTP1_SIMD_TCHAR_ROWS, HTTP1_SIMD_TCHAR_ROWS);
+  const __m256i cols =
+      _mm256_setr_epi8(HTTP1_SIMD_TCHAR_COLS, HTTP1_SIMD_TCHAR_COLS);
+#if HTTP_HEADERS_LOWERCASE
+  const __m256i before_a = _mm256_set1_epi8('A' - 1);
+  const __m256i after_z = _mm256_set1_epi8('Z' + 1);
+  const __m256i case_bit = _mm256_set1_epi8(0x20);
+  const __m256i index = _mm256_setr_epi8(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+      21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+#endif
+  uint32_t invalid = 0;
+  for (uint8_t *p = *pos; p + 32 <= limit; p += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    const uint32_t eol =
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+    const uint32_t stop =
+        eol | (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, colon));
+    /* the bytes belonging to the header name (before the first stop) */
+    const uint32_t name = stop ? ((stop & (0U - stop)) - 1) : 0xFFFFFFFFU;
+    const __m256i tchar = _mm256_and_si256(
+        _mm256_shuffle_epi8(rows, _mm256_and_si256(v, nibble)),
+        _mm256_shuffle_epi8(cols,
+                            _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+    invalid |= name & (uint32_t)_mm256_movemask_epi8(
+                          _mm256_cmpeq_epi8(tchar, _mm256_setzero_si256()));
+#if HTTP_HEADERS_LOWERCASE
+    const __m256i upper = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpgt_epi8(v, before_a),
+                         _mm256_cmpgt_epi8(after_z, v)),
+        _mm256_cmpgt_epi8(
+            _mm256_set1_epi8((char)(stop ? __builtin_ctz(stop) : 32)), index));
+    if (!_mm256_testz_si256(upper, upper))
+      _mm256_storeu_si256((__m256i *)p,
+                          _mm256_or_si256(v, _mm256_and_si256(upper, case_bit)));
+#endif
+    if (!stop)
+      continue;
+    const uint32_t found = (uint32_t)__builtin_ctz(stop);
+    if (p[found] == '\n') {
+      /* no colon */
+      *end_name = NULL;
+      *pos = p + found;
+      return http1_eol_len(*pos);
+    }
+    *end_name = (invalid || p + found == *pos) ? NULL : p + found;
+    if (eol) {
+      /* the EOL is in the same block (common for short values) */
+      *pos = p + __builtin_ctz(eol);
+      return http1_eol_len(*pos);
+    }
+    *pos = p + 32;
+    if (!seek2ch(pos, limit, '\n'))
+      return 0;
+    return http1_eol_len(*pos);
+  }
+  /* less than a block left in the buffer */
+  return http1_seek_header_scalar(pos, limit, end_name);
+}
+
+__attribute__((target("sse4.2"))) static uint8_t
+http1_seek_path_sse42(uint8_t **pos, uint8_t *const limit) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i question = _mm_set1_epi8('?');
+  for (; *pos + 16 <= limit; *pos += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)*pos);
+    const uint32_t stop = (uint32_t)_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, question)));
+    if (stop) {
+      *pos += __builtin_ctz(stop);
+      return 1;
+    }
+  }
+  return http1_seek_path_scalar(pos, limit);
+}
+
+__attribute__((target("avx2"))) static uint8_t
+http1_seek_path_avx2(uint8_t **pos, uint8_t *const limit) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i question = _mm256_set1_epi8('?');
+  for (; *pos + 32 <= limit; *pos += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)*pos);
+    const uint32_t stop = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, question)));
+    if (stop) {
+      *pos += __builtin_ctz(stop);
+      return 1;
+    }
+  }
+  return http1_seek_path_scalar(pos, limit);
+}
+
+#undef HTTP1_SIMD_TCHAR_ROWS
+#undef HTTP1_SIMD_TCHAR_COLS
+
+/** Returns the SIMD level supported by the CPU: 2 = AVX2, 1 = SSE4.2. */
+static uint8_t http1_simd_level(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return 2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return 1;
+  return 0;
+}
+
+static uint8_t http1_seek_header_init(uint8_t **pos, uint8_t *const limit,
+                                      uint8_t **end_name);
+static uint8_t http1_seek_path_init(uint8_t **pos, uint8_t *const limit);
+
+/* the scanners are selected on first use (a benign race, same result). */
+static uint8_t (*http1_seek_header)(uint8_t **, uint8_t *const,
+                                    uint8_t **) = http1_seek_header_init;
+static uint8_t (*http1_seek_path)(uint8_t **,
+                                  uint8_t *const) = http1_seek_path_init;
+
+static void http1_simd_select(void) {
+  switch (http1_simd_level()) {
+  case 2:
+    http1_seek_path = http1_seek_path_avx2;
+    http1_seek_header = http1_seek_header_avx2;
+    break;
+  case 1:
+    http1_seek_path = http1_seek_path_sse42;
+    http1_seek_header = http1_seek_header_sse42;
+    break;
+  default:
+    http1_seek_path = http1_seek_path_scalar;
+    http1_seek_header = http1_seek_header_scalar;
+  }
+}
+
+static uint8_t http1_seek_header_init(uint8_t **pos, uint8_t *const limit,
+                                      uint8_t **end_name) {
+  http1_simd_select();
+  return http1_seek_header(pos, limit, end_name);
+}
+
+static uint8_t http1_seek_path_init(uint8_t **pos, uint8_t *const limit) {
+  http1_simd_select();
+  return http1_seek_path(pos, limit);
+}
+
+#else
+#define http1_seek_header http1_seek_header_scalar
+#define http1_seek_path http1_seek_path_scalar
+#endif /* HTTP1_PARSER_SIMD */
+
 /* *****************************************************************************
 String to Number
 ***************************************************************************** */
@@ -373,6 +688,10 @@ inline static int http1_consume_request_line(http1_parser_s *parser,
   uint8_t *host_end = NULL;
   if (!seek2ch(&tmp, end, ' '))
     return -1;
+  for (uint8_t *t = start; t < tmp; ++t) {
+    if (!http1_is_tchar(*t))
+      return -1;
+  }
   if (http1_on_method(parser, (char *)start, tmp - start))
     return -1;
   tmp = start = tmp + 1;
@@ -400,20 +719,17 @@ inline static int http1_consume_request_line(http1_parser_s *parser,
   }
 review_path:
   tmp = start;
-  if (seek2ch(&tmp, end, '?')) {
-    if (http1_on_path(parser, (char *)start, tmp - start))
-      return -1;
+  /* a single pass finds the end of the path (either '?' or ' ') */
+  if (!http1_seek_path(&tmp, end))
+    return -1;
+  if (http1_on_path(parser, (char *)start, tmp - start))
+    return -1;
+  if (*tmp == '?') {
     tmp = start = tmp + 1;
     if (!seek2ch(&tmp, end, ' '))
       return -1;
     if (tmp - start > 0 && http1_on_query(parser, (char *)start, tmp - start))
       return -1;
-  } else {
-    tmp = start;
-    if (!seek2ch(&tmp, end, ' '))
-      return -1;
-    if (http1_on_path(parser, (char *)start, tmp - start))
-      return -1;
   }
 start_version:
   start = tmp + 1;
@@ -617,19 +933,11 @@ white_listed:
   return 0;
 }
 
+/* the header name was validated (and lowercased) by `http1_seek_header` */
 inline static int http1_consume_header(http1_parser_s *parser, uint8_t *start,
-                                       uint8_t *end) {
-  uint8_t *end_name = start;
-  /* divide header name from data */
-  if (!seek2ch(&end_name, end, ':'))
+                                       uint8_t *end_name, uint8_t *end) {
+  if (!end_name)
     return -1;
-  if (end_name[-1] == ' ' || end_name[-1] == '\t')
-    return -1;
-#if HTTP_HEADERS_LOWERCASE
-  for (uint8_t *t = start; t < end_name; t++) {
-    *t = http_tolower(*t);
-  }
-#endif
   uint8_t *start_value = end_name + 1;
   // clear away leading white space from value.
   while (start_value < end &&
@@ -786,6 +1094,7 @@ static size_t http1_parse(http1_parser_s *parser, void *buffer, size_t length) {
   parser->state.next = NULL;
   uint8_t *start = (uint8_t *)buffer;
   uint8_t *end = start;
+  uint8_t *end_name = NULL;
   uint8_t *const stop = start + length;
   uint8_t eol_len = 0;
 #define HTTP1_CONSUMED ((size_t)((uintptr_t)start - (uintptr_t)buffer))
@@ -827,9 +1136,9 @@ re_eval:
         goto finished_headers; /* empty line, end of headers */
       }
       end = start;
-      if (!(eol_len = seek2eol(&end, stop)))
+      if (!(eol_len = http1_seek_header(&end, stop, &end_name)))
         return HTTP1_CONSUMED;
-      if (http1_consume_header(parser, start, end - eol_len + 1))
+      if (http1_consume_header(parser, start, end_name, end - eol_len + 1))
         goto error;
       end = start = end + 1;
     } while ((parser->state.reserved & HTTP1_P_FLAG_HEADER_COMPLETE) == 0);
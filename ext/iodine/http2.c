@@ -0,0 +1,1883 @@
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#include <fio.h>
+
+#include <hpack.h>
+#include <http2.h>
+#include <http_internal.h>
+
+#include <fiobj.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+
+/* *****************************************************************************
+Protocol Constants
+***************************************************************************** */
+
+/** The maximum frame payload we accept (the protocol's default). */
+#define HTTP2_FRAME_SIZE 16384
+/** The read buffer fits a full frame, its header and a partial next frame. */
+#define HTTP2_READ_BUFFER ((HTTP2_FRAME_SIZE + 9) * 2)
+/** The HPACK dynamic table limit (the protocol's default, never changed). */
+#define HTTP2_HPACK_TABLE_SIZE 4096
+/** Each table entry costs at least 32 bytes, limiting the entry count. */
+#define HTTP2_HPACK_TABLE_ENTRIES (HTTP2_HPACK_TABLE_SIZE / 32)
+/** The largest window allowed by the protocol. */
+#define HTTP2_MAX_WINDOW 2147483647LL
+/** The initial flow control window (the protocol's default, never changed). */
+#define HTTP2_DEFAULT_WINDOW 65535
+
+typedef enum {
+  HTTP2_FRAME_DATA = 0,
+  HTTP2_FRAME_HEADERS = 1,
+  HTTP2_FRAME_PRIORITY = 2,
+  HTTP2_FRAME_RST_STREAM = 3,
+  HTTP2_FRAME_SETTINGS = 4,
+  HTTP2_FRAME_PUSH_PROMISE = 5,
+  HTTP2_FRAME_PING = 6,
+  HTTP2_FRAME_GOAWAY = 7,
+  HTTP2_FRAME_WINDOW_UPDATE = 8,
+  HTTP2_FRAME_CONTINUATION = 9,
+} http2_frame_type_e;
+
+typedef enum {
+  HTTP2_FLAG_END_STREAM = 1, /* also used as the ACK flag */
+  HTTP2_FLAG_END_HEADERS = 4,
+  HTTP2_FLAG_PADDED = 8,
+  HTTP2_FLAG_PRIORITY = 32,
+} http2_frame_flags_e;
+
+typedef enum {
+  HTTP2_NO_ERROR = 0,
+  HTTP2_PROTOCOL_ERROR = 1,
+  HTTP2_INTERNAL_ERROR = 2,
+  HTTP2_FLOW_CONTROL_ERROR = 3,
+  HTTP2_STREAM_CLOSED = 5,
+  HTTP2_FRAME_SIZE_ERROR = 6,
+  HTTP2_REFUSED_STREAM = 7,
+  HTTP2_COMPRESSION_ERROR = 9,
+  HTTP2_ENHANCE_YOUR_CALM = 11,
+  HTTP2_HTTP_1_1_REQUIRED = 13,
+} http2_error_e;
+
+/** stream state flags */
+typedef enum {
+  HTTP2_S_REMOTE_CLOSED = 1, /* the client sent END_STREAM */
+  HTTP2_S_HANDLING = 2,      /* the `on_request` callback is running */
+  HTTP2_S_PAUSED = 4,        /* the request was paused using `http_pause` */
+  HTTP2_S_RESPONDED = 8,     /* the response headers were sent */
+  HTTP2_S_RESET = 16,        /* the stream was reset */
+  HTTP2_S_DONE = 32,         /* END_STREAM was sent */
+  HTTP2_S_BAD = 64,          /* malformed request */
+  HTTP2_S_FLOOD = 128,       /* header flood */
+  HTTP2_S_STREAMING = 256,   /* the response body is being streamed */
+  HTTP2_S_QUEUED = 512,      /* waiting for another request's handler */
+} http2_stream_state_e;
+
+static const char http2_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/* *****************************************************************************
+The HTTP/2 Protocol Object
+***************************************************************************** */
+
+/** An HPACK dynamic table (a ring buffer, newest entry first). */
+typedef struct {
+  struct {
+    FIOBJ name;
+    FIOBJ value;
+  } entries[HTTP2_HPACK_TABLE_ENTRIES];
+  size_t head;  /* the newest entry's position */
+  size_t count; /* the number of entries in the table */
+  size_t size;  /* the table's size, as defined by the HPACK specification */
+  size_t max;   /* the table's current size limit */
+} http2_hpack_s;
+
+typedef struct http2_stream_s {
+  http_s h; /* must be first */
+  fio_ls_embd_s node;
+  FIOBJ out;              /* response body data waiting for flow control */
+  uintptr_t out_pos;      /* the amount of `out` already sent */
+  uintptr_t file_len;     /* the amount of file data waiting to be sent */
+  uintptr_t file_offset;  /* the next file offset to be sent */
+  int file;               /* the response file, -1 if none */
+  uint32_t id;            /* the stream's identifier */
+  uint32_t header_size;   /* the decoded header size, for flood protection */
+  int32_t window;         /* the stream's send window */
+  int32_t recv_window;    /* the stream's receive window */
+  uint16_t state;         /* the stream's state flags */
+  uint8_t fields;         /* set once a regular header field was received */
+} http2_stream_s;
+
+typedef struct http2pr_s {
+  http_fio_protocol_s p;
+  fio_ls_embd_s streams;  /* active streams */
+  http2_hpack_s decoder;  /* the client's HPACK dynamic table */
+  FIOBJ hblock;           /* a header block waiting for CONTINUATION frames */
+  uint32_t hblock_stream; /* the stream expecting CONTINUATION frames */
+  uint32_t last_stream;   /* the highest stream identifier processed */
+  uint32_t stream_count;  /* the number of streams in the `streams` list */
+  uint32_t frame_size;    /* the client's maximum frame size */
+  int32_t window;         /* the connection's send window */
+  int32_t recv_window;    /* the connection's receive window */
+  int32_t initial_window; /* the client's initial stream window */
+  uintptr_t buf_len;
+  uintptr_t buf_pos;      /* the next frame to be processed in `buf` */
+  uint8_t hblock_end;     /* the header block ends the stream */
+  uint8_t preface;        /* the client's connection preface was received */
+  uint8_t goaway;         /* 1 == GOAWAY received, 2 == connection error */
+  uint8_t stop;           /* 4 == waiting for the socket to drain */
+  uint8_t handling;       /* an `on_request` callback is running */
+  uint8_t queued;         /* requests are waiting for the running callback */
+  uint8_t buf[];
+} http2pr_s;
+
+struct http_vtable_s HTTP2_VTABLE; /* initialized later on */
+
+#define handle2pr(h) ((http2pr_s *)(h)->private_data.flag)
+#define handle2stream(h) ((http2_stream_s *)(h))
+
+/* *****************************************************************************
+Frame Writing Helpers
+***************************************************************************** */
+
+static inline void http2_frame_header(uint8_t *dest, uint32_t len,
+                                      uint8_t type, uint8_t flags,
+                                      uint32_t id) {
+  dest[0] = (len >> 16) & 0xFF;
+  dest[1] = (len >> 8) & 0xFF;
+  dest[2] = len & 0xFF;
+  dest[3] = type;
+  dest[4] = flags;
+  fio_u2str32(dest + 5, id & 0x7FFFFFFFUL);
+}
+
+/** Sends a short control frame (the payload is copied). */
+static void http2_send_frame(http2pr_s *p, uint8_t type, uint8_t flags,
+                             uint32_t id, void *payload, uint32_t len) {
+  uint8_t frame[9 + 24];
+  FIO_ASSERT(len <= 24, "HTTP/2 control frame payload too long");
+  http2_frame_header(frame, len, type, flags, id);
+  if (len)
+    memcpy(frame + 9, payload, len);
+  fio_write(p->p.uuid, frame, 9 + len);
+}
+
+static void http2_send_rst(http2pr_s *p, uint32_t id, uint32_t error) {
+  uint8_t payload[4];
+  fio_u2str32(payload, error);
+  http2_send_frame(p, HTTP2_FRAME_RST_STREAM, 0, id, payload, 4);
+}
+
+static void http2_send_window_update(http2pr_s *p, uint32_t id,
+                                     uint32_t increment) {
+  uint8_t payload[4];
+  fio_u2str32(payload, increment & 0x7FFFFFFFUL);
+  http2_send_frame(p, HTTP2_FRAME_WINDOW_UPDATE, 0, id, payload, 4);
+}
+
+static void http2_send_goaway(http2pr_s *p, uint32_t error) {
+  uint8_t payload[8];
+  fio_u2str32(payload, p->last_stream);
+  fio_u2str32(payload + 4, error);
+  http2_send_frame(p, HTTP2_FRAME_GOAWAY, 0, 0, payload, 8);
+}
+
+/** Reports a connection error and closes the connection (after flushing). */
+static int http2_connection_error(http2pr_s *p, uint32_t error) {
+  if (p->goaway < 2) {
+    FIO_LOG_DEBUG("(HTTP/2) connection error %u for %p", (unsigned int)error,
+                  (void *)p->p.uuid);
+    http2_send_goaway(p, error);
+    p->goaway = 2;
+  }
+  fio_close(p->p.uuid);
+  return -1;
+}
+
+/* *****************************************************************************
+HPACK Decoding
+***************************************************************************** */
+
+static inline size_t http2_hpack_entry_size(FIOBJ name, FIOBJ value) {
+  return fiobj_obj2cstr(name).len + fiobj_obj2cstr(value).len + 32;
+}
+
+static void http2_hpack_evict(http2_hpack_s *t) {
+  const size_t pos = (t->head + t->count - 1) % HTTP2_HPACK_TABLE_ENTRIES;
+  t->size -= http2_hpack_entry_size(t->entries[pos].name,
+                                    t->entries[pos].value);
+  fiobj_free(t->entries[pos].name);
+  fiobj_free(t->entries[pos].value);
+  --t->count;
+}
+
+static void http2_hpack_resize(http2_hpack_s *t, size_t max) {
+  t->max = max;
+  while (t->count && t->size > t->max)
+    http2_hpack_evict(t);
+}
+
+static void http2_hpack_add(http2_hpack_s *t, fio_str_info_s name,
+                            fio_str_info_s value) {
+  const size_t size = name.len + value.len + 32;
+  if (size > t->max) {
+    /* an entry larger than the table empties the table (RFC 7541, 4.4) */
+    http2_hpack_resize(t, t->max);
+    while (t->count)
+      http2_hpack_evict(t);
+    return;
+  }
+  FIOBJ n = fiobj_str_new(name.data, name.len);
+  FIOBJ v = fiobj_str_new(value.data, value.len);
+  while (t->count && t->size + size > t->max)
+    http2_hpack_evict(t);
+  t->head = (t->head + HTTP2_HPACK_TABLE_ENTRIES - 1) %
+            HTTP2_HPACK_TABLE_ENTRIES;
+  t->entries[t->head].name = n;
+  t->entries[t->head].value = v;
+  t->size += size;
+  ++t->count;
+}
+
+static void http2_hpack_destroy(http2_hpack_s *t) {
+  while (t->count)
+    http2_hpack_evict(t);
+}
+
+/** Finds a header in the static or dynamic table. `value` may be NULL. */
+static int http2_hpack_get(http2_hpack_s *t, uint64_t index,
+                           fio_str_info_s *name, fio_str_info_s *value) {
+  if (!index)
+    return -1;
+  if (index < 62) {
+    const char *str;
+    size_t len;
+    if (hpack_header_static_find(index, 0, &str, &len))
+      return -1;
+    *name = (fio_str_info_s){.data = (char *)str, .len = len};
+    if (value) {
+      hpack_header_static_find(index, 1, &str, &len);
+      *value = (fio_str_info_s){.data = (char *)str, .len = len};
+    }
+    return 0;
+  }
+  index -= 62;
+  if (index >= t->count)
+    return -1;
+  index = (t->head + index) % HTTP2_HPACK_TABLE_ENTRIES;
+  *name = fiobj_obj2cstr(t->entries[index].name);
+  if (value)
+    *value = fiobj_obj2cstr(t->entries[index].value);
+  return 0;
+}
+
+static void http2_on_header(http2pr_s *p, http2_stream_s *s,
+                            fio_str_info_s name, fio_str_info_s value);
+
+/**
+ * Decodes a header block, calling `http2_on_header` for every header.
+ *
+ * The stream may be NULL, in which case the headers are decoded (keeping the
+ * dynamic table in sync) and discarded.
+ *
+ * Returns -1 on a compression error (a connection error).
+ */
+static int http2_hpack_decode(http2pr_s *p, http2_stream_s *s, uint8_t *data,
+                              size_t len) {
+  char buf[HTTP_MAX_HEADER_LENGTH];
+  size_t pos = 0;
+  while (pos < len) {
+    fio_str_info_s name, value;
+    const uint8_t c = data[pos];
+    int64_t index;
+    if (c & 128) {
+      /* Indexed Header Field */
+      index = hpack_int_unpack(data, len, 7, &pos);
+      if (index <= 0 || http2_hpack_get(&p->decoder, index, &name, &value))
+        return -1;
+      http2_on_header(p, s, name, value);
+      continue;
+    }
+    if ((c & 224) == 32) {
+      /* Dynamic Table Size Update */
+      index = hpack_int_unpack(data, len, 5, &pos);
+      if (index < 0 || index > HTTP2_HPACK_TABLE_SIZE)
+        return -1;
+      http2_hpack_resize(&p->decoder, (size_t)index);
+      continue;
+    }
+    /* Literal Header Field (with incremental indexing, without indexing or
+     * never indexed) */
+    const uint8_t add = (c & 64);
+    size_t used = 0;
+    int l;
+    index = hpack_int_unpack(data, len, (add ? 6 : 4), &pos);
+    if (index < 0)
+      return -1;
+    if (index) {
+      if (http2_hpack_get(&p->decoder, index, &name, NULL))
+        return -1;
+    } else {
+      if (pos >= len)
+        return -1;
+      l = hpack_string_unpack(buf, sizeof(buf), data, len, &pos);
+      if (l < 0 || (size_t)l > sizeof(buf))
+        return -1;
+      name = (fio_str_info_s){.data = buf, .len = (size_t)l};
+      used = (size_t)l;
+    }
+    if (pos >= len)
+      return -1;
+    l = hpack_string_unpack(buf + used, sizeof(buf) - used, data, len, &pos);
+    if (l < 0 || (size_t)l > sizeof(buf) - used)
+      return -1;
+    value = (fio_str_info_s){.data = buf + used, .len = (size_t)l};
+    /* the callback is performed first, `name` might be evicted by `add` */
+    http2_on_header(p, s, name, value);
+    if (add)
+      http2_hpack_add(&p->decoder, name, value);
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+HPACK Encoding
+***************************************************************************** */
+
+static void http2_hpack_write_int(FIOBJ dest, uint8_t head, uint64_t i,
+                                  uint8_t prefix) {
+  fio_str_info_s s = fiobj_obj2cstr(dest);
+  fiobj_str_capa_assert(dest, s.len + 12);
+  s = fiobj_obj2cstr(dest);
+  s.data[s.len] = head;
+  fiobj_str_resize(dest,
+                   s.len + hpack_int_pack(s.data + s.len, 12, i, prefix));
+}
+
+static void http2_hpack_write_str(FIOBJ dest, char *data, size_t len) {
+  const uint8_t compress = (size_t)hpack_huffman_pack(NULL, 0, data, len) < len;
+  fio_str_info_s s = fiobj_obj2cstr(dest);
+  fiobj_str_capa_assert(dest, s.len + len + 16);
+  s = fiobj_obj2cstr(dest);
+  fiobj_str_resize(dest, s.len + hpack_string_pack(s.data + s.len, len + 16,
+                                                   data, len, compress));
+}
+
+/** Returns a static table index for a header name, or 0. */
+static uint8_t http2_hpack_static_name(char *name, size_t len) {
+  for (uint8_t i = 15; i < 62; ++i) {
+    const char *str;
+    size_t l;
+    hpack_header_static_find(i, 0, &str, &l);
+    if (l == len && !memcmp(str, name, len))
+      return i;
+  }
+  return 0;
+}
+
+struct http2_header_writer_s {
+  FIOBJ dest;
+  FIOBJ name;
+};
+
+static int http2_write_header(FIOBJ o, void *w_) {
+  struct http2_header_writer_s *w = w_;
+  if (!o)
+    return 0;
+  if (fiobj_hash_key_in_loop()) {
+    w->name = fiobj_hash_key_in_loop();
+  }
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    fiobj_each1(o, 0, http2_write_header, w);
+    return 0;
+  }
+  fio_str_info_s name = fiobj_obj2cstr(w->name);
+  fio_str_info_s str = fiobj_obj2cstr(o);
+  if (!str.data || !name.len || name.len > 256)
+    return 0;
+  /* HTTP/2 header names are lower case */
+  char lower[256];
+  for (size_t i = 0; i < name.len; ++i)
+    lower[i] = tolower((unsigned char)name.data[i]);
+  name.data = lower;
+  /* connection specific headers are forbidden */
+  switch (name.len) {
+  case 7:
+    if (!memcmp(name.data, "upgrade", 7))
+      return 0;
+    break;
+  case 10:
+    if (!memcmp(name.data, "connection", 10) ||
+        !memcmp(name.data, "keep-alive", 10))
+      return 0;
+    break;
+  case 16:
+    if (!memcmp(name.data, "proxy-connection", 16))
+      return 0;
+    break;
+  case 17:
+    if (!memcmp(name.data, "transfer-encoding", 17))
+      return 0;
+    break;
+  }
+  /* Literal Header Field without Indexing */
+  uint8_t index = http2_hpack_static_name(name.data, name.len);
+  http2_hpack_write_int(w->dest, 0, index, 4);
+  if (!index)
+    http2_hpack_write_str(w->dest, name.data, name.len);
+  http2_hpack_write_str(w->dest, str.data, str.len);
+  return 0;
+}
+
+/** Encodes the response status and headers as an HPACK header block. */
+static FIOBJ http2_headers2block(http_s *h) {
+  struct http2_header_writer_s w;
+  w.dest =
+      fiobj_str_buf(fiobj_hash_count(h->private_data.out_headers) * 48 + 16);
+  uint8_t index = 0;
+  switch (h->status) {
+  case 200: index = 8; break;
+  case 204: index = 9; break;
+  case 206: index = 10; break;
+  case 304: index = 11; break;
+  case 400: index = 12; break;
+  case 404: index = 13; break;
+  case 500: index = 14; break;
+  }
+  if (index) {
+    http2_hpack_write_int(w.dest, 128, index, 7);
+  } else {
+    char status[3];
+    const uintptr_t s = (h->status >= 100 && h->status < 1000) ? h->status : 500;
+    status[0] = '0' + (s / 100);
+    status[1] = '0' + ((s / 10) % 10);
+    status[2] = '0' + (s % 10);
+    http2_hpack_write_int(w.dest, 0, 8, 4);
+    http2_hpack_write_str(w.dest, status, 3);
+  }
+  fiobj_each1(h->private_data.out_headers, 0, http2_write_header, &w);
+  return w.dest;
+}
+
+/* *****************************************************************************
+Stream Management
+***************************************************************************** */
+
+static http2_stream_s *http2_stream_new(http2pr_s *p, uint32_t id) {
+  http2_stream_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (http2_stream_s){
+      .file = -1,
+      .id = id,
+      .window = p->initial_window,
+      .recv_window = HTTP2_DEFAULT_WINDOW,
+  };
+  http_s_new(&s->h, &p->p, &HTTP2_VTABLE);
+  fio_ls_embd_push(&p->streams, &s->node);
+  ++p->stream_count;
+  return s;
+}
+
+static http2_stream_s *http2_stream_find(http2pr_s *p, uint32_t id) {
+  FIO_LS_EMBD_FOR(&p->streams, pos) {
+    http2_stream_s *s = FIO_LS_EMBD_OBJ(http2_stream_s, node, pos);
+    if (s->id == id)
+      return s;
+  }
+  return NULL;
+}
+
+/** Releases any response data waiting to be sent. */
+static void http2_stream_release(http2_stream_s *s) {
+  if (s->file != -1) {
+    http_sendfile_close(s->file);
+    s->file = -1;
+  }
+  s->file_len = 0;
+  fiobj_free(s->out);
+  s->out = FIOBJ_INVALID;
+}
+
+static void http2_stream_free(http2pr_s *p, http2_stream_s *s) {
+  http2_stream_release(s);
+  if (!(s->state & HTTP2_S_RESPONDED))
+    http_s_destroy(&s->h, 0);
+  fio_ls_embd_remove(&s->node);
+  --p->stream_count;
+  fio_free(s);
+  if (p->goaway == 1 && !p->stream_count)
+    fio_close(p->p.uuid);
+}
+
+/** Frees the stream once it's no longer used by the protocol or the user. */
+static void http2_stream_review(http2pr_s *p, http2_stream_s *s) {
+  if ((s->state & (HTTP2_S_HANDLING | HTTP2_S_PAUSED)))
+    return;
+  if ((s->state & HTTP2_S_RESET)) {
+    http2_stream_free(p, s);
+    return;
+  }
+  if ((s->state & HTTP2_S_DONE)) {
+    /* we might have answered before the request was fully received */
+    if (!(s->state & HTTP2_S_REMOTE_CLOSED))
+      http2_send_rst(p, s->id, HTTP2_NO_ERROR);
+    http2_stream_free(p, s);
+  }
+}
+
+static void http2_stream_reset(http2pr_s *p, http2_stream_s *s,
+                               uint32_t error) {
+  if (!(s->state & HTTP2_S_RESET))
+    http2_send_rst(p, s->id, error);
+  s->state |= HTTP2_S_RESET;
+  http2_stream_release(s);
+  http2_stream_review(p, s);
+}
+
+/** Sends DATA frames, as allowed by flow control. */
+static void http2_stream_flush(http2pr_s *p, http2_stream_s *s) {
+  for (;;) {
+    uintptr_t remaining = s->file_len;
+    if (s->out)
+      remaining = fiobj_obj2cstr(s->out).len - s->out_pos;
+    if (!remaining || (s->state & (HTTP2_S_RESET | HTTP2_S_DONE)))
+      return;
+    /* streaming responses are throttled by the streaming thread */
+    if (fio_pending(p->p.uuid) > HTTP2_MAX_PENDING &&
+        !(s->state & HTTP2_S_STREAMING)) {
+      p->stop |= 4;
+      return;
+    }
+    uintptr_t len = remaining;
+    if (len > p->frame_size)
+      len = p->frame_size;
+    if ((intptr_t)len > p->window)
+      len = p->window > 0 ? p->window : 0;
+    if ((intptr_t)len > s->window)
+      len = s->window > 0 ? s->window : 0;
+    if (!len)
+      return; /* wait for a WINDOW_UPDATE */
+    uint8_t *frame = fio_malloc(len + 9);
+    FIO_ASSERT_ALLOC(frame);
+    if (s->out) {
+      memcpy(frame + 9, fiobj_obj2cstr(s->out).data + s->out_pos, len);
+      s->out_pos += len;
+    } else {
+      ssize_t r = pread(s->file, frame + 9, len, s->file_offset);
+      if (r <= 0) {
+        fio_free(frame);
+        http2_stream_reset(p, s, HTTP2_INTERNAL_ERROR);
+        return;
+      }
+      len = (uintptr_t)r;
+      s->file_offset += len;
+      s->file_len -= len;
+    }
+    const uint8_t end =
+        (len == remaining && !(s->state & HTTP2_S_STREAMING));
+    http2_frame_header(frame, len, HTTP2_FRAME_DATA,
+                       (end ? HTTP2_FLAG_END_STREAM : 0), s->id);
+    fio_write2(p->p.uuid, .data.buffer = frame, .length = len + 9,
+               .after.dealloc = fio_free);
+    p->window -= len;
+    s->window -= len;
+    if (end) {
+      s->state |= HTTP2_S_DONE;
+      http2_stream_release(s);
+      http2_stream_review(p, s);
+      return;
+    }
+    if (len == remaining) {
+      /* streaming: everything written so far was sent */
+      http2_stream_release(s);
+      return;
+    }
+  }
+}
+
+/** Flushes all streams waiting for flow control or the socket. */
+static void http2_flush(http2pr_s *p) {
+  p->stop &= ~4;
+  fio_ls_embd_s *pos = p->streams.next;
+  while (pos != &p->streams && p->window > 0 && !(p->stop & 4)) {
+    fio_ls_embd_s *next = pos->next;
+    http2_stream_s *s = FIO_LS_EMBD_OBJ(http2_stream_s, node, pos);
+    if ((s->state & HTTP2_S_RESPONDED))
+      http2_stream_flush(p, s);
+    pos = next;
+  }
+}
+
+/* *****************************************************************************
+HTTP Request / Response (Virtual) Functions
+***************************************************************************** */
+
+/**
+ * Writes the response headers (HEADERS and CONTINUATION frames). Returns -1 if
+ * the stream was reset.
+ */
+static int http2_write_headers(http_s *h, uint8_t end_stream) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if ((s->state & HTTP2_S_RESET))
+    return -1;
+  FIOBJ block = http2_headers2block(h);
+  fio_str_info_s b = fiobj_obj2cstr(block);
+  FIOBJ packet = fiobj_str_buf(b.len + 9 + ((b.len / p->frame_size) * 9));
+  uint8_t type = HTTP2_FRAME_HEADERS;
+  uint8_t head[9];
+  do {
+    uint32_t len = b.len > p->frame_size ? p->frame_size : (uint32_t)b.len;
+    uint8_t flags = (len == b.len ? HTTP2_FLAG_END_HEADERS : 0);
+    if (type == HTTP2_FRAME_HEADERS && end_stream)
+      flags |= HTTP2_FLAG_END_STREAM;
+    http2_frame_header(head, len, type, flags, s->id);
+    fiobj_str_write(packet, (char *)head, 9);
+    fiobj_str_write(packet, b.data, len);
+    b.data += len;
+    b.len -= len;
+    type = HTTP2_FRAME_CONTINUATION;
+  } while (b.len);
+  fiobj_free(block);
+  fiobj_send_free(p->p.uuid, packet);
+  if (end_stream)
+    s->state |= HTTP2_S_DONE;
+  return 0;
+}
+
+/**
+ * Sends the response headers (HEADERS and CONTINUATION frames) and destroys
+ * the handle's data. Returns -1 if the stream was reset.
+ */
+static int http2_send_headers(http_s *h, uint8_t end_stream) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  int ret = http2_write_headers(h, end_stream);
+  http_s_destroy(h, p->p.settings->log);
+  s->state |= HTTP2_S_RESPONDED;
+  s->state &= ~HTTP2_S_PAUSED;
+  return ret;
+}
+
+/** Should send existing headers and data */
+static int http2_send_body(http_s *h, void *data, uintptr_t length) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (http2_send_headers(h, 0)) {
+    http2_stream_review(p, s);
+    return -1;
+  }
+  s->out = fiobj_str_new(data, length);
+  s->out_pos = 0;
+  http2_stream_flush(p, s);
+  return 0;
+}
+
+/** Should send existing headers and file */
+static int http2_sendfile(http_s *h, int fd, uintptr_t length,
+                          uintptr_t offset) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (http2_send_headers(h, !length)) {
+    http_sendfile_close(fd);
+    http2_stream_review(p, s);
+    return -1;
+  }
+  if (!length) {
+    http_sendfile_close(fd);
+    http2_stream_review(p, s);
+    return 0;
+  }
+  s->file = fd;
+  s->file_len = length;
+  s->file_offset = offset;
+  http2_stream_flush(p, s);
+  return 0;
+}
+
+/**
+ * Should send existing headers and data and prepare for streaming.
+ *
+ * Data the flow control window doesn't allow is buffered until a WINDOW_UPDATE
+ * frame is processed (once the `on_request` callback returns).
+ */
+static int http2_stream(http_s *h, void *data, uintptr_t length) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (!(s->state & HTTP2_S_STREAMING)) {
+    if (http2_write_headers(h, 0))
+      return -1;
+    s->state |= HTTP2_S_STREAMING;
+  }
+  if ((s->state & HTTP2_S_RESET))
+    return -1;
+  if (!s->out) {
+    s->out = fiobj_str_buf(length);
+    s->out_pos = 0;
+  } else if (s->out_pos) {
+    /* drop the data already sent, so the buffer doesn't keep growing */
+    fio_str_info_s o = fiobj_obj2cstr(s->out);
+    memmove(o.data, o.data + s->out_pos, o.len - s->out_pos);
+    fiobj_str_resize(s->out, o.len - s->out_pos);
+    s->out_pos = 0;
+  }
+  fiobj_str_write(s->out, data, length);
+  http2_stream_flush(p, s);
+  return 0;
+}
+
+/** Should send existing headers or complete streaming */
+static void http2_finish(http_s *h) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (!(s->state & HTTP2_S_STREAMING)) {
+    http2_send_headers(h, 1);
+    http2_stream_review(p, s);
+    return;
+  }
+  s->state &= ~HTTP2_S_STREAMING;
+  http_s_destroy(h, p->p.settings->log);
+  s->state |= HTTP2_S_RESPONDED;
+  s->state &= ~HTTP2_S_PAUSED;
+  if (s->out) {
+    /* the last DATA frame will end the stream */
+    http2_stream_flush(p, s);
+    return;
+  }
+  if (!(s->state & HTTP2_S_RESET)) {
+    uint8_t frame[9];
+    http2_frame_header(frame, 0, HTTP2_FRAME_DATA, HTTP2_FLAG_END_STREAM,
+                       s->id);
+    fio_write(p->p.uuid, frame, 9);
+    s->state |= HTTP2_S_DONE;
+  }
+  http2_stream_review(p, s);
+}
+
+/** Should abort streaming (resets the stream) */
+static void http2_stream_abort(http_s *h) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  s->state &= ~HTTP2_S_STREAMING;
+  http_s_destroy(h, p->p.settings->log);
+  s->state |= HTTP2_S_RESPONDED;
+  s->state &= ~HTTP2_S_PAUSED;
+  http2_stream_reset(p, s, HTTP2_INTERNAL_ERROR);
+}
+
+/** Returns the number of DATA frames held back by flow control. */
+static size_t http2_pending(http_s *h) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (!s->out)
+    return 0;
+  const size_t len = fiobj_obj2cstr(s->out).len - s->out_pos;
+  return (len + p->frame_size - 1) / p->frame_size;
+}
+
+static void http2_consume_data(intptr_t uuid, http2pr_s *p);
+
+/**
+ * Waits (briefly) for the client to open the flow control window.
+ *
+ * The streaming `on_request` callback blocks the connection, so the client's
+ * frames are read and processed here (new requests are handled once the
+ * callback returns).
+ */
+static int http2_wait(http_s *h) {
+  http2_stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  const intptr_t uuid = p->p.uuid;
+  if ((s->state & (HTTP2_S_HANDLING | HTTP2_S_PAUSED)) != HTTP2_S_HANDLING) {
+    /* the connection isn't blocked, frames are processed by `on_data` */
+    fio_throttle_thread(500000);
+    goto finish;
+  }
+  http2_consume_data(uuid, p);
+  http2_stream_flush(p, s);
+  if (!http2_pending(h) || (s->state & HTTP2_S_RESET))
+    goto finish;
+  if (fio_flush(uuid) < 0 && errno != EWOULDBLOCK)
+    return -1;
+  ssize_t i =
+      fio_read(uuid, p->buf + p->buf_len, HTTP2_READ_BUFFER - p->buf_len);
+  if (i < 0)
+    return -1;
+  if (i) {
+    p->buf_len += i;
+    goto finish;
+  }
+  struct pollfd list = {.fd = fio_uuid2fd(uuid),
+                        .events = (POLLIN | (fio_pending(uuid) ? POLLOUT : 0))};
+  if (poll(&list, 1, 100) < 0 && errno != EINTR)
+    return -1;
+finish:
+  if ((s->state & HTTP2_S_RESET) || p->goaway == 2 || !fio_is_valid(uuid))
+    return -1;
+  return 0;
+}
+
+/** Push for data - unsupported (push is deprecated by most clients). */
+static int http2_push_data(http_s *h, void *data, uintptr_t length,
+                           FIOBJ mime_type) {
+  return -1;
+  (void)h;
+  (void)data;
+  (void)length;
+  (void)mime_type;
+}
+
+/** Push for files - unsupported (push is deprecated by most clients). */
+static int http2_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
+  return -1;
+  (void)h;
+  (void)filename;
+  (void)mime_type;
+}
+
+/**
+ * Called befor a pause task. Other streams keep going.
+ */
+static void http2_on_pause(http_s *h, http_fio_protocol_s *pr) {
+  handle2stream(h)->state |= HTTP2_S_PAUSED;
+  (void)pr;
+}
+
+/**
+ * Called after the resume task had completed.
+ *
+ * The stream (and the handle) might have been freed by the task.
+ */
+static void http2_on_resume(http_s *h, http_fio_protocol_s *pr) {
+  http2_flush((http2pr_s *)pr);
+  (void)h;
+}
+
+/**
+ * Refuses to hijack a multiplexed connection, asking the client to retry the
+ * request using HTTP/1.1.
+ */
+static intptr_t http2_hijack(http_s *h, fio_str_info_s *leftover) {
+  if (leftover)
+    *leftover = (fio_str_info_s){.len = 0, .data = NULL};
+  http2_stream_s *s = handle2stream(h);
+  if (!(s->state & HTTP2_S_RESET))
+    http2_send_rst(handle2pr(h), s->id, HTTP2_HTTP_1_1_REQUIRED);
+  s->state |= HTTP2_S_RESET;
+  return -1;
+}
+
+/** Websockets require HTTP/1.1 (RFC 8441 isn't supported). */
+static int http2_http2websocket(http_s *h, websocket_settings_s *args) {
+  http2_hijack(h, NULL);
+  http_finish(h);
+  if (args->on_close)
+    args->on_close(-1, args->udata);
+  return -1;
+}
+
+/** EventSource connections require HTTP/1.1 (ask the client to retry). */
+static int http2_upgrade2sse(http_s *h, http_sse_s *sse) {
+  http2_hijack(h, NULL);
+  http_finish(h);
+  if (sse->on_close)
+    sse->on_close(sse);
+  return -1;
+}
+
+static int http2_sse_write(http_sse_s *sse, FIOBJ str) {
+  fiobj_free(str);
+  return -1;
+  (void)sse;
+}
+
+static int http2_sse_close(http_sse_s *sse) {
+  return -1;
+  (void)sse;
+}
+
+/* *****************************************************************************
+Virtual Table Decleration
+***************************************************************************** */
+
+struct http_vtable_s HTTP2_VTABLE = {
+    .http_send_body = http2_send_body,
+    .http_sendfile = http2_sendfile,
+    .http_stream = http2_stream,
+    .http_stream_abort = http2_stream_abort,
+    .http_pending = http2_pending,
+    .http_wait = http2_wait,
+    .http_finish = http2_finish,
+    .http_push_data = http2_push_data,
+    .http_push_file = http2_push_file,
+    .http_on_pause = http2_on_pause,
+    .http_on_resume = http2_on_resume,
+    .http_hijack = http2_hijack,
+    .http2websocket = http2_http2websocket,
+    .http_upgrade2sse = http2_upgrade2sse,
+    .http_sse_write = http2_sse_write,
+    .http_sse_close = http2_sse_close,
+};
+
+void *http2_vtable(void) { return (void *)&HTTP2_VTABLE; }
+
+/* *****************************************************************************
+Request Handling
+***************************************************************************** */
+
+/** called for every decoded header. */
+static void http2_on_header(http2pr_s *p, http2_stream_s *s,
+                            fio_str_info_s name, fio_str_info_s value) {
+  if (!s || (s->state & (HTTP2_S_BAD | HTTP2_S_FLOOD)))
+    return;
+  s->header_size += name.len + value.len;
+  if (s->header_size >= p->p.settings->max_header_size ||
+      fiobj_hash_count(s->h.headers) > HTTP_MAX_HEADER_COUNT) {
+    if (p->p.settings->log) {
+      FIO_LOG_WARNING("(HTTP/2) security alert - header flood detected.");
+    }
+    s->state |= HTTP2_S_FLOOD;
+    return;
+  }
+  if (name.len && name.data[0] == ':') {
+    /* pseudo headers must precede regular headers */
+    if (s->fields || !value.len)
+      goto bad_request;
+    switch (name.len) {
+    case 5:
+      if (memcmp(name.data, ":path", 5) || s->h.path)
+        goto bad_request;
+      {
+        char *query = memchr(value.data, '?', value.len);
+        if (query) {
+          s->h.query = fiobj_str_new(query + 1,
+                                     value.len - (query + 1 - value.data));
+          value.len = query - value.data;
+        }
+        s->h.path = fiobj_str_new(value.data, value.len);
+      }
+      return;
+    case 7:
+      if (!memcmp(name.data, ":method", 7) && !s->h.method) {
+        s->h.method = fiobj_str_new(value.data, value.len);
+        return;
+      }
+      if (!memcmp(name.data, ":scheme", 7))
+        return;
+      goto bad_request;
+    case 10:
+      if (memcmp(name.data, ":authority", 10))
+        goto bad_request;
+      set_header_add(s->h.headers, HTTP_HEADER_HOST,
+                     fiobj_str_new(value.data, value.len));
+      return;
+    }
+    goto bad_request;
+  }
+  s->fields = 1;
+  for (size_t i = 0; i < name.len; ++i) {
+    if (isupper((unsigned char)name.data[i]))
+      goto bad_request;
+  }
+  if (name.len == 10 && !memcmp(name.data, "connection", 10))
+    goto bad_request;
+  FIOBJ sym = fiobj_str_new(name.data, name.len);
+  if (name.len == 6 && !memcmp(name.data, "cookie", 6)) {
+    /* cookies might be split (RFC 7540, 8.1.2.5) */
+    FIOBJ old = fiobj_hash_get(s->h.headers, sym);
+    if (old) {
+      fiobj_str_write(old, "; ", 2);
+      fiobj_str_write(old, value.data, value.len);
+      fiobj_free(sym);
+      return;
+    }
+  }
+  set_header_add(s->h.headers, sym, fiobj_str_new(value.data, value.len));
+  fiobj_free(sym);
+  return;
+bad_request:
+  s->state |= HTTP2_S_BAD;
+}
+
+/** called once a request was fully received. */
+static void http2_on_request(http2pr_s *p, http2_stream_s *s) {
+  if ((s->state & HTTP2_S_BAD) || !s->h.method || !s->h.path) {
+    http2_stream_reset(p, s, HTTP2_PROTOCOL_ERROR);
+    return;
+  }
+  if ((s->state & HTTP2_S_RESPONDED)) {
+    http2_stream_review(p, s);
+    return;
+  }
+  if (p->handling) {
+    /* a streaming callback is processing frames (see `http2_wait`) */
+    s->state |= HTTP2_S_QUEUED;
+    p->queued = 1;
+    return;
+  }
+  p->handling = 1;
+  s->state |= HTTP2_S_HANDLING;
+  if ((s->state & HTTP2_S_FLOOD)) {
+    http_send_error(&s->h, 413);
+  } else {
+    s->h.version = fiobj_str_new("HTTP/2.0", 8);
+    http_on_request_handler______internal(&s->h, p->p.settings);
+    if (s->h.method && !(s->state & (HTTP2_S_PAUSED | HTTP2_S_RESPONDED)))
+      http_finish(&s->h);
+  }
+  s->state &= ~HTTP2_S_HANDLING;
+  p->handling = 0;
+  http2_stream_review(p, s);
+}
+
+/** Handles the requests received while another request was handled. */
+static void http2_on_queued(http2pr_s *p) {
+  p->queued = 0;
+  /* callbacks might free any stream, so the search restarts every time */
+  for (;;) {
+    http2_stream_s *s = NULL;
+    FIO_LS_EMBD_FOR(&p->streams, pos) {
+      http2_stream_s *tmp = FIO_LS_EMBD_OBJ(http2_stream_s, node, pos);
+      if ((tmp->state & HTTP2_S_QUEUED)) {
+        s = tmp;
+        break;
+      }
+    }
+    if (!s)
+      return;
+    s->state &= ~HTTP2_S_QUEUED;
+    http2_on_request(p, s);
+  }
+}
+
+/* *****************************************************************************
+Frame Handlers
+***************************************************************************** */
+
+/** Handles a complete header block. */
+static int http2_on_header_block(http2pr_s *p, uint32_t id, uint8_t end_stream,
+                                 uint8_t *data, size_t len) {
+  http2_stream_s *s = http2_stream_find(p, id);
+  uint8_t refuse = 0;
+  if (s) {
+    /* trailers are decoded and discarded */
+    if ((s->state & HTTP2_S_REMOTE_CLOSED)) {
+      if (http2_hpack_decode(p, NULL, data, len))
+        return http2_connection_error(p, HTTP2_COMPRESSION_ERROR);
+      return http2_connection_error(p, HTTP2_STREAM_CLOSED);
+    }
+    if (http2_hpack_decode(p, NULL, data, len))
+      return http2_connection_error(p, HTTP2_COMPRESSION_ERROR);
+    if (!end_stream)
+      return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+    s->state |= HTTP2_S_REMOTE_CLOSED;
+    http2_on_request(p, s);
+    return 0;
+  }
+  if (id <= p->last_stream || !(id & 1)) {
+    /* a closed stream or a server stream identifier */
+    if (http2_hpack_decode(p, NULL, data, len))
+      return http2_connection_error(p, HTTP2_COMPRESSION_ERROR);
+    if (!(id & 1))
+      return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+    return 0;
+  }
+  p->last_stream = id;
+  if (p->goaway || p->stream_count >= HTTP2_MAX_STREAMS)
+    refuse = 1;
+  else
+    s = http2_stream_new(p, id);
+  if (http2_hpack_decode(p, s, data, len))
+    return http2_connection_error(p, HTTP2_COMPRESSION_ERROR);
+  if (refuse) {
+    http2_send_rst(p, id, HTTP2_REFUSED_STREAM);
+    return 0;
+  }
+  if (end_stream) {
+    s->state |= HTTP2_S_REMOTE_CLOSED;
+    http2_on_request(p, s);
+  }
+  return 0;
+}
+
+/** Removes padding (and priority data) from DATA and HEADERS frames. */
+static int http2_unpad(uint8_t flags, uint8_t **data, uint32_t *len) {
+  uint32_t pad = 0;
+  if ((flags & HTTP2_FLAG_PADDED)) {
+    if (!*len)
+      return -1;
+    pad = (*data)[0];
+    ++(*data);
+    --(*len);
+  }
+  if (pad > *len)
+    return -1;
+  *len -= pad;
+  return 0;
+}
+
+static int http2_on_frame_headers(http2pr_s *p, uint8_t flags, uint32_t id,
+                                  uint8_t *data, uint32_t len) {
+  if (!id)
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  if (http2_unpad(flags, &data, &len))
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  if ((flags & HTTP2_FLAG_PRIORITY)) {
+    if (len < 5)
+      return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+    data += 5;
+    len -= 5;
+  }
+  if ((flags & HTTP2_FLAG_END_HEADERS))
+    return http2_on_header_block(p, id, (flags & HTTP2_FLAG_END_STREAM), data,
+                                 len);
+  p->hblock = fiobj_str_new((char *)data, len);
+  p->hblock_stream = id;
+  p->hblock_end = (flags & HTTP2_FLAG_END_STREAM);
+  return 0;
+}
+
+static int http2_on_frame_continuation(http2pr_s *p, uint8_t flags,
+                                       uint32_t id, uint8_t *data,
+                                       uint32_t len) {
+  if (!p->hblock_stream || id != p->hblock_stream)
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  fiobj_str_write(p->hblock, (char *)data, len);
+  fio_str_info_s b = fiobj_obj2cstr(p->hblock);
+  if (b.len > p->p.settings->max_header_size)
+    return http2_connection_error(p, HTTP2_ENHANCE_YOUR_CALM);
+  if (!(flags & HTTP2_FLAG_END_HEADERS))
+    return 0;
+  FIOBJ block = p->hblock;
+  p->hblock = FIOBJ_INVALID;
+  p->hblock_stream = 0;
+  int ret = http2_on_header_block(p, id, p->hblock_end, (uint8_t *)b.data,
+                                  b.len);
+  fiobj_free(block);
+  return ret;
+}
+
+static int http2_on_frame_data(http2pr_s *p, uint8_t flags, uint32_t id,
+                               uint8_t *data, uint32_t len) {
+  const uint32_t frame_len = len;
+  if (!id)
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  if (http2_unpad(flags, &data, &len))
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  /* the whole frame (padding included) counts against the receive windows */
+  if ((int32_t)frame_len > p->recv_window)
+    return http2_connection_error(p, HTTP2_FLOW_CONTROL_ERROR);
+  /* replenish the connection's flow control window */
+  if (frame_len)
+    http2_send_window_update(p, 0, frame_len);
+  http2_stream_s *s = http2_stream_find(p, id);
+  if (!s) {
+    if (id > p->last_stream)
+      return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+    return 0; /* a closed (or refused) stream */
+  }
+  if ((s->state & HTTP2_S_REMOTE_CLOSED)) {
+    http2_stream_reset(p, s, HTTP2_STREAM_CLOSED);
+    return 0;
+  }
+  if ((int32_t)frame_len > s->recv_window) {
+    http2_stream_reset(p, s, HTTP2_FLOW_CONTROL_ERROR);
+    return 0;
+  }
+  s->recv_window -= frame_len;
+  if (!(s->state & (HTTP2_S_RESPONDED | HTTP2_S_RESET)) && len) {
+    if (!s->h.body) {
+      static uint64_t content_length_hash = 0;
+      if (!content_length_hash)
+        content_length_hash = fiobj_hash_string("content-length", 14);
+      FIOBJ cl = fiobj_hash_get2(s->h.headers, content_length_hash);
+      if (cl && fiobj_obj2num(cl) <= HTTP_MAX_HEADER_LENGTH)
+        s->h.body = fiobj_data_newstr();
+      else
+        s->h.body = fiobj_data_newtmpfile();
+    }
+    fiobj_data_write(s->h.body, data, len);
+    if ((size_t)fiobj_data_len(s->h.body) > p->p.settings->max_body_size) {
+      s->state |= HTTP2_S_HANDLING;
+      http_send_error(&s->h, 413);
+      s->state &= ~HTTP2_S_HANDLING;
+    }
+  }
+  if ((flags & HTTP2_FLAG_END_STREAM)) {
+    s->state |= HTTP2_S_REMOTE_CLOSED;
+    http2_on_request(p, s);
+    return 0;
+  }
+  if (frame_len && !(s->state & (HTTP2_S_RESPONDED | HTTP2_S_RESET))) {
+    http2_send_window_update(p, id, frame_len);
+    s->recv_window += frame_len;
+  }
+  http2_stream_review(p, s);
+  return 0;
+}
+
+static int http2_on_frame_settings(http2pr_s *p, uint8_t flags, uint32_t id,
+                                   uint8_t *data, uint32_t len) {
+  if (id)
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  if ((len % 6))
+    return http2_connection_error(p, HTTP2_FRAME_SIZE_ERROR);
+  if ((flags & HTTP2_FLAG_END_STREAM)) {
+    /* ACK */
+    if (len)
+      return http2_connection_error(p, HTTP2_FRAME_SIZE_ERROR);
+    return 0;
+  }
+  for (uint32_t i = 0; i < len; i += 6) {
+    const uint16_t setting = fio_str2u16(data + i);
+    const uint32_t value = fio_str2u32(data + i + 2);
+    switch (setting) {
+    case 4: /* SETTINGS_INITIAL_WINDOW_SIZE */
+      if (value > HTTP2_MAX_WINDOW)
+        return http2_connection_error(p, HTTP2_FLOW_CONTROL_ERROR);
+      {
+        const int64_t delta = (int64_t)value - p->initial_window;
+        FIO_LS_EMBD_FOR(&p->streams, pos) {
+          http2_stream_s *s = FIO_LS_EMBD_OBJ(http2_stream_s, node, pos);
+          if (s->window + delta > HTTP2_MAX_WINDOW)
+            return http2_connection_error(p, HTTP2_FLOW_CONTROL_ERROR);
+          s->window += delta;
+        }
+        p->initial_window = value;
+      }
+      break;
+    case 5: /* SETTINGS_MAX_FRAME_SIZE */
+      if (value < 16384 || value > 16777215)
+        return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+      p->frame_size = value;
+      break;
+    }
+  }
+  http2_send_frame(p, HTTP2_FRAME_SETTINGS, HTTP2_FLAG_END_STREAM, 0, NULL, 0);
+  http2_flush(p);
+  return 0;
+}
+
+static int http2_on_frame_window_update(http2pr_s *p, uint32_t id,
+                                        uint8_t *data, uint32_t len) {
+  if (len != 4)
+    return http2_connection_error(p, HTTP2_FRAME_SIZE_ERROR);
+  const uint32_t increment = fio_str2u32(data) & 0x7FFFFFFFUL;
+  if (!id) {
+    if (!increment)
+      return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+    if ((int64_t)p->window + increment > HTTP2_MAX_WINDOW)
+      return http2_connection_error(p, HTTP2_FLOW_CONTROL_ERROR);
+    p->window += increment;
+    http2_flush(p);
+    return 0;
+  }
+  http2_stream_s *s = http2_stream_find(p, id);
+  if (!s)
+    return 0;
+  if (!increment) {
+    http2_stream_reset(p, s, HTTP2_PROTOCOL_ERROR);
+    return 0;
+  }
+  if ((int64_t)s->window + increment > HTTP2_MAX_WINDOW) {
+    http2_stream_reset(p, s, HTTP2_FLOW_CONTROL_ERROR);
+    return 0;
+  }
+  s->window += increment;
+  if ((s->state & HTTP2_S_RESPONDED) && !(p->stop & 4))
+    http2_stream_flush(p, s);
+  return 0;
+}
+
+static int http2_on_frame_rst_stream(http2pr_s *p, uint32_t id, uint32_t len) {
+  if (!id)
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  if (len != 4)
+    return http2_connection_error(p, HTTP2_FRAME_SIZE_ERROR);
+  http2_stream_s *s = http2_stream_find(p, id);
+  if (!s)
+    return 0;
+  s->state |= HTTP2_S_RESET;
+  http2_stream_release(s);
+  http2_stream_review(p, s);
+  return 0;
+}
+
+/** Processes a single frame. Returns -1 if processing should stop. */
+static int http2_on_frame(http2pr_s *p, uint8_t type, uint8_t flags,
+                          uint32_t id, uint8_t *data, uint32_t len) {
+  if (p->hblock_stream && type != HTTP2_FRAME_CONTINUATION)
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  switch ((http2_frame_type_e)type) {
+  case HTTP2_FRAME_DATA:
+    return http2_on_frame_data(p, flags, id, data, len);
+  case HTTP2_FRAME_HEADERS:
+    return http2_on_frame_headers(p, flags, id, data, len);
+  case HTTP2_FRAME_CONTINUATION:
+    return http2_on_frame_continuation(p, flags, id, data, len);
+  case HTTP2_FRAME_PRIORITY:
+    if (len != 5)
+      return http2_connection_error(p, HTTP2_FRAME_SIZE_ERROR);
+    return 0;
+  case HTTP2_FRAME_RST_STREAM:
+    return http2_on_frame_rst_stream(p, id, len);
+  case HTTP2_FRAME_SETTINGS:
+    return http2_on_frame_settings(p, flags, id, data, len);
+  case HTTP2_FRAME_PUSH_PROMISE:
+    return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+  case HTTP2_FRAME_PING:
+    if (id)
+      return http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+    if (len != 8)
+      return http2_connection_error(p, HTTP2_FRAME_SIZE_ERROR);
+    if (!(flags & HTTP2_FLAG_END_STREAM))
+      http2_send_frame(p, HTTP2_FRAME_PING, HTTP2_FLAG_END_STREAM, 0, data, 8);
+    return 0;
+  case HTTP2_FRAME_GOAWAY:
+    if (!p->goaway)
+      p->goaway = 1;
+    if (!p->stream_count)
+      fio_close(p->p.uuid);
+    return 0;
+  case HTTP2_FRAME_WINDOW_UPDATE:
+    return http2_on_frame_window_update(p, id, data, len);
+  }
+  /* unknown frame types are ignored */
+  return 0;
+}
+
+/* *****************************************************************************
+Connection Callbacks
+***************************************************************************** */
+
+/**
+ * Processes the frames in the read buffer.
+ *
+ * A streaming `on_request` callback waiting for a WINDOW_UPDATE calls this
+ * function again (see `http2_wait`), so the position is kept in `buf_pos` and
+ * frames never reference the buffer once `on_request` was called.
+ */
+static void http2_consume_data(intptr_t uuid, http2pr_s *p) {
+  if (!p->preface) {
+    if (p->buf_len < 24)
+      return;
+    if (memcmp(p->buf, http2_preface, 24)) {
+      FIO_LOG_DEBUG("(HTTP/2) invalid client preface.");
+      http2_connection_error(p, HTTP2_PROTOCOL_ERROR);
+      return;
+    }
+    p->preface = 1;
+    p->buf_pos = 24;
+  }
+  while (p->buf_len - p->buf_pos >= 9 && p->goaway < 2) {
+    uint8_t *pos = p->buf + p->buf_pos;
+    const uint32_t len = ((uint32_t)pos[0] << 16) | ((uint32_t)pos[1] << 8) |
+                         (uint32_t)pos[2];
+    if (len > HTTP2_FRAME_SIZE) {
+      http2_connection_error(p, HTTP2_FRAME_SIZE_ERROR);
+      return;
+    }
+    if (p->buf_len - p->buf_pos < len + 9)
+      break;
+    p->buf_pos += len + 9;
+    if (http2_on_frame(p, pos[3], pos[4], fio_str2u32(pos + 5) & 0x7FFFFFFFUL,
+                       pos + 9, len))
+      return;
+    if (fio_is_closed(uuid))
+      return;
+    if (p->queued && !p->handling)
+      http2_on_queued(p);
+  }
+  p->buf_len -= p->buf_pos;
+  if (p->buf_len && p->buf_pos)
+    memmove(p->buf, p->buf + p->buf_pos, p->buf_len);
+  p->buf_pos = 0;
+}
+
+/** called when a data is available, but will not run concurrently */
+static void http2_on_data(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  if ((p->stop & 4))
+    http2_flush(p);
+  if (fio_pending(uuid) > HTTP2_MAX_PENDING) {
+    /* throttle busy clients until the socket drains */
+    p->stop |= 4;
+    fio_suspend(uuid);
+    return;
+  }
+  ssize_t i = fio_read(uuid, p->buf + p->buf_len,
+                       HTTP2_READ_BUFFER - p->buf_len);
+  if (i > 0) {
+    p->buf_len += i;
+  }
+  http2_consume_data(uuid, p);
+}
+
+/** called when the socket drained its outgoing buffer */
+static void http2_on_ready(intptr_t uuid, fio_protocol_s *protocol) {
+  /* flushing requires the task lock (performed by `on_data`) */
+  http2pr_s *p = (http2pr_s *)protocol;
+  if ((p->stop & 4)) {
+    fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  }
+}
+
+/** called when the server is shutting down */
+static uint8_t http2_on_shutdown(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  if (!p->goaway)
+    http2_send_goaway(p, HTTP2_NO_ERROR);
+  p->goaway = 2;
+  return 0;
+  (void)uuid;
+}
+
+/** called when the connection was closed, but will not run concurrently */
+static void http2_on_close(intptr_t uuid, fio_protocol_s *protocol) {
+  http2_destroy(protocol);
+  (void)uuid;
+}
+
+/* *****************************************************************************
+Public API
+***************************************************************************** */
+
+/**
+ * Creates an HTTP/2 protocol object and handles any unread data in the buffer
+ * (if any).
+ */
+fio_protocol_s *http2_new(uintptr_t uuid, http_settings_s *settings,
+                          void *unread_data, size_t unread_length) {
+  if (unread_data && unread_length > HTTP2_READ_BUFFER)
+    return NULL;
+  http2pr_s *p = fio_malloc(sizeof(*p) + HTTP2_READ_BUFFER);
+  FIO_ASSERT_ALLOC(p);
+  *p = (http2pr_s){
+      .p.protocol =
+          {
+              .on_data = http2_on_data,
+              .on_ready = http2_on_ready,
+              .on_shutdown = http2_on_shutdown,
+              .on_close = http2_on_close,
+          },
+      .p.uuid = uuid,
+      .p.settings = settings,
+      .streams = FIO_LS_INIT(p->streams),
+      .decoder.max = HTTP2_HPACK_TABLE_SIZE,
+      .frame_size = HTTP2_FRAME_SIZE,
+      .window = HTTP2_DEFAULT_WINDOW,
+      .recv_window = HTTP2_DEFAULT_WINDOW,
+      .initial_window = HTTP2_DEFAULT_WINDOW,
+  };
+  if (unread_data && unread_length) {
+    memcpy(p->buf, unread_data, unread_length);
+    p->buf_len = unread_length;
+  }
+  {
+    /* the server's connection preface (a SETTINGS frame) */
+    uint8_t settings_frame[12];
+    fio_u2str16(settings_frame, 3); /* SETTINGS_MAX_CONCURRENT_STREAMS */
+    fio_u2str32(settings_frame + 2, HTTP2_MAX_STREAMS);
+    fio_u2str16(settings_frame + 6, 6); /* SETTINGS_MAX_HEADER_LIST_SIZE */
+    fio_u2str32(settings_frame + 8, settings->max_header_size);
+    http2_send_frame(p, HTTP2_FRAME_SETTINGS, 0, 0, settings_frame, 12);
+  }
+  /* once attached, the protocol might be closed (and freed) at any time */
+  fio_attach(uuid, &p->p.protocol);
+  if (unread_data && unread_length) {
+    fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  }
+  return &p->p.protocol;
+}
+
+/** Manually destroys the HTTP/2 protocol object. */
+void http2_destroy(fio_protocol_s *pr) {
+  http2pr_s *p = (http2pr_s *)pr;
+  p->goaway = 2; /* don't close the connection while freeing streams */
+  while (fio_ls_embd_any(&p->streams)) {
+    http2_stream_s *s =
+        FIO_LS_EMBD_OBJ(http2_stream_s, node, p->streams.next);
+    http2_stream_free(p, s);
+  }
+  fiobj_free(p->hblock);
+  http2_hpack_destroy(&p->decoder);
+  fio_free(p);
+}
+
+/* *****************************************************************************
+Tests
+***************************************************************************** */
+#if DEBUG
+
+#include <sys/socket.h>
+
+/* a protocol object attached to one end of a socket pair (the client's end is
+ * read by the test) */
+typedef struct {
+  int fds[2];
+  intptr_t uuid;
+  http2pr_s *p;
+} http2_test_s;
+
+/* the last frame of a type sent to the client */
+typedef struct {
+  uint32_t found;
+  uint32_t len;
+  uint32_t id;
+  uint8_t flags;
+  uint8_t payload[8];
+} http2_test_frame_s;
+
+static void http2_test_on_request(http_s *h) {
+  http_send_body(h, "ok", 2);
+}
+
+/* feeds the client's data directly to the parser */
+static void http2_test_feed(http2_test_s *t, const void *data, size_t len) {
+  FIO_ASSERT(t->p->buf_len + len <= HTTP2_READ_BUFFER,
+             "HTTP/2 test data overflows the read buffer");
+  memcpy(t->p->buf + t->p->buf_len, data, len);
+  t->p->buf_len += len;
+  http2_consume_data(t->uuid, t->p);
+}
+
+/* `preface` is fed once the protocol is attached (NULL for none) */
+static void http2_test_open(http2_test_s *t, http_settings_s *settings,
+                            const char *preface) {
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, t->fds),
+             "HTTP/2 test socketpair failed");
+  t->uuid = fio_fd2uuid(t->fds[0]);
+  t->p = (http2pr_s *)http2_new(t->uuid, settings, NULL, 0);
+  FIO_ASSERT(t->p, "HTTP/2 test protocol allocation failed");
+  if (preface)
+    http2_test_feed(t, preface, 24);
+}
+
+/* returns a request header as a C string ("" if missing) */
+static const char *http2_test_header(http2_stream_s *s, const char *name) {
+  FIOBJ v = fiobj_hash_get2(s->h.headers, fiobj_hash_string(name, strlen(name)));
+  return v ? fiobj_obj2cstr(v).data : "";
+}
+
+/* feeds a single frame */
+static void http2_test_frame(http2_test_s *t, uint8_t type, uint8_t flags,
+                             uint32_t id, const void *payload, uint32_t len) {
+  uint8_t frame[9 + 128];
+  FIO_ASSERT(len <= 128, "HTTP/2 test frame payload too long");
+  http2_frame_header(frame, len, type, flags, id);
+  if (len)
+    memcpy(frame + 9, payload, len);
+  http2_test_feed(t, frame, len + 9);
+}
+
+/* reads everything sent to the client, returning the last frame of `type` */
+static http2_test_frame_s http2_test_read(http2_test_s *t, uint8_t type) {
+  http2_test_frame_s r = {.found = 0};
+  static uint8_t buf[1 << 18];
+  size_t len = 0;
+  while (fio_is_valid(t->uuid) && fio_flush(t->uuid) > 0)
+    ;
+  for (;;) {
+    ssize_t i = recv(t->fds[1], buf + len, sizeof(buf) - len, MSG_DONTWAIT);
+    if (i <= 0)
+      break;
+    len += i;
+  }
+  for (size_t pos = 0; pos + 9 <= len;) {
+    const uint32_t flen =
+        ((uint32_t)buf[pos] << 16) | ((uint32_t)buf[pos + 1] << 8) | buf[pos + 2];
+    FIO_ASSERT(pos + 9 + flen <= len, "HTTP/2 test read a partial frame");
+    if (buf[pos + 3] == type) {
+      r = (http2_test_frame_s){
+          .found = 1,
+          .len = flen,
+          .id = fio_str2u32(buf + pos + 5) & 0x7FFFFFFFUL,
+          .flags = buf[pos + 4],
+      };
+      memcpy(r.payload, buf + pos + 9, flen > 8 ? 8 : flen);
+    }
+    pos += 9 + flen;
+  }
+  return r;
+}
+
+static void http2_test_close(http2_test_s *t) {
+  if (fio_is_valid(t->uuid))
+    fio_force_close(t->uuid);
+  fio_defer_perform();
+  close(t->fds[1]);
+}
+
+/* tests that the client's frame triggers a GOAWAY with the `error` code */
+static void http2_test_goaway(http_settings_s *settings, uint8_t type,
+                              uint8_t flags, uint32_t id, const void *payload,
+                              uint32_t len, uint32_t error, const char *name) {
+  http2_test_s t;
+  http2_test_open(&t, settings, http2_preface);
+  http2_test_frame(&t, type, flags, id, payload, len);
+  http2_test_frame_s f = http2_test_read(&t, HTTP2_FRAME_GOAWAY);
+  FIO_ASSERT(f.found && fio_str2u32(f.payload + 4) == error,
+             "HTTP/2 %s should cause a GOAWAY (%u), got %u", name,
+             (unsigned int)error,
+             f.found ? (unsigned int)fio_str2u32(f.payload + 4) : 0xFFFFFFFF);
+  http2_test_close(&t);
+}
+
+/* a request header block: GET / with the `www.example.com` authority */
+static const uint8_t http2_test_request[] = {
+    0x82, 0x86, 0x84, 0x41, 0x0f, 'w', 'w', 'w', '.', 'e',
+    'x',  'a',  'm',  'p',  'l',  'e', '.', 'c', 'o', 'm'};
+
+static void http2_test_hpack(void) {
+  /* RFC 7541, C.3 (without Huffman) and C.4 (with Huffman) */
+  static const struct {
+    const char *block;
+    size_t len;
+  } vectors[2][3] = {
+      {
+          {"\x82\x86\x84\x41\x0f\x77\x77\x77\x2e\x65\x78\x61\x6d\x70\x6c\x65"
+           "\x2e\x63\x6f\x6d",
+           20},
+          {"\x82\x86\x84\xbe\x58\x08\x6e\x6f\x2d\x63\x61\x63\x68\x65", 14},
+          {"\x82\x87\x85\xbf\x40\x0a\x63\x75\x73\x74\x6f\x6d\x2d\x6b\x65\x79"
+           "\x0c\x63\x75\x73\x74\x6f\x6d\x2d\x76\x61\x6c\x75\x65",
+           29},
+      },
+      {
+          {"\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4"
+           "\xff",
+           17},
+          {"\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf", 12},
+          {"\x82\x87\x85\xbf\x40\x88\x25\xa8\x49\xe9\x5b\xa9\x7d\x7f\x89\x25"
+           "\xa8\x49\xe9\x5b\xb8\xe8\xb4\xbf",
+           24},
+      },
+  };
+  static const size_t table_size[3] = {57, 110, 164};
+  static const char *paths[3] = {"/", "/", "/index.html"};
+  http_settings_s settings = {.on_request = http2_test_on_request,
+                              .max_header_size = 8192,
+                              .max_body_size = 1024};
+  for (size_t v = 0; v < 2; ++v) {
+    http2_test_s t;
+    http2_test_open(&t, &settings, http2_preface);
+    for (size_t i = 0; i < 3; ++i) {
+      http2_stream_s *s = http2_stream_new(t.p, (uint32_t)(i * 2 + 1));
+      FIO_ASSERT(!http2_hpack_decode(t.p, s, (uint8_t *)vectors[v][i].block,
+                                     vectors[v][i].len),
+                 "HPACK decoding failed (C.%zu.%zu)", v + 3, i + 1);
+      FIO_ASSERT(t.p->decoder.size == table_size[i],
+                 "HPACK dynamic table size error (C.%zu.%zu): %zu",
+                 v + 3, i + 1, t.p->decoder.size);
+      FIO_ASSERT(!(s->state & HTTP2_S_BAD) &&
+                     fiobj_obj2cstr(s->h.method).len == 3 &&
+                     !strcmp(fiobj_obj2cstr(s->h.path).data, paths[i]),
+                 "HPACK decoded the wrong request (C.%zu.%zu)", v + 3, i + 1);
+      FIO_ASSERT(!strcmp(http2_test_header(s, "host"), "www.example.com"),
+                 "HPACK decoded the wrong authority (C.%zu.%zu)", v + 3, i + 1);
+      FIO_ASSERT(i != 1 ||
+                     !strcmp(http2_test_header(s, "cache-control"), "no-cache"),
+                 "HPACK literal with a static name failed (C.%zu.2)", v + 3);
+      FIO_ASSERT(i != 2 || !strcmp(http2_test_header(s, "custom-key"),
+                                   "custom-value"),
+                 "HPACK literal with a new name failed (C.%zu.3)", v + 3);
+      http2_stream_free(t.p, s);
+    }
+    /* a dynamic table size update evicts everything (the indexes are gone) */
+    FIO_ASSERT(!http2_hpack_decode(t.p, NULL, (uint8_t *)"\x20", 1) &&
+                   !t.p->decoder.count && !t.p->decoder.size,
+               "HPACK dynamic table size update didn't evict the entries");
+    FIO_ASSERT(http2_hpack_decode(t.p, NULL, (uint8_t *)"\xbe", 1),
+               "HPACK should reject indexes beyond the dynamic table");
+    FIO_ASSERT(http2_hpack_decode(t.p, NULL, (uint8_t *)"\x3f\xe2\x1f", 3),
+               "HPACK should reject table size updates above the setting");
+    FIO_ASSERT(http2_hpack_decode(t.p, NULL, (uint8_t *)"\x80", 1),
+               "HPACK should reject the zero index");
+    FIO_ASSERT(http2_hpack_decode(t.p, NULL, (uint8_t *)"\x40\x05" "ab", 4),
+               "HPACK should reject truncated strings");
+    http2_test_close(&t);
+  }
+}
+
+void http2_test(void) {
+  fprintf(stderr, "=== Testing HTTP/2 (HPACK and frames)\n");
+  hpack_test();
+  http2_test_hpack();
+  http_settings_s settings = {.on_request = http2_test_on_request,
+                              .max_header_size = 8192,
+                              .max_body_size = 1024};
+  uint8_t payload[16] = {0};
+  {
+    /* a request is answered, SETTINGS and PING are acknowledged */
+    http2_test_s t;
+    http2_test_open(&t, &settings, http2_preface);
+    http2_test_frame(&t, HTTP2_FRAME_SETTINGS, 0, 0, NULL, 0);
+    http2_test_frame_s f = http2_test_read(&t, HTTP2_FRAME_SETTINGS);
+    FIO_ASSERT(f.found && f.flags == HTTP2_FLAG_END_STREAM && !f.len,
+               "HTTP/2 SETTINGS weren't acknowledged");
+    http2_test_frame(&t, HTTP2_FRAME_PING, 0, 0, "pingpong", 8);
+    f = http2_test_read(&t, HTTP2_FRAME_PING);
+    FIO_ASSERT(f.found && f.flags == HTTP2_FLAG_END_STREAM &&
+                   !memcmp(f.payload, "pingpong", 8),
+               "HTTP/2 PING wasn't acknowledged");
+    http2_test_frame(&t, HTTP2_FRAME_HEADERS,
+                     HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM, 1,
+                     http2_test_request, sizeof(http2_test_request));
+    f = http2_test_read(&t, HTTP2_FRAME_DATA);
+    FIO_ASSERT(f.found && f.id == 1 && f.len == 2 &&
+                   (f.flags & HTTP2_FLAG_END_STREAM) &&
+                   !memcmp(f.payload, "ok", 2),
+               "HTTP/2 request wasn't answered");
+    /* padded HEADERS (with a priority) are accepted */
+    {
+      uint8_t padded[1 + 5 + sizeof(http2_test_request) + 3] = {3};
+      memcpy(padded + 6, http2_test_request, sizeof(http2_test_request));
+      http2_test_frame(&t, HTTP2_FRAME_HEADERS,
+                       HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM |
+                           HTTP2_FLAG_PADDED | HTTP2_FLAG_PRIORITY,
+                       3, padded, sizeof(padded));
+      f = http2_test_read(&t, HTTP2_FRAME_DATA);
+      FIO_ASSERT(f.found && f.id == 3,
+                 "HTTP/2 padded request wasn't answered");
+    }
+    /* GOAWAY from the client refuses new streams (stream 5 remains open) */
+    http2_test_frame(&t, HTTP2_FRAME_HEADERS, HTTP2_FLAG_END_HEADERS, 5,
+                     http2_test_request, sizeof(http2_test_request));
+    http2_test_frame(&t, HTTP2_FRAME_GOAWAY, 0, 0, payload, 8);
+    http2_test_frame(&t, HTTP2_FRAME_HEADERS,
+                     HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM, 7,
+                     http2_test_request, sizeof(http2_test_request));
+    f = http2_test_read(&t, HTTP2_FRAME_RST_STREAM);
+    FIO_ASSERT(f.found && f.id == 7 &&
+                   fio_str2u32(f.payload) == HTTP2_REFUSED_STREAM,
+               "HTTP/2 streams after GOAWAY weren't refused");
+    http2_test_close(&t);
+  }
+  {
+    /* WINDOW_UPDATE frames */
+    http2_test_s t;
+    http2_test_open(&t, &settings, http2_preface);
+    http2_test_frame(&t, HTTP2_FRAME_HEADERS, HTTP2_FLAG_END_HEADERS, 1,
+                     http2_test_request, sizeof(http2_test_request));
+    fio_u2str32(payload, 1024);
+    http2_test_frame(&t, HTTP2_FRAME_WINDOW_UPDATE, 0, 1, payload, 4);
+    FIO_ASSERT(t.p->streams.next != &t.p->streams &&
+                   FIO_LS_EMBD_OBJ(http2_stream_s, node, t.p->streams.next)
+                           ->window == HTTP2_DEFAULT_WINDOW + 1024,
+               "HTTP/2 stream WINDOW_UPDATE wasn't applied");
+    http2_test_frame(&t, HTTP2_FRAME_WINDOW_UPDATE, 0, 0, payload, 4);
+    FIO_ASSERT(t.p->window == HTTP2_DEFAULT_WINDOW + 1024,
+               "HTTP/2 connection WINDOW_UPDATE wasn't applied");
+    fio_u2str32(payload, 0x7FFFFFFFUL);
+    http2_test_frame(&t, HTTP2_FRAME_WINDOW_UPDATE, 0, 1, payload, 4);
+    http2_test_frame_s f = http2_test_read(&t, HTTP2_FRAME_RST_STREAM);
+    FIO_ASSERT(f.found && f.id == 1 &&
+                   fio_str2u32(f.payload) == HTTP2_FLOW_CONTROL_ERROR,
+               "HTTP/2 stream window overflow wasn't reset");
+    http2_test_close(&t);
+  }
+  {
+    /* DATA beyond the receive windows (the windows are replenished after
+     * every frame, so they are reduced here to simulate a peer ignoring them) */
+    http2_test_s t;
+    http2_test_open(&t, &settings, http2_preface);
+    http2_test_frame(&t, HTTP2_FRAME_HEADERS, HTTP2_FLAG_END_HEADERS, 1,
+                     http2_test_request, sizeof(http2_test_request));
+    http2_stream_s *s = http2_stream_find(t.p, 1);
+    FIO_ASSERT(s, "HTTP/2 stream wasn't opened");
+    s->recv_window = 8;
+    memset(payload, 0, sizeof(payload));
+    http2_test_frame(&t, HTTP2_FRAME_DATA, 0, 1, payload, 8);
+    FIO_ASSERT(s->recv_window == 8 && !http2_test_read(&t, HTTP2_FRAME_RST_STREAM).found,
+               "HTTP/2 DATA within the stream's window should be accepted");
+    http2_test_frame(&t, HTTP2_FRAME_DATA, HTTP2_FLAG_PADDED, 1, payload, 9);
+    http2_test_frame_s f = http2_test_read(&t, HTTP2_FRAME_RST_STREAM);
+    FIO_ASSERT(f.found && f.id == 1 &&
+                   fio_str2u32(f.payload) == HTTP2_FLOW_CONTROL_ERROR,
+               "HTTP/2 DATA beyond the stream's window wasn't reset");
+    t.p->recv_window = 8;
+    http2_test_frame(&t, HTTP2_FRAME_DATA, 0, 1, payload, 9);
+    f = http2_test_read(&t, HTTP2_FRAME_GOAWAY);
+    FIO_ASSERT(f.found && fio_str2u32(f.payload + 4) == HTTP2_FLOW_CONTROL_ERROR,
+               "HTTP/2 DATA beyond the connection's window wasn't an error");
+    http2_test_close(&t);
+  }
+  /* connection errors */
+  fio_u2str32(payload, 0);
+  http2_test_goaway(&settings, HTTP2_FRAME_WINDOW_UPDATE, 0, 0, payload, 4,
+                    HTTP2_PROTOCOL_ERROR, "zero WINDOW_UPDATE");
+  fio_u2str32(payload, 0x7FFFFFFFUL);
+  http2_test_goaway(&settings, HTTP2_FRAME_WINDOW_UPDATE, 0, 0, payload, 4,
+                    HTTP2_FLOW_CONTROL_ERROR, "connection window overflow");
+  http2_test_goaway(&settings, HTTP2_FRAME_WINDOW_UPDATE, 0, 0, payload, 3,
+                    HTTP2_FRAME_SIZE_ERROR, "short WINDOW_UPDATE");
+  http2_test_goaway(&settings, HTTP2_FRAME_SETTINGS, 0, 0, payload, 5,
+                    HTTP2_FRAME_SIZE_ERROR, "malformed SETTINGS");
+  http2_test_goaway(&settings, HTTP2_FRAME_SETTINGS, 0, 1, payload, 6,
+                    HTTP2_PROTOCOL_ERROR, "stream SETTINGS");
+  http2_test_goaway(&settings, HTTP2_FRAME_SETTINGS, HTTP2_FLAG_END_STREAM, 0,
+                    payload, 6, HTTP2_FRAME_SIZE_ERROR, "SETTINGS ACK payload");
+  /* SETTINGS_INITIAL_WINDOW_SIZE above the maximum */
+  fio_u2str16(payload, 4);
+  fio_u2str32(payload + 2, 0x80000000UL);
+  http2_test_goaway(&settings, HTTP2_FRAME_SETTINGS, 0, 0, payload, 6,
+                    HTTP2_FLOW_CONTROL_ERROR, "initial window overflow");
+  /* SETTINGS_MAX_FRAME_SIZE below the minimum */
+  fio_u2str16(payload, 5);
+  fio_u2str32(payload + 2, 1024);
+  http2_test_goaway(&settings, HTTP2_FRAME_SETTINGS, 0, 0, payload, 6,
+                    HTTP2_PROTOCOL_ERROR, "small frame size");
+  http2_test_goaway(&settings, HTTP2_FRAME_PING, 0, 0, payload, 7,
+                    HTTP2_FRAME_SIZE_ERROR, "short PING");
+  http2_test_goaway(&settings, HTTP2_FRAME_PING, 0, 1, payload, 8,
+                    HTTP2_PROTOCOL_ERROR, "stream PING");
+  http2_test_goaway(&settings, HTTP2_FRAME_PUSH_PROMISE, 0, 1, payload, 8,
+                    HTTP2_PROTOCOL_ERROR, "client PUSH_PROMISE");
+  http2_test_goaway(&settings, HTTP2_FRAME_CONTINUATION, 4, 1,
+                    http2_test_request, sizeof(http2_test_request),
+                    HTTP2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+  http2_test_goaway(&settings, HTTP2_FRAME_HEADERS, 5, 2, http2_test_request,
+                    sizeof(http2_test_request), HTTP2_PROTOCOL_ERROR,
+                    "server stream identifier");
+  http2_test_goaway(&settings, HTTP2_FRAME_HEADERS, 5, 1, "\xbe", 1,
+                    HTTP2_COMPRESSION_ERROR, "invalid header block");
+  http2_test_goaway(&settings, HTTP2_FRAME_DATA, 0, 0, payload, 4,
+                    HTTP2_PROTOCOL_ERROR, "connection DATA");
+  http2_test_goaway(&settings, HTTP2_FRAME_DATA, 0, 7, payload, 4,
+                    HTTP2_PROTOCOL_ERROR, "DATA on an idle stream");
+  payload[0] = 8;
+  http2_test_goaway(&settings, HTTP2_FRAME_DATA, HTTP2_FLAG_PADDED, 1, payload,
+                    4, HTTP2_PROTOCOL_ERROR, "padding beyond the frame");
+  http2_test_goaway(&settings, HTTP2_FRAME_HEADERS,
+                    HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_PRIORITY, 1, payload,
+                    4, HTTP2_PROTOCOL_ERROR, "short priority data");
+  {
+    /* frames above the maximum frame size */
+    http2_test_s t;
+    http2_test_open(&t, &settings, http2_preface);
+    uint8_t head[9];
+    http2_frame_header(head, HTTP2_FRAME_SIZE + 1, HTTP2_FRAME_DATA, 0, 1);
+    http2_test_feed(&t, head, 9);
+    http2_test_frame_s f = http2_test_read(&t, HTTP2_FRAME_GOAWAY);
+    FIO_ASSERT(f.found && fio_str2u32(f.payload + 4) == HTTP2_FRAME_SIZE_ERROR,
+               "HTTP/2 oversized frame should cause a FRAME_SIZE_ERROR");
+    http2_test_close(&t);
+  }
+  {
+    /* an invalid connection preface */
+    http2_test_s t;
+    http2_test_open(&t, &settings, NULL);
+    http2_test_feed(&t, "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n", 24);
+    http2_test_frame_s f = http2_test_read(&t, HTTP2_FRAME_GOAWAY);
+    FIO_ASSERT(f.found && fio_str2u32(f.payload + 4) == HTTP2_PROTOCOL_ERROR,
+               "HTTP/2 invalid preface should cause a PROTOCOL_ERROR");
+    http2_test_close(&t);
+  }
+  fprintf(stderr, "* passed.\n");
+}
+#endif
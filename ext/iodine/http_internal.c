@@ -19,6 +19,8 @@ void http_on_request_handler______internal(http_s *h,
   if (!http_upgrade_hash)
     http_upgrade_hash = fiobj_hash_string("upgrade", 7);
   h->udata = settings->udata;
+  if (settings->log)
+    clock_gettime(CLOCK_REALTIME, &h->private_data.handled_at);
 
   static uint64_t host_hash = 0;
   if (!host_hash)
@@ -26,22 +28,31 @@ void http_on_request_handler______internal(http_s *h,
 
   if (1) {
     /* test for Host header and avoid duplicates */
-    FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
-    if (!tmp)
-      goto missing_host;
-    if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY)) {
-      fiobj_hash_set(h->headers, HTTP_HEADER_HOST, fiobj_ary_pop(tmp));
+    if (h->headers) {
+      FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
+      if (!tmp)
+        goto missing_host;
+      if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY)) {
+        fiobj_hash_set(h->headers, HTTP_HEADER_HOST, fiobj_ary_pop(tmp));
+      }
+    } else {
+      if (!http_header_get(h, host_hash).data)
+        goto missing_host;
+      http_hslices_remove(h->private_data.hslices, host_hash, 1);
     }
   }
 
-  FIOBJ t = fiobj_hash_get2(h->headers, http_upgrade_hash);
-  if (t)
+  fio_str_info_s t = http_header_get(h, http_upgrade_hash);
+  if (t.data)
     goto upgrade;
 
-  if (fiobj_iseq(
-          fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_ACCEPT)),
-          HTTP_HVALUE_SSE_MIME))
-    goto eventsource;
+  {
+    fio_str_info_s accept =
+        http_header_get(h, fiobj_obj2hash(HTTP_HEADER_ACCEPT));
+    fio_str_info_s sse = fiobj_obj2cstr(HTTP_HVALUE_SSE_MIME);
+    if (accept.len == sse.len && !memcmp(accept.data, sse.data, sse.len))
+      goto eventsource;
+  }
   if (settings->public_folder) {
     fio_str_info_s path_str = fiobj_obj2cstr(h->path);
     if (!http_sendfile2(h, settings->public_folder,
@@ -50,19 +61,22 @@ void http_on_request_handler______internal(http_s *h,
       return;
     }
   }
+  if (settings->micro_cache_size > 0 && http_micro_cache_request(h, settings))
+    return;
   settings->on_request(h);
   return;
 
 upgrade:
   if (1) {
-    fiobj_dup(t); /* allow upgrade name access after http_finish */
-    fio_str_info_s val = fiobj_obj2cstr(t);
+    /* allow upgrade name access after http_finish */
+    FIOBJ name = fiobj_str_new(t.data, t.len);
+    fio_str_info_s val = fiobj_obj2cstr(name);
     if (val.data[0] == 'h' && val.data[1] == '2') {
       http_send_error(h, 400);
     } else {
       settings->on_upgrade(h, val.data, val.len);
     }
-    fiobj_free(t);
+    fiobj_free(name);
     return;
   }
 eventsource:
@@ -79,13 +93,12 @@ void http_on_response_handler______internal(http_s *h,
   if (!http_upgrade_hash)
     http_upgrade_hash = fiobj_hash_string("upgrade", 7);
   h->udata = settings->udata;
-  FIOBJ t = fiobj_hash_get2(h->headers, http_upgrade_hash);
-  if (t == FIOBJ_INVALID) {
+  fio_str_info_s t = http_header_get(h, http_upgrade_hash);
+  if (!t.data) {
     settings->on_response(h);
     return;
   } else {
-    fio_str_info_s val = fiobj_obj2cstr(t);
-    settings->on_upgrade(h, val.data, val.len);
+    settings->on_upgrade(h, t.data, t.len);
   }
 }
 
@@ -105,6 +118,228 @@ int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings) {
   return ret;
 }
 
+/* *****************************************************************************
+Request headers stored as slices
+***************************************************************************** */
+
+/** Allocates a new header slices store. */
+http_hslices_s *http_hslices_new(void) {
+  http_hslices_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  s->buf = NULL;
+  s->len = 0;
+  s->capa = 0;
+  s->count = 0;
+  memset(s->index, 0, sizeof(s->index));
+  return s;
+}
+
+/** Frees a header slices store. */
+void http_hslices_free(http_hslices_s *s) {
+  if (!s)
+    return;
+  fio_free(s->buf);
+  fio_free(s);
+}
+
+/** Adds a header. Returns -1 if the header count limit was reached. */
+int http_hslices_add(http_hslices_s *s, char *name, size_t name_len,
+                     char *value, size_t value_len) {
+  if (s->count > HTTP_MAX_HEADER_COUNT)
+    return -1;
+  const size_t required = s->len + name_len + value_len + 2;
+  if (required > s->capa) {
+    size_t capa = s->capa ? s->capa : 1024;
+    while (capa < required)
+      capa <<= 1;
+    s->buf = fio_realloc2(s->buf, capa, s->len);
+    FIO_ASSERT_ALLOC(s->buf);
+    s->capa = capa;
+  }
+  http_hslice_s *slice = s->slices + s->count;
+  *slice = (http_hslice_s){
+      .hash = fiobj_hash_string(name, name_len),
+      .name = s->len,
+      .name_len = name_len,
+      .value = s->len + name_len + 1,
+      .value_len = value_len,
+  };
+  memcpy(s->buf + slice->name, name, name_len);
+  s->buf[slice->name + name_len] = 0;
+  memcpy(s->buf + slice->value, value, value_len);
+  s->buf[slice->value + value_len] = 0;
+  s->len = required;
+  ++s->count;
+  /* index by name, the newest value replaces (and links to) the older one */
+  size_t pos = slice->hash & (HTTP_HSLICES_INDEX - 1);
+  while (s->index[pos]) {
+    http_hslice_s *old = s->slices + (s->index[pos] - 1);
+    if (old->hash == slice->hash) {
+      slice->prev = s->index[pos];
+      slice->dup = old->dup + 1;
+      break;
+    }
+    pos = (pos + 1) & (HTTP_HSLICES_INDEX - 1);
+  }
+  s->index[pos] = s->count;
+  return 0;
+}
+
+/** Returns the last (non-removed) value of a header, or NULL. */
+http_hslice_s *http_hslices_find(http_hslices_s *s, uint64_t hash) {
+  size_t pos = hash & (HTTP_HSLICES_INDEX - 1);
+  while (s->index[pos]) {
+    http_hslice_s *slice = s->slices + (s->index[pos] - 1);
+    if (slice->hash == hash)
+      return (slice->removed ? NULL : slice);
+    pos = (pos + 1) & (HTTP_HSLICES_INDEX - 1);
+  }
+  return NULL;
+}
+
+/** Removes a header. If `keep_last` is set, only previous values are removed. */
+void http_hslices_remove(http_hslices_s *s, uint64_t hash, uint8_t keep_last) {
+  http_hslice_s *slice = http_hslices_find(s, hash);
+  if (!slice)
+    return;
+  if (keep_last) {
+    slice->dup = 0;
+    slice = (slice->prev ? s->slices + (slice->prev - 1) : NULL);
+  }
+  while (slice) {
+    slice->removed = 1;
+    slice = (slice->prev ? s->slices + (slice->prev - 1) : NULL);
+  }
+}
+
+/** Creates a Hash containing the headers (same layout as `set_header_add`). */
+FIOBJ http_hslices2hash(http_hslices_s *s) {
+  FIOBJ hash = fiobj_hash_new2(s->count);
+  for (size_t i = 0; i < s->count; ++i) {
+    http_hslice_s *slice = s->slices + i;
+    if (slice->removed)
+      continue;
+    FIOBJ name = fiobj_str_new(s->buf + slice->name, slice->name_len);
+    set_header_add(hash, name,
+                   fiobj_str_new(s->buf + slice->value, slice->value_len));
+    fiobj_free(name);
+  }
+  return hash;
+}
+
+/* *****************************************************************************
+Request scoped memory (a per-connection arena)
+***************************************************************************** */
+
+static http_arena_stats_s http_arena_stats_data;
+
+static http_arena_page_s *http_arena_page_new(size_t capa) {
+  http_arena_page_s *page = fio_malloc(sizeof(*page) + capa);
+  FIO_ASSERT_ALLOC(page);
+  page->next = NULL;
+  page->capa = capa;
+  return page;
+}
+
+/** Allocates a new arena (and it's first page). */
+http_arena_s *http_arena_new(void) {
+  http_arena_s *a = fio_malloc(sizeof(*a));
+  FIO_ASSERT_ALLOC(a);
+  *a = (http_arena_s){
+      .page = http_arena_page_new(HTTP_ARENA_PAGE_SIZE -
+                                  sizeof(http_arena_page_s)),
+  };
+  return a;
+}
+
+/** Frees an arena and all it's pages. */
+void http_arena_free(http_arena_s *a) {
+  if (!a)
+    return;
+  http_arena_clear(a);
+  fio_free(a->page);
+  fio_free(a);
+}
+
+/** Allocates 16 byte aligned memory from the arena. */
+void *http_arena_alloc(http_arena_s *a, size_t len) {
+  len = (len + 15) & (~(size_t)15);
+  if (a->pos + len > a->page->capa) {
+    /* overflow pages are freed once the request is finished */
+    size_t capa = HTTP_ARENA_PAGE_SIZE - sizeof(http_arena_page_s);
+    if (len > capa)
+      capa = len;
+    http_arena_page_s *page = http_arena_page_new(capa);
+    page->next = a->page;
+    a->page = page;
+    a->pos = 0;
+    ++a->pages;
+  }
+  void *ret = (char *)(a->page + 1) + a->pos;
+  a->pos += len;
+  a->bytes += len;
+  ++a->allocations;
+  return ret;
+}
+
+/** Empties the arena, keeping the first (warm) page. */
+void http_arena_clear(http_arena_s *a) {
+  if (!a->allocations)
+    return;
+#if DEBUG
+  /* the String follows its link (see `http_arena_str_alloc`) */
+  for (void **link = a->strs; link; link = link[0]) {
+    FIOBJ str = (FIOBJ)((uintptr_t)(link + 2) | FIOBJECT_STRING_FLAG);
+    FIO_ASSERT(FIOBJECT2HEAD(str)->ref < FIOBJ_STR_NEW_IN_REF,
+               "an arena String (%s) is still referenced after the request",
+               fiobj_obj2cstr(str).data);
+  }
+  a->strs = NULL;
+#endif
+  while (a->page->next) {
+    http_arena_page_s *tmp = a->page;
+    a->page = tmp->next;
+    fio_free(tmp);
+  }
+  fio_atomic_add(&http_arena_stats_data.requests, 1);
+  fio_atomic_add(&http_arena_stats_data.allocations, a->allocations);
+  fio_atomic_add(&http_arena_stats_data.bytes, a->bytes);
+  if (a->pages)
+    fio_atomic_add(&http_arena_stats_data.pages, a->pages);
+  a->pos = 0;
+  a->bytes = 0;
+  a->allocations = 0;
+  a->pages = 0;
+}
+
+static void *http_arena_str_alloc(void *arena, size_t len) {
+#if DEBUG
+  /* Strings are linked, so `http_arena_clear` can test their references */
+  http_arena_s *a = arena;
+  void **link = http_arena_alloc(a, len + (sizeof(void *) * 2));
+  link[0] = a->strs;
+  a->strs = link;
+  return link + 2;
+#else
+  return http_arena_alloc(arena, len);
+#endif
+}
+
+/** Creates a frozen String object in the arena. */
+FIOBJ http_arena_str(http_arena_s *a, const char *data, size_t len) {
+  return fiobj_str_new_in(http_arena_str_alloc, a, data, len);
+}
+
+/** Returns the process's request arena statistics. */
+http_arena_stats_s http_arena_stats(void) {
+  return (http_arena_stats_s){
+      .requests = fio_atomic_add(&http_arena_stats_data.requests, 0),
+      .allocations = fio_atomic_add(&http_arena_stats_data.allocations, 0),
+      .bytes = fio_atomic_add(&http_arena_stats_data.bytes, 0),
+      .pages = fio_atomic_add(&http_arena_stats_data.pages, 0),
+  };
+}
+
 /* *****************************************************************************
 Library initialization
 ***************************************************************************** */
@@ -125,8 +360,11 @@ FIOBJ HTTP_HEADER_LAST_MODIFIED;
 FIOBJ HTTP_HEADER_ORIGIN;
 FIOBJ HTTP_HEADER_SET_COOKIE;
 FIOBJ HTTP_HEADER_UPGRADE;
+FIOBJ HTTP_HEADER_VARY;
 FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 FIOBJ HTTP_HEADER_WS_SEC_KEY;
+FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
+FIOBJ HTTP_HVALUE_BR;
 FIOBJ HTTP_HVALUE_BYTES;
 FIOBJ HTTP_HVALUE_CLOSE;
 FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -139,6 +377,7 @@ FIOBJ HTTP_HVALUE_WEBSOCKET;
 FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 FIOBJ HTTP_HVALUE_WS_UPGRADE;
 FIOBJ HTTP_HVALUE_WS_VERSION;
+FIOBJ HTTP_HVALUE_ZSTD;
 
 static void http_lib_init(void *ignr_);
 static void http_lib_cleanup(void *ignr_);
@@ -152,6 +391,7 @@ void http_mimetype_stats(void);
 static void http_lib_cleanup(void *ignr_) {
   (void)ignr_;
   http_mimetype_clear();
+  http_file_cache_clear();
 #define HTTPLIB_RESET(x)                                                       \
   fiobj_free(x);                                                               \
   x = FIOBJ_INVALID;
@@ -171,8 +411,11 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HEADER_ORIGIN);
   HTTPLIB_RESET(HTTP_HEADER_SET_COOKIE);
   HTTPLIB_RESET(HTTP_HEADER_UPGRADE);
+  HTTPLIB_RESET(HTTP_HEADER_VARY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_KEY);
+  HTTPLIB_RESET(HTTP_HVALUE_ACCEPT_ENCODING);
+  HTTPLIB_RESET(HTTP_HVALUE_BR);
   HTTPLIB_RESET(HTTP_HVALUE_BYTES);
   HTTPLIB_RESET(HTTP_HVALUE_CLOSE);
   HTTPLIB_RESET(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
@@ -185,6 +428,7 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HVALUE_WS_SEC_VERSION);
   HTTPLIB_RESET(HTTP_HVALUE_WS_UPGRADE);
   HTTPLIB_RESET(HTTP_HVALUE_WS_VERSION);
+  HTTPLIB_RESET(HTTP_HVALUE_ZSTD);
 
 #undef HTTPLIB_RESET
   http_mimetype_stats();
@@ -212,8 +456,11 @@ static void http_lib_init(void *ignr_) {
   HTTP_HEADER_ORIGIN = fiobj_str_new("origin", 6);
   HTTP_HEADER_SET_COOKIE = fiobj_str_new("set-cookie", 10);
   HTTP_HEADER_UPGRADE = fiobj_str_new("upgrade", 7);
+  HTTP_HEADER_VARY = fiobj_str_new("vary", 4);
   HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_str_new("sec-websocket-key", 17);
   HTTP_HEADER_WS_SEC_KEY = fiobj_str_new("sec-websocket-accept", 20);
+  HTTP_HVALUE_ACCEPT_ENCODING = fiobj_str_new("accept-encoding", 15);
+  HTTP_HVALUE_BR = fiobj_str_new("br", 2);
   HTTP_HVALUE_BYTES = fiobj_str_new("bytes", 5);
   HTTP_HVALUE_CLOSE = fiobj_str_new("close", 5);
   HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
@@ -227,6 +474,7 @@ static void http_lib_init(void *ignr_) {
   HTTP_HVALUE_WS_SEC_VERSION = fiobj_str_new("sec-websocket-version", 21);
   HTTP_HVALUE_WS_UPGRADE = fiobj_str_new("Upgrade", 7);
   HTTP_HVALUE_WS_VERSION = fiobj_str_new("13", 2);
+  HTTP_HVALUE_ZSTD = fiobj_str_new("zstd", 4);
 
   fiobj_obj2hash(HTTP_HEADER_ACCEPT_RANGES);
   fiobj_obj2hash(HTTP_HEADER_CACHE_CONTROL);
@@ -243,8 +491,11 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HEADER_ORIGIN);
   fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
   fiobj_obj2hash(HTTP_HEADER_UPGRADE);
+  fiobj_obj2hash(HTTP_HEADER_VARY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_KEY);
+  fiobj_obj2hash(HTTP_HVALUE_ACCEPT_ENCODING);
+  fiobj_obj2hash(HTTP_HVALUE_BR);
   fiobj_obj2hash(HTTP_HVALUE_BYTES);
   fiobj_obj2hash(HTTP_HVALUE_CLOSE);
   fiobj_obj2hash(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
@@ -257,6 +508,7 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HVALUE_WS_SEC_VERSION);
   fiobj_obj2hash(HTTP_HVALUE_WS_UPGRADE);
   fiobj_obj2hash(HTTP_HVALUE_WS_VERSION);
+  fiobj_obj2hash(HTTP_HVALUE_ZSTD);
 
 #define REGISTER_MIME(ext, type)                                               \
   http_mimetype_register((char *)ext, sizeof(ext) - 1,                         \
@@ -35,6 +35,18 @@ struct http_vtable_s {
   int (*const http_stream)(http_s *h, void *data, uintptr_t length);
   /** Should send existing headers or complete streaming */
   void (*const http_finish)(http_s *h);
+  /** Should abort streaming (the client must be able to tell) */
+  void (*const http_stream_abort)(http_s *h);
+  /**
+   * (optional) Should return the number of packets held back by the protocol
+   * (i.e., waiting for flow control), see `http_pending`.
+   */
+  size_t (*http_pending)(http_s *h);
+  /**
+   * (optional) Should wait (briefly) for the client to accept the packets held
+   * back by the protocol. Returns -1 if the stream was lost.
+   */
+  int (*http_wait)(http_s *h);
   /** Push for data. */
   int (*const http_push_data)(http_s *h, void *data, uintptr_t length,
                               FIOBJ mime_type);
@@ -56,6 +68,18 @@ struct http_vtable_s {
   int (*http_sse_write)(http_sse_s *sse, FIOBJ str);
   /** Closes an EventSource (SSE) connection. */
   int (*http_sse_close)(http_sse_s *sse);
+  /**
+   * (optional) Should serialize the existing headers (without sending them),
+   * leaving room for `length` bytes of body, so the response can be reused
+   * (see `http_send_prepared`). Returns FIOBJ_INVALID if unsupported.
+   */
+  FIOBJ (*http_prepare)(http_s *h, uintptr_t length);
+  /**
+   * (optional) Should send a response serialized by `http_prepare` (headers
+   * and body), consuming the packet. Returns -1 (without consuming the packet)
+   * if the request can't be answered with a pre-serialized response.
+   */
+  int (*http_send_prepared)(http_s *h, FIOBJ packet);
 };
 
 struct http_fio_protocol_s {
@@ -73,6 +97,9 @@ Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 extern FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 extern FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 extern FIOBJ HTTP_HEADER_WS_SEC_KEY;
+extern FIOBJ HTTP_HEADER_VARY;
+extern FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
+extern FIOBJ HTTP_HVALUE_BR;
 extern FIOBJ HTTP_HVALUE_BYTES;
 extern FIOBJ HTTP_HVALUE_CLOSE;
 extern FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -85,27 +112,212 @@ extern FIOBJ HTTP_HVALUE_WEBSOCKET;
 extern FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 extern FIOBJ HTTP_HVALUE_WS_UPGRADE;
 extern FIOBJ HTTP_HVALUE_WS_VERSION;
+extern FIOBJ HTTP_HVALUE_ZSTD;
+
+/* *****************************************************************************
+Request headers stored as slices
+***************************************************************************** */
+
+#ifndef HTTP_HSLICES_INDEX
+/**
+ * The number of slots in the header slice index (open addressing). Must be a
+ * power of 2, larger than HTTP_MAX_HEADER_COUNT.
+ */
+#define HTTP_HSLICES_INDEX 256
+#endif
+
+#if HTTP_HSLICES_INDEX <= HTTP_MAX_HEADER_COUNT ||                             \
+    (HTTP_HSLICES_INDEX & (HTTP_HSLICES_INDEX - 1))
+#error HTTP_HSLICES_INDEX must be a power of 2, larger than HTTP_MAX_HEADER_COUNT
+#endif
+
+/** A header name / value pair, stored as offsets into the slices buffer. */
+typedef struct {
+  uint64_t hash;      /* the header name's hash (`fiobj_hash_string`) */
+  uint32_t name;      /* the name's offset in the buffer (NUL terminated) */
+  uint32_t name_len;  /* the name's length */
+  uint32_t value;     /* the value's offset in the buffer (NUL terminated) */
+  uint32_t value_len; /* the value's length */
+  uint16_t prev;      /* the previous value of the same header (1 based) */
+  uint16_t dup;       /* the number of previous values of the same header */
+  uint8_t removed;    /* set by http_hslices_remove */
+} http_hslice_s;
+
+/**
+ * A per-connection store for request headers, reused by every request.
+ *
+ * The header data is copied once (the parser's buffer moves as data is
+ * consumed) and FIOBJ objects are only created if the Hash is requested.
+ */
+typedef struct {
+  char *buf;       /* the header data */
+  uint32_t len;    /* the header data's length */
+  uint32_t capa;   /* the buffer's capacity */
+  uint32_t count;  /* the number of slices */
+  uint16_t index[HTTP_HSLICES_INDEX]; /* slice numbers (1 based) by name */
+  http_hslice_s slices[HTTP_MAX_HEADER_COUNT + 1];
+} http_hslices_s;
+
+/** Allocates a new header slices store. */
+http_hslices_s *http_hslices_new(void);
+
+/** Frees a header slices store. */
+void http_hslices_free(http_hslices_s *s);
+
+/** Empties the store (preparing it for the next request). */
+static inline void http_hslices_clear(http_hslices_s *s) {
+  if (!s->count)
+    return;
+  memset(s->index, 0, sizeof(s->index));
+  s->count = 0;
+  s->len = 0;
+}
+
+/** Adds a header. Returns -1 if the header count limit was reached. */
+int http_hslices_add(http_hslices_s *s, char *name, size_t name_len,
+                     char *value, size_t value_len);
+
+/** Returns the last (non-removed) value of a header, or NULL. */
+http_hslice_s *http_hslices_find(http_hslices_s *s, uint64_t hash);
+
+/** Removes a header. If `keep_last` is set, only previous values are removed. */
+void http_hslices_remove(http_hslices_s *s, uint64_t hash, uint8_t keep_last);
+
+/** Creates a Hash containing the headers (same layout as `set_header_add`). */
+FIOBJ http_hslices2hash(http_hslices_s *s);
+
+/** Returns a slice's name. */
+#define http_hslice_name(s, slice)                                             \
+  ((fio_str_info_s){.data = (s)->buf + (slice)->name, .len = (slice)->name_len})
+/** Returns a slice's value. */
+#define http_hslice_value(s, slice)                                            \
+  ((fio_str_info_s){.data = (s)->buf + (slice)->value,                          \
+                    .len = (slice)->value_len})
+
+/* *****************************************************************************
+Request scoped memory (a per-connection arena)
+***************************************************************************** */
+
+#ifndef HTTP_ARENA_PAGE_SIZE
+/**
+ * The size of an arena memory page (including the page's header). The first
+ * page is kept (warm) between requests on the same connection.
+ */
+#define HTTP_ARENA_PAGE_SIZE 4096
+#endif
+
+/** An arena memory page (followed by the page's data). */
+typedef struct http_arena_page_s {
+  struct http_arena_page_s *next; /* the previous page */
+  size_t capa;                    /* the data's capacity */
+#if UINTPTR_MAX != UINT64_MAX
+  uint8_t padding[16 - (sizeof(void *) + sizeof(size_t))];
+#endif
+} http_arena_page_s;
+
+/**
+ * A per-connection bump allocator for request scoped memory.
+ *
+ * Memory is never freed individually - the whole arena is emptied in one step
+ * (`http_arena_clear`) once the request is finished, so objects allocated in
+ * the arena MUST NOT outlive the request.
+ *
+ * The arena holds the request's method, path, query and version Strings. The
+ * body isn't allocated from the arena, since it grows as it's received (up to
+ * `max_body_size`, possibly moving to a temporary file). The cookies and params
+ * Hashes are only created on demand (`http_parse_cookies` / `http_parse_query`,
+ * which Rack applications don't use) and grow by reallocating their storage,
+ * which a bump allocator can't release.
+ */
+typedef struct {
+  http_arena_page_s *page; /* the current page, linked to previous pages */
+  size_t pos;              /* the used portion of the current page */
+  size_t bytes;            /* bytes allocated for the current request */
+  size_t allocations;      /* allocations for the current request */
+  size_t pages;            /* overflow pages allocated for the current request */
+#if DEBUG
+  void **strs; /* the request's Strings, tested for references by `clear` */
+#endif
+} http_arena_s;
+
+/** Allocates a new arena (and it's first page). */
+http_arena_s *http_arena_new(void);
+
+/** Frees an arena and all it's pages. */
+void http_arena_free(http_arena_s *a);
+
+/** Allocates 16 byte aligned memory from the arena. */
+void *http_arena_alloc(http_arena_s *a, size_t len);
+
+/**
+ * Empties the arena (preparing it for the next request), freeing any overflow
+ * pages and updating the `http_arena_stats` counters.
+ *
+ * In DEBUG mode, fails if a String created by `http_arena_str` is still
+ * referenced (i.e., it was `fiobj_dup`-ed, or the request didn't release it).
+ */
+void http_arena_clear(http_arena_s *a);
+
+/**
+ * Creates a frozen String object in the arena (see `fiobj_str_new_in`).
+ *
+ * `fiobj_free` is a no-op for these Strings, and they MUST NOT be used (or
+ * `fiobj_dup`-ed for later use) after the request was finished.
+ */
+FIOBJ http_arena_str(http_arena_s *a, const char *data, size_t len);
 
 /* *****************************************************************************
 HTTP request/response object management
 ***************************************************************************** */
 
-static inline void http_s_new(http_s *h, http_fio_protocol_s *owner,
-                              http_vtable_s *vtbl) {
+/**
+ * Answers a request from the micro-cache, or pauses it while an identical
+ * request is handled (see the `micro_cache_size` setting). Returns 0 if the
+ * request should be handled by the application.
+ */
+int http_micro_cache_request(http_s *h, http_settings_s *settings);
+
+/**
+ * Completes a micro-cache entry that wasn't filled by the response (i.e.,
+ * streamed responses), handling the waiting requests.
+ */
+void http_micro_cache_release(void *entry);
+
+/**
+ * Initializes an HTTP handle. If `hslices` is set, the request headers will be
+ * stored there instead of the `headers` Hash. If `arena` is set, it's emptied
+ * so it can be used for the request's (request scoped) data.
+ */
+static inline void http_s_new2(http_s *h, http_fio_protocol_s *owner,
+                               http_vtable_s *vtbl, http_hslices_s *hslices,
+                               http_arena_s *arena) {
   *h = (http_s){
       .private_data =
           {
               .vtbl = vtbl,
               .flag = (uintptr_t)owner,
               .out_headers = fiobj_hash_new(),
+              .hslices = hslices,
+              .arena = arena,
           },
-      .headers = fiobj_hash_new(),
+      .headers = (hslices ? FIOBJ_INVALID : fiobj_hash_new()),
       .received_at = fio_last_tick(),
       .status = 200,
   };
+  if (hslices)
+    http_hslices_clear(hslices);
+  if (arena)
+    http_arena_clear(arena);
+}
+
+static inline void http_s_new(http_s *h, http_fio_protocol_s *owner,
+                              http_vtable_s *vtbl) {
+  http_s_new2(h, owner, vtbl, NULL, NULL);
 }
 
 static inline void http_s_destroy(http_s *h, uint8_t log) {
+  if (h->private_data.micro_cache)
+    http_micro_cache_release(h->private_data.micro_cache);
   if (log && h->status && !h->status_str) {
     http_write_log(h);
   }
@@ -123,13 +335,16 @@ static inline void http_s_destroy(http_s *h, uint8_t log) {
   *h = (http_s){
       .private_data.vtbl = h->private_data.vtbl,
       .private_data.flag = h->private_data.flag,
+      .private_data.hslices = h->private_data.hslices,
+      .private_data.arena = h->private_data.arena,
   };
 }
 
 static inline void http_s_clear(http_s *h, uint8_t log) {
   http_s_destroy(h, log);
-  http_s_new(h, (http_fio_protocol_s *)h->private_data.flag,
-             h->private_data.vtbl);
+  http_s_new2(h, (http_fio_protocol_s *)h->private_data.flag,
+              h->private_data.vtbl, h->private_data.hslices,
+              h->private_data.arena);
 }
 
 /** tests handle validity */
@@ -148,6 +363,13 @@ void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings);
 int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings);
 
+/**
+ * Releases a file descriptor passed to the `http_sendfile` VTable function
+ * (files may be shared by the static file cache). Protocols MUST use this
+ * instead of `close`.
+ */
+void http_sendfile_close(intptr_t fd);
+
 /* *****************************************************************************
 EventSource Support (SSE)
 ***************************************************************************** */
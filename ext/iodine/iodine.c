@@ -5,6 +5,7 @@
 #define FIO_INCLUDE_LINKED_LIST
 #include "fio.h"
 #include "fio_cli.h"
+#include "iodine_compress.h"
 /* *****************************************************************************
 OS specific patches
 ***************************************************************************** */
@@ -38,20 +39,28 @@ ID iodine_to_s_id;
 static VALUE address_sym;
 static VALUE app_sym;
 static VALUE body_sym;
+static VALUE compress_min_sym;
+static VALUE compress_sym;
 static VALUE cookies_sym;
 static VALUE handler_sym;
 static VALUE headers_sym;
+static VALUE lazy_env_sym;
 static VALUE log_sym;
 static VALUE max_body_sym;
 static VALUE max_clients_sym;
 static VALUE max_headers_sym;
 static VALUE max_msg_sym;
 static VALUE method_sym;
+static VALUE micro_cache_sym;
+static VALUE micro_cache_vary_sym;
 static VALUE path_sym;
+static VALUE pipeline_sym;
 static VALUE ping_sym;
 static VALUE port_sym;
 static VALUE public_sym;
+static VALUE reuse_port_sym;
 static VALUE service_sym;
+static VALUE static_cache_sym;
 static VALUE timeout_sym;
 static VALUE tls_sym;
 static VALUE url_sym;
@@ -326,6 +335,30 @@ static VALUE iodine_running(VALUE self) {
   }
 }
 
+/**
+ * Returns a Hash with the connection table statistics:
+ *
+ * - `:capacity` - the maximum number of open files (connections).
+ * - `:used` - one above the highest file descriptor used so far.
+ * - `:resident` - the (approximate) memory used by the connection tables.
+ * - `:per_connection` - the connection table memory used by each connection.
+ *
+ * Memory is only committed for file descriptors that were actually used, so
+ * the resident memory follows the number of connections rather than the open
+ * file limit.
+ */
+static VALUE iodine_connection_stats(VALUE self) {
+  fio_capa_stats_s stats = fio_capa_stats();
+  VALUE h = rb_hash_new();
+  rb_hash_aset(h, ID2SYM(rb_intern("capacity")), SIZET2NUM(stats.capa));
+  rb_hash_aset(h, ID2SYM(rb_intern("used")), SIZET2NUM(stats.used));
+  rb_hash_aset(h, ID2SYM(rb_intern("resident")), SIZET2NUM(stats.resident));
+  rb_hash_aset(h, ID2SYM(rb_intern("per_connection")),
+               SIZET2NUM(stats.per_connection));
+  return h;
+  (void)self;
+}
+
 /* *****************************************************************************
 CLI parser (Ruby's OptParser is more limiting than I knew...)
 ***************************************************************************** */
@@ -401,15 +434,33 @@ static VALUE iodine_cli_parse(VALUE self) {
       FIO_CLI_INT("-workers -w number of processes to use."),
       FIO_CLI_PRINT("Negative concurrency values "
                     "map to fractions of available CPU cores."),
+      FIO_CLI_BOOL("-reuse-port -reuse per-worker listening sockets "
+                   "(SO_REUSEPORT)."),
       FIO_CLI_PRINT_HEADER("HTTP Settings:"),
       FIO_CLI_STRING("-public -www public folder, for static file service."),
       FIO_CLI_INT("-keep-alive -k -tout HTTP keep-alive timeout in seconds "
                   "(0..255). Default: 40s"),
       FIO_CLI_BOOL("-log -v HTTP request logging."),
+      FIO_CLI_STRING("-log-file -lf HTTP request log file (implies -v). "
+                     "Reopened on SIGHUP. Default: stderr"),
+      FIO_CLI_BOOL("-log-json -lj HTTP request logging in JSON (implies -v)."),
+      FIO_CLI_BOOL("-lazy-env -lazy Rack env headers are copied on demand."),
       FIO_CLI_INT(
           "-max-body -maxbd HTTP upload limit in Mega-Bytes. Default: 50Mb"),
       FIO_CLI_INT("-max-header -maxhd header limit per HTTP request in Kb. "
                   "Default: 32Kb."),
+      FIO_CLI_INT("-static-cache -sc static file memory cache limit in "
+                  "Mega-Bytes (0 disables). Default: 8Mb"),
+      FIO_CLI_INT("-micro-cache -mc dynamic GET response cache limit in "
+                  "Mega-Bytes (see Cache-Control: s-maxage). Default: off"),
+      FIO_CLI_STRING("-micro-cache-vary -mcv comma separated request headers "
+                     "added to the micro-cache key."),
+      FIO_CLI_INT("-compress -cmp compresses dynamic responses using the "
+                  "compression level (1..9). Default: off"),
+      FIO_CLI_INT("-compress-min -cmpmin minimal response length for "
+                  "compression in bytes. Default: 1024"),
+      FIO_CLI_INT("-pipeline -pl pipelined HTTP/1.x requests handled (and "
+                  "responses coalesced) per pass. Default: 8"),
       FIO_CLI_PRINT_HEADER("WebSocket Settings:"),
       FIO_CLI_INT("-max-msg -maxms incoming WebSocket message limit in Kb. "
                   "Default: 250Kb"),
@@ -457,9 +508,22 @@ static VALUE iodine_cli_parse(VALUE self) {
   if (fio_cli_get("-t")) {
     iodine_threads_set(IodineModule, INT2NUM(fio_cli_get_i("-t")));
   }
-  if (fio_cli_get_bool("-v")) {
+  if (fio_cli_get("-lf") && http_log_output(fio_cli_get("-lf"), -1)) {
+    FIO_LOG_ERROR("couldn't open the log file %s: %s", fio_cli_get("-lf"),
+                  strerror(errno));
+  }
+  if (fio_cli_get_bool("-lj")) {
+    http_log_format(HTTP_LOG_FORMAT_JSON);
+  }
+  if (fio_cli_get_bool("-v") || fio_cli_get("-lf") || fio_cli_get_bool("-lj")) {
     rb_hash_aset(defaults, log_sym, Qtrue);
   }
+  if (fio_cli_get_bool("-reuse-port")) {
+    rb_hash_aset(defaults, reuse_port_sym, Qtrue);
+  }
+  if (fio_cli_get_bool("-lazy-env")) {
+    rb_hash_aset(defaults, lazy_env_sym, Qtrue);
+  }
   if (fio_cli_get_bool("-warmup")) {
     rb_hash_aset(defaults, ID2SYM(rb_intern("warmup_")), Qtrue);
   }
@@ -511,6 +575,26 @@ static VALUE iodine_cli_parse(VALUE self) {
     rb_hash_aset(defaults, max_body_sym,
                  INT2NUM((fio_cli_get_i("-max-body") /* * 1024 * 1024 */)));
   }
+  if (fio_cli_get("-sc")) {
+    rb_hash_aset(defaults, static_cache_sym, INT2NUM(fio_cli_get_i("-sc")));
+  }
+  if (fio_cli_get("-mc")) {
+    rb_hash_aset(defaults, micro_cache_sym, INT2NUM(fio_cli_get_i("-mc")));
+  }
+  if (fio_cli_get("-mcv")) {
+    rb_hash_aset(defaults, micro_cache_vary_sym,
+                 rb_str_new_cstr(fio_cli_get("-mcv")));
+  }
+  if (fio_cli_get("-cmp")) {
+    rb_hash_aset(defaults, compress_sym, INT2NUM(fio_cli_get_i("-cmp")));
+  }
+  if (fio_cli_get("-cmpmin")) {
+    rb_hash_aset(defaults, compress_min_sym,
+                 INT2NUM(fio_cli_get_i("-cmpmin")));
+  }
+  if (fio_cli_get("-pl")) {
+    rb_hash_aset(defaults, pipeline_sym, INT2NUM(fio_cli_get_i("-pl")));
+  }
   if (fio_cli_get("-maxms")) {
     rb_hash_aset(defaults, max_msg_sym,
                  INT2NUM((fio_cli_get_i("-maxms") /* * 1024 */)));
@@ -634,6 +718,8 @@ FIO_FUNC void iodine_connect_args_cleanup(iodine_connection_args_s *s) {
     fio_free(s->port.data);
   if (s->address.capa)
     fio_free(s->address.data);
+  if (s->micro_cache_vary.capa)
+    fio_free(s->micro_cache_vary.data);
   if (s->tls)
     fio_tls_destroy(s->tls);
 }
@@ -656,7 +742,15 @@ Supported Settigs:
 - `:body` (HTTP client)
 - `:tls`
 - `:log` (HTTP only)
+- `:lazy_env` (HTTP server only)
+- `:micro_cache` (HTTP server only)
+- `:micro_cache_vary` (HTTP server only)
+- `:compress` (HTTP server only)
+- `:compress_min` (HTTP server only)
+- `:pipeline` (HTTP server only)
 - `:public` (public folder, HTTP server only)
+- `:reuse_port` (servers only)
+- `:static_cache` (HTTP server only)
 - `:timeout` (HTTP only)
 - `:ping` (`:raw` clients and WebSockets only)
 - `:max_headers` (HTTP only)
@@ -671,20 +765,28 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
   VALUE address = rb_hash_aref(s, address_sym);
   VALUE app = rb_hash_aref(s, app_sym);
   VALUE body = rb_hash_aref(s, body_sym);
+  VALUE compress = rb_hash_aref(s, compress_sym);
+  VALUE compress_min = rb_hash_aref(s, compress_min_sym);
   VALUE cookies = rb_hash_aref(s, cookies_sym);
   VALUE handler = rb_hash_aref(s, handler_sym);
   VALUE headers = rb_hash_aref(s, headers_sym);
+  VALUE lazy_env = rb_hash_aref(s, lazy_env_sym);
   VALUE log = rb_hash_aref(s, log_sym);
   VALUE max_body = rb_hash_aref(s, max_body_sym);
   VALUE max_clients = rb_hash_aref(s, max_clients_sym);
   VALUE max_headers = rb_hash_aref(s, max_headers_sym);
   VALUE max_msg = rb_hash_aref(s, max_msg_sym);
   VALUE method = rb_hash_aref(s, method_sym);
+  VALUE micro_cache = rb_hash_aref(s, micro_cache_sym);
+  VALUE micro_cache_vary = rb_hash_aref(s, micro_cache_vary_sym);
   VALUE path = rb_hash_aref(s, path_sym);
+  VALUE pipeline = rb_hash_aref(s, pipeline_sym);
   VALUE ping = rb_hash_aref(s, ping_sym);
   VALUE port = rb_hash_aref(s, port_sym);
   VALUE r_public = rb_hash_aref(s, public_sym);
+  VALUE reuse_port = rb_hash_aref(s, reuse_port_sym);
   VALUE service = rb_hash_aref(s, service_sym);
+  VALUE static_cache = rb_hash_aref(s, static_cache_sym);
   VALUE timeout = rb_hash_aref(s, timeout_sym);
   VALUE tls = rb_hash_aref(s, tls_sym);
   VALUE r_url = rb_hash_aref(s, url_sym);
@@ -695,12 +797,18 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
     address = rb_hash_aref(iodine_default_args, address_sym);
   if (app == Qnil)
     app = rb_hash_aref(iodine_default_args, app_sym);
+  if (compress == Qnil)
+    compress = rb_hash_aref(iodine_default_args, compress_sym);
+  if (compress_min == Qnil)
+    compress_min = rb_hash_aref(iodine_default_args, compress_min_sym);
   if (cookies == Qnil)
     cookies = rb_hash_aref(iodine_default_args, cookies_sym);
   if (handler == Qnil)
     handler = rb_hash_aref(iodine_default_args, handler_sym);
   if (headers == Qnil)
     headers = rb_hash_aref(iodine_default_args, headers_sym);
+  if (lazy_env == Qnil)
+    lazy_env = rb_hash_aref(iodine_default_args, lazy_env_sym);
   if (log == Qnil)
     log = rb_hash_aref(iodine_default_args, log_sym);
   if (max_body == Qnil)
@@ -713,8 +821,14 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
     max_msg = rb_hash_aref(iodine_default_args, max_msg_sym);
   if (method == Qnil)
     method = rb_hash_aref(iodine_default_args, method_sym);
+  if (micro_cache == Qnil)
+    micro_cache = rb_hash_aref(iodine_default_args, micro_cache_sym);
+  if (micro_cache_vary == Qnil)
+    micro_cache_vary = rb_hash_aref(iodine_default_args, micro_cache_vary_sym);
   if (path == Qnil)
     path = rb_hash_aref(iodine_default_args, path_sym);
+  if (pipeline == Qnil)
+    pipeline = rb_hash_aref(iodine_default_args, pipeline_sym);
   if (ping == Qnil)
     ping = rb_hash_aref(iodine_default_args, ping_sym);
   if (port == Qnil)
@@ -722,8 +836,12 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
   if (r_public == Qnil) {
     r_public = rb_hash_aref(iodine_default_args, public_sym);
   }
+  if (reuse_port == Qnil)
+    reuse_port = rb_hash_aref(iodine_default_args, reuse_port_sym);
   // if (service == Qnil) // not supported by default settings...
   //   service = rb_hash_aref(iodine_default_args, service_sym);
+  if (static_cache == Qnil)
+    static_cache = rb_hash_aref(iodine_default_args, static_cache_sym);
   if (timeout == Qnil)
     timeout = rb_hash_aref(iodine_default_args, timeout_sym);
   if (tls == Qnil)
@@ -768,12 +886,69 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
   if (log != Qnil && log != Qfalse) {
     r.log = 1;
   }
+  if (is_srv && lazy_env != Qnil && lazy_env != Qfalse) {
+    r.lazy_env = 1;
+  }
   if (max_body != Qnil && RB_TYPE_P(max_body, T_FIXNUM)) {
     r.max_body = FIX2ULONG(max_body) * 1024 * 1024;
   }
   if (max_clients != Qnil && RB_TYPE_P(max_clients, T_FIXNUM)) {
     r.max_clients = FIX2ULONG(max_clients);
   }
+  if (is_srv && static_cache != Qnil) {
+    /* `false` or 0 disable the cache (HTTP uses 0 for the default limit) */
+    if (static_cache == Qfalse)
+      r.static_cache = -1;
+    else if (RB_TYPE_P(static_cache, T_FIXNUM))
+      r.static_cache = FIX2LONG(static_cache) > 0
+                           ? (intptr_t)FIX2LONG(static_cache) * 1024 * 1024
+                           : -1;
+  }
+  if (is_srv && micro_cache != Qnil && RB_TYPE_P(micro_cache, T_FIXNUM) &&
+      FIX2LONG(micro_cache) > 0) {
+    r.micro_cache = (intptr_t)FIX2LONG(micro_cache) * 1024 * 1024;
+  }
+  if (is_srv && micro_cache_vary != Qnil) {
+    /* a String or an Array of header names, joined by commas */
+    if (!RB_TYPE_P(micro_cache_vary, T_ARRAY))
+      micro_cache_vary = rb_ary_new_from_args(1, micro_cache_vary);
+    FIOBJ tmp = fiobj_str_buf(64);
+    for (long i = 0; i < RARRAY_LEN(micro_cache_vary); ++i) {
+      VALUE name = rb_ary_entry(micro_cache_vary, i);
+      if (RB_TYPE_P(name, T_SYMBOL))
+        name = rb_sym2str(name);
+      if (!RB_TYPE_P(name, T_STRING)) {
+        FIO_LOG_WARNING("invalid :micro_cache_vary header name, ignored.");
+        continue;
+      }
+      if (fiobj_obj2cstr(tmp).len)
+        fiobj_str_write(tmp, ",", 1);
+      fiobj_str_write(tmp, RSTRING_PTR(name), RSTRING_LEN(name));
+    }
+    fio_str_info_s t = fiobj_obj2cstr(tmp);
+    if (t.len) {
+      r.micro_cache_vary = (fio_str_info_s){
+          .data = fio_malloc(t.len + 1), .len = t.len, .capa = 1};
+      FIO_ASSERT_ALLOC(r.micro_cache_vary.data);
+      memcpy(r.micro_cache_vary.data, t.data, t.len + 1);
+    }
+    fiobj_free(tmp);
+  }
+  if (is_srv && compress != Qnil && compress != Qfalse) {
+    /* `true` selects the default level, 0 disables compression */
+    if (compress == Qtrue)
+      r.compress = IODINE_COMPRESS_DEFAULT_LEVEL;
+    else if (RB_TYPE_P(compress, T_FIXNUM) && FIX2LONG(compress) > 0)
+      r.compress = FIX2LONG(compress) > 9 ? 9 : (uint8_t)FIX2LONG(compress);
+  }
+  if (is_srv && compress_min != Qnil && RB_TYPE_P(compress_min, T_FIXNUM) &&
+      FIX2LONG(compress_min) > 0) {
+    r.compress_min = FIX2ULONG(compress_min);
+  }
+  if (is_srv && pipeline != Qnil && RB_TYPE_P(pipeline, T_FIXNUM) &&
+      FIX2LONG(pipeline) > 0) {
+    r.pipeline = FIX2ULONG(pipeline);
+  }
   if (max_headers != Qnil && RB_TYPE_P(max_headers, T_FIXNUM)) {
     r.max_headers = FIX2ULONG(max_headers) * 1024;
   }
@@ -812,6 +987,12 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
   if (r_public != Qnil && RB_TYPE_P(r_public, T_STRING)) {
     r.public = IODINE_RSTRINFO(r_public);
   }
+  if (is_srv && reuse_port != Qnil && reuse_port != Qfalse) {
+    r.reuse_port = 1;
+    if (RB_TYPE_P(reuse_port, T_SYMBOL) &&
+        SYM2ID(reuse_port) == rb_intern("cpu"))
+      r.reuse_port = 2;
+  }
   if (service != Qnil && RB_TYPE_P(service, T_STRING)) {
     service_str = IODINE_RSTRINFO(service);
   } else if (service != Qnil && RB_TYPE_P(service, T_SYMBOL)) {
@@ -960,14 +1141,22 @@ Supported Settigs:
 | `:url` | URL indicating service type, host name and port. Path will be parsed as a Unix socket. |
 | `:handler` | (deprecated: `:app`) see details below. |
 | `:address` | an IP address or a unix socket address. Only relevant if `:url` is missing. |
-| `:log` |  (HTTP only) request logging. For global verbosity see {Iodine.verbosity} |
+| `:compress` | (HTTP server only) compresses dynamic responses (gzip, deflate or brotli, according to the request's `Accept-Encoding`) using the compression level (`1..9`, `true` for 6). Responses with a `Content-Encoding` are left untouched. Default: off. |
+| `:compress_min` | (HTTP server only) the minimal response body length (in bytes) for compression. Default: 1024. |
+| `:lazy_env` | (HTTP server only) when `true`, the `HTTP_*` headers are only copied to the Rack `env` when the application reads them (see below). |
+| `:log` |  (HTTP only) request logging. See {Iodine.access_log=} for the log's output and format. For global verbosity see {Iodine.verbosity} |
 | `:max_body` | (HTTP only) maximum upload size allowed per request before disconnection (in Mb). |
 | `:max_headers` |  (HTTP only) maximum total header length allowed per request (in Kb). |
+| `:micro_cache` | (HTTP server only) memory limit (in Mb) for dynamic `GET` responses kept in memory (as complete HTTP/1.1 responses) for the number of seconds set by the response's `Cache-Control: s-maxage` directive. Concurrent identical requests are collapsed into a single call to the application. Responses that set cookies (or are `private` / `no-store` / `no-cache`) aren't cached. Default: off. |
+| `:micro_cache_vary` | (HTTP server only) the request headers (an Array or a comma separated String) added to the `:micro_cache` key (the method, host, path, query and `Accept-Encoding`). The response's `Vary` header may only list these headers. |
 | `:max_msg` |  (WebSockets only) maximum message size pre message (in Kb). |
 | `:ping` |  (`:raw` clients and WebSockets only) ping interval (in seconds). Up to 255 seconds. |
+| `:pipeline` | (HTTP server only) the number of pipelined HTTP/1.x requests handled in a single pass (before other connections are served). Their responses are coalesced and sent together. Default: 8. |
 | `:port` | port number to listen to either a String or Number) |
 | `:public` | (HTTP server only) public folder for static file service. |
+| `:reuse_port` | (TCP/IP only) when `true`, each worker process listens on its own `SO_REUSEPORT` socket and the kernel balances new connections between workers. Use `:cpu` to (also) steer connections by the receiving CPU (Linux). |
 | `:service` | (`:raw` / `:tls` / `:ws` / `:wss` / `:http` / `:https` ) a supported service this socket will listen to. |
+| `:static_cache` | (HTTP server only) memory limit (in Mb) for small static files kept in memory as complete HTTP/1.1 responses. Shared by all the HTTP services in the process. `0` (or `false`) disables. Default: 8Mb. |
 | `:timeout` |  (HTTP only) keep-alive timeout in seconds. Up to 255 seconds. |
 | `:tls` | an {Iodine::TLS} context object for encrypted connections. |
 
@@ -977,6 +1166,8 @@ If `:url` is provided, it will overwrite the `:address` and `:port` settings (if
 
 For HTTP connections, the `:handler` **must** be a valid Rack application object (answers `.call(env)`).
 
+When `:lazy_env` is set, the `HTTP_*` request headers are only copied to the Rack `env` when read using `env[key]` (or `dig`), which saves the String objects for headers the application never reads. Since `env` remains a Hash (as required by `Rack::Lint`), iteration (`each`, `keys`, `select`, etc'), `key?` / `fetch` and copies (`dup`, `merge`, etc') only see the headers that were already read, unless {Iodine.load_env} is called first to copy the remaining headers. Similar to `rack.input`, headers are only available until the application returns a response. WebSocket and EventSource (SSE) requests always copy all the headers.
+
 Here's an example for an HTTP hello world application:
 
       require 'iodine'
@@ -1274,20 +1465,28 @@ void Init_iodine(void) {
   IODINE_MAKE_SYM(address);
   IODINE_MAKE_SYM(app);
   IODINE_MAKE_SYM(body);
+  IODINE_MAKE_SYM(compress);
+  IODINE_MAKE_SYM(compress_min);
   IODINE_MAKE_SYM(cookies);
   IODINE_MAKE_SYM(handler);
   IODINE_MAKE_SYM(headers);
+  IODINE_MAKE_SYM(lazy_env);
   IODINE_MAKE_SYM(log);
   IODINE_MAKE_SYM(max_body);
   IODINE_MAKE_SYM(max_clients);
   IODINE_MAKE_SYM(max_headers);
   IODINE_MAKE_SYM(max_msg);
   IODINE_MAKE_SYM(method);
+  IODINE_MAKE_SYM(micro_cache);
+  IODINE_MAKE_SYM(micro_cache_vary);
   IODINE_MAKE_SYM(path);
+  IODINE_MAKE_SYM(pipeline);
   IODINE_MAKE_SYM(ping);
   IODINE_MAKE_SYM(port);
   IODINE_MAKE_SYM(public);
+  IODINE_MAKE_SYM(reuse_port);
   IODINE_MAKE_SYM(service);
+  IODINE_MAKE_SYM(static_cache);
   IODINE_MAKE_SYM(timeout);
   IODINE_MAKE_SYM(tls);
   IODINE_MAKE_SYM(url);
@@ -1318,6 +1517,8 @@ void Init_iodine(void) {
   rb_define_module_function(IodineModule, "master?", iodine_master_is, 0);
   rb_define_module_function(IodineModule, "worker?", iodine_worker_is, 0);
   rb_define_module_function(IodineModule, "running?", iodine_running, 0);
+  rb_define_module_function(IodineModule, "connection_stats",
+                            iodine_connection_stats, 0);
   rb_define_module_function(IodineModule, "listen", iodine_listen, 1);
   rb_define_module_function(IodineModule, "connect", iodine_connect, 1);
 
@@ -22,10 +22,18 @@ typedef struct {
   size_t max_headers;
   size_t max_body;
   intptr_t max_clients;
+  intptr_t static_cache;
+  intptr_t micro_cache;
+  fio_str_info_s micro_cache_vary;
+  size_t compress_min;
+  size_t pipeline;
   size_t max_msg;
   uint8_t timeout;
   uint8_t ping;
   uint8_t log;
+  uint8_t reuse_port;
+  uint8_t lazy_env;
+  uint8_t compress;
   enum {
     IODINE_SERVICE_RAW,
     IODINE_SERVICE_HTTP,
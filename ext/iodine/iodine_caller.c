@@ -21,6 +21,7 @@ typedef struct {
   VALUE (*protected_task)(VALUE tsk_);
   VALUE (*each_func)(VALUE block_arg, VALUE data, int argc, VALUE *argv);
   VALUE each_udata;
+  VALUE (*c_func)(VALUE arg);
 } iodine_rb_task_s;
 
 /* printout backtrace in case of exceptions */
@@ -67,12 +68,19 @@ static VALUE iodine_ruby_caller_perform(VALUE tsk_) {
   return rb_funcall2(task->obj, task->method, task->argc, task->argv);
 }
 
+/* calls the C function within the protection block */
+static VALUE iodine_ruby_caller_perform_c(VALUE tsk_) {
+  iodine_rb_task_s *task = (void *)tsk_;
+  return task->c_func(task->obj);
+}
+
 /* wrap the function call in exception handling block (uses longjmp) */
 static void *iodine_protect_ruby_call(void *task_) {
   int state = 0;
   VALUE ret = rb_protect(((iodine_rb_task_s *)task_)->protected_task,
                          (VALUE)(task_), &state);
   if (state) {
+    ((iodine_rb_task_s *)task_)->exception = state;
     iodine_handle_exception(NULL);
   }
   return (void *)ret;
@@ -150,6 +158,20 @@ static VALUE iodine_call_block(VALUE obj, ID method, int argc, VALUE *argv,
   return (VALUE)rv;
 }
 
+/**
+ * Calls a C function within the GVL, protecting against exceptions. Returns -1
+ * if an exception was raised (the exception is reported) and 0 on success.
+ */
+static int iodine_protect(VALUE (*func)(VALUE arg), VALUE arg) {
+  iodine_rb_task_s task = {
+      .obj = arg,
+      .c_func = func,
+      .protected_task = iodine_ruby_caller_perform_c,
+  };
+  iodine_enterGVL(iodine_protect_ruby_call, &task);
+  return task.exception ? -1 : 0;
+}
+
 /** Returns the GVL state flag. */
 static uint8_t iodine_in_GVL(void) { return iodine_GVL_state; }
 
@@ -171,6 +193,8 @@ struct IodineCaller_s IodineCaller = {
     .call = iodine_call,
     /** Calls a Ruby method on a given object, protecting against exceptions. */
     .call2 = iodine_call2,
+    /** Calls a C function within the GVL, protecting against exceptions. */
+    .protect = iodine_protect,
     /** Returns the GVL state flag. */
     .in_GVL = iodine_in_GVL,
     /** Forces the GVL state flag. */
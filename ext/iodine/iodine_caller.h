@@ -18,6 +18,11 @@ extern struct IodineCaller_s {
   VALUE(*call_with_block)
   (VALUE obj, ID method, int argc, VALUE *argv, VALUE udata,
    VALUE (*block_func)(VALUE block_argv1, VALUE udata, int argc, VALUE *argv));
+  /**
+   * Calls a C function within the GVL, protecting against exceptions. Returns
+   * -1 if an exception was raised (the exception is reported) and 0 otherwise.
+   */
+  int (*protect)(VALUE (*func)(VALUE arg), VALUE arg);
   /** Returns the GVL state flag. */
   uint8_t (*in_GVL)(void);
   /** Forces the GVL state flag. */
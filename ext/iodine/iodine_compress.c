@@ -0,0 +1,331 @@
+#include "iodine_compress.h"
+
+#include "fio.h"
+#include "http_internal.h"
+
+#include <string.h>
+#include <strings.h>
+
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if HAVE_ZLIB && HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+/* *****************************************************************************
+Compressors
+***************************************************************************** */
+
+struct iodine_compress_s {
+  iodine_compress_e encoding;
+#if HAVE_ZLIB
+  z_stream z;
+#endif
+#if HAVE_ZLIB && HAVE_BROTLI
+  BrotliEncoderState *br;
+#endif
+};
+
+/** Returns 1 if iodine was compiled with compression support (zlib). */
+uint8_t iodine_compress_available(void) {
+#if HAVE_ZLIB
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/** Creates a compressor for the encoding (level 1..9), or returns NULL. */
+iodine_compress_s *iodine_compress_new(iodine_compress_e encoding,
+                                       uint8_t level) {
+#if HAVE_ZLIB
+  if (level > 9)
+    level = 9;
+  iodine_compress_s *c = fio_malloc(sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  *c = (iodine_compress_s){.encoding = encoding};
+  switch (encoding) {
+  case IODINE_COMPRESS_GZIP: /* fallthrough */
+  case IODINE_COMPRESS_DEFLATE:
+    /* gzip uses a gzip header and trailer (window bits + 16) */
+    if (deflateInit2(&c->z, level, Z_DEFLATED,
+                     (encoding == IODINE_COMPRESS_GZIP ? 31 : 15), 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      goto error;
+    return c;
+#if HAVE_BROTLI
+  case IODINE_COMPRESS_BR:
+    c->br = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    if (!c->br)
+      goto error;
+    BrotliEncoderSetParameter(c->br, BROTLI_PARAM_QUALITY, level);
+    BrotliEncoderSetParameter(c->br, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+    return c;
+#endif
+  default:
+    break;
+  }
+error:
+  fio_free(c);
+#endif
+  return NULL;
+  (void)encoding;
+  (void)level;
+}
+
+/** Frees a compressor. */
+void iodine_compress_free(iodine_compress_s *c) {
+  if (!c)
+    return;
+#if HAVE_ZLIB
+#if HAVE_BROTLI
+  if (c->encoding == IODINE_COMPRESS_BR)
+    BrotliEncoderDestroyInstance(c->br);
+  else
+#endif
+    deflateEnd(&c->z);
+#endif
+  fio_free(c);
+}
+
+/**
+ * Compresses (and flushes) a chunk of data, appending the compressed data to
+ * the `dest` String. Set `finish` to complete the compressed stream.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int iodine_compress_write(iodine_compress_s *c, FIOBJ dest, const void *data,
+                          size_t length, uint8_t finish) {
+#if HAVE_ZLIB
+  if (!c)
+    return -1;
+  /* reserve a bit more than the length a fast compression would require */
+  size_t reserve = (length >> 1) + 64;
+#if HAVE_BROTLI
+  if (c->encoding == IODINE_COMPRESS_BR) {
+    size_t avail_in = length;
+    const uint8_t *next_in = data;
+    const BrotliEncoderOperation op =
+        finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH;
+    for (;;) {
+      size_t len = fiobj_obj2cstr(dest).len;
+      size_t avail_out = fiobj_str_capa_assert(dest, len + reserve) - len;
+      uint8_t *next_out = (uint8_t *)fiobj_obj2cstr(dest).data + len;
+      if (!BrotliEncoderCompressStream(c->br, op, &avail_in, &next_in,
+                                       &avail_out, &next_out, NULL))
+        return -1;
+      fiobj_str_resize(dest,
+                       (size_t)((char *)next_out - fiobj_obj2cstr(dest).data));
+      if (!avail_in && !BrotliEncoderHasMoreOutput(c->br) &&
+          (!finish || BrotliEncoderIsFinished(c->br)))
+        return 0;
+      reserve <<= 1;
+    }
+  }
+#endif
+  c->z.next_in = (Bytef *)data;
+  c->z.avail_in = (uInt)length;
+  for (;;) {
+    size_t len = fiobj_obj2cstr(dest).len;
+    size_t capa = fiobj_str_capa_assert(dest, len + reserve);
+    c->z.next_out = (Bytef *)fiobj_obj2cstr(dest).data + len;
+    c->z.avail_out = (uInt)(capa - len);
+    int r = deflate(&c->z, finish ? Z_FINISH : Z_SYNC_FLUSH);
+    fiobj_str_resize(dest, capa - c->z.avail_out);
+    if (r == Z_STREAM_END)
+      return 0;
+    if (r != Z_OK && r != Z_BUF_ERROR)
+      return -1;
+    /* a full output buffer might hide more data (or the stream's end) */
+    if (c->z.avail_out && !c->z.avail_in)
+      return finish ? -1 : 0;
+    reserve <<= 1;
+  }
+#else
+  return -1;
+  (void)c;
+  (void)dest;
+  (void)data;
+  (void)length;
+  (void)finish;
+#endif
+}
+
+/**
+ * Compresses a complete body, returning a new String, or FIOBJ_INVALID on
+ * error.
+ */
+FIOBJ iodine_compress_body(iodine_compress_e encoding, uint8_t level,
+                           const void *data, size_t length) {
+  iodine_compress_s *c = iodine_compress_new(encoding, level);
+  if (!c)
+    return FIOBJ_INVALID;
+  FIOBJ dest = fiobj_str_buf((length >> 1) + 64);
+  if (iodine_compress_write(c, dest, data, length, 1)) {
+    fiobj_free(dest);
+    dest = FIOBJ_INVALID;
+  }
+  iodine_compress_free(c);
+  return dest;
+}
+
+/* *****************************************************************************
+Selecting the content encoding
+***************************************************************************** */
+
+/* the names of the encodings (see `http_accept_encoding`), by enum value */
+static const char *const iodine_compress_encodings[] = {"identity", "gzip",
+                                                        "deflate", "br"};
+
+/* returns the (first) value of a response header */
+static fio_str_info_s iodine_compress_header(http_s *h, uint64_t hash) {
+  FIOBJ o = fiobj_hash_get2(h->private_data.out_headers, hash);
+  if (o && FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY))
+    o = fiobj_ary_index(o, 0);
+  if (!o)
+    return (fio_str_info_s){.data = NULL};
+  return fiobj_obj2cstr(o);
+}
+
+/* tests a (lower case) token within a (case insensitive) header value */
+static uint8_t iodine_compress_has(fio_str_info_s value, const char *token,
+                                   size_t len) {
+  for (size_t i = 0; i + len <= value.len; ++i) {
+    if (!strncasecmp(value.data + i, token, len))
+      return 1;
+  }
+  return 0;
+}
+
+/* tests if the (response) content type is worth compressing */
+static uint8_t iodine_compress_type(fio_str_info_s t) {
+  char *end = memchr(t.data, ';', t.len);
+  if (end)
+    t.len = end - t.data;
+  while (t.len && t.data[t.len - 1] == ' ')
+    --t.len;
+  if (t.len > 5 && !strncasecmp(t.data, "text/", 5))
+    return 1;
+  if (t.len > 5 && (!strncasecmp(t.data + t.len - 5, "+json", 5) ||
+                    !strncasecmp(t.data + t.len - 4, "+xml", 4)))
+    return 1;
+  if (t.len <= 12 || strncasecmp(t.data, "application/", 12))
+    return 0;
+  static const char *const types[] = {
+      "json", "javascript", "x-javascript", "ecmascript", "xml", "wasm", NULL};
+  for (size_t i = 0; types[i]; ++i) {
+    if (t.len - 12 == strlen(types[i]) &&
+        !strncasecmp(t.data + 12, types[i], t.len - 12))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Selects a content encoding for the response (before it's headers are sent),
+ * according to the response's headers and the request's `accept-encoding`.
+ *
+ * `length` is the body's length, or 0 if it's unknown (a streamed body).
+ * Bodies shorter than `min` aren't compressed.
+ *
+ * Sets the `vary` header for any response that could be compressed.
+ *
+ * Returns IODINE_COMPRESS_NONE if the response shouldn't be compressed.
+ */
+iodine_compress_e iodine_compress_select(http_s *h, size_t length,
+                                         size_t min) {
+  static uint64_t ct_hash = 0, ce_hash = 0, cl_hash = 0, cc_hash = 0,
+                  vary_hash = 0;
+  if (!ct_hash) {
+    ce_hash = fiobj_hash_string("content-encoding", 16);
+    cl_hash = fiobj_hash_string("content-length", 14);
+    cc_hash = fiobj_hash_string("cache-control", 13);
+    vary_hash = fiobj_hash_string("vary", 4);
+    ct_hash = fiobj_hash_string("content-type", 12);
+  }
+  if (!iodine_compress_available() || HTTP_INVALID_HANDLE(h) ||
+      h->status < 200 || h->status == 204 || h->status == 206 ||
+      h->status == 304)
+    return IODINE_COMPRESS_NONE;
+  fio_str_info_s tmp = iodine_compress_header(h, ct_hash);
+  if (!tmp.data || !iodine_compress_type(tmp) ||
+      fiobj_hash_get2(h->private_data.out_headers, ce_hash))
+    return IODINE_COMPRESS_NONE;
+  if (!length) {
+    /* a streamed body might have a known length */
+    tmp = iodine_compress_header(h, cl_hash);
+    if (tmp.data) {
+      char *pos = tmp.data;
+      length = (size_t)fio_atol(&pos);
+      if (length < min)
+        return IODINE_COMPRESS_NONE;
+    }
+  } else if (length < min) {
+    return IODINE_COMPRESS_NONE;
+  }
+  tmp = iodine_compress_header(h, cc_hash);
+  if (tmp.data && iodine_compress_has(tmp, "no-transform", 12))
+    return IODINE_COMPRESS_NONE;
+  /* the response depends on the `accept-encoding` header */
+  tmp = iodine_compress_header(h, vary_hash);
+  if (!tmp.data || (!iodine_compress_has(tmp, "accept-encoding", 15) &&
+                    !iodine_compress_has(tmp, "*", 1)))
+    http_set_header(h, HTTP_HEADER_VARY,
+                    fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+
+  uint16_t q[4];
+  http_accept_encoding(h, iodine_compress_encodings, 4, q);
+#if !HAVE_BROTLI
+  q[IODINE_COMPRESS_BR] = 0;
+#endif
+  /* the preferred encoding wins when quality values are equal */
+  static const iodine_compress_e order[] = {
+      IODINE_COMPRESS_BR, IODINE_COMPRESS_GZIP, IODINE_COMPRESS_DEFLATE,
+      IODINE_COMPRESS_NONE};
+  iodine_compress_e selected = IODINE_COMPRESS_NONE;
+  uint16_t best = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    if (q[order[i]] > best) {
+      best = q[order[i]];
+      selected = order[i];
+    }
+  }
+  return selected;
+}
+
+/**
+ * Sets the response headers for a compressed response (`content-encoding`,
+ * removing `content-length` and weakening a strong `etag`).
+ */
+void iodine_compress_headers(http_s *h, iodine_compress_e encoding) {
+  static uint64_t cl_hash = 0, etag_hash = 0;
+  if (!cl_hash) {
+    cl_hash = fiobj_hash_string("content-length", 14);
+    etag_hash = fiobj_hash_string("etag", 4);
+  }
+  FIOBJ value;
+  switch (encoding) {
+  case IODINE_COMPRESS_GZIP:
+    value = fiobj_dup(HTTP_HVALUE_GZIP);
+    break;
+  case IODINE_COMPRESS_BR:
+    value = fiobj_dup(HTTP_HVALUE_BR);
+    break;
+  case IODINE_COMPRESS_DEFLATE:
+    value = fiobj_str_new("deflate", 7);
+    break;
+  default:
+    return;
+  }
+  http_set_header(h, HTTP_HEADER_CONTENT_ENCODING, value);
+  fiobj_hash_delete2(h->private_data.out_headers, cl_hash);
+  /* the compressed body isn't byte-for-byte identical to the original */
+  fio_str_info_s etag = iodine_compress_header(h, etag_hash);
+  if (etag.data && etag.len && etag.data[0] == '"') {
+    FIOBJ weak = fiobj_str_buf(etag.len + 2);
+    fiobj_str_write(weak, "W/", 2);
+    fiobj_str_write(weak, etag.data, etag.len);
+    fiobj_hash_set(h->private_data.out_headers, HTTP_HEADER_ETAG, weak);
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef H_IODINE_COMPRESS_H
+#define H_IODINE_COMPRESS_H
+
+#include "http.h"
+
+#include <stdint.h>
+
+#ifndef IODINE_COMPRESS_DEFAULT_LEVEL
+/** The compression level used when compression is enabled using `true`. */
+#define IODINE_COMPRESS_DEFAULT_LEVEL 6
+#endif
+
+#ifndef IODINE_COMPRESS_DEFAULT_MIN
+/** Responses with shorter (known) bodies are sent without compression. */
+#define IODINE_COMPRESS_DEFAULT_MIN 1024
+#endif
+
+/** The content encodings used for on-the-fly response compression. */
+typedef enum {
+  IODINE_COMPRESS_NONE = 0,
+  IODINE_COMPRESS_GZIP,
+  IODINE_COMPRESS_DEFLATE,
+  IODINE_COMPRESS_BR,
+} iodine_compress_e;
+
+/** A (streaming) compressor, see `iodine_compress_new`. */
+typedef struct iodine_compress_s iodine_compress_s;
+
+/** Returns 1 if iodine was compiled with compression support (zlib). */
+uint8_t iodine_compress_available(void);
+
+/**
+ * Selects a content encoding for the response (before it's headers are sent),
+ * according to the response's headers and the request's `accept-encoding`.
+ *
+ * `length` is the body's length, or 0 if it's unknown (a streamed body).
+ * Bodies shorter than `min` aren't compressed.
+ *
+ * Sets the `vary` header for any response that could be compressed.
+ *
+ * Returns IODINE_COMPRESS_NONE if the response shouldn't be compressed.
+ */
+iodine_compress_e iodine_compress_select(http_s *h, size_t length, size_t min);
+
+/**
+ * Sets the response headers for a compressed response (`content-encoding`,
+ * removing `content-length` and weakening a strong `etag`).
+ */
+void iodine_compress_headers(http_s *h, iodine_compress_e encoding);
+
+/** Creates a compressor for the encoding (level 1..9), or returns NULL. */
+iodine_compress_s *iodine_compress_new(iodine_compress_e encoding,
+                                       uint8_t level);
+
+/**
+ * Compresses (and flushes) a chunk of data, appending the compressed data to
+ * the `dest` String. Set `finish` to complete the compressed stream.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int iodine_compress_write(iodine_compress_s *c, FIOBJ dest, const void *data,
+                          size_t length, uint8_t finish);
+
+/** Frees a compressor. */
+void iodine_compress_free(iodine_compress_s *c);
+
+/**
+ * Compresses a complete body, returning a new String, or FIOBJ_INVALID on
+ * error.
+ */
+FIOBJ iodine_compress_body(iodine_compress_e encoding, uint8_t level,
+                           const void *data, size_t length);
+
+#endif
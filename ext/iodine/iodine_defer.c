@@ -37,7 +37,7 @@ static void *iodine_io_thread(void *arg) {
   while (sock_io_thread_flag) {
     if (fio_flush_all())
       fio_throttle_thread(500000UL);
-    else
+    else if (fio_flush_wait(150) == -1)
       fio_throttle_thread(150000000UL);
   }
   return NULL;
@@ -181,10 +181,44 @@ static void iodine_defer_performe_once(void *block, void *ignr) {
 }
 
 static void iodine_defer_run_timer(void *block) {
-  /* TODO, update return value to allow timer cancellation */
   IodineCaller.call((VALUE)block, call_id);
 }
 
+/* *****************************************************************************
+Timer handles (stored in the block's hidden instance variable)
+***************************************************************************** */
+
+static ID timer_handle_id;
+
+static void iodine_timer_handle_free(void *timer) { fio_timer_free(timer); }
+
+static const rb_data_type_t iodine_timer_handle_type = {
+    .wrap_struct_name = "IodineTimerHandle",
+    .function =
+        {
+            .dmark = NULL,
+            .dfree = iodine_timer_handle_free,
+            .dsize = NULL,
+        },
+    .data = NULL,
+};
+
+/* creates a timer for the block, allowing it to be cancelled. */
+static int iodine_defer_add_timer(size_t milli, size_t repeat, VALUE block) {
+  fio_timer_s *timer =
+      fio_run_every_handle(milli, repeat, iodine_defer_run_timer, (void *)block,
+                           (void (*)(void *))IodineStore.remove);
+  if (!timer)
+    return -1;
+  if (OBJ_FROZEN(block)) {
+    fio_timer_free(timer);
+    return 0;
+  }
+  rb_ivar_set(block, timer_handle_id,
+              TypedData_Wrap_Struct(0, &iodine_timer_handle_type, timer));
+  return 0;
+}
+
 /* *****************************************************************************
 Defer API
 ***************************************************************************** */
@@ -213,7 +247,8 @@ Time is counted only once Iodine started running (using {Iodine.start}).
 
 Tasks scheduled before calling {Iodine.start} will run once for every process.
 
-Always returns a copy of the block object.
+Always returns a copy of the block object, which can be used to cancel the
+timer using {Iodine.cancel_timer}.
 */
 static VALUE iodine_defer_run_after(VALUE self, VALUE milliseconds) {
   (void)(self);
@@ -234,8 +269,7 @@ static VALUE iodine_defer_run_after(VALUE self, VALUE milliseconds) {
   if (block == Qnil)
     return Qfalse;
   IodineStore.add(block);
-  if (fio_run_every(milli, 1, iodine_defer_run_timer, (void *)block,
-                    (void (*)(void *))IodineStore.remove) == -1) {
+  if (iodine_defer_add_timer(milli, 1, block) == -1) {
     perror("ERROR: Iodine couldn't initialize timer");
     return Qnil;
   }
@@ -258,7 +292,8 @@ perform.
 
 The event will repeat itself until the number of repetitions had been delpeted.
 
-Always returns a copy of the block object.
+Always returns a copy of the block object, which can be used to cancel the
+timer using {Iodine.cancel_timer}.
 */
 static VALUE iodine_defer_run_every(int argc, VALUE *argv, VALUE self) {
   // clang-format on
@@ -281,14 +316,39 @@ static VALUE iodine_defer_run_every(int argc, VALUE *argv, VALUE self) {
   // requires a block to be passed
   rb_need_block();
   IodineStore.add(block);
-  if (fio_run_every(milli, repeat, iodine_defer_run_timer, (void *)block,
-                    (void (*)(void *))IodineStore.remove) == -1) {
+  if (iodine_defer_add_timer(milli, repeat, block) == -1) {
     perror("ERROR: Iodine couldn't initialize timer");
     return Qnil;
   }
   return block;
 }
 
+/**
+Cancels a timer created using {Iodine.run_after} or {Iodine.run_every}.
+
+Accepts the block object returned when the timer was created.
+
+Returns `true` if the timer was cancelled or `false` if the timer was already
+done (or the object isn't a timer).
+
+Note: if the same block object was used for a number of timers, only the latest
+timer will be cancelled.
+*/
+static VALUE iodine_defer_cancel_timer(VALUE self, VALUE block) {
+  if (!rb_obj_is_proc(block))
+    return Qfalse;
+  VALUE handle = rb_attr_get(block, timer_handle_id);
+  if (handle == Qnil)
+    return Qfalse;
+  fio_timer_s *timer;
+  TypedData_Get_Struct(handle, fio_timer_s, &iodine_timer_handle_type, timer);
+  if (!timer)
+    return Qfalse;
+  DATA_PTR(handle) = NULL; /* the handle is released by `fio_timer_cancel` */
+  return fio_timer_cancel(timer) ? Qfalse : Qtrue;
+  (void)self;
+}
+
 /* *****************************************************************************
 Pre/Post `fork`
 ***************************************************************************** */
@@ -391,6 +451,7 @@ Add defer API to Iodine
 
 void iodine_defer_initialize(void) {
   call_id = rb_intern2("call", 4);
+  timer_handle_id = rb_intern2("__iodine_timer", 14);
   rb_define_module_function(IodineModule, "run", iodine_defer_run, 0);
   rb_define_module_function(IodineModule, "defer", iodine_defer_run, 0);
 
@@ -398,6 +459,8 @@ void iodine_defer_initialize(void) {
                             1);
   rb_define_module_function(IodineModule, "run_every", iodine_defer_run_every,
                             -1);
+  rb_define_module_function(IodineModule, "cancel_timer",
+                            iodine_defer_cancel_timer, 1);
   rb_define_module_function(IodineModule, "on_state", iodine_on_state, 1);
 
   STATE_PRE_START = rb_intern("pre_start");
@@ -7,6 +7,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include "iodine.h"
 
 #include "http.h"
+#include "iodine_compress.h"
 
 #include <ruby/encoding.h>
 #include <ruby/io.h>
@@ -14,9 +15,12 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* *****************************************************************************
 Available Globals
@@ -24,7 +28,9 @@ Available Globals
 
 typedef struct {
   VALUE app;
-  VALUE env;
+  size_t compress_min;
+  uint8_t lazy_env;
+  uint8_t compress;
 } iodine_http_settings_s;
 
 /* these three are used also by iodin_rack_io.c */
@@ -40,22 +46,21 @@ static VALUE RACK_UPGRADE_SSE;
 static VALUE RACK_UPGRADE_WEBSOCKET;
 static VALUE UPGRADE_TCP;
 
-static VALUE HTTP_ACCEPT;
-static VALUE HTTP_USER_AGENT;
-static VALUE HTTP_ACCEPT_ENCODING;
-static VALUE HTTP_ACCEPT_LANGUAGE;
-static VALUE HTTP_CONNECTION;
-static VALUE HTTP_HOST;
-
 static VALUE hijack_func_sym;
 static ID close_method_id;
 static ID each_method_id;
+static ID to_ary_method_id;
+static ID to_path_method_id;
 static ID attach_method_id;
 static ID iodine_call_proc_id;
+static ID iodine_stream_var_id;
 
 static VALUE env_template_no_upgrade;
 static VALUE env_template_websockets;
 static VALUE env_template_sse;
+static VALUE env_template_lazy;
+
+static VALUE IodineRackStream;
 
 static rb_encoding *IodineUTF8Encoding;
 static rb_encoding *IodineBinaryEncoding;
@@ -101,11 +106,14 @@ rack_declare(CONTENT_LENGTH_HEADER); // for X-Sendfile support
 typedef struct {
   http_s *h;
   FIOBJ body;
+  int fd;
   enum iodine_http_response_type_enum {
     IODINE_HTTP_NONE,
     IODINE_HTTP_SENDBODY,
     IODINE_HTTP_XSENDFILE,
+    IODINE_HTTP_SENDFILE,
     IODINE_HTTP_EMPTY,
+    IODINE_HTTP_ABORT,
     IODINE_HTTP_ERROR,
   } type;
   enum iodine_upgrade_type_enum {
@@ -113,6 +121,7 @@ typedef struct {
     IODINE_UPGRADE_WEBSOCKET,
     IODINE_UPGRADE_SSE,
   } upgrade;
+  uint8_t lazy;
 } iodine_http_request_handle_s;
 
 /* *****************************************************************************
@@ -251,57 +260,387 @@ Copying data from the C request to the Rack's ENV
 
 #define to_upper(c) (((c) >= 'a' && (c) <= 'z') ? ((c) & ~32) : (c))
 
-static int iodine_copy2env_task(FIOBJ o, void *env_) {
-  VALUE env = (VALUE)env_;
-  FIOBJ name = fiobj_hash_key_in_loop();
-  fio_str_info_s tmp = fiobj_obj2cstr(name);
-  VALUE hname = (VALUE)0;
-  /* test for common header names, using pre-allocated memory */
-  if (tmp.len == 6 && !memcmp("accept", tmp.data, 6)) {
-    hname = HTTP_ACCEPT;
-  } else if (tmp.len == 10 && !memcmp("user-agent", tmp.data, 10)) {
-    hname = HTTP_USER_AGENT;
-  } else if (tmp.len == 15 && !memcmp("accept-encoding", tmp.data, 15)) {
-    hname = HTTP_ACCEPT_ENCODING;
-  } else if (tmp.len == 15 && !memcmp("accept-language", tmp.data, 15)) {
-    hname = HTTP_ACCEPT_LANGUAGE;
-  } else if (tmp.len == 10 && !memcmp("connection", tmp.data, 10)) {
-    hname = HTTP_CONNECTION;
-  } else if (tmp.len == 4 && !memcmp("host", tmp.data, 4)) {
-    hname = HTTP_HOST;
-  } else if (tmp.len > 123) {
-    char *buf = fio_malloc(tmp.len + 5);
+#ifndef IODINE_ENV_KEY_CACHE
+/**
+ * The number of header names (ones missing from the common header table) for
+ * which the Rack `env` key is cached, 4 keys per bucket. Must be a power of 2.
+ */
+#define IODINE_ENV_KEY_CACHE 128
+#endif
+
+#ifndef IODINE_ENV_KEY_CACHE_LIMIT
+/** Header names longer than this aren't cached (they're likely to be unique). */
+#define IODINE_ENV_KEY_CACHE_LIMIT 64
+#endif
+
+/* common request headers, their Rack keys are created (and frozen) once */
+static const char *iodine_env_common_headers[] = {
+    "a-im",
+    "accept",
+    "accept-charset",
+    "accept-datetime",
+    "accept-encoding",
+    "accept-language",
+    "access-control-request-headers",
+    "access-control-request-method",
+    "authorization",
+    "cache-control",
+    "cdn-loop",
+    "cf-connecting-ip",
+    "cf-ipcountry",
+    "cf-ray",
+    "cf-visitor",
+    "connection",
+    "content-encoding",
+    "content-md5",
+    "cookie",
+    "date",
+    "dnt",
+    "early-data",
+    "expect",
+    "forwarded",
+    "from",
+    "host",
+    "http2-settings",
+    "if-match",
+    "if-modified-since",
+    "if-none-match",
+    "if-range",
+    "if-unmodified-since",
+    "keep-alive",
+    "max-forwards",
+    "origin",
+    "pragma",
+    "prefer",
+    "priority",
+    "proxy-authorization",
+    "purpose",
+    "range",
+    "referer",
+    "save-data",
+    "sec-ch-ua",
+    "sec-ch-ua-mobile",
+    "sec-ch-ua-platform",
+    "sec-fetch-dest",
+    "sec-fetch-mode",
+    "sec-fetch-site",
+    "sec-fetch-user",
+    "sec-gpc",
+    "sec-purpose",
+    "sec-websocket-extensions",
+    "sec-websocket-key",
+    "sec-websocket-protocol",
+    "sec-websocket-version",
+    "te",
+    "traceparent",
+    "tracestate",
+    "trailer",
+    "transfer-encoding",
+    "true-client-ip",
+    "upgrade",
+    "upgrade-insecure-requests",
+    "user-agent",
+    "via",
+    "warning",
+    "x-amzn-trace-id",
+    "x-api-key",
+    "x-b3-parentspanid",
+    "x-b3-sampled",
+    "x-b3-spanid",
+    "x-b3-traceid",
+    "x-cloud-trace-context",
+    "x-correlation-id",
+    "x-csrf-token",
+    "x-do-not-track",
+    "x-forwarded-for",
+    "x-forwarded-host",
+    "x-forwarded-port",
+    "x-forwarded-proto",
+    "x-forwarded-ssl",
+    "x-http-method-override",
+    "x-real-ip",
+    "x-request-id",
+    "x-request-start",
+    "x-requested-with",
+    "x-xsrf-token",
+    NULL,
+};
+
+#define IODINE_ENV_COMMON_COUNT                                                \
+  (sizeof(iodine_env_common_headers) / sizeof(iodine_env_common_headers[0]) -  \
+   1)
+/* the common header table is indexed using a perfect hash (10 bits) */
+#define IODINE_ENV_COMMON_BITS 10
+
+static struct {
+  VALUE keys[IODINE_ENV_COMMON_COUNT];
+  uint8_t lengths[IODINE_ENV_COMMON_COUNT];
+  uint8_t index[1 << IODINE_ENV_COMMON_BITS]; /* 1 based, 0 == empty */
+  uint64_t seed;
+} iodine_env_common;
+
+/* runtime header names, cached in 4 way buckets (least recently used out) */
+static struct {
+  VALUE key;
+  uint64_t hash;
+  uint64_t used;
+} iodine_env_cache[IODINE_ENV_KEY_CACHE];
+static uint64_t iodine_env_cache_tick;
+
+/* FNV-1a, seeded */
+static inline uint64_t iodine_env_key_hash(uint64_t seed, const char *name,
+                                           size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (uint8_t)name[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h ^ (h >> 29);
+}
+
+/* Creates a frozen (deduplicated, where supported) Rack key for the header. */
+static VALUE iodine_env_key_new(const char *name, size_t len) {
+  char buf[IODINE_ENV_KEY_CACHE_LIMIT + 8];
+  memcpy(buf, "HTTP_", 5);
+  for (size_t i = 0; i < len; ++i) {
+    buf[i + 5] = (name[i] == '-') ? '_' : to_upper(name[i]);
+  }
+#ifdef HAVE_RB_INTERNED_STR
+  return rb_interned_str(buf, len + 5);
+#else
+  VALUE key = rb_enc_str_new(buf, len + 5, IodineBinaryEncoding);
+  rb_obj_freeze(key);
+  return key;
+#endif
+}
+
+/* Tests if a Rack key (`HTTP_` prefixed) was created for the header name. */
+static inline int iodine_env_key_eq(VALUE key, const char *name, size_t len) {
+  if ((size_t)RSTRING_LEN(key) != len + 5)
+    return 0;
+  const char *k = RSTRING_PTR(key) + 5;
+  for (size_t i = 0; i < len; ++i) {
+    if (k[i] != ((name[i] == '-') ? '_' : to_upper(name[i])))
+      return 0;
+  }
+  return 1;
+}
+
+/* Builds the common header table (called once, during initialization). */
+static void iodine_env_keys_init(void) {
+  for (size_t i = 0; i < IODINE_ENV_COMMON_COUNT; ++i) {
+    const size_t len = strlen(iodine_env_common_headers[i]);
+    iodine_env_common.lengths[i] = len;
+    iodine_env_common.keys[i] =
+        iodine_env_key_new(iodine_env_common_headers[i], len);
+    rb_global_variable(iodine_env_common.keys + i);
+  }
+  /* find a seed that maps every common header to it's own slot */
+  for (uint64_t seed = 0;; ++seed) {
+    FIO_ASSERT(seed < (1 << 16),
+               "(iodine) couldn't find a perfect hash for the common headers.");
+    memset(iodine_env_common.index, 0, sizeof(iodine_env_common.index));
+    size_t i = 0;
+    for (; i < IODINE_ENV_COMMON_COUNT; ++i) {
+      const size_t pos = iodine_env_key_hash(seed, iodine_env_common_headers[i],
+                                             iodine_env_common.lengths[i]) >>
+                         (64 - IODINE_ENV_COMMON_BITS);
+      if (iodine_env_common.index[pos])
+        break;
+      iodine_env_common.index[pos] = i + 1;
+    }
+    if (i == IODINE_ENV_COMMON_COUNT) {
+      iodine_env_common.seed = seed;
+      break;
+    }
+  }
+}
+
+/*
+ * Returns the Rack `env` key for a header name, without allocating memory for
+ * common (and recently seen) header names. Must be called within the GVL.
+ */
+static VALUE iodine_env_key(const char *name, size_t len) {
+  const uint64_t hash =
+      iodine_env_key_hash(iodine_env_common.seed, name, len);
+  {
+    const uint8_t i =
+        iodine_env_common.index[hash >> (64 - IODINE_ENV_COMMON_BITS)];
+    if (i && iodine_env_common.lengths[i - 1] == len &&
+        !memcmp(iodine_env_common_headers[i - 1], name, len))
+      return iodine_env_common.keys[i - 1];
+  }
+  if (len > IODINE_ENV_KEY_CACHE_LIMIT) {
+    char *buf = fio_malloc(len + 5);
     memcpy(buf, "HTTP_", 5);
-    for (size_t i = 0; i < tmp.len; ++i) {
-      buf[i + 5] = (tmp.data[i] == '-') ? '_' : to_upper(tmp.data[i]);
+    for (size_t i = 0; i < len; ++i) {
+      buf[i + 5] = (name[i] == '-') ? '_' : to_upper(name[i]);
     }
-    hname = rb_enc_str_new(buf, tmp.len + 5, IodineBinaryEncoding);
+    VALUE key = rb_enc_str_new(buf, len + 5, IodineBinaryEncoding);
     fio_free(buf);
+    return key;
+  }
+  /* test the bucket, replacing the least recently used key on a miss */
+  const size_t bucket = (hash & ((IODINE_ENV_KEY_CACHE >> 2) - 1)) << 2;
+  size_t lru = bucket;
+  ++iodine_env_cache_tick;
+  for (size_t i = bucket; i < bucket + 4; ++i) {
+    if (iodine_env_cache[i].hash == hash && iodine_env_cache[i].key &&
+        iodine_env_key_eq(iodine_env_cache[i].key, name, len)) {
+      iodine_env_cache[i].used = iodine_env_cache_tick;
+      return iodine_env_cache[i].key;
+    }
+    if (iodine_env_cache[i].used < iodine_env_cache[lru].used)
+      lru = i;
+  }
+  if (iodine_env_cache[lru].key)
+    IodineStore.remove(iodine_env_cache[lru].key);
+  iodine_env_cache[lru].key = IodineStore.add(iodine_env_key_new(name, len));
+  iodine_env_cache[lru].hash = hash;
+  iodine_env_cache[lru].used = iodine_env_cache_tick;
+  return iodine_env_cache[lru].key;
+}
+
+static int iodine_copy2env_task(fio_str_info_s tmp, fio_str_info_s value,
+                                size_t index, void *env_) {
+  VALUE env = (VALUE)env_;
+  VALUE hname = iodine_env_key(tmp.data, tmp.len);
+  VALUE val = rb_enc_str_new(value.data, value.len, IodineBinaryEncoding);
+  if (!index) {
+    rb_hash_aset(env, hname, val);
   } else {
-    char buf[128];
-    memcpy(buf, "HTTP_", 5);
-    for (size_t i = 0; i < tmp.len; ++i) {
-      buf[i + 5] = (tmp.data[i] == '-') ? '_' : to_upper(tmp.data[i]);
+    /* a repeated header, values are collected in an Array */
+    VALUE ary = rb_hash_aref(env, hname);
+    if (!RB_TYPE_P(ary, T_ARRAY)) {
+      VALUE first = ary;
+      ary = rb_ary_new2(index + 1);
+      rb_ary_push(ary, first);
+      rb_hash_aset(env, hname, ary);
     }
-    hname = rb_enc_str_new(buf, tmp.len + 5, IodineBinaryEncoding);
+    rb_ary_push(ary, val);
   }
+  return 0;
+}
 
-  if (FIOBJ_TYPE_IS(o, FIOBJ_T_STRING)) {
-    tmp = fiobj_obj2cstr(o);
-    rb_hash_aset(env, hname,
-                 rb_enc_str_new(tmp.data, tmp.len, IodineBinaryEncoding));
+/* Lazy `env` objects - headers are copied when the application reads them.
+ * The requests currently handled using a lazy `env` (GVL protected): */
+static struct {
+  VALUE env;
+  http_s *h;
+} *iodine_lazy_envs;
+static size_t iodine_lazy_envs_count;
+static size_t iodine_lazy_envs_capa;
+
+static void iodine_lazy_env_add(VALUE env, http_s *h) {
+  if (iodine_lazy_envs_count == iodine_lazy_envs_capa) {
+    const size_t capa = iodine_lazy_envs_capa ? iodine_lazy_envs_capa << 1 : 8;
+    iodine_lazy_envs =
+        fio_realloc2(iodine_lazy_envs, capa * sizeof(*iodine_lazy_envs),
+                     iodine_lazy_envs_count * sizeof(*iodine_lazy_envs));
+    FIO_ASSERT_ALLOC(iodine_lazy_envs);
+    iodine_lazy_envs_capa = capa;
+  }
+  iodine_lazy_envs[iodine_lazy_envs_count].env = env;
+  iodine_lazy_envs[iodine_lazy_envs_count].h = h;
+  ++iodine_lazy_envs_count;
+}
 
+static void iodine_lazy_env_remove(VALUE env) {
+  for (size_t i = 0; i < iodine_lazy_envs_count; ++i) {
+    if (iodine_lazy_envs[i].env == env) {
+      iodine_lazy_envs[i] = iodine_lazy_envs[--iodine_lazy_envs_count];
+      return;
+    }
+  }
+}
+
+typedef struct {
+  VALUE key;
+  VALUE value;
+  size_t count;
+} iodine_lazy_env_task_s;
+
+/* collects the value(s) of the header(s) matching the Rack key */
+static int iodine_lazy_env_task(fio_str_info_s name, fio_str_info_s value,
+                                size_t index, void *a_) {
+  iodine_lazy_env_task_s *a = a_;
+  if (!iodine_env_key_eq(a->key, name.data, name.len))
+    return 0;
+  VALUE val = rb_enc_str_new(value.data, value.len, IodineBinaryEncoding);
+  if (!a->count) {
+    a->value = val;
   } else {
-    /* it's an array */
-    size_t count = fiobj_ary_count(o);
-    VALUE ary = rb_ary_new2(count);
-    rb_hash_aset(env, hname, ary);
-    for (size_t i = 0; i < count; ++i) {
-      tmp = fiobj_obj2cstr(fiobj_ary_index(o, i));
-      rb_ary_push(ary, rb_enc_str_new(tmp.data, tmp.len, IodineBinaryEncoding));
+    if (a->count == 1) {
+      VALUE first = a->value;
+      a->value = rb_ary_new2(2);
+      rb_ary_push(a->value, first);
     }
+    rb_ary_push(a->value, val);
   }
+  ++a->count;
   return 0;
+  (void)index;
+}
+
+static int iodine_lazy_env_merge_task(VALUE key, VALUE val, VALUE env) {
+  if (rb_hash_lookup2(env, key, Qundef) == Qundef)
+    rb_hash_aset(env, key, val);
+  return ST_CONTINUE;
+}
+
+/* copies the remaining headers, the `env` is no longer lazy */
+static void iodine_lazy_env_load(VALUE env) {
+  http_s *h = NULL;
+  for (size_t i = 0; i < iodine_lazy_envs_count; ++i) {
+    if (iodine_lazy_envs[i].env == env) {
+      h = iodine_lazy_envs[i].h;
+      iodine_lazy_envs[i] = iodine_lazy_envs[--iodine_lazy_envs_count];
+      break;
+    }
+  }
+  if (!h)
+    return;
+  /* keys already set (or read) by the application are left untouched */
+  VALUE tmp = rb_hash_new();
+  http_header_each(h, iodine_copy2env_task, (void *)tmp);
+  rb_hash_foreach(tmp, iodine_lazy_env_merge_task, env);
+}
+
+/* the lazy `env` default proc: `|env, key|` */
+static VALUE iodine_lazy_env_default(RB_BLOCK_CALL_FUNC_ARGLIST(yielded,
+                                                                 udata)) {
+  if (argc < 2 || !RB_TYPE_P(argv[1], T_STRING) || RSTRING_LEN(argv[1]) <= 5 ||
+      memcmp(RSTRING_PTR(argv[1]), "HTTP_", 5))
+    return Qnil;
+  http_s *h = NULL;
+  for (size_t i = 0; i < iodine_lazy_envs_count; ++i) {
+    if (iodine_lazy_envs[i].env == argv[0]) {
+      h = iodine_lazy_envs[i].h;
+      break;
+    }
+  }
+  if (!h)
+    return Qnil; /* the request is over (or this is a copy of the `env`) */
+  iodine_lazy_env_task_s a = {.key = argv[1], .value = Qnil};
+  http_header_each(h, iodine_lazy_env_task, &a);
+  if (a.count) {
+    const size_t len = RSTRING_LEN(argv[1]) - 5;
+    VALUE key = argv[1];
+    if (len <= IODINE_ENV_KEY_CACHE_LIMIT) {
+      /* prefer the frozen (cached) key over duplicating the user's key */
+      char name[IODINE_ENV_KEY_CACHE_LIMIT];
+      for (size_t i = 0; i < len; ++i) {
+        const char c = RSTRING_PTR(argv[1])[i + 5];
+        name[i] = (c == '_') ? '-' : tolower(c);
+      }
+      key = iodine_env_key(name, len);
+    }
+    rb_hash_aset(argv[0], key, a.value);
+  }
+  return a.value;
+  (void)yielded;
+  (void)udata;
+  (void)blockarg;
 }
 
 static inline VALUE copy2env(iodine_http_request_handle_s *handle) {
@@ -316,7 +655,8 @@ static inline VALUE copy2env(iodine_http_request_handle_s *handle) {
     break;
   case IODINE_UPGRADE_NONE: /* fallthrough */
   default:
-    env = rb_hash_dup(env_template_no_upgrade);
+    env = rb_hash_dup(handle->lazy ? env_template_lazy
+                                   : env_template_no_upgrade);
     break;
   }
   IodineStore.add(env);
@@ -358,7 +698,9 @@ static inline VALUE copy2env(iodine_http_request_handle_s *handle) {
   static uint64_t host_hash = 0;
   if (!host_hash)
     host_hash = fiobj_hash_string("host", 4);
-  tmp = fiobj_obj2cstr(fiobj_hash_get2(h->headers, host_hash));
+  tmp = http_header_get(h, host_hash);
+  if (!tmp.data)
+    tmp = (fio_str_info_s){.data = (char *)""};
   pos = tmp.data;
   while (*pos && *pos != ':')
     pos++;
@@ -381,41 +723,33 @@ static inline VALUE copy2env(iodine_http_request_handle_s *handle) {
     static uint64_t content_length_hash = 0;
     if (!content_length_hash)
       content_length_hash = fiobj_hash_string("content-length", 14);
-    FIOBJ cl = fiobj_hash_get2(h->headers, content_length_hash);
-    if (cl) {
-      tmp = fiobj_obj2cstr(fiobj_hash_get2(h->headers, content_length_hash));
-      if (tmp.data) {
-        rb_hash_aset(env, CONTENT_LENGTH,
-                     rb_enc_str_new(tmp.data, tmp.len, IodineBinaryEncoding));
-        fiobj_hash_delete2(h->headers, content_length_hash);
-      }
+    tmp = http_header_get(h, content_length_hash);
+    if (tmp.data) {
+      rb_hash_aset(env, CONTENT_LENGTH,
+                   rb_enc_str_new(tmp.data, tmp.len, IodineBinaryEncoding));
+      http_header_remove(h, content_length_hash);
     }
   }
   {
     static uint64_t content_type_hash = 0;
     if (!content_type_hash)
       content_type_hash = fiobj_hash_string("content-type", 12);
-    FIOBJ ct = fiobj_hash_get2(h->headers, content_type_hash);
-    if (ct) {
-      tmp = fiobj_obj2cstr(ct);
-      if (tmp.len && tmp.data) {
-        rb_hash_aset(env, CONTENT_TYPE,
-                     rb_enc_str_new(tmp.data, tmp.len, IodineBinaryEncoding));
-        fiobj_hash_delete2(h->headers, content_type_hash);
-      }
+    tmp = http_header_get(h, content_type_hash);
+    if (tmp.len && tmp.data) {
+      rb_hash_aset(env, CONTENT_TYPE,
+                   rb_enc_str_new(tmp.data, tmp.len, IodineBinaryEncoding));
+      http_header_remove(h, content_type_hash);
     }
   }
   /* handle scheme / sepcial forwarding headers */
   {
-    FIOBJ objtmp;
     static uint64_t xforward_hash = 0;
     if (!xforward_hash)
       xforward_hash = fiobj_hash_string("x-forwarded-proto", 27);
     static uint64_t forward_hash = 0;
     if (!forward_hash)
       forward_hash = fiobj_hash_string("forwarded", 9);
-    if ((objtmp = fiobj_hash_get2(h->headers, xforward_hash))) {
-      tmp = fiobj_obj2cstr(objtmp);
+    if ((tmp = http_header_get(h, xforward_hash)).data) {
       if (tmp.len >= 5 && !strncasecmp(tmp.data, "https", 5)) {
         rb_hash_aset(env, R_URL_SCHEME, HTTPS_SCHEME);
       } else if (tmp.len == 4 && !strncasecmp(tmp.data, "http", 4)) {
@@ -424,8 +758,7 @@ static inline VALUE copy2env(iodine_http_request_handle_s *handle) {
         rb_hash_aset(env, R_URL_SCHEME,
                      rb_enc_str_new(tmp.data, tmp.len, IodineBinaryEncoding));
       }
-    } else if ((objtmp = fiobj_hash_get2(h->headers, forward_hash))) {
-      tmp = fiobj_obj2cstr(objtmp);
+    } else if ((tmp = http_header_get(h, forward_hash)).data) {
       pos = tmp.data;
       if (pos) {
         while (*pos) {
@@ -457,8 +790,11 @@ static inline VALUE copy2env(iodine_http_request_handle_s *handle) {
     }
   }
 
-  /* add all remaining headers */
-  fiobj_each1(h->headers, 0, iodine_copy2env_task, (void *)env);
+  /* add all remaining headers (lazy `env` objects add them on demand) */
+  if (handle->lazy)
+    iodine_lazy_env_add(env, h);
+  else
+    http_header_each(h, iodine_copy2env_task, (void *)env);
   return env;
 }
 #undef add_str_to_env
@@ -531,6 +867,236 @@ static VALUE for_each_body_string(VALUE str, VALUE body_, int argc,
   (void)argv;
 }
 
+/* *****************************************************************************
+Streaming the response body
+***************************************************************************** */
+
+#ifndef IODINE_HTTP_STREAM_MAX_PENDING
+/**
+ * The number of response body chunks a streaming response may queue before the
+ * Ruby thread waits (without the GVL) for the connection to drain.
+ */
+#define IODINE_HTTP_STREAM_MAX_PENDING 16
+#endif
+
+typedef struct {
+  http_s *h;
+  iodine_compress_s *compress;
+  VALUE body;
+  VALUE stream; /* the Rack 3 stream object, if any */
+  uint8_t started;
+  uint8_t closed;
+} iodine_http_stream_s;
+
+static void *iodine_http_stream_wait(void *s_) {
+  iodine_http_stream_s *s = s_;
+  return (void *)(intptr_t)http_stream_wait(s->h,
+                                            IODINE_HTTP_STREAM_MAX_PENDING);
+}
+
+typedef struct {
+  iodine_http_stream_s *s;
+  const char *data;
+  size_t len;
+  uint8_t finish;
+} iodine_http_stream_chunk_s;
+
+/* compresses and streams a chunk (outside the GVL) */
+static void *iodine_http_stream_compressed(void *c_) {
+  iodine_http_stream_chunk_s *c = c_;
+  intptr_t ret = -1;
+  FIOBJ out = fiobj_str_buf((c->len >> 1) + 64);
+  if (!iodine_compress_write(c->s->compress, out, c->data, c->len,
+                             c->finish)) {
+    fio_str_info_s data = fiobj_obj2cstr(out);
+    ret = http_stream(c->s->h, data.data, data.len);
+  }
+  fiobj_free(out);
+  return (void *)ret;
+}
+
+/* selects the stream's content encoding, before the headers are sent */
+static void iodine_http_stream_start(iodine_http_stream_s *s) {
+  iodine_http_settings_s *settings = s->h->udata;
+  s->started = 1;
+  if (!settings || !settings->compress)
+    return;
+  iodine_compress_e encoding =
+      iodine_compress_select(s->h, 0, settings->compress_min);
+  if (encoding &&
+      (s->compress = iodine_compress_new(encoding, settings->compress)))
+    iodine_compress_headers(s->h, encoding);
+}
+
+/* completes the compressed stream (if any) */
+static void iodine_http_stream_finish(iodine_http_stream_s *s) {
+  if (!s->compress)
+    return;
+  iodine_http_stream_chunk_s c = {.s = s, .finish = 1};
+  IodineCaller.leaveGVL(iodine_http_stream_compressed, &c);
+  iodine_compress_free(s->compress);
+  s->compress = NULL;
+}
+
+/* writes a chunk to the client, returns -1 if the stream was closed / lost. */
+static int iodine_http_stream_write(iodine_http_stream_s *s, VALUE str) {
+  if (s->closed)
+    return -1;
+  if (!RSTRING_LEN(str))
+    return 0;
+  if (!s->started)
+    iodine_http_stream_start(s);
+  if (s->compress) {
+    /* compress without holding the GVL (the String can't be modified) */
+    iodine_http_stream_chunk_s c = {
+        .s = s, .data = RSTRING_PTR(str), .len = RSTRING_LEN(str)};
+    rb_str_locktmp(str);
+    void *ret = IodineCaller.leaveGVL(iodine_http_stream_compressed, &c);
+    rb_str_unlocktmp(str);
+    if (ret)
+      goto lost;
+  } else if (http_stream(s->h, RSTRING_PTR(str), RSTRING_LEN(str))) {
+    goto lost;
+  }
+  /* backpressure - wait for the client without blocking other threads */
+  if (http_pending(s->h) > IODINE_HTTP_STREAM_MAX_PENDING &&
+      IodineCaller.leaveGVL(iodine_http_stream_wait, s))
+    goto lost;
+  return 0;
+lost:
+  s->closed = 1;
+  return -1;
+}
+
+// streams each chunk yielded by the body's `each` method
+static VALUE for_each_body_chunk(VALUE str, VALUE s_, int argc, VALUE *argv) {
+  if (TYPE(str) != T_STRING) {
+    FIO_LOG_ERROR("(Iodine) response body not a String\n");
+    return Qfalse;
+  }
+  if (iodine_http_stream_write((iodine_http_stream_s *)s_, str))
+    rb_iter_break(); /* the client is gone, stop iterating */
+  return Qtrue;
+  (void)argc;
+  (void)argv;
+}
+
+inline static iodine_http_stream_s *iodine_rack_stream_get(VALUE self) {
+  VALUE i = rb_ivar_get(self, iodine_stream_var_id);
+  if (i == Qnil || i == INT2FIX(0))
+    return NULL;
+  return (iodine_http_stream_s *)NUM2ULL(i);
+}
+
+/**
+Writes the data to the client, sending the response headers with the first
+write. Returns the number of bytes written.
+
+Blocks (without holding the GVL) while the client is slow to read the data.
+
+Raises an IOError if the stream was closed or the client disconnected.
+*/
+static VALUE iodine_rack_stream_write(int argc, VALUE *argv, VALUE self) {
+  iodine_http_stream_s *s = iodine_rack_stream_get(self);
+  size_t count = 0;
+  for (int i = 0; i < argc; ++i) {
+    VALUE str = argv[i];
+    if (TYPE(str) != T_STRING)
+      str = IodineCaller.call(str, iodine_to_s_id);
+    Check_Type(str, T_STRING);
+    if (!s || iodine_http_stream_write(s, str))
+      rb_raise(rb_eIOError, "closed stream");
+    count += RSTRING_LEN(str);
+  }
+  return SIZET2NUM(count);
+}
+
+/** Writes the data to the client (see {write}). Returns `self`. */
+static VALUE iodine_rack_stream_push(VALUE self, VALUE str) {
+  iodine_rack_stream_write(1, &str, self);
+  return self;
+}
+
+/** Data is written as soon as it's available, so this does nothing. */
+static VALUE iodine_rack_stream_flush(VALUE self) { return self; }
+
+/**
+Closes the stream. The response is completed once the streaming body's `call`
+method returns.
+*/
+static VALUE iodine_rack_stream_close(VALUE self) {
+  iodine_http_stream_s *s = iodine_rack_stream_get(self);
+  if (s)
+    s->closed = 1;
+  return Qnil;
+}
+
+/** The request's body is available using `env['rack.input']`. */
+static VALUE iodine_rack_stream_read(int argc, VALUE *argv, VALUE self) {
+  return Qnil;
+  (void)argc;
+  (void)argv;
+  (void)self;
+}
+
+/** Does nothing (the request's body is available using `rack.input`). */
+static VALUE iodine_rack_stream_close_read(VALUE self) {
+  return Qnil;
+  (void)self;
+}
+
+/** Returns true if the stream was closed (or the client disconnected). */
+static VALUE iodine_rack_stream_is_closed(VALUE self) {
+  iodine_http_stream_s *s = iodine_rack_stream_get(self);
+  return (!s || s->closed) ? Qtrue : Qfalse;
+}
+
+/* streams the response body (called within the exception protection block) */
+static VALUE iodine_http_stream_body(VALUE s_) {
+  iodine_http_stream_s *s = (iodine_http_stream_s *)s_;
+  if (rb_respond_to(s->body, each_method_id)) {
+    // stream each chunk as soon as it's available
+    rb_block_call(s->body, each_method_id, 0, NULL,
+                  (rb_block_call_func_t)for_each_body_chunk, s_);
+    return Qnil;
+  }
+  // a Rack 3 streaming body (`body.call(stream)`)
+  s->stream = rb_obj_alloc(IodineRackStream);
+  rb_ivar_set(s->stream, iodine_stream_var_id, ULL2NUM((uintptr_t)s));
+  rb_funcall2(s->body, iodine_call_proc_id, 1, &s->stream);
+  return Qnil;
+}
+
+/* *****************************************************************************
+Sending the response body
+***************************************************************************** */
+
+/* opens the file of a body responding to `to_path` (i.e., Rack::Files). */
+static inline int ruby2c_response_file(iodine_http_request_handle_s *handle,
+                                       VALUE body) {
+  VALUE path = IodineCaller.call(body, to_path_method_id);
+  if (TYPE(path) != T_STRING || !RSTRING_LEN(path) ||
+      memchr(RSTRING_PTR(path), 0, RSTRING_LEN(path)))
+    return -1;
+  FIOBJ filename = fiobj_str_new(RSTRING_PTR(path), RSTRING_LEN(path));
+  /* open before the body is closed (it might be a temporary file) */
+  struct stat st;
+  int fd = open(fiobj_obj2cstr(filename).data, O_RDONLY | O_NONBLOCK);
+  if (fd == -1)
+    goto error;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    goto error;
+  }
+  handle->body = filename;
+  handle->fd = fd;
+  handle->type = IODINE_HTTP_SENDFILE;
+  return 0;
+error:
+  fiobj_free(filename);
+  return -1;
+}
+
 static inline int ruby2c_response_send(iodine_http_request_handle_s *handle,
                                        VALUE rbresponse, VALUE env) {
   (void)(env);
@@ -543,6 +1109,21 @@ static inline int ruby2c_response_send(iodine_http_request_handle_s *handle,
     handle->type = IODINE_HTTP_NONE;
     return 0;
   }
+  if (TYPE(body) != T_ARRAY && TYPE(body) != T_STRING &&
+      handle->h->status == 200 && rb_respond_to(body, to_path_method_id) &&
+      !ruby2c_response_file(handle, body)) {
+    // the file is sent by the server, without copying its data to Ruby
+    if (rb_respond_to(body, close_method_id))
+      IodineCaller.call(body, close_method_id);
+    return 0;
+  }
+  if (TYPE(body) != T_ARRAY && TYPE(body) != T_STRING &&
+      rb_respond_to(body, to_ary_method_id)) {
+    // the body is buffered (i.e., a BodyProxy), `to_ary` also closes the body
+    VALUE tmp = IodineCaller.call(body, to_ary_method_id);
+    if (TYPE(tmp) == T_ARRAY)
+      body = tmp;
+  }
   if (TYPE(body) == T_ARRAY) {
     if (RARRAY_LEN(body) == 0) { // only headers
       handle->type = IODINE_HTTP_EMPTY;
@@ -561,18 +1142,38 @@ static inline int ruby2c_response_send(iodine_http_request_handle_s *handle,
       handle->type = IODINE_HTTP_SENDBODY;
     }
     return 0;
-  } else if (rb_respond_to(body, each_method_id)) {
-    // fprintf(stderr, "Review body as for-each ...\n");
+  } else if (TYPE(body) == T_ARRAY) {
+    // the whole body is available, so it's sent with a known length
     handle->body = fiobj_str_buf(1);
     handle->type = IODINE_HTTP_SENDBODY;
     IodineCaller.call_with_block(body, each_method_id, 0, NULL,
                                  (VALUE)handle->body, for_each_body_string);
-    // we need to call `close` in case the object is an IO / BodyProxy
-    if (rb_respond_to(body, close_method_id))
-      IodineCaller.call(body, close_method_id);
     return 0;
   }
-  return -1;
+  if (!rb_respond_to(body, each_method_id) &&
+      !rb_respond_to(body, iodine_call_proc_id))
+    return -1;
+  iodine_http_stream_s stream = {.h = handle->h, .body = body};
+  const int failed =
+      IodineCaller.protect(iodine_http_stream_body, (VALUE)&stream);
+  /* the stream is only valid while `call` is running */
+  if (stream.stream)
+    rb_ivar_set(stream.stream, iodine_stream_var_id, INT2FIX(0));
+  if (failed) {
+    /* a truncated response must not look complete (no trailer / last chunk) */
+    iodine_compress_free(stream.compress);
+    stream.compress = NULL;
+  } else {
+    iodine_http_stream_finish(&stream);
+  }
+  // we need to call `close` in case the object is an IO / BodyProxy
+  if (rb_respond_to(body, close_method_id))
+    IodineCaller.call(body, close_method_id);
+  if (failed && !stream.started)
+    return -1; /* nothing was sent yet, respond with an error */
+  // completes (or aborts) the response outside the GVL
+  handle->type = failed ? IODINE_HTTP_ABORT : IODINE_HTTP_EMPTY;
+  return 0;
 }
 
 /* *****************************************************************************
@@ -647,8 +1248,10 @@ static inline void *iodine_handle_request_in_GVL(void *handle_) {
   VALUE rbresponse = 0;
   VALUE env = 0;
   http_s *h = handle->h;
-  if (!h->udata)
+  iodine_http_settings_s *settings = h->udata;
+  if (!settings)
     goto err_not_found;
+  handle->lazy = (settings->lazy_env && handle->upgrade == IODINE_UPGRADE_NONE);
 
   // create / register env variable
   env = copy2env(handle);
@@ -656,9 +1259,12 @@ static inline void *iodine_handle_request_in_GVL(void *handle_) {
   VALUE tmp = IodineRackIO.create(h, env);
   // pass env variable to handler
   rbresponse =
-      IodineCaller.call2((VALUE)h->udata, iodine_call_proc_id, 1, &env);
+      IodineCaller.call2(settings->app, iodine_call_proc_id, 1, &env);
   // close rack.io
   IodineRackIO.close(tmp);
+  // headers are no longer available to a lazy env
+  if (handle->lazy)
+    iodine_lazy_env_remove(env);
   // test handler's return value
   if (rbresponse == 0 || rbresponse == Qnil || TYPE(rbresponse) != T_ARRAY)
     goto internal_error;
@@ -736,10 +1342,35 @@ internal_error:
   return NULL;
 }
 
+/* compresses a buffered response body (called outside the GVL) */
+static void iodine_http_compress_body(iodine_http_request_handle_s *handle) {
+  iodine_http_settings_s *settings = handle->h->udata;
+  if (!settings || !settings->compress)
+    return;
+  fio_str_info_s data = fiobj_obj2cstr(handle->body);
+  iodine_compress_e encoding =
+      iodine_compress_select(handle->h, data.len, settings->compress_min);
+  if (!encoding)
+    return;
+  FIOBJ compressed =
+      iodine_compress_body(encoding, settings->compress, data.data, data.len);
+  if (!compressed)
+    return;
+  if (fiobj_obj2cstr(compressed).len >= data.len) {
+    /* not worth it */
+    fiobj_free(compressed);
+    return;
+  }
+  iodine_compress_headers(handle->h, encoding);
+  fiobj_free(handle->body);
+  handle->body = compressed;
+}
+
 static inline void
 iodine_perform_handle_action(iodine_http_request_handle_s handle) {
   switch (handle.type) {
   case IODINE_HTTP_SENDBODY: {
+    iodine_http_compress_body(&handle);
     fio_str_info_s data = fiobj_obj2cstr(handle.body);
     http_send_body(handle.h, data.data, data.len);
     fiobj_free(handle.body);
@@ -760,10 +1391,21 @@ iodine_perform_handle_action(iodine_http_request_handle_s handle) {
     fiobj_free(handle.body);
     break;
   }
+  case IODINE_HTTP_SENDFILE: {
+    fio_str_info_s data = fiobj_obj2cstr(handle.body);
+    if (http_sendfile_fd(handle.h, handle.fd, data.data, data.len)) {
+      http_send_error(handle.h, 500);
+    }
+    fiobj_free(handle.body);
+    break;
+  }
   case IODINE_HTTP_EMPTY:
     http_finish(handle.h);
     fiobj_free(handle.body);
     break;
+  case IODINE_HTTP_ABORT:
+    http_stream_abort(handle.h);
+    break;
   case IODINE_HTTP_NONE:
     /* nothing to do - this had to be performed within the Ruby GIL :-( */
     break;
@@ -878,6 +1520,15 @@ static void initialize_env_template(void) {
   IodineStore.add(env_template_sse);
   rb_hash_aset(env_template_sse, RACK_UPGRADE_Q, RACK_UPGRADE_SSE);
 
+  /* lazy `env` support (the default proc is copied by `rb_hash_dup`) */
+  env_template_lazy = rb_hash_dup(env_template_no_upgrade);
+  IodineStore.add(env_template_lazy);
+  {
+    VALUE proc = rb_proc_new(iodine_lazy_env_default, Qnil);
+    IodineStore.add(proc);
+    rb_funcall(env_template_lazy, rb_intern("default_proc="), 1, proc);
+  }
+
 #undef add_value_to_env
 #undef add_str_to_env
 }
@@ -888,7 +1539,9 @@ Listenninng to HTTP
 */
 
 static void free_iodine_http(http_settings_s *s) {
-  IodineStore.remove((VALUE)s->udata);
+  iodine_http_settings_s *settings = s->udata;
+  IodineStore.remove(settings->app);
+  fio_free(settings);
 }
 
 // clang-format off
@@ -914,37 +1567,70 @@ max_body:: The maximum body size for incoming HTTP messages in bytes. Default: ~
 max_headers:: The maximum total header length for incoming HTTP messages. Default: ~64Kib.
 max_msg:: The maximum Websocket message size allowed. Default: ~250Kib.
 ping:: The Websocket `ping` interval. Default: 40 seconds.
+static_cache:: Memory limit (in Mb) for small static files kept in memory as complete HTTP/1.1 responses (`0` disables). Default: 8Mb.
+micro_cache:: Memory limit (in Mb) for dynamic `GET` responses cached according to their `Cache-Control: s-maxage` directive (see {Iodine.listen}). Default: off.
+micro_cache_vary:: The request headers added to the micro-cache key (an Array or a comma separated String). Default: none.
+compress:: Compression level (1..9, or `true` for 6) for dynamic responses (see {Iodine.listen}). Default: off.
+compress_min:: The minimal (known) response body length for compression, in bytes. Default: 1024.
+pipeline:: The number of pipelined HTTP/1.x requests handled (and their responses coalesced) in a single pass. Default: 8.
 
 Either the `app` or the `public` properties are required. If niether exists,
 the function will fail. If both exist, Iodine will serve static files as well
 as dynamic requests.
 
-When using the static file server, it's possible to serve `gzip` versions of
-the static files by saving a compressed version with the `gz` extension (i.e.
-`styles.css.gz`).
-
-`gzip` will only be served to clients tat support the `gzip` transfer
-encoding.
-
-Once HTTP/2 is supported (planned, but probably very far away), HTTP/2
-timeouts will be dynamically managed by Iodine. The `timeout` option is only
-relevant to HTTP/1.x connections.
+When using the static file server, it's possible to serve `br`, `zstd` and
+`gzip` versions of the static files by saving compressed versions with the
+`br`, `zst` and `gz` extensions (i.e. `styles.css.br`, `styles.css.gz`).
+
+Compressed versions will only be served to clients that accept their encoding
+(see the `Accept-Encoding` header). The smallest acceptable version is served
+(preferring `br`, then `zstd`, then `gzip` when the sizes are the same).
+
+HTTP/2 is used when negotiated using ALPN (`h2`) or when an unencrypted
+connection starts with the HTTP/2 preface (`h2c` with prior knowledge). HTTP/2
+connections use the same `timeout` option: a connection that didn't read or
+write any data for `timeout` seconds is closed, even if streams are still open
+(Iodine doesn't send PING frames to keep it alive).
+
+HTTP/2 flow control uses the protocol's default (65,535 byte) windows. The
+receive windows are replenished as request body data is read, up to the
+`max_body` limit. Response data that doesn't fit the client's windows is
+buffered until the client sends a `WINDOW_UPDATE` frame, while streamed Rack
+bodies wait for the update instead of buffering the data.
 */
 intptr_t iodine_http_listen(iodine_connection_args_s args){
   // clang-format on
   if (args.public.data) {
     rb_hash_aset(env_template_no_upgrade, XSENDFILE_TYPE, XSENDFILE);
     rb_hash_aset(env_template_no_upgrade, XSENDFILE_TYPE_HEADER, XSENDFILE);
+    /* the lazy template is a copy, made before any listening socket */
+    rb_hash_aset(env_template_lazy, XSENDFILE_TYPE, XSENDFILE);
+    rb_hash_aset(env_template_lazy, XSENDFILE_TYPE_HEADER, XSENDFILE);
     support_xsendfile = 1;
   }
+  iodine_http_settings_s *settings = fio_malloc(sizeof(*settings));
+  FIO_ASSERT_ALLOC(settings);
+  *settings = (iodine_http_settings_s){
+      .app = args.handler,
+      .lazy_env = args.lazy_env,
+      .compress = args.compress,
+      .compress_min =
+          args.compress_min ? args.compress_min : IODINE_COMPRESS_DEFAULT_MIN,
+  };
+  if (args.compress && !iodine_compress_available())
+    FIO_LOG_WARNING("(listen) response compression requires zlib, iodine was "
+                    "compiled without it.");
   IodineStore.add(args.handler);
   intptr_t uuid = http_listen(
       args.port.data, args.address.data, .on_request = on_rack_request,
-      .on_upgrade = on_rack_upgrade, .udata = (void *)args.handler,
+      .on_upgrade = on_rack_upgrade, .udata = settings,
       .tls = args.tls, .timeout = args.timeout, .ws_timeout = args.ping,
       .ws_max_msg_size = args.max_msg, .max_header_size = args.max_headers,
       .on_finish = free_iodine_http, .log = args.log,
-      .max_body_size = args.max_body, .public_folder = args.public.data);
+      .max_body_size = args.max_body, .public_folder = args.public.data,
+      .reuse_port = args.reuse_port, .static_cache_size = args.static_cache,
+      .pipeline_limit = args.pipeline, .micro_cache_size = args.micro_cache,
+      .micro_cache_vary = args.micro_cache_vary.data);
   if (uuid == -1)
     return uuid;
 
@@ -961,6 +1647,166 @@ intptr_t iodine_http_listen(iodine_connection_args_s args){
   return uuid;
 }
 
+/**
+ * Returns a Hash with the static file cache statistics (for the current
+ * process):
+ *
+ * - `:hits` - the number of static file requests served using a cached file.
+ * - `:misses` - the number of static file requests that opened a file (or
+ *   didn't find one).
+ * - `:count` - the number of files currently cached.
+ * - `:memory_hits` - the number of cache hits served from memory (as a
+ *   pre-serialized response), a subset of `:hits`.
+ * - `:memory` - the number of bytes used by the in-memory responses (see the
+ *   `:static_cache` option of {Iodine.listen}).
+ *
+ * Static files are served from the folder set by the `:public` option of
+ * {Iodine.listen}.
+ */
+static VALUE iodine_http_file_cache_stats(VALUE self) {
+  http_file_cache_stats_s stats = http_file_cache_stats();
+  VALUE h = rb_hash_new();
+  rb_hash_aset(h, ID2SYM(rb_intern("hits")), SIZET2NUM(stats.hits));
+  rb_hash_aset(h, ID2SYM(rb_intern("misses")), SIZET2NUM(stats.misses));
+  rb_hash_aset(h, ID2SYM(rb_intern("count")), SIZET2NUM(stats.count));
+  rb_hash_aset(h, ID2SYM(rb_intern("memory_hits")),
+               SIZET2NUM(stats.memory_hits));
+  rb_hash_aset(h, ID2SYM(rb_intern("memory")), SIZET2NUM(stats.memory));
+  return h;
+  (void)self;
+}
+
+/**
+ * Returns a Hash with the micro-cache statistics (for the current process):
+ *
+ * - `:hits` - the number of requests answered with a cached response.
+ * - `:misses` - the number of requests handled by the application (and
+ *   cached, if the response allowed it).
+ * - `:collapsed` - the number of requests that waited for an identical request
+ *   to complete.
+ * - `:count` - the number of entries currently cached.
+ * - `:memory` - the number of bytes used by cached responses and entries
+ *   (including their keys).
+ *
+ * The micro-cache is enabled by the `:micro_cache` option of {Iodine.listen}.
+ */
+static VALUE iodine_http_micro_cache_stats(VALUE self) {
+  http_micro_cache_stats_s stats = http_micro_cache_stats();
+  VALUE h = rb_hash_new();
+  rb_hash_aset(h, ID2SYM(rb_intern("hits")), SIZET2NUM(stats.hits));
+  rb_hash_aset(h, ID2SYM(rb_intern("misses")), SIZET2NUM(stats.misses));
+  rb_hash_aset(h, ID2SYM(rb_intern("collapsed")), SIZET2NUM(stats.collapsed));
+  rb_hash_aset(h, ID2SYM(rb_intern("count")), SIZET2NUM(stats.count));
+  rb_hash_aset(h, ID2SYM(rb_intern("memory")), SIZET2NUM(stats.memory));
+  return h;
+  (void)self;
+}
+
+/**
+ * Sets the HTTP access log's output (see the `:log` option of
+ * {Iodine.listen}). Accepts:
+ *
+ * - A file name (String) - the file is opened for appending and reopened
+ *   whenever the root process receives a `SIGHUP` signal (for log rotation).
+ *   The workers reopen the file without restarting (`SIGUSR1` is reserved
+ *   for hot restarts).
+ * - An IO object or a file descriptor (Integer), which should remain open.
+ * - `nil` - the default output (`STDERR`).
+ *
+ * Log records are buffered by each thread and written (in batches) by a
+ * dedicated thread, so a slow output doesn't slow down the server. Records are
+ * dropped (see {Iodine.access_log_dropped}) when a buffer is full.
+ */
+static VALUE iodine_http_access_log_set(VALUE self, VALUE output) {
+  int fd = -1;
+  const char *filename = NULL;
+  if (output == Qnil) {
+    fd = STDERR_FILENO;
+  } else if (RB_TYPE_P(output, T_STRING)) {
+    filename = StringValueCStr(output);
+  } else if (RB_TYPE_P(output, T_FIXNUM)) {
+    fd = FIX2INT(output);
+  } else if (rb_respond_to(output, rb_intern("fileno"))) {
+    fd = NUM2INT(IodineCaller.call(output, rb_intern("fileno")));
+  } else {
+    rb_raise(rb_eTypeError, "access log should be a file name, an IO or nil.");
+  }
+  if (http_log_output(filename, fd))
+    rb_raise(rb_eIOError, "couldn't open the access log: %s", strerror(errno));
+  return output;
+  (void)self;
+}
+
+/**
+ * Sets the HTTP access log's format, either `:text` (the default) or `:json`.
+ *
+ * The JSON format logs a JSON object per request, including the time spent
+ * before the request was routed to the application (`wait_us`), the time spent
+ * handling the request (`handler_us`) and the total (`total_us`), in
+ * microseconds.
+ */
+static VALUE iodine_http_access_log_format_set(VALUE self, VALUE format) {
+  Check_Type(format, T_SYMBOL);
+  if (SYM2ID(format) == rb_intern("json"))
+    http_log_format(HTTP_LOG_FORMAT_JSON);
+  else if (SYM2ID(format) == rb_intern("text"))
+    http_log_format(HTTP_LOG_FORMAT_TEXT);
+  else
+    rb_raise(rb_eArgError, "access log format should be :text or :json.");
+  return format;
+  (void)self;
+}
+
+/**
+ * Returns the number of HTTP access log records dropped (by the current
+ * process) because a log buffer was full.
+ */
+static VALUE iodine_http_access_log_dropped(VALUE self) {
+  return SIZET2NUM(http_log_dropped());
+  (void)self;
+}
+
+/**
+ * Copies the remaining `HTTP_*` headers to a lazy Rack `env` and returns the
+ * `env`.
+ *
+ * A lazy `env` (see the `lazy_env` option for {Iodine.listen}) only contains
+ * the headers read using `env[key]`. Applications (or middleware) that iterate
+ * the `env`, test its keys or copy it should call this method first. Does
+ * nothing if the `env` isn't lazy or the request was already answered.
+ */
+static VALUE iodine_http_load_env(VALUE self, VALUE env) {
+  iodine_lazy_env_load(env);
+  return env;
+  (void)self;
+}
+
+/**
+ * Returns a Hash with the (current process's) request arena statistics.
+ *
+ * The request's method, path, query and version are allocated from a
+ * per-connection memory arena that's emptied in one step once the request is
+ * finished, instead of using a heap allocation (and free) per object.
+ *
+ * - `:requests` - the number of requests that used an arena.
+ * - `:allocations` - the number of arena allocations (heap allocations that
+ *   were avoided).
+ * - `:bytes` - the number of bytes allocated from the arenas.
+ * - `:pages` - the number of heap allocations made by the arenas (overflow
+ *   pages, used when a request's data doesn't fit in the connection's page).
+ */
+static VALUE iodine_http_arena_stats(VALUE self) {
+  http_arena_stats_s stats = http_arena_stats();
+  VALUE h = rb_hash_new();
+  rb_hash_aset(h, ID2SYM(rb_intern("requests")), SIZET2NUM(stats.requests));
+  rb_hash_aset(h, ID2SYM(rb_intern("allocations")),
+               SIZET2NUM(stats.allocations));
+  rb_hash_aset(h, ID2SYM(rb_intern("bytes")), SIZET2NUM(stats.bytes));
+  rb_hash_aset(h, ID2SYM(rb_intern("pages")), SIZET2NUM(stats.pages));
+  return h;
+  (void)self;
+}
+
 /* *****************************************************************************
 HTTP Websocket Connect
 ***************************************************************************** */
@@ -1098,12 +1944,6 @@ void iodine_init_http(void) {
   rack_autoset(HTTP_VERSION);
   rack_autoset(REMOTE_ADDR);
 
-  rack_autoset(HTTP_ACCEPT);
-  rack_autoset(HTTP_USER_AGENT);
-  rack_autoset(HTTP_ACCEPT_ENCODING);
-  rack_autoset(HTTP_ACCEPT_LANGUAGE);
-  rack_autoset(HTTP_CONNECTION);
-  rack_autoset(HTTP_HOST);
 
   rack_set(HTTP_SCHEME, "http");
   rack_set(HTTPS_SCHEME, "https");
@@ -1130,12 +1970,18 @@ void iodine_init_http(void) {
   hijack_func_sym = ID2SYM(rb_intern("_hijack"));
   close_method_id = rb_intern("close");
   each_method_id = rb_intern("each");
+  to_ary_method_id = rb_intern("to_ary");
+  to_path_method_id = rb_intern("to_path");
   attach_method_id = rb_intern("attach_fd");
   iodine_call_proc_id = rb_intern("call");
+  /* not an `@` name, so the pointer is out of Ruby's reach */
+  iodine_stream_var_id = rb_intern2("iodine_stream", 13);
 
   IodineUTF8Encoding = rb_enc_find("UTF-8");
   IodineBinaryEncoding = rb_enc_find("binary");
 
+  iodine_env_keys_init();
+
   {
     VALUE STRIO_CLASS = rb_const_get(rb_cObject, rb_intern("StringIO"));
     IODINE_R_INPUT_DEFAULT = rb_str_new_static("", 0);
@@ -1144,4 +1990,33 @@ void iodine_init_http(void) {
     rb_global_variable(&IODINE_R_INPUT_DEFAULT);
   }
   initialize_env_template();
+
+  /* Rack 3 streaming bodies */
+  IodineRackStream =
+      rb_define_class_under(IodineBaseModule, "RackStream", rb_cObject);
+  rb_define_method(IodineRackStream, "write", iodine_rack_stream_write, -1);
+  rb_define_method(IodineRackStream, "<<", iodine_rack_stream_push, 1);
+  rb_define_method(IodineRackStream, "flush", iodine_rack_stream_flush, 0);
+  rb_define_method(IodineRackStream, "close", iodine_rack_stream_close, 0);
+  rb_define_method(IodineRackStream, "close_write", iodine_rack_stream_close,
+                   0);
+  rb_define_method(IodineRackStream, "read", iodine_rack_stream_read, -1);
+  rb_define_method(IodineRackStream, "close_read",
+                   iodine_rack_stream_close_read, 0);
+  rb_define_method(IodineRackStream, "closed?", iodine_rack_stream_is_closed,
+                   0);
+
+  rb_define_module_function(IodineModule, "file_cache_stats",
+                            iodine_http_file_cache_stats, 0);
+  rb_define_module_function(IodineModule, "micro_cache_stats",
+                            iodine_http_micro_cache_stats, 0);
+  rb_define_module_function(IodineModule, "access_log=",
+                            iodine_http_access_log_set, 1);
+  rb_define_module_function(IodineModule, "access_log_format=",
+                            iodine_http_access_log_format_set, 1);
+  rb_define_module_function(IodineModule, "access_log_dropped",
+                            iodine_http_access_log_dropped, 0);
+  rb_define_module_function(IodineModule, "load_env", iodine_http_load_env, 1);
+  rb_define_module_function(IodineModule, "http_arena_stats",
+                            iodine_http_arena_stats, 0);
 }
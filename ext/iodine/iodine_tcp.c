@@ -212,7 +212,8 @@ intptr_t iodine_tcp_listen(iodine_connection_args_s args) {
   return fio_listen(.port = args.port.data, .address = args.address.data,
                     .on_open = iodine_tcp_on_open,
                     .on_finish = iodine_tcp_on_finish, .tls = args.tls,
-                    .udata = (void *)args.handler);
+                    .udata = (void *)args.handler,
+                    .reuse_port = args.reuse_port);
 }
 
 // clang-format off
@@ -45,7 +45,7 @@ require_relative './iodine/iodine' # loading a binary C extension
 #
 # Methods for setting startup / operational callbacks include {on_idle}, {on_state}.
 #
-# Methods for asynchronous execution include {run} (same as {defer}), {run_after} and {run_every}.
+# Methods for asynchronous execution include {run} (same as {defer}), {run_after}, {run_every} and {cancel_timer}.
 #
 # Methods for application wide pub/sub include {subscribe}, {unsubscribe} and {publish}. Connection specific pub/sub methods are documented in the {Iodine::Connection} class).
 #
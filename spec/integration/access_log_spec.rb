@@ -0,0 +1,37 @@
+require 'http'
+require 'json'
+
+RSpec.describe 'Access log', with_app: :access_log, app_args: '-lf spec/log/access.log -lj' do
+  let(:log_file) { 'spec/log/access.log' }
+
+  # the log is written asynchronously
+  def log_lines(count)
+    20.times do
+      lines = File.exist?(log_file) ? File.readlines(log_file) : []
+      return lines if lines.size >= count
+      sleep 0.1
+    end
+    File.exist?(log_file) ? File.readlines(log_file) : []
+  end
+
+  before { File.write(log_file, '') }
+  after { File.delete(log_file) if File.exist?(log_file) }
+
+  it 'writes a JSON record for every request' do
+    http_get('/first?a=1')
+    http_get('/second')
+    records = log_lines(2).map { |line| JSON.parse(line) }
+
+    expect(records.map { |r| r['path'] }).to eql(['/first', '/second'])
+    expect(records.map { |r| r['status'] }).to eql([200, 200])
+    expect(records.first['method']).to eql('GET')
+    expect(records.first['bytes']).to eql('logged /first'.bytesize)
+  end
+
+  it 'escapes the request data' do
+    raw_request("GET /quote\"\\ HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+    record = JSON.parse(log_lines(1).last)
+
+    expect(record['path']).to eql('/quote"\\')
+  end
+end
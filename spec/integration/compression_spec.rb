@@ -0,0 +1,48 @@
+require 'http'
+require 'zlib'
+
+RSpec.describe 'Dynamic response compression', with_app: :compression, app_args: '-compress 6 -compress-min 1' do
+  let(:text) { 'Iodine compresses text responses on-the-fly. ' * 64 }
+
+  it 'compresses responses using gzip' do
+    response = http_get('/', headers: { 'Accept-Encoding' => 'gzip' })
+
+    expect(response.headers['Content-Encoding']).to eql('gzip')
+    expect(response.headers['Vary'].to_s.downcase).to include('accept-encoding')
+    expect(Zlib.gunzip(response.body.to_s)).to eql(text)
+  end
+
+  it 'compresses streamed responses' do
+    response = http_get('/stream', headers: { 'Accept-Encoding' => 'gzip' })
+
+    expect(response.headers['Content-Encoding']).to eql('gzip')
+    expect(Zlib.gunzip(response.body.to_s)).to eql(text * 4)
+  end
+
+  it "doesn't compress responses the client can't decode" do
+    response = http_get('/', headers: { 'Accept-Encoding' => 'identity' })
+
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.body.to_s).to eql(text)
+  end
+
+  it 'respects gzip;q=0' do
+    response = http_get('/', headers: { 'Accept-Encoding' => 'gzip;q=0' })
+
+    expect(response.headers['Content-Encoding']).to be_nil
+  end
+
+  it 'respects Cache-Control: no-transform' do
+    response = http_get('/no-transform', headers: { 'Accept-Encoding' => 'gzip' })
+
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.body.to_s).to eql(text)
+  end
+
+  it 'keeps the Content-Encoding set by the application' do
+    response = http_get('/encoded', headers: { 'Accept-Encoding' => 'gzip' })
+
+    expect(response.headers['Content-Encoding']).to eql('identity')
+    expect(response.body.to_s).to eql(text)
+  end
+end
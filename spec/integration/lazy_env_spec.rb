@@ -0,0 +1,38 @@
+require 'http'
+
+RSpec.describe 'Lazy Rack env', with_app: :lazy_env, app_args: '-lazy-env' do
+  let(:headers) { { 'X-First' => 'one', 'X-Second' => 'two' } }
+
+  it 'is a Hash' do
+    expect(http_get('/class').body.to_s).to eql('Hash')
+  end
+
+  it 'copies the headers read using env[key]' do
+    expect(http_get('/read', headers: headers).body.to_s).to eql('one')
+  end
+
+  it 'only lists the headers that were read' do
+    expect(http_get('/keys', headers: headers).body.to_s).to eql('HTTP_X_FIRST')
+  end
+
+  it 'copies the remaining headers when the env is loaded' do
+    expect(http_get('/load', headers: headers).body.to_s).to eql('HTTP_X_FIRST,HTTP_X_SECOND')
+    expect(http_get('/each', headers: headers).body.to_s).to eql('HTTP_X_FIRST=one,HTTP_X_SECOND=two')
+  end
+
+  it 'supports key?, fetch and copies of a loaded env' do
+    expect(http_get('/key', headers: headers).body.to_s).to eql('true')
+    expect(http_get('/fetch', headers: headers).body.to_s).to eql('two')
+    expect(http_get('/fetch').body.to_s).to eql('missing')
+    expect(http_get('/dup', headers: headers).body.to_s).to eql('two')
+  end
+end
+
+RSpec.describe 'Lazy Rack env with Rack::Lint', with_app: :lazy_env_lint, app_args: '-lazy-env' do
+  it 'passes Rack::Lint' do
+    response = http_get('/', headers: { 'X-First' => 'one' })
+
+    expect(response.code).to eql(200)
+    expect(response.body.to_s).to eql('one')
+  end
+end
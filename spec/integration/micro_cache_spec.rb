@@ -0,0 +1,78 @@
+require 'http'
+require 'time'
+
+RSpec.describe 'Micro-cache', with_app: :micro_cache, app_args: '-mc 1' do
+  # non persistent connections don't use the cache
+  let(:client) { http_client.persistent("http://localhost:#{server_port}") }
+
+  after { client.close }
+
+  def cached_get(path)
+    client.get(path)
+  end
+
+  it 'answers identical requests from the cache' do
+    first = cached_get('/cached').body.to_s
+    second = cached_get('/cached').body.to_s
+
+    expect(first).to eql('localhost:2222 /cached 1')
+    expect(second).to eql(first)
+  end
+
+  it 'keys the cache by the query' do
+    expect(cached_get('/query?a').body.to_s).to eql('localhost:2222 /query 1')
+    expect(cached_get('/query?b').body.to_s).to eql('localhost:2222 /query 2')
+    expect(cached_get('/query?a').body.to_s).to eql('localhost:2222 /query 1')
+  end
+
+  it "doesn't confuse a host's path with another host" do
+    # the requests are pipelined, the last one closes the connection
+    response = raw_request("GET /b/c HTTP/1.1\r\nHost: a\r\n\r\n" \
+                           "GET /c HTTP/1.1\r\nHost: a/b\r\n\r\n" \
+                           "GET /close HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n")
+
+    expect(response).to include("\r\n\r\na /b/c 1")
+    expect(response).to include("\r\n\r\na/b /c 1")
+  end
+
+  it "doesn't cache responses that set cookies" do
+    cached_get('/cookie')
+
+    expect(cached_get('/cookie').body.to_s).to eql('localhost:2222 /cookie 2')
+  end
+
+  it "doesn't cache private responses" do
+    cached_get('/private')
+
+    expect(cached_get('/private').body.to_s).to eql('localhost:2222 /private 2')
+  end
+
+  it "doesn't cache responses with private fields" do
+    cached_get('/private-fields')
+
+    expect(cached_get('/private-fields').body.to_s).to eql('localhost:2222 /private-fields 2')
+  end
+
+  it "doesn't cache streamed responses" do
+    cached_get('/stream')
+
+    expect(cached_get('/stream').body.to_s).to eql('localhost:2222 /stream 2')
+  end
+
+  it 'expires responses according to s-maxage' do
+    cached_get('/expires')
+    expect(cached_get('/expires').body.to_s).to eql('localhost:2222 /expires 1')
+    sleep 1.5
+
+    expect(cached_get('/expires').body.to_s).to eql('localhost:2222 /expires 2')
+  end
+
+  it 'sends an updated date header' do
+    cached_get('/date')
+    sleep 1.5
+    response = cached_get('/date')
+
+    expect(response.body.to_s).to eql('localhost:2222 /date 1')
+    expect(Time.now - Time.httpdate(response.headers['Date'])).to be < 1.5
+  end
+end
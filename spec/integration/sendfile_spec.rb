@@ -0,0 +1,95 @@
+require 'http'
+
+RSpec.describe 'Rack bodies responding to to_path', with_app: :sendfile do
+  let(:css) { File.binread('spec/support/public/style.css') }
+  let(:size) { css.bytesize }
+
+  it 'sends the file' do
+    response = http_get('/file')
+
+    expect(response.code).to eql(200)
+    expect(response.headers['Content-Length']).to eql(size.to_s)
+    expect(response.body.to_s).to eql(css)
+  end
+
+  it 'sends files the body deletes when closed' do
+    expect(http_get('/temp').body.to_s).to eql('temporary file contents')
+    expect(http_get('/temp-deleted').body.to_s).to eql('true')
+  end
+
+  it "uses body.each when the file can't be opened" do
+    expect(http_get('/missing').body.to_s).to eql('sent using each')
+  end
+
+  it 'answers HEAD requests with the length' do
+    response = http_head('/file')
+
+    expect(response.code).to eql(200)
+    expect(response.headers['Content-Length']).to eql(size.to_s)
+    expect(response.body.to_s).to be_empty
+  end
+
+  it 'answers suffix range requests' do
+    response = http_get('/file', headers: { 'Range' => 'bytes=-10' })
+
+    expect(response.code).to eql(206)
+    expect(response.headers['Content-Range']).to eql("bytes #{size - 10}-#{size - 1}/#{size}")
+    expect(response.body.to_s).to eql(css[-10, 10])
+  end
+
+  it 'sends the whole file for suffix ranges longer than the file' do
+    response = http_get('/file', headers: { 'Range' => "bytes=-#{size + 100}" })
+
+    expect(response.code).to eql(206)
+    expect(response.headers['Content-Range']).to eql("bytes 0-#{size - 1}/#{size}")
+    expect(response.body.to_s).to eql(css)
+  end
+
+  it 'answers open ended range requests' do
+    response = http_get('/file', headers: { 'Range' => "bytes=#{size - 5}-" })
+
+    expect(response.code).to eql(206)
+    expect(response.body.to_s).to eql(css[-5, 5])
+  end
+
+  it 'stops ranges ending past the end of the file at the last byte' do
+    response = http_get('/file', headers: { 'Range' => "bytes=10-#{size + 100}" })
+
+    expect(response.code).to eql(206)
+    expect(response.headers['Content-Range']).to eql("bytes 10-#{size - 1}/#{size}")
+    expect(response.body.to_s).to eql(css[10..-1])
+  end
+
+  it 'ignores ranges starting past the end of the file' do
+    response = http_get('/file', headers: { 'Range' => "bytes=#{size}-" })
+
+    expect(response.code).to eql(200)
+    expect(response.body.to_s).to eql(css)
+  end
+
+  it 'answers range requests with a matching If-Range' do
+    first = http_get('/file')
+
+    [first.headers['ETag'], first.headers['Last-Modified']].each do |validator|
+      response = http_get('/file', headers: { 'Range' => 'bytes=0-9', 'If-Range' => validator })
+
+      expect(response.code).to eql(206)
+      expect(response.body.to_s).to eql(css[0, 10])
+    end
+  end
+
+  it 'sends the whole file when If-Range is stale' do
+    response = http_get('/file', headers: { 'Range' => 'bytes=0-9', 'If-Range' => '"stale"' })
+
+    expect(response.code).to eql(200)
+    expect(response.body.to_s).to eql(css)
+  end
+
+  it 'answers conditional requests' do
+    etag = http_get('/file').headers['ETag']
+    response = http_get('/file', headers: { 'If-None-Match' => etag })
+
+    expect(response.code).to eql(304)
+    expect(response.body.to_s).to be_empty
+  end
+end
@@ -0,0 +1,61 @@
+require 'http'
+require 'zlib'
+
+RSpec.describe 'Static files', with_app: :static, app_args: '-www spec/support/public' do
+  let(:css) { File.binread('spec/support/public/style.css') }
+
+  it 'sends the file' do
+    response = http_get('/style.css')
+
+    expect(response.code).to eql(200)
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.body.to_s).to eql(css)
+  end
+
+  it 'sends the same response when the file is served from memory' do
+    first = http_get('/style.css')
+    second = http_get('/style.css')
+
+    expect(second.body.to_s).to eql(css)
+    expect(second.headers['ETag']).to eql(first.headers['ETag'])
+  end
+
+  it 'prefers the pre-compressed file accepted by the client' do
+    response = http_get('/style.css', headers: { 'Accept-Encoding' => 'br;q=0.5, gzip' })
+
+    expect(response.headers['Content-Encoding']).to eql('gzip')
+    expect(response.headers['Vary'].to_s.downcase).to include('accept-encoding')
+    expect(Zlib.gunzip(response.body.to_s)).to eql(css)
+  end
+
+  it 'sends the original file when gzip is refused' do
+    response = http_get('/style.css', headers: { 'Accept-Encoding' => 'gzip;q=0' })
+
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.body.to_s).to eql(css)
+  end
+
+  it 'answers HEAD requests with the length' do
+    response = http_head('/style.css')
+
+    expect(response.headers['Content-Length']).to eql(css.bytesize.to_s)
+  end
+
+  it 'answers range requests' do
+    response = http_get('/style.css', headers: { 'Range' => 'bytes=10-19' })
+
+    expect(response.code).to eql(206)
+    expect(response.body.to_s).to eql(css[10, 10])
+  end
+
+  it 'answers conditional requests' do
+    etag = http_get('/style.css').headers['ETag']
+    response = http_get('/style.css', headers: { 'If-None-Match' => etag })
+
+    expect(response.code).to eql(304)
+  end
+
+  it 'passes missing files to the application' do
+    expect(http_get('/missing.css').code).to eql(404)
+  end
+end
@@ -0,0 +1,38 @@
+require 'http'
+
+RSpec.describe 'Streamed response bodies', with_app: :streaming do
+  it 'sends the chunks yielded by body.each' do
+    response = http_get('/each')
+
+    expect(response.headers['Transfer-Encoding']).to eql('chunked')
+    expect(response.body.to_s).to eql("each 0\neach 1\neach 2\n")
+  end
+
+  it 'supports streaming bodies (body.call)' do
+    expect(http_get('/call').body.to_s).to eql("call 0\ncall 1\ncall 2\n")
+  end
+
+  it 'sends bodies larger than the socket buffer' do
+    body = http_get('/big').body.to_s
+
+    expect(body.bytesize).to eql(256 * 4096)
+    expect(body[-4096, 7]).to eql('0000255')
+  end
+
+  it 'answers with an error if the body raises before the response started' do
+    expect(http_get('/raise-early').code).to eql(500)
+  end
+
+  it "doesn't complete the response if the body raises after it started" do
+    response = raw_request("GET /raise-late HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+
+    expect(response).to include("started\n")
+    expect(response).not_to end_with("0\r\n\r\n")
+  end
+
+  it 'keeps serving requests after a body raised' do
+    raw_request("GET /raise-late HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+
+    expect(http_get('/each').body.to_s).to eql("each 0\neach 1\neach 2\n")
+  end
+end
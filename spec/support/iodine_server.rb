@@ -15,6 +15,25 @@ module Spec
         http_client.post("http://localhost:#{server_port}#{path}", *args)
       end
 
+      def http_head(path, *args)
+        http_client.head("http://localhost:#{server_port}#{path}", *args)
+      end
+
+      # Sends a raw request and returns everything read until the server closes
+      # the connection (the request should include `Connection: close`).
+      def raw_request(request)
+        Socket.tcp('localhost', server_port, connect_timeout: 1) do |socket|
+          socket.write(request)
+          response = ''.b
+          while IO.select([socket], nil, nil, 1)
+            chunk = socket.read_nonblock(65536, exception: false)
+            break if chunk.nil?
+            response << chunk if chunk.is_a?(String)
+          end
+          response
+        end
+      end
+
       def spawn_with_test_log(cmd, verbose: ENV.key?('VERBOSE'))
         test_log = verbose ? STDERR : File.open('spec/log/test.log', 'a+')
 
@@ -42,11 +61,13 @@ module Spec
         end
       end
 
-      def start_iodine_with_app(name, **opts)
+      # `args` are additional command line options (i.e., `"-mc 1"`).
+      def start_iodine_with_app(name, args: nil, **opts)
         filename = "spec/support/apps/#{name}.ru"
         raise "test rack file (#{name}) does not exist" unless File.exist?(filename)
         cmd = "bundle exec exe/iodine -w 1 -t 1 -p #{server_port}".dup
         cmd += " -V 5 -log" if opts[:verbose]
+        cmd += " #{args}" if args
         pid = spawn_with_test_log("#{cmd} #{filename}", **opts)
         wait_until_iodine_ready
         pid
@@ -76,7 +97,7 @@ RSpec.configure do |config|
   when_tagged_with_app = { with_app: ->(v) { !!v } }
 
   config.around(:each, when_tagged_with_app) do |ex|
-    with_app(ex.metadata[:with_app], verbose: ex.metadata[:verbose]) { ex.run }
+    with_app(ex.metadata[:with_app], verbose: ex.metadata[:verbose], args: ex.metadata[:app_args]) { ex.run }
   end
 
   config.include(Spec::Support::IodineServer, type: :integration)